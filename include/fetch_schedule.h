@@ -0,0 +1,137 @@
+// fetch_schedule.h
+//
+// Adaptive scheduling of the weather fetches.
+//
+// The provider publishes a new observation every few minutes, and the "dt"
+// field of each response tells when it was taken. By watching the distance
+// between successive dt values we learn the provider update period, and the
+// next fetch is placed just after the next expected update instead of on a
+// fixed timer. A daily request budget caps the number of requests, so a whole
+// fleet of clocks stays within the API quota.
+//
+// Everything here works on epoch seconds passed in by the caller and has no
+// dependency on the Arduino core.
+
+#ifndef FETCH_SCHEDULE_H
+#define FETCH_SCHEDULE_H
+
+#define PROVIDER_PERIOD_MIN 300   // Never assume the provider updates faster than every 5 minutes
+#define PROVIDER_PERIOD_MAX 3600  // ...or slower than every hour
+#define FETCH_MARGIN 60           // Fetch this long after the expected update
+#define FETCH_RECHECK 120         // Provider is late, look again after this long
+#define SECONDS_PER_DAY 86400L
+
+/*
+*   RequestBudget - Requests allowed per day, shared by all the endpoints
+*/
+struct RequestBudget {
+    long day;     // Day (epoch / 86400) the count refers to
+    int used;     // Requests made on that day
+    int limit;    // Requests allowed per day
+};
+
+/*
+*   FetchSchedule - Cadence of one endpoint
+*/
+struct FetchSchedule {
+    long lastDt;    // Provider time of the newest data we have
+    long period;    // Estimated provider update period, in seconds
+    long nextFetch; // Epoch of the next fetch, 0 fetches right away
+};
+
+/*
+*   budgetRollover() - Starts a new count when the day changes
+*   budgetLeft() - Requests still allowed today
+*   budgetSpend() - Counts one request against the budget
+*   budgetSpacing() - Minimum distance between requests to make the rest of the budget last the day
+*/
+inline void budgetRollover(RequestBudget& b, long now) {
+    long day = now / SECONDS_PER_DAY;
+    if (day != b.day) {
+        b.day = day;
+        b.used = 0;
+    }
+}
+
+inline int budgetLeft(RequestBudget& b, long now) {
+    budgetRollover(b, now);
+    return b.limit > b.used ? b.limit - b.used : 0;
+}
+
+inline void budgetSpend(RequestBudget& b, long now) {
+    budgetRollover(b, now);
+    b.used++;
+}
+
+inline long budgetSpacing(RequestBudget& b, long now) {
+    long secondsLeft = SECONDS_PER_DAY - now % SECONDS_PER_DAY;
+    int left = budgetLeft(b, now);
+    return left > 0 ? secondsLeft / left : secondsLeft;
+}
+
+/*
+*   scheduleInit() - Starts a schedule with a guess of the provider period
+*/
+inline void scheduleInit(FetchSchedule& s, long period) {
+    s.lastDt = 0;
+    s.period = period;
+    s.nextFetch = 0;
+}
+
+/*
+*   scheduleDue() - True when the endpoint should be fetched now
+*/
+inline bool scheduleDue(const FetchSchedule& s, RequestBudget& b, long now) {
+    return now >= s.nextFetch && budgetLeft(b, now) > 0;
+}
+
+/*
+*   scheduleUpdate() - Plans the next fetch after a successful one
+*
+*  dt is the provider time of the data just received and jitter a random number
+*  of seconds in [0, FETCH_MARGIN], so the clocks of a fleet don't all hit
+*  the provider in the same second. A new dt refines the period estimate
+*  (exponential average, 1/4 weight). A gap spanning several updates, after a
+*  missed fetch or an outage, is first divided by the number of periods it
+*  covers, so it does not drag the estimate towards PROVIDER_PERIOD_MAX. If the data was not newer than what we
+*  had, the provider is late and we look again after FETCH_RECHECK.
+*/
+inline void scheduleUpdate(FetchSchedule& s, RequestBudget& b, long now, long dt, long jitter) {
+    bool fresh = dt > s.lastDt;
+    if (fresh && s.lastDt > 0) {
+        long observed = dt - s.lastDt;
+        long periods = (observed + s.period / 2) / s.period; // Nearest whole number of periods
+        if (periods > 1) {
+            observed /= periods;
+        }
+        s.period = (3 * s.period + observed) / 4;
+        if (s.period < PROVIDER_PERIOD_MIN) {
+            s.period = PROVIDER_PERIOD_MIN;
+        } else if (s.period > PROVIDER_PERIOD_MAX) {
+            s.period = PROVIDER_PERIOD_MAX;
+        }
+    }
+    if (fresh) {
+        s.lastDt = dt;
+    }
+
+    long next = s.lastDt + s.period + FETCH_MARGIN + jitter;
+    if (!fresh || next <= now) {
+        next = now + FETCH_RECHECK + jitter;
+    }
+    long earliest = now + budgetSpacing(b, now);
+    s.nextFetch = next > earliest ? next : earliest;
+}
+
+/*
+*   scheduleSpaced() - Plans the next fetch of an endpoint that has no provider time to follow
+*
+*  The next fetch comes s.period after now, or later when the budget left
+*  needs the requests spread further apart.
+*/
+inline void scheduleSpaced(FetchSchedule& s, RequestBudget& b, long now) {
+    long spacing = budgetSpacing(b, now);
+    s.nextFetch = now + (s.period > spacing ? s.period : spacing);
+}
+
+#endif
@@ -0,0 +1,248 @@
+// http_body.h
+//
+// Decoding of an HTTP/1.1 response body as it comes off the socket.
+//
+// The caller reads the header lines and hands each one to bodyHeader(), then
+// pushes the raw body bytes through bodyReceive() in pieces of any size. The
+// chunked framing is removed when Transfer-Encoding is chunked, and a gzip
+// body (Content-Encoding) is inflated on the fly, so only the decoded body is
+// ever stored, in a buffer supplied by the caller. A body that does not fit
+// in it is flagged rather than cut short.
+//
+// With bodySink() the decoded body is handed to a sink instead, for a parser
+// that reads it as it comes. The buffer is then only the inflate window, and
+// a body of any size goes through.
+//
+// Nothing here depends on the Arduino core, reading the socket is left to the
+// caller.
+
+#ifndef HTTP_BODY_H
+#define HTTP_BODY_H
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inflate.h>
+
+enum { CHUNK_SIZE, CHUNK_EXT, CHUNK_DATA, CHUNK_DATA_END, CHUNK_DONE };
+
+/*
+*   HttpBody - Decoding state of a response body
+*
+*  The body goes through the chunked decoder when Transfer-Encoding is chunked
+*  and through inflate when Content-Encoding is gzip, and lands in out, or
+*  in the sink when there is one. The compressed stream is never stored, only
+*  INFLATE_INPUT bytes of it.
+*/
+struct HttpBody {
+    bool gzip;
+    bool chunked;
+    long contentLength;   // -1 when not given
+    uint8_t chunkState;
+    unsigned long chunkLeft;
+    unsigned long wireBytes; // Body bytes received, before decoding
+    bool overflow;
+    int inflateStatus;
+
+    char* out;            // Decoded body, NUL terminated by bodyFinish()
+    size_t outSize;       // Including the terminator
+    size_t outLen;        // Decoded bytes, also those past out with a sink
+    Inflate* inflater;    // Used for gzip bodies
+    void (*sink)(void* ctx, const uint8_t* data, size_t len);
+    void* sinkCtx;
+};
+
+/*
+*   bodyBegin() - Starts a response, the body goes to out (size bytes, terminator included)
+*/
+inline void bodyBegin(HttpBody& body, char* out, size_t size, Inflate* inflater) {
+    body.gzip = false;
+    body.chunked = false;
+    body.contentLength = -1;
+    body.chunkState = CHUNK_SIZE;
+    body.chunkLeft = 0;
+    body.wireBytes = 0;
+    body.overflow = false;
+    body.inflateStatus = INFLATE_OK;
+    body.out = out;
+    body.outSize = size;
+    body.outLen = 0;
+    body.inflater = inflater;
+    body.sink = NULL;
+    body.sinkCtx = NULL;
+    out[0] = '\0';
+}
+
+/*
+*   bodySink() - Hands the decoded body to sink as it arrives, call before bodyStart()
+*
+*  out then becomes the inflate window, used as a ring, so its size must be a
+*  power of 2. It still holds the whole body as long as the body fits in it
+*  with its terminator, see bodyKept().
+*/
+inline void bodySink(HttpBody& body, void (*sink)(void* ctx, const uint8_t* data, size_t len), void* ctx) {
+    body.sink = sink;
+    body.sinkCtx = ctx;
+}
+
+/*
+*   bodyHeader() - Takes one header line, without the line break
+*/
+inline void bodyHeader(HttpBody& body, const char* line) {
+    if (strncasecmp(line, "Content-Encoding:", 17) == 0) {
+        body.gzip = strstr(line + 17, "gzip") != NULL;
+    } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+        body.chunked = strstr(line + 18, "chunked") != NULL;
+    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        body.contentLength = atol(line + 15);
+    }
+}
+
+/*
+*   bodyStart() - Called after the last header, before the first body byte
+*/
+inline void bodyStart(HttpBody& body) {
+    if (body.gzip && body.sink) {
+        inflateBegin(*body.inflater, (uint8_t*)body.out, body.outSize, body.sink, body.sinkCtx);
+    } else if (body.gzip) {
+        inflateBegin(*body.inflater, (uint8_t*)body.out, body.outSize - 1, NULL, NULL);
+    }
+}
+
+/*
+*   bodyWrite() - Stores decoded body bytes
+*/
+inline void bodyWrite(HttpBody& body, const uint8_t* data, size_t len) {
+    if (body.gzip) {
+        body.inflateStatus = inflateFeed(*body.inflater, data, len, false);
+        body.outLen = body.inflater->outTotal;
+        return;
+    }
+    if (body.sink) {
+        if (body.outLen + len < body.outSize) {
+            memcpy(body.out + body.outLen, data, len); // Kept while it fits, like the inflate ring
+        }
+        body.outLen += len;
+        body.sink(body.sinkCtx, data, len);
+        return;
+    }
+    if (body.outLen + len > body.outSize - 1) {
+        body.overflow = true;
+        return;
+    }
+    memcpy(body.out + body.outLen, data, len);
+    body.outLen += len;
+}
+
+/*
+*   bodyReceive() - Takes raw body bytes off the wire, removing the chunk framing
+*/
+inline void bodyReceive(HttpBody& body, const uint8_t* data, size_t len) {
+    if (!body.chunked) {
+        size_t n = len;
+        if (body.contentLength >= 0) { // Anything past Content-Length is not part of the body
+            unsigned long left = (long)body.wireBytes < body.contentLength ? body.contentLength - body.wireBytes : 0;
+            n = len < left ? len : left;
+        }
+        body.wireBytes += len;
+        bodyWrite(body, data, n);
+        return;
+    }
+    body.wireBytes += len;
+    while (len > 0) {
+        switch (body.chunkState) {
+            case CHUNK_SIZE: {
+                char c = *data++;
+                len--;
+                if (isxdigit((unsigned char)c)) {
+                    body.chunkLeft = body.chunkLeft * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+                } else if (c == '\n') {
+                    body.chunkState = body.chunkLeft ? CHUNK_DATA : CHUNK_DONE;
+                } else if (c != '\r') {
+                    body.chunkState = CHUNK_EXT;
+                }
+                break;
+            }
+            case CHUNK_EXT:
+                if (*data++ == '\n') {
+                    body.chunkState = body.chunkLeft ? CHUNK_DATA : CHUNK_DONE;
+                }
+                len--;
+                break;
+            case CHUNK_DATA: {
+                size_t n = len < body.chunkLeft ? len : body.chunkLeft;
+                bodyWrite(body, data, n);
+                data += n;
+                len -= n;
+                body.chunkLeft -= n;
+                if (body.chunkLeft == 0) {
+                    body.chunkState = CHUNK_DATA_END;
+                }
+                break;
+            }
+            case CHUNK_DATA_END:
+                if (*data++ == '\n') {
+                    body.chunkState = CHUNK_SIZE;
+                }
+                len--;
+                break;
+            case CHUNK_DONE:
+                return; // Trailers are ignored
+        }
+    }
+}
+
+/*
+*   bodyComplete() - True when the whole body has been received
+*/
+inline bool bodyComplete(const HttpBody& body) {
+    if (body.gzip && body.inflateStatus == INFLATE_DONE) {
+        return true; // The gzip trailer was checked, whatever follows it is framing
+    }
+    if (body.chunked) {
+        return body.chunkState == CHUNK_DONE;
+    }
+    return body.contentLength >= 0 && (long)body.wireBytes >= body.contentLength;
+}
+
+/*
+*   bodyFinish() - Ends the body when the connection is done, NUL terminates it if kept
+*/
+inline void bodyFinish(HttpBody& body) {
+    if (body.gzip && body.inflateStatus == INFLATE_OK) {
+        body.inflateStatus = inflateFeed(*body.inflater, NULL, 0, true);
+        body.outLen = body.inflater->outTotal;
+    }
+    if (body.outLen < body.outSize) {
+        body.out[body.outLen] = '\0';
+    }
+}
+
+/*
+*   bodyKept() - True when out holds the whole decoded body
+*
+*  Always the case without a sink, unless the body overflowed. With a sink,
+*  only when the body was smaller than out.
+*/
+inline bool bodyKept(const HttpBody& body) {
+    return !body.overflow && body.outLen < body.outSize;
+}
+
+/*
+*   bodyTruncated() - True when the connection ended before the framing said the body ends
+*
+*  A gzip body that got to its checked trailer is whole, even if the last chunk
+*  header or the rest of Content-Length did not arrive with it.
+*/
+inline bool bodyTruncated(const HttpBody& body) {
+    if (body.gzip && body.inflateStatus == INFLATE_DONE) {
+        return false;
+    }
+    return (body.chunked && body.chunkState != CHUNK_DONE) ||
+           (body.contentLength >= 0 && (long)body.wireBytes < body.contentLength);
+}
+
+#endif
@@ -0,0 +1,489 @@
+// inflate.h
+//
+// Streaming gzip/DEFLATE decoder (RFC 1951/1952) for the weather payloads.
+//
+// The compressed stream is pushed in pieces of any size as they come from
+// the socket. Only INFLATE_INPUT bytes of it are buffered ahead of the
+// decoder. The decoder works one step at a time and starts a step only when
+// enough input for the worst case of that step is buffered, so it can stop
+// at any point and go on when more data is fed.
+//
+// Back references are resolved against a window supplied by the caller.
+// With a sink the window is used as a ring: every decoded byte is handed to
+// the sink, and nothing but the window is kept. Without a sink the window is
+// the output buffer itself, and a stream that does not fit in it is an error.
+// A back reference further than the window is also an error, so a small
+// window works for small payloads or for servers using a small window.
+//
+// The trailer CRC-32 and size are checked. No dependency on the Arduino core.
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define INFLATE_INPUT 512 // Compressed bytes buffered ahead of the decoder, power of 2
+#define INFLATE_HEADER_AHEAD 320 // A dynamic block header never takes more than this
+#define INFLATE_SYMBOL_AHEAD 8 // Bytes needed by the longest literal/length + distance pair
+
+#define INFLATE_OK 0 // More input expected
+#define INFLATE_DONE 1 // End of the gzip stream, trailer checked
+#define INFLATE_ERR_DATA -1 // Corrupt stream or not gzip
+#define INFLATE_ERR_WINDOW -2 // Back reference further than the window
+#define INFLATE_ERR_SIZE -3 // Output does not fit in the buffer (no sink)
+#define INFLATE_ERR_TRUNCATED -4 // Input ended before the end of the stream
+#define INFLATE_ERR_CHECK -5 // CRC-32 or size mismatch
+
+struct InflateTree {
+    uint16_t counts[16];   // Number of codes of each length
+    uint16_t symbols[288]; // Symbols ordered by code
+};
+
+struct Inflate {
+    // Compressed input ring
+    uint8_t in[INFLATE_INPUT];
+    uint16_t inHead;
+    uint16_t inCount;
+    bool inFinal;
+    uint32_t bitBuf;
+    uint8_t bitCount;
+    uint32_t inTotal;
+
+    // Output window
+    uint8_t* window;
+    uint32_t windowSize;
+    uint32_t outTotal;
+    uint32_t flushed;
+    void (*sink)(void* ctx, const uint8_t* data, size_t len);
+    void* ctx;
+
+    // Decoder state
+    uint8_t state;
+    uint8_t flags;     // gzip header flags
+    uint16_t skip;     // gzip header bytes or stored block bytes left
+    bool lastBlock;
+    InflateTree lit;
+    InflateTree dist;
+    uint32_t crc;
+    int status;
+};
+
+enum {
+    INF_GZIP_HEADER, INF_GZIP_EXTRA_LEN, INF_GZIP_EXTRA, INF_GZIP_NAME, INF_GZIP_COMMENT, INF_GZIP_HCRC,
+    INF_BLOCK, INF_STORED, INF_SYMBOLS, INF_TRAILER, INF_END
+};
+
+/*
+*   inflateBegin() - Prepares a decoder
+*
+*  window must stay valid while decoding. With a sink its size must be a
+*  power of 2.
+*/
+inline void inflateBegin(Inflate& z, uint8_t* window, size_t windowSize,
+                         void (*sink)(void* ctx, const uint8_t* data, size_t len), void* ctx) {
+    memset(&z, 0, sizeof(z));
+    z.window = window;
+    z.windowSize = windowSize;
+    z.sink = sink;
+    z.ctx = ctx;
+    z.state = INF_GZIP_HEADER;
+    z.skip = 10;
+    z.crc = 0xFFFFFFFF;
+}
+
+// Input bits available to the decoder
+inline uint32_t inflateBits(const Inflate& z) {
+    return (uint32_t)z.inCount * 8 + z.bitCount;
+}
+
+// True if a step needing up to `bytes` bytes of input can run now
+inline bool inflateAhead(const Inflate& z, uint32_t bytes) {
+    return z.inFinal || inflateBits(z) >= bytes * 8;
+}
+
+inline uint8_t inflatePop(Inflate& z) {
+    uint8_t b = z.in[z.inHead];
+    z.inHead = (z.inHead + 1) & (INFLATE_INPUT - 1);
+    z.inCount--;
+    return b;
+}
+
+inline uint32_t inflateGetBits(Inflate& z, uint8_t n) {
+    while (z.bitCount < n) {
+        if (z.inCount == 0) {
+            z.status = INFLATE_ERR_TRUNCATED;
+            return 0;
+        }
+        z.bitBuf |= (uint32_t)inflatePop(z) << z.bitCount;
+        z.bitCount += 8;
+    }
+    uint32_t value = z.bitBuf & ((1UL << n) - 1);
+    z.bitBuf >>= n;
+    z.bitCount -= n;
+    return value;
+}
+
+// Next whole byte, for the gzip framing and stored blocks (bit buffer is byte aligned there)
+inline uint8_t inflateGetByte(Inflate& z) {
+    return (uint8_t)inflateGetBits(z, 8);
+}
+
+inline void inflateFlush(Inflate& z) {
+    if (!z.sink) {
+        return;
+    }
+    while (z.flushed != z.outTotal) {
+        uint32_t start = z.flushed & (z.windowSize - 1);
+        uint32_t len = z.outTotal - z.flushed;
+        if (start + len > z.windowSize) {
+            len = z.windowSize - start;
+        }
+        z.sink(z.ctx, z.window + start, len);
+        z.flushed += len;
+    }
+}
+
+inline void inflatePut(Inflate& z, uint8_t b) {
+    if (z.sink) {
+        if (z.outTotal - z.flushed == z.windowSize) {
+            inflateFlush(z);
+        }
+        z.window[z.outTotal & (z.windowSize - 1)] = b;
+    } else {
+        if (z.outTotal >= z.windowSize) {
+            z.status = INFLATE_ERR_SIZE;
+            return;
+        }
+        z.window[z.outTotal] = b;
+    }
+    z.outTotal++;
+    z.crc ^= b;
+    for (int k = 0; k < 8; k++) {
+        z.crc = (z.crc >> 1) ^ (0xEDB88320 & (0 - (z.crc & 1)));
+    }
+}
+
+/*
+*   inflateBuildTree() - Builds a canonical Huffman tree from code lengths
+*/
+inline bool inflateBuildTree(InflateTree& t, const uint8_t* lengths, int num) {
+    uint16_t offs[16];
+    memset(t.counts, 0, sizeof(t.counts));
+    for (int i = 0; i < num; i++) {
+        t.counts[lengths[i]]++;
+    }
+    t.counts[0] = 0;
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left = left * 2 - t.counts[len];
+        if (left < 0) {
+            return false; // Over-subscribed
+        }
+    }
+    uint16_t sum = 0;
+    for (int len = 0; len < 16; len++) {
+        offs[len] = sum;
+        sum += t.counts[len];
+    }
+    for (int i = 0; i < num; i++) {
+        if (lengths[i]) {
+            t.symbols[offs[lengths[i]]++] = i;
+        }
+    }
+    return true;
+}
+
+inline int inflateDecodeSymbol(Inflate& z, const InflateTree& t) {
+    int sum = 0, cur = 0, len = 0;
+    do {
+        cur = 2 * cur + inflateGetBits(z, 1);
+        if (++len > 15 || z.status < 0) {
+            z.status = z.status < 0 ? z.status : INFLATE_ERR_DATA;
+            return 0;
+        }
+        sum += t.counts[len];
+        cur -= t.counts[len];
+    } while (cur >= 0);
+    return t.symbols[sum + cur];
+}
+
+inline void inflateFixedTrees(Inflate& z) {
+    uint8_t lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    inflateBuildTree(z.lit, lengths, 288);
+    memset(lengths, 5, 30);
+    inflateBuildTree(z.dist, lengths, 30);
+}
+
+inline void inflateDynamicTrees(Inflate& z) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint8_t lengths[288 + 32];
+    InflateTree& codeTree = z.dist; // Free until the distance tree is built
+
+    int hlit = inflateGetBits(z, 5) + 257;
+    int hdist = inflateGetBits(z, 5) + 1;
+    int hclen = inflateGetBits(z, 4) + 4;
+    if (hlit > 286 || hdist > 30) {
+        z.status = INFLATE_ERR_DATA;
+        return;
+    }
+    memset(lengths, 0, 19);
+    for (int i = 0; i < hclen; i++) {
+        lengths[order[i]] = inflateGetBits(z, 3);
+    }
+    if (!inflateBuildTree(codeTree, lengths, 19)) {
+        z.status = INFLATE_ERR_DATA;
+        return;
+    }
+
+    int num = 0;
+    while (num < hlit + hdist && z.status >= 0) {
+        int sym = inflateDecodeSymbol(z, codeTree);
+        int repeat = 0;
+        uint8_t value = 0;
+        if (sym < 16) {
+            lengths[num++] = sym;
+            continue;
+        } else if (sym == 16) {
+            if (num == 0) {
+                z.status = INFLATE_ERR_DATA;
+                return;
+            }
+            value = lengths[num - 1];
+            repeat = inflateGetBits(z, 2) + 3;
+        } else if (sym == 17) {
+            repeat = inflateGetBits(z, 3) + 3;
+        } else {
+            repeat = inflateGetBits(z, 7) + 11;
+        }
+        if (num + repeat > hlit + hdist) {
+            z.status = INFLATE_ERR_DATA;
+            return;
+        }
+        while (repeat--) {
+            lengths[num++] = value;
+        }
+    }
+    if (z.status < 0 || !inflateBuildTree(z.lit, lengths, hlit) || !inflateBuildTree(z.dist, lengths + hlit, hdist)) {
+        z.status = z.status < 0 ? z.status : INFLATE_ERR_DATA;
+    }
+}
+
+/*
+*   inflateSymbol() - Decodes one literal or one length/distance pair
+*/
+inline void inflateSymbol(Inflate& z) {
+    static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                          257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                          8193, 12289, 16385, 24577};
+    static const uint8_t distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                          7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    int sym = inflateDecodeSymbol(z, z.lit);
+    if (z.status < 0) {
+        return;
+    }
+    if (sym < 256) {
+        inflatePut(z, sym);
+        return;
+    }
+    if (sym == 256) {
+        z.state = z.lastBlock ? INF_TRAILER : INF_BLOCK;
+        return;
+    }
+    sym -= 257;
+    if (sym >= 29) {
+        z.status = INFLATE_ERR_DATA;
+        return;
+    }
+    int length = lengthBase[sym] + inflateGetBits(z, lengthExtra[sym]);
+    int d = inflateDecodeSymbol(z, z.dist);
+    if (z.status < 0 || d >= 30) {
+        z.status = z.status < 0 ? z.status : INFLATE_ERR_DATA;
+        return;
+    }
+    uint32_t distance = distBase[d] + inflateGetBits(z, distExtra[d]);
+    if (distance > z.outTotal || distance > z.windowSize) {
+        z.status = INFLATE_ERR_WINDOW;
+        return;
+    }
+    while (length-- && z.status >= 0) {
+        uint32_t from = z.outTotal - distance;
+        inflatePut(z, z.window[z.sink ? (from & (z.windowSize - 1)) : from]);
+    }
+}
+
+/*
+*   inflateStep() - Runs one decoder step if enough input is buffered
+*
+*  Returns false when the decoder has to wait for more input, or stopped.
+*/
+inline bool inflateStep(Inflate& z) {
+    if (z.status < 0 || z.state == INF_END) {
+        return false;
+    }
+    if (z.inCount == 0 && z.bitCount == 0 && !(z.state == INF_SYMBOLS && z.inFinal)) {
+        if (z.inFinal) {
+            z.status = INFLATE_ERR_TRUNCATED;
+        }
+        return false;
+    }
+    switch (z.state) {
+        case INF_GZIP_HEADER: {
+            uint8_t b = inflateGetByte(z);
+            int pos = 10 - z.skip--;
+            if ((pos == 0 && b != 0x1F) || (pos == 1 && b != 0x8B) || (pos == 2 && b != 8)) {
+                z.status = INFLATE_ERR_DATA;
+            } else if (pos == 3) {
+                z.flags = b;
+            }
+            if (z.skip == 0) {
+                z.skip = 2;
+                z.state = INF_GZIP_EXTRA_LEN;
+            }
+            break;
+        }
+        case INF_GZIP_EXTRA_LEN:
+            if (!(z.flags & 0x04)) {
+                z.state = INF_GZIP_NAME;
+                break;
+            }
+            if (!inflateAhead(z, 2)) {
+                return false;
+            }
+            z.skip = inflateGetByte(z);
+            z.skip |= inflateGetByte(z) << 8;
+            z.state = INF_GZIP_EXTRA;
+            break;
+        case INF_GZIP_EXTRA:
+            if (z.skip == 0) {
+                z.state = INF_GZIP_NAME;
+            } else {
+                inflateGetByte(z);
+                z.skip--;
+            }
+            break;
+        case INF_GZIP_NAME:
+            if (!(z.flags & 0x08) || inflateGetByte(z) == 0) {
+                z.state = INF_GZIP_COMMENT;
+            }
+            break;
+        case INF_GZIP_COMMENT:
+            if (!(z.flags & 0x10) || inflateGetByte(z) == 0) {
+                z.state = INF_GZIP_HCRC;
+                z.skip = (z.flags & 0x02) ? 2 : 0;
+            }
+            break;
+        case INF_GZIP_HCRC:
+            if (z.skip == 0) {
+                z.state = INF_BLOCK;
+            } else {
+                inflateGetByte(z);
+                z.skip--;
+            }
+            break;
+        case INF_BLOCK: {
+            if (!inflateAhead(z, INFLATE_HEADER_AHEAD)) {
+                return false;
+            }
+            z.lastBlock = inflateGetBits(z, 1);
+            int type = inflateGetBits(z, 2);
+            if (type == 0) {
+                z.bitBuf = 0; // Stored blocks start on a byte boundary
+                z.bitCount = 0;
+                uint16_t len = inflateGetByte(z);
+                len |= inflateGetByte(z) << 8;
+                uint16_t nlen = inflateGetByte(z);
+                nlen |= inflateGetByte(z) << 8;
+                if ((uint16_t)~nlen != len) {
+                    z.status = INFLATE_ERR_DATA;
+                }
+                z.skip = len;
+                z.state = INF_STORED;
+            } else if (type == 1) {
+                inflateFixedTrees(z);
+                z.state = INF_SYMBOLS;
+            } else if (type == 2) {
+                inflateDynamicTrees(z);
+                z.state = INF_SYMBOLS;
+            } else {
+                z.status = INFLATE_ERR_DATA;
+            }
+            break;
+        }
+        case INF_STORED:
+            if (z.skip == 0) {
+                z.state = z.lastBlock ? INF_TRAILER : INF_BLOCK;
+            } else {
+                inflatePut(z, inflateGetByte(z));
+                z.skip--;
+            }
+            break;
+        case INF_SYMBOLS:
+            if (!inflateAhead(z, INFLATE_SYMBOL_AHEAD)) {
+                return false;
+            }
+            inflateSymbol(z);
+            break;
+        case INF_TRAILER: {
+            z.bitBuf >>= z.bitCount & 7; // The trailer starts on a byte boundary
+            z.bitCount -= z.bitCount & 7;
+            if (!inflateAhead(z, 8)) {
+                return false;
+            }
+            uint32_t crc = 0, size = 0;
+            for (int i = 0; i < 4; i++) {
+                crc |= (uint32_t)inflateGetByte(z) << (8 * i);
+            }
+            for (int i = 0; i < 4; i++) {
+                size |= (uint32_t)inflateGetByte(z) << (8 * i);
+            }
+            if (z.status >= 0) {
+                z.status = (crc == ~z.crc && size == z.outTotal) ? INFLATE_DONE : INFLATE_ERR_CHECK;
+            }
+            z.state = INF_END;
+            inflateFlush(z);
+            return false;
+        }
+    }
+    return z.status >= 0;
+}
+
+/*
+*   inflateFeed() - Pushes compressed bytes and decodes as far as possible
+*
+*  final marks the end of the compressed input. Returns INFLATE_OK while more
+*  input is expected, INFLATE_DONE at the end of the stream or an error.
+*/
+inline int inflateFeed(Inflate& z, const uint8_t* data, size_t len, bool final) {
+    while (z.status == INFLATE_OK) {
+        while (len > 0 && z.inCount < INFLATE_INPUT) {
+            z.in[(z.inHead + z.inCount) & (INFLATE_INPUT - 1)] = *data++;
+            z.inCount++;
+            z.inTotal++;
+            len--;
+        }
+        z.inFinal = final && len == 0;
+        while (inflateStep(z)) {
+        }
+        if (len == 0 || z.status != INFLATE_OK) {
+            break;
+        }
+    }
+    if (z.status == INFLATE_OK && final && z.state != INF_END) {
+        z.status = INFLATE_ERR_TRUNCATED;
+    }
+    inflateFlush(z);
+    return z.status;
+}
+
+#endif
@@ -0,0 +1,213 @@
+// lcd_mirror.h
+//
+// Mirror of the 16x2 display, streamed to tools/lcdview.
+//
+// lcdMirrorTrack() sees every byte sent to the HD44780 and keeps a copy of the
+// visible characters and of the 8 CGRAM glyphs, with a dirty bit for each one
+// that changed. lcdMirrorEncode() turns the dirty ones into a small packet and
+// clears them; a keyframe carries everything, so a viewer started at any time
+// catches up. lcdMirrorDecode() applies a packet to a viewer's copy.
+//
+// Packet layout, little endian:
+//   magic u16 "LM", version u8, flags u8 (LCD_MIRROR_KEYFRAME_FLAG), seq u16, sender u32
+//   then records until the end:
+//     0x00-0x1F  run of cells: first cell (row * 16 + column), count u8, count character codes
+//     0x80-0x87  glyph 0-7: 8 row bytes, 5 pixels each in the low bits
+//
+// Nothing here depends on the Arduino core.
+
+#ifndef LCD_MIRROR_H
+#define LCD_MIRROR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LCD_MIRROR_ROWS 2
+#define LCD_MIRROR_COLS 16
+#define LCD_MIRROR_CELLS (LCD_MIRROR_ROWS * LCD_MIRROR_COLS)
+#define LCD_MIRROR_MAGIC 0x4D4C // "LM"
+#define LCD_MIRROR_VERSION 1
+#define LCD_MIRROR_HEADER_LEN 10
+#define LCD_MIRROR_PACKET_MAX 128 // A keyframe is 116 bytes
+#define LCD_MIRROR_KEYFRAME_FLAG 0x01
+#define LCD_MIRROR_GLYPH 0x80 // Record tag of glyph 0, glyph n is 0x80 + n
+#define LCD_MIRROR_GAP 2 // Clean cells sent inside a run instead of starting a new one
+
+struct LcdMirror {
+    uint8_t cells[LCD_MIRROR_CELLS]; // Character codes, row after row
+    uint8_t glyphs[8][8];            // CGRAM, 8 rows of 5 pixels per glyph
+    uint32_t dirtyCells;             // Bit i: cells[i] changed since the last packet
+    uint8_t dirtyGlyphs;
+    uint8_t address;                 // HD44780 address counter
+    bool cgram;                      // The address counter points into CGRAM
+    bool decrement;                  // Entry mode moves the address counter backwards
+};
+
+struct LcdMirrorHeader {
+    uint8_t flags;
+    uint16_t seq;
+    uint32_t sender;
+};
+
+/*
+*   lcdMirrorInit() - Starts with a blank display, as the HD44780 after power on
+*/
+inline void lcdMirrorInit(LcdMirror& m) {
+    memset(&m, 0, sizeof(m));
+    memset(m.cells, ' ', sizeof(m.cells));
+}
+
+inline void lcdMirrorSetCell(LcdMirror& m, int cell, uint8_t value) {
+    if (m.cells[cell] != value) {
+        m.cells[cell] = value;
+        m.dirtyCells |= 1UL << cell;
+    }
+}
+
+/*
+*   lcdMirrorTrack() - Follows one command or data byte sent to the display
+*
+*  DDRAM rows are at 0x00-0x27 and 0x40-0x67 in two line mode, only the
+*  first LCD_MIRROR_COLS of each are visible. Display shifts are not followed.
+*/
+inline void lcdMirrorTrack(LcdMirror& m, uint8_t value, bool data) {
+    if (!data) {
+        if (value & 0x80) {
+            m.address = value & 0x7F;
+            m.cgram = false;
+        } else if (value & 0x40) {
+            m.address = value & 0x3F;
+            m.cgram = true;
+        } else if ((value & 0xFC) == 0x04) {
+            m.decrement = !(value & 0x02);
+        } else if ((value & 0xFE) == 0x02) {
+            m.address = 0;
+            m.cgram = false;
+        } else if (value == 0x01) {
+            for (int i = 0; i < LCD_MIRROR_CELLS; i++) {
+                lcdMirrorSetCell(m, i, ' ');
+            }
+            m.address = 0;
+            m.cgram = false;
+            m.decrement = false;
+        }
+        return;
+    }
+
+    if (m.cgram) {
+        uint8_t row = value & 0x1F;
+        if (m.glyphs[m.address >> 3][m.address & 7] != row) {
+            m.glyphs[m.address >> 3][m.address & 7] = row;
+            m.dirtyGlyphs |= 1 << (m.address >> 3);
+        }
+        m.address = (m.address + (m.decrement ? -1 : 1)) & 0x3F;
+        return;
+    }
+    int column = m.address & 0x3F;
+    if (column < LCD_MIRROR_COLS) {
+        lcdMirrorSetCell(m, (m.address >= 0x40) * LCD_MIRROR_COLS + column, value);
+    }
+    if (m.decrement) {
+        m.address = m.address == 0x00 ? 0x67 : m.address == 0x40 ? 0x27 : m.address - 1;
+    } else {
+        m.address = m.address == 0x27 ? 0x40 : m.address == 0x67 ? 0x00 : m.address + 1;
+    }
+}
+
+/*
+*   lcdMirrorEncode() - Writes the changes, or everything for a keyframe, and clears the dirty bits
+*
+*  Changed cells close to each other go in one run. Returns the packet
+*  length, 0 if size is below LCD_MIRROR_PACKET_MAX.
+*/
+inline size_t lcdMirrorEncode(uint8_t* out, size_t size, LcdMirror& m, bool keyframe, uint16_t seq, uint32_t sender) {
+    if (size < LCD_MIRROR_PACKET_MAX) {
+        return 0;
+    }
+    uint32_t dirty = keyframe ? 0xFFFFFFFFUL : m.dirtyCells;
+    uint8_t dirtyGlyphs = keyframe ? 0xFF : m.dirtyGlyphs;
+    uint8_t* p = out;
+    *p++ = LCD_MIRROR_MAGIC & 0xFF;
+    *p++ = LCD_MIRROR_MAGIC >> 8;
+    *p++ = LCD_MIRROR_VERSION;
+    *p++ = keyframe ? LCD_MIRROR_KEYFRAME_FLAG : 0;
+    *p++ = seq & 0xFF;
+    *p++ = seq >> 8;
+    for (int i = 0; i < 4; i++) {
+        *p++ = sender >> (8 * i);
+    }
+
+    int i = 0;
+    while (i < LCD_MIRROR_CELLS) {
+        if (!(dirty & (1UL << i))) {
+            i++;
+            continue;
+        }
+        int end = i + 1;
+        for (int j = end; j < LCD_MIRROR_CELLS && j <= end + LCD_MIRROR_GAP; j++) {
+            if (dirty & (1UL << j)) {
+                end = j + 1;
+            }
+        }
+        *p++ = i;
+        *p++ = end - i;
+        memcpy(p, m.cells + i, end - i);
+        p += end - i;
+        i = end;
+    }
+    for (int g = 0; g < 8; g++) {
+        if (dirtyGlyphs & (1 << g)) {
+            *p++ = LCD_MIRROR_GLYPH + g;
+            memcpy(p, m.glyphs[g], 8);
+            p += 8;
+        }
+    }
+    m.dirtyCells = 0;
+    m.dirtyGlyphs = 0;
+    return p - out;
+}
+
+/*
+*   lcdMirrorDecode() - Checks a packet and applies it to m
+*
+*  Nothing is applied unless the whole packet is valid.
+*/
+inline bool lcdMirrorDecode(const uint8_t* in, size_t len, LcdMirror& m, LcdMirrorHeader& h) {
+    if (len < LCD_MIRROR_HEADER_LEN || (in[0] | in[1] << 8) != LCD_MIRROR_MAGIC || in[2] != LCD_MIRROR_VERSION) {
+        return false;
+    }
+    h.flags = in[3];
+    h.seq = in[4] | in[5] << 8;
+    h.sender = (uint32_t)in[6] | (uint32_t)in[7] << 8 | (uint32_t)in[8] << 16 | (uint32_t)in[9] << 24;
+
+    for (int apply = 0; apply < 2; apply++) {
+        size_t i = LCD_MIRROR_HEADER_LEN;
+        while (i < len) {
+            uint8_t tag = in[i++];
+            if (tag < LCD_MIRROR_CELLS) {
+                if (i >= len || in[i] > LCD_MIRROR_CELLS - tag || len - i - 1 < in[i]) {
+                    return false;
+                }
+                uint8_t count = in[i++];
+                if (apply) {
+                    memcpy(m.cells + tag, in + i, count);
+                }
+                i += count;
+            } else if (tag >= LCD_MIRROR_GLYPH && tag < LCD_MIRROR_GLYPH + 8) {
+                if (len - i < 8) {
+                    return false;
+                }
+                if (apply) {
+                    memcpy(m.glyphs[tag - LCD_MIRROR_GLYPH], in + i, 8);
+                }
+                i += 8;
+            } else {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,97 @@
+// lcd_text.h
+//
+// Text helpers for the 16x2 display: the HD44780 character ROM has no
+// accented letters, and lines longer than the display scroll.
+//
+// Nothing here depends on the Arduino core.
+
+#ifndef LCD_TEXT_H
+#define LCD_TEXT_H
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+*  removeAccents() - Removes accents from a string
+*
+*  This function takes an UTF-8 string as input and removes any accents from the characters.
+*  It is necessary for the correct display of characters on the LCD.
+*/
+inline void removeAccents(char* str) {
+    char* src = str;
+    char* dst = str;
+
+    while (*src) {
+        // Se encontrar caractere UTF-8 multibyte (início com 0xC3)
+        if ((uint8_t)*src == 0xC3) {
+            src++;  // Avança para o próximo byte
+            if (*src == '\0') {  // Truncated sequence at the end of the string
+                *dst++ = '?';
+                break;
+            }
+            switch ((uint8_t)*src) {
+                case 0xA0: case 0xA1: case 0xA2: case 0xA3: case 0xA4:  *dst = 'a'; break; // àáâãä
+                case 0x80: case 0x81: case 0x82: case 0x83: case 0x84:  *dst = 'A'; break; // ÀÁÂÃÄ
+                case 0xA7: *dst = 'c'; break; // ç
+                case 0x87: *dst = 'C'; break; // Ç
+                case 0xA8: case 0xA9: case 0xAA: case 0xAB: *dst = 'e'; break; // èéêë
+                case 0x88: case 0x89: case 0x8A: case 0x8B: *dst = 'E'; break; // ÈÉÊË
+                case 0xAC: case 0xAD: case 0xAE: case 0xAF: *dst = 'i'; break; // ìíîï
+                case 0x8C: case 0x8D: case 0x8E: case 0x8F: *dst = 'I'; break; // ÌÍÎÏ
+                case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: *dst = 'o'; break; // òóôõö
+                case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: *dst = 'O'; break; // ÒÓÔÕÖ
+                case 0xB9: case 0xBA: case 0xBB: case 0xBC: *dst = 'u'; break; // ùúûü
+                case 0x99: case 0x9A: case 0x9B: case 0x9C: *dst = 'U'; break; // ÙÚÛÜ
+                case 0xB1: *dst = 'n'; break; // ñ
+                case 0x91: *dst = 'N'; break; // Ñ
+                default: *dst = '?'; break; // desconhecido
+            }
+            dst++;
+            src++; // Pula o segundo byte do caractere especial
+        } else {
+            *dst++ = *src++; // Copia byte normal
+        }
+    }
+    *dst = '\0'; // Termina a nova string
+}
+
+/*
+*  getScrollWindow() - Creates a scrolling window of characters
+*
+*  This function takes a source string and creates a scrolling window of characters
+*  with a specified width. The function wraps around the string if the position exceeds
+*  the length of the string. It fills the remaining space with spaces if the string is shorter
+*  than the specified width. The resulting string is stored in the destination buffer,
+*  which holds width + 1 chars. The default is the 16 columns of the LCD.
+*/
+inline void getScrollWindow(const char* src, char* dest, int pos, int width = 16) {
+    int len = strlen(src);
+    if (len == 0) {
+        dest[0] = '\0';  // Returns an empty string for empty source
+        return;
+    }
+
+    pos = pos % len; // Wraps around the scroll position
+
+    for (int i = 0; i < width; i++) {
+        int idx = (pos + i) % (len);  // Wraps around the string
+        if (idx < len) {
+            dest[i] = src[idx];
+        } else {
+            dest[i] = ' ';  // Adds spaces for the remaining width
+        }
+    }
+    dest[width] = '\0';
+}
+
+/*
+*  upperFirstLetter() - Converts the first letter of a string to uppercase
+*/
+inline void upperFirstLetter(char* str) {
+    if (str && str[0] != '\0') {  // Checks for empty string
+        str[0] = toupper((unsigned char)str[0]);  // Convert the first character to uppercase
+    }
+}
+
+#endif
@@ -0,0 +1,184 @@
+// log.h
+//
+// Ring buffered log with levels.
+//
+// Log lines are formatted into a RAM ring and logDrain() copies them to the
+// UART only as far as the TX FIFO has room, so logging never waits on the
+// serial port. When the ring is full new lines are dropped and counted, and
+// a note with the count is logged once there is room again.
+//
+// logLevel filters at runtime. Lines at syslogLevel or above also go out as
+// UDP syslog packets when LOG_SYSLOG_HOST is defined. logPayload() logs the
+// size and a short hex and text preview of a buffer instead of the whole of it.
+//
+// With SERIALPRINT undefined the LOG macros compile to nothing.
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include <stdarg.h>
+
+#define LOG_RING_SIZE 2048 // Bytes of log waiting for the UART
+#define LOG_LINE_MAX 160 // Longer lines are cut
+#define LOG_PAYLOAD_HEAD 24 // Bytes shown by logPayload()
+#define LOG_SYSLOG_PORT 514
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+int logLevel = LOG_INFO;    // Lines above this level are not logged
+int syslogLevel = LOG_WARN; // Lines up to this level also go to syslog
+char logRing[LOG_RING_SIZE];
+size_t logStart = 0, logCount = 0; // Oldest byte not yet sent, bytes waiting
+unsigned long logDropped = 0, logDroppedTotal = 0;
+
+#ifdef LOG_SYSLOG_HOST
+WiFiUDP syslogUDP;
+#endif
+
+void logPush(const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        logRing[(logStart + logCount++) % LOG_RING_SIZE] = data[i];
+    }
+}
+
+void logSyslog(int level, const char* line, size_t len) {
+    #ifdef LOG_SYSLOG_HOST
+    static const uint8_t severity[] = {3, 4, 6, 7};
+    if (level > syslogLevel || WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    char head[16];
+    int n = snprintf(head, sizeof(head), "<%d>ntp162: ", 16 * 8 + severity[level]); // Facility local0
+    syslogUDP.beginPacket(LOG_SYSLOG_HOST, LOG_SYSLOG_PORT);
+    syslogUDP.write((const uint8_t*)head, n);
+    syslogUDP.write((const uint8_t*)line, len);
+    syslogUDP.endPacket();
+    #endif
+}
+
+/*
+*   logFormat() - Formats one line with its tag and time, returns its length without the line break
+*   logQueue() - Puts a formatted line in the ring, or counts it as dropped
+*/
+size_t logFormat(char* line, char tag, size_t& textStart, const char* format, va_list args) {
+    int n = snprintf(line, LOG_LINE_MAX, "%c %lu ", tag, millis());
+    int m = vsnprintf(line + n, LOG_LINE_MAX - n - 1, format, args);
+    textStart = n;
+    size_t len = n + (m < 0 ? 0 : min((size_t)m, (size_t)LOG_LINE_MAX - n - 2));
+    line[len] = '\n';
+    return len;
+}
+
+void logQueue(const char* line, size_t len) {
+    if (logDropped > 0 && LOG_RING_SIZE - logCount >= 40 + len) {
+        char note[40];
+        logPush(note, snprintf(note, sizeof(note), "W %lu %lu linhas perdidas\n", millis(), logDropped));
+        logDropped = 0;
+    }
+    if (LOG_RING_SIZE - logCount < len) {
+        logDropped++;
+        logDroppedTotal++;
+        return;
+    }
+    logPush(line, len);
+}
+
+/*
+*   logPrintf() - Logs one line at a level, the line break is added
+*/
+void logPrintf(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void logPrintf(int level, const char* format, ...) {
+    if (level > logLevel) {
+        return;
+    }
+    static const char tags[] = "EWID";
+    char line[LOG_LINE_MAX];
+    size_t textStart;
+    va_list args;
+    va_start(args, format);
+    size_t len = logFormat(line, tags[level], textStart, format, args);
+    va_end(args);
+    logSyslog(level, line + textStart, len - textStart);
+    logQueue(line, len + 1);
+}
+
+/*
+*   logReply() - Queues a reply of the serial console, whatever the log level
+*/
+void logReply(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void logReply(const char* format, ...) {
+    char line[LOG_LINE_MAX];
+    size_t textStart;
+    va_list args;
+    va_start(args, format);
+    size_t len = logFormat(line, '>', textStart, format, args);
+    va_end(args);
+    logQueue(line, len + 1);
+}
+
+/*
+*   logPayload() - Logs the size of a buffer and a preview of its start
+*/
+void logPayload(int level, const char* label, const char* data, size_t len) {
+    if (level > logLevel) {
+        return;
+    }
+    char hex[2 * LOG_PAYLOAD_HEAD + 1];
+    char text[LOG_PAYLOAD_HEAD + 1];
+    size_t shown = min(len, (size_t)LOG_PAYLOAD_HEAD);
+    for (size_t i = 0; i < shown; i++) {
+        uint8_t c = data[i];
+        snprintf(hex + 2 * i, 3, "%02x", c);
+        text[i] = c >= 32 && c < 127 ? c : '.';
+    }
+    hex[2 * shown] = '\0';
+    text[shown] = '\0';
+    logPrintf(level, "%s: %u bytes, %s |%s|%s", label, (unsigned)len, hex, text, len > shown ? "..." : "");
+}
+
+/*
+*   logDrain() - Sends what the UART FIFO can take right now
+*/
+void logDrain() {
+    while (logCount > 0) {
+        int room = Serial.availableForWrite();
+        if (room <= 0) {
+            return;
+        }
+        size_t n = min(min(logCount, LOG_RING_SIZE - logStart), (size_t)room);
+        Serial.write((const uint8_t*)logRing + logStart, n);
+        logStart = (logStart + n) % LOG_RING_SIZE;
+        logCount -= n;
+    }
+}
+
+/*
+*   logFlush() - Waits until the whole log is out, for setup() and before a restart
+*/
+void logFlush() {
+    while (logCount > 0) {
+        logDrain();
+        yield();
+    }
+}
+
+#ifdef SERIALPRINT
+#define LOGE(...) logPrintf(LOG_ERROR, __VA_ARGS__)
+#define LOGW(...) logPrintf(LOG_WARN, __VA_ARGS__)
+#define LOGI(...) logPrintf(LOG_INFO, __VA_ARGS__)
+#define LOGD(...) logPrintf(LOG_DEBUG, __VA_ARGS__)
+#define LOG_PAYLOAD(level, label, data, len) logPayload(level, label, data, len)
+#else
+#define LOGE(...) ((void)0)
+#define LOGW(...) ((void)0)
+#define LOGI(...) ((void)0)
+#define LOGD(...) ((void)0)
+#define LOG_PAYLOAD(level, label, data, len) ((void)0)
+#endif
+
+#endif
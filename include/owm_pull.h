@@ -0,0 +1,477 @@
+// owm_pull.h
+//
+// Pull parser for the OpenWeatherMap /weather and /forecast JSON.
+//
+// The JSON is read one byte at a time by a state machine that keeps only a
+// stack of the open objects and arrays, so owmPullFeed() can take the body in
+// pieces of any size and stop and resume anywhere, even inside a key or a
+// number. Keys are not stored: each one is hashed (FNV-1a) into the path of
+// its value, e.g. "list[].main.temp", and the path is matched against hashes
+// computed at compile time. Values the schema wants are written straight into
+// the weather model, strings are copied only when they have a place in it,
+// everything else is skipped.
+//
+// Fields missing from the response are left at 0, as with ArduinoJson.
+//
+// Nothing here depends on the Arduino core.
+
+#ifndef OWM_PULL_H
+#define OWM_PULL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <weather_model.h>
+
+#define OWM_PULL_DEPTH 8 // Nesting allowed, /forecast goes 5 deep
+
+enum { OWM_PULL_MORE, OWM_PULL_DONE, OWM_PULL_ERROR };
+
+/*
+*   owmHash() - FNV-1a of a path, usable in case labels
+*   owmHashByte() - One more byte of a hash
+*/
+constexpr uint32_t owmHashByte(uint32_t h, uint8_t c) {
+    return (h ^ c) * 16777619UL;
+}
+
+constexpr uint32_t owmHash(const char* s, uint32_t h = 2166136261UL) {
+    return *s ? owmHash(s + 1, owmHashByte(h, *s)) : h;
+}
+
+#define OWM_PATH_ROOT 2166136261UL // owmHash("")
+
+struct OwmPullLevel {
+    uint32_t path;  // Path of the object or array, arrays end in "[]"
+    uint16_t index; // Element being read, for arrays
+    bool array;
+};
+
+struct OwmPull {
+    uint8_t state;
+    uint8_t depth;
+    OwmPullLevel stack[OWM_PULL_DEPTH];
+    uint32_t path;       // Path of the key or value being read
+    size_t offset;       // Bytes consumed, for error messages
+
+    // Number being read
+    uint64_t mantissa;
+    int16_t scale;       // Decimal exponent from the fraction digits
+    int16_t exponent;
+    uint8_t digits;
+    bool negative, exponentNegative;
+
+    // String being read, out is NULL when it is skipped
+    char* out;
+    size_t outSize, outLen;
+    uint16_t unicode;    // \uXXXX being read
+    uint8_t unicodeDigits;
+
+    CurrentWeather* current; // Filled from /weather, or NULL
+    Forecast* slots;         // Filled from /forecast, or NULL
+    int maxSlots;
+    int count;               // Forecast slots seen, up to maxSlots
+};
+
+enum {
+    OWM_S_START, OWM_S_KEY_OR_END, OWM_S_KEY_START, OWM_S_KEY, OWM_S_KEY_ESCAPE, OWM_S_COLON,
+    OWM_S_VALUE, OWM_S_VALUE_OR_END, OWM_S_STRING, OWM_S_STRING_ESCAPE, OWM_S_STRING_UNICODE,
+    OWM_S_NUMBER, OWM_S_FRACTION, OWM_S_EXPONENT_SIGN, OWM_S_EXPONENT, OWM_S_LITERAL,
+    OWM_S_AFTER_VALUE, OWM_S_DONE, OWM_S_ERROR
+};
+
+/*
+*   owmPullBegin() - Starts a parse into current for /weather, or into slots for /forecast
+*/
+inline void owmPullBegin(OwmPull& p, CurrentWeather* current, Forecast* slots, int maxSlots) {
+    memset(&p, 0, sizeof(p));
+    p.state = OWM_S_START;
+    p.current = current;
+    p.slots = slots;
+    p.maxSlots = maxSlots;
+    if (current) {
+        memset(current, 0, sizeof(*current));
+    }
+}
+
+/*
+*   owmPullSlot() - Forecast slot of the list element being read, NULL if none
+*/
+inline Forecast* owmPullSlot(OwmPull& p) {
+    if (!p.slots || p.depth < 2 || p.stack[1].path != owmHash("list[]") || p.stack[1].index >= p.maxSlots) {
+        return NULL;
+    }
+    return &p.slots[p.stack[1].index];
+}
+
+/*
+*   owmPullFirst() - True if the innermost array around the value's object is at its first element
+*
+*  For "weather[].description", where only weather[0] is kept.
+*/
+inline bool owmPullFirst(const OwmPull& p) {
+    return p.depth >= 2 && p.stack[p.depth - 2].array && p.stack[p.depth - 2].index == 0;
+}
+
+inline void owmPullNumber(OwmPull& p, double v) {
+    CurrentWeather* c = p.current;
+    Forecast* slot = owmPullSlot(p);
+    switch (p.path) {
+        case owmHash("dt"):                    if (c) c->dt = (long)v; break;
+        case owmHash("main.temp"):             if (c) c->temp = v; break;
+        case owmHash("main.feels_like"):       if (c) c->feels_like = v; break;
+        case owmHash("main.temp_min"):         if (c) c->temp_min = v; break;
+        case owmHash("main.temp_max"):         if (c) c->temp_max = v; break;
+        case owmHash("main.pressure"):         if (c) c->pressure = (int)v; break;
+        case owmHash("main.humidity"):         if (c) c->humidity = (int)v; break;
+        case owmHash("sys.sunrise"):           if (c) c->sunrise = (long)v; break;
+        case owmHash("sys.sunset"):            if (c) c->sunset = (long)v; break;
+        case owmHash("list[].dt"):             if (slot) slot->dt = (long)v; break;
+        case owmHash("list[].main.temp"):      if (slot) slot->temp = v; break;
+        case owmHash("list[].main.feels_like"): if (slot) slot->feels_like = v; break;
+        case owmHash("list[].main.temp_min"):  if (slot) slot->temp_min = v; break;
+        case owmHash("list[].main.temp_max"):  if (slot) slot->temp_max = v; break;
+        case owmHash("list[].main.pressure"):  if (slot) slot->pressure = (int)v; break;
+        case owmHash("list[].main.humidity"):  if (slot) slot->humidity = (int)v; break;
+        case owmHash("list[].pop"):            if (slot) slot->pop = v; break;
+        case owmHash("list[].rain.3h"):        if (slot) slot->rain_3h = v; break;
+    }
+}
+
+/*
+*   owmPullStringTarget() - Where the string starting now goes, NULL to skip it
+*/
+inline char* owmPullStringTarget(OwmPull& p, size_t& size) {
+    Forecast* slot;
+    switch (p.path) {
+        case owmHash("name"):
+            if (p.current) {
+                size = sizeof(p.current->location);
+                return p.current->location;
+            }
+            break;
+        case owmHash("weather[].description"):
+            if (p.current && owmPullFirst(p)) {
+                size = sizeof(p.current->description);
+                return p.current->description;
+            }
+            break;
+        case owmHash("list[].weather[].description"):
+            if ((slot = owmPullSlot(p)) && owmPullFirst(p)) {
+                size = sizeof(slot->description);
+                return slot->description;
+            }
+            break;
+    }
+    return NULL;
+}
+
+/*
+*   owmPullObjectStart() - A list element starts a forecast slot, cleared first
+*/
+inline void owmPullObjectStart(OwmPull& p) {
+    Forecast* slot = owmPullSlot(p);
+    if (slot && p.depth == 3) {
+        memset(slot, 0, sizeof(*slot));
+        p.count = p.stack[1].index + 1;
+    }
+}
+
+inline void owmPullPut(OwmPull& p, char c) {
+    if (p.out && p.outLen + 1 < p.outSize) {
+        p.out[p.outLen++] = c;
+        p.out[p.outLen] = '\0';
+    }
+}
+
+inline bool owmPullPush(OwmPull& p, bool array) {
+    if (p.depth >= OWM_PULL_DEPTH) {
+        return false;
+    }
+    OwmPullLevel& level = p.stack[p.depth++];
+    level.path = array ? owmHashByte(owmHashByte(p.path, '['), ']') : p.path;
+    level.index = 0;
+    level.array = array;
+    if (!array) {
+        owmPullObjectStart(p);
+    }
+    return true;
+}
+
+inline uint8_t owmPullPop(OwmPull& p, bool array) {
+    if (p.depth == 0 || p.stack[p.depth - 1].array != array) {
+        return OWM_S_ERROR;
+    }
+    p.depth--;
+    return p.depth == 0 ? OWM_S_DONE : OWM_S_AFTER_VALUE;
+}
+
+inline void owmPullNumberEnd(OwmPull& p) {
+    static const double powers[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8};
+    int e = p.scale + (p.exponentNegative ? -p.exponent : p.exponent);
+    double v = (double)p.mantissa;
+    while (e > 8) {
+        v *= 1e8;
+        e -= 8;
+    }
+    while (e < -8) {
+        v /= 1e8;
+        e += 8;
+    }
+    v = e >= 0 ? v * powers[e] : v / powers[-e];
+    owmPullNumber(p, p.negative ? -v : v);
+}
+
+inline bool owmPullSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+/*
+*   owmPullDigit() - Adds a digit to the mantissa, later ones only move the scale
+*/
+inline void owmPullDigit(OwmPull& p, char c, bool fraction) {
+    if (p.digits < 18) {
+        p.mantissa = p.mantissa * 10 + (c - '0');
+        p.digits += p.mantissa > 0;
+        p.scale -= fraction;
+    } else if (!fraction) {
+        p.scale++;
+    }
+}
+
+/*
+*   owmPullValueStart() - First byte of a value, returns the next state
+*/
+inline uint8_t owmPullValueStart(OwmPull& p, char c) {
+    if (c == '{') {
+        return owmPullPush(p, false) ? OWM_S_KEY_OR_END : OWM_S_ERROR;
+    }
+    if (c == '[') {
+        return owmPullPush(p, true) ? OWM_S_VALUE_OR_END : OWM_S_ERROR;
+    }
+    if (c == '"') {
+        p.out = owmPullStringTarget(p, p.outSize);
+        p.outLen = 0;
+        if (p.out) {
+            p.out[0] = '\0';
+        }
+        return OWM_S_STRING;
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        p.mantissa = 0;
+        p.scale = p.exponent = 0;
+        p.digits = 0;
+        p.negative = c == '-';
+        p.exponentNegative = false;
+        if (c != '-') {
+            owmPullDigit(p, c, false);
+        }
+        return OWM_S_NUMBER;
+    }
+    if (c == 't' || c == 'f' || c == 'n') {
+        return OWM_S_LITERAL;
+    }
+    return OWM_S_ERROR;
+}
+
+/*
+*   owmPullUtf8() - Writes a \u escape as UTF-8, surrogates become '?'
+*/
+inline void owmPullUtf8(OwmPull& p, uint16_t u) {
+    if (u < 0x80) {
+        owmPullPut(p, u);
+    } else if (u < 0x800) {
+        owmPullPut(p, 0xC0 | u >> 6);
+        owmPullPut(p, 0x80 | (u & 0x3F));
+    } else if (u >= 0xD800 && u < 0xE000) {
+        owmPullPut(p, '?');
+    } else {
+        owmPullPut(p, 0xE0 | u >> 12);
+        owmPullPut(p, 0x80 | ((u >> 6) & 0x3F));
+        owmPullPut(p, 0x80 | (u & 0x3F));
+    }
+}
+
+/*
+*   owmPullFeed() - Parses the next len bytes
+*
+*  Returns OWM_PULL_MORE until the root object closes, then OWM_PULL_DONE
+*  (bytes after it are ignored), or OWM_PULL_ERROR on JSON it can't follow.
+*  Anything before the first '{' is skipped.
+*/
+inline int owmPullFeed(OwmPull& p, const char* data, size_t len) {
+    for (size_t i = 0; i < len && p.state != OWM_S_DONE && p.state != OWM_S_ERROR; i++) {
+        char c = data[i];
+        p.offset++;
+        bool again; // The byte ends a number or a literal and is read again
+        do {
+            again = false;
+            switch (p.state) {
+                case OWM_S_START:
+                    if (c == '{') {
+                        p.path = OWM_PATH_ROOT;
+                        p.state = owmPullValueStart(p, c);
+                    }
+                    break;
+
+                case OWM_S_KEY_OR_END:
+                    if (c == '}') {
+                        p.state = owmPullPop(p, false);
+                        break;
+                    }
+                    // Fall through
+                case OWM_S_KEY_START:
+                    if (c == '"') {
+                        p.path = p.stack[p.depth - 1].path;
+                        if (p.depth > 1) {
+                            p.path = owmHashByte(p.path, '.');
+                        }
+                        p.state = OWM_S_KEY;
+                    } else if (!owmPullSpace(c)) {
+                        p.state = OWM_S_ERROR;
+                    }
+                    break;
+
+                case OWM_S_KEY:
+                    if (c == '"') {
+                        p.state = OWM_S_COLON;
+                    } else {
+                        p.path = owmHashByte(p.path, c);
+                        p.state = c == '\\' ? OWM_S_KEY_ESCAPE : OWM_S_KEY;
+                    }
+                    break;
+
+                case OWM_S_KEY_ESCAPE:
+                    p.path = owmHashByte(p.path, c); // Schema keys have no escapes, any such key just won't match
+                    p.state = OWM_S_KEY;
+                    break;
+
+                case OWM_S_COLON:
+                    if (c == ':') {
+                        p.state = OWM_S_VALUE;
+                    } else if (!owmPullSpace(c)) {
+                        p.state = OWM_S_ERROR;
+                    }
+                    break;
+
+                case OWM_S_VALUE_OR_END:
+                    if (c == ']') {
+                        p.state = owmPullPop(p, true);
+                        break;
+                    }
+                    // Fall through
+                case OWM_S_VALUE:
+                    if (!owmPullSpace(c)) {
+                        if (p.stack[p.depth - 1].array) {
+                            p.path = p.stack[p.depth - 1].path;
+                        }
+                        p.state = owmPullValueStart(p, c);
+                    }
+                    break;
+
+                case OWM_S_STRING:
+                    if (c == '"') {
+                        p.state = OWM_S_AFTER_VALUE;
+                    } else if (c == '\\') {
+                        p.state = OWM_S_STRING_ESCAPE;
+                    } else {
+                        owmPullPut(p, c);
+                    }
+                    break;
+
+                case OWM_S_STRING_ESCAPE:
+                    p.state = OWM_S_STRING;
+                    switch (c) {
+                        case 'n': owmPullPut(p, '\n'); break;
+                        case 't': owmPullPut(p, '\t'); break;
+                        case 'r': owmPullPut(p, '\r'); break;
+                        case 'b': owmPullPut(p, '\b'); break;
+                        case 'f': owmPullPut(p, '\f'); break;
+                        case 'u':
+                            p.unicode = 0;
+                            p.unicodeDigits = 0;
+                            p.state = OWM_S_STRING_UNICODE;
+                            break;
+                        default: owmPullPut(p, c); break; // \" \\ \/
+                    }
+                    break;
+
+                case OWM_S_STRING_UNICODE: {
+                    int d = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+                    if (d < 0) {
+                        p.state = OWM_S_ERROR;
+                        break;
+                    }
+                    p.unicode = p.unicode << 4 | d;
+                    if (++p.unicodeDigits == 4) {
+                        owmPullUtf8(p, p.unicode);
+                        p.state = OWM_S_STRING;
+                    }
+                    break;
+                }
+
+                case OWM_S_NUMBER:
+                case OWM_S_FRACTION:
+                    if (c >= '0' && c <= '9') {
+                        owmPullDigit(p, c, p.state == OWM_S_FRACTION);
+                    } else if (c == '.' && p.state == OWM_S_NUMBER) {
+                        p.state = OWM_S_FRACTION;
+                    } else if (c == 'e' || c == 'E') {
+                        p.state = OWM_S_EXPONENT_SIGN;
+                    } else {
+                        owmPullNumberEnd(p);
+                        p.state = OWM_S_AFTER_VALUE;
+                        again = true;
+                    }
+                    break;
+
+                case OWM_S_EXPONENT_SIGN:
+                    p.state = OWM_S_EXPONENT;
+                    if (c == '-' || c == '+') {
+                        p.exponentNegative = c == '-';
+                        break;
+                    }
+                    again = true;
+                    break;
+
+                case OWM_S_EXPONENT:
+                    if (c >= '0' && c <= '9') {
+                        if (p.exponent < 400) {
+                            p.exponent = p.exponent * 10 + (c - '0');
+                        }
+                    } else {
+                        owmPullNumberEnd(p);
+                        p.state = OWM_S_AFTER_VALUE;
+                        again = true;
+                    }
+                    break;
+
+                case OWM_S_LITERAL:
+                    if (c < 'a' || c > 'z') {
+                        p.state = OWM_S_AFTER_VALUE; // true, false and null carry nothing the model uses
+                        again = true;
+                    }
+                    break;
+
+                case OWM_S_AFTER_VALUE:
+                    if (c == ',') {
+                        OwmPullLevel& level = p.stack[p.depth - 1];
+                        if (level.array) {
+                            level.index++;
+                            p.state = OWM_S_VALUE;
+                        } else {
+                            p.state = OWM_S_KEY_START;
+                        }
+                    } else if (c == '}' || c == ']') {
+                        p.state = owmPullPop(p, c == ']');
+                    } else if (!owmPullSpace(c)) {
+                        p.state = OWM_S_ERROR;
+                    }
+                    break;
+            }
+        } while (again);
+    }
+    return p.state == OWM_S_DONE ? OWM_PULL_DONE : p.state == OWM_S_ERROR ? OWM_PULL_ERROR : OWM_PULL_MORE;
+}
+
+#endif
@@ -0,0 +1,71 @@
+// provider_gateway.h
+//
+// Weather gateway provider (tools/gateway).
+//
+// The gateway fetches the weather once for every clock at a location and
+// serves it over plain HTTP on the LAN as a signed binary snapshot
+// (weather_snapshot.h). There is no TLS handshake and no text to parse, the
+// fields are read straight into the weather model. Both the current weather
+// and the forecast come in the same snapshot.
+// Expects snapshotTagValid() defined in main.cpp, the gateway must be started
+// with the same PEER_KEY.
+
+#ifndef PROVIDER_GATEWAY_H
+#define PROVIDER_GATEWAY_H
+
+#include <stdio.h>
+#include <weather_model.h>
+#include <weather_snapshot.h>
+
+#ifndef GATEWAY_HOST
+#define GATEWAY_HOST "weather-gateway.local" // Host running tools/gateway
+#endif
+#define GATEWAY_PORT 8162
+
+void gatewayBuildRequest(char* request, size_t size, bool forecast, int slots, const char* lat, const char* lon, const char* apiKey) {
+    snprintf(request, size,
+             "GET /snapshot?lat=%s&lon=%s HTTP/1.1\r\n"
+             "Host: " GATEWAY_HOST "\r\n"
+             "Connection: close\r\n\r\n",
+             lat, lon);
+}
+
+/*
+*   gatewayDecode() - Checks the tag of a snapshot and reads it
+*/
+bool gatewayDecode(const char* body, size_t len, CurrentWeather& current, Forecast* slots, int maxSlots, int& count) {
+    if (len <= SNAPSHOT_TAG_LEN) {
+        return false;
+    }
+    len -= SNAPSHOT_TAG_LEN;
+    const uint8_t* data = (const uint8_t*)body;
+    if (!snapshotTagValid(data, len, data + len)) {
+        LOGW("Erro: snapshot do gateway com tag invalida.");
+        return false;
+    }
+    long fetched;
+    return snapshotDecodeWeather(data, len, current, fetched, slots, maxSlots, count, 0);
+}
+
+bool gatewayParseCurrent(char* body, size_t len, CurrentWeather& current) {
+    Forecast slot;
+    int count;
+    return gatewayDecode(body, len, current, &slot, 1, count);
+}
+
+int gatewayParseForecast(char* body, size_t len, Forecast* slots, int maxSlots) {
+    CurrentWeather current;
+    int count;
+    if (!gatewayDecode(body, len, current, slots, maxSlots, count)) {
+        return -1;
+    }
+    return count;
+}
+
+const WeatherProvider weatherGateway = {
+    "Gateway", GATEWAY_HOST, GATEWAY_PORT,
+    gatewayBuildRequest, gatewayParseCurrent, gatewayParseForecast,
+    NULL, NULL, NULL
+};
+
+#endif
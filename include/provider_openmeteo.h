@@ -0,0 +1,243 @@
+// provider_openmeteo.h
+//
+// Open-Meteo provider (https://open-meteo.com), CSV format.
+//
+// Open-Meteo needs no API key and answers over plain HTTP, so a fetch costs
+// no TLS handshake. The CSV body is a few hundred bytes, it is parsed line by
+// line in place, and nothing is allocated. The weather is given as a WMO code,
+// which is translated to a description here.
+//
+// The body holds sections separated by blank lines, each one a header row
+// followed by data rows. The columns come in the order they are requested.
+
+#ifndef PROVIDER_OPENMETEO_H
+#define PROVIDER_OPENMETEO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <weather_model.h>
+
+/*
+*   openMeteoBuildRequest() - Builds the HTTP request for current weather or forecast
+*
+*  The current weather comes with today's minimum, maximum, sunrise and sunset.
+*  The forecast asks for the hours of the slots wanted, grouped in 3 hour slots.
+*  The reply may come chunked and gzipped, fetchPoll() undoes both.
+*/
+void openMeteoBuildRequest(char* request, size_t size, bool forecast, int slots, const char* lat, const char* lon, const char* apiKey) {
+    if (forecast) {
+        snprintf(request, size,
+                 "GET /v1/forecast?latitude=%s&longitude=%s"
+                 "&hourly=temperature_2m,apparent_temperature,relative_humidity_2m,pressure_msl,"
+                 "precipitation_probability,precipitation,weather_code"
+                 "&forecast_hours=%d&timeformat=unixtime&format=csv HTTP/1.1\r\n"
+                 "Host: api.open-meteo.com\r\n"
+                 "Connection: close\r\n\r\n",
+                 lat, lon, slots * 3);
+    } else {
+        snprintf(request, size,
+                 "GET /v1/forecast?latitude=%s&longitude=%s"
+                 "&current=temperature_2m,apparent_temperature,relative_humidity_2m,pressure_msl,weather_code"
+                 "&daily=temperature_2m_min,temperature_2m_max,sunrise,sunset"
+                 "&forecast_days=1&timeformat=unixtime&format=csv HTTP/1.1\r\n"
+                 "Host: api.open-meteo.com\r\n"
+                 "Connection: close\r\n\r\n",
+                 lat, lon);
+    }
+}
+
+/*
+*   openMeteoDescription() - Describes a WMO weather code
+*/
+const char* openMeteoDescription(int code) {
+    switch (code) {
+        case 0: return "Ceu limpo";
+        case 1: return "Predominantemente limpo";
+        case 2: return "Parcialmente nublado";
+        case 3: return "Nublado";
+        case 45: case 48: return "Nevoeiro";
+        case 51: case 53: case 55: return "Garoa";
+        case 56: case 57: return "Garoa congelante";
+        case 61: return "Chuva fraca";
+        case 63: return "Chuva moderada";
+        case 65: return "Chuva forte";
+        case 66: case 67: return "Chuva congelante";
+        case 71: case 73: case 75: return "Neve";
+        case 77: return "Graos de neve";
+        case 80: return "Pancadas de chuva fracas";
+        case 81: return "Pancadas de chuva";
+        case 82: return "Pancadas de chuva fortes";
+        case 85: case 86: return "Pancadas de neve";
+        case 95: return "Trovoada";
+        case 96: case 99: return "Trovoada com granizo";
+        default: return "";
+    }
+}
+
+/*
+*   csvNumber() - Reads the next field of a CSV row and moves past it, an empty field reads as 0
+*/
+double csvNumber(char*& field) {
+    double value = strtod(field, NULL);
+    char* comma = strchr(field, ',');
+    field = comma ? comma + 1 : field + strlen(field);
+    return value;
+}
+
+/*
+*   csvNextLine() - Cuts the next line out of the body and advances past it
+*
+*  Returns NULL at the end of the body. The line is NUL terminated in place.
+*/
+char* csvNextLine(char*& cursor, char* end) {
+    if (cursor >= end) {
+        return NULL;
+    }
+    char* line = cursor;
+    char* eol = (char*)memchr(line, '\n', end - line);
+    if (!eol) {
+        eol = end;
+    }
+    cursor = eol + 1;
+    *eol = '\0';
+    if (eol > line && eol[-1] == '\r') {
+        eol[-1] = '\0';
+    }
+    return line;
+}
+
+bool csvIsData(const char* line) {
+    return isdigit((unsigned char)line[0]) || line[0] == '-';
+}
+
+/*
+*   openMeteoParseCurrent() - Reads the current + daily sections into the weather model
+*/
+bool openMeteoParseCurrent(char* body, size_t len, CurrentWeather& current) {
+    enum { OTHER, CURRENT, DAILY } section = OTHER;
+    bool gotCurrent = false;
+    char* cursor = body;
+    char* line;
+    while ((line = csvNextLine(cursor, body + len)) != NULL) {
+        if (line[0] == '\0') {
+            section = OTHER;
+        } else if (!csvIsData(line)) {
+            if (strncmp(line, "time", 4) != 0) {
+                section = OTHER; // Location metadata
+            } else {
+                section = strstr(line, "sunrise") ? DAILY : CURRENT;
+            }
+        } else if (section == CURRENT) {
+            char* field = line;
+            current.dt = (long)csvNumber(field);
+            current.temp = csvNumber(field);
+            current.feels_like = csvNumber(field);
+            current.humidity = (int)csvNumber(field);
+            current.pressure = (int)(csvNumber(field) + 0.5);
+            const char* desc = openMeteoDescription((int)csvNumber(field));
+            strncpy(current.description, desc, sizeof(current.description));
+            current.description[sizeof(current.description) - 1] = '\0';
+            gotCurrent = true;
+        } else if (section == DAILY) {
+            char* field = line;
+            csvNumber(field); // Day
+            current.temp_min = csvNumber(field);
+            current.temp_max = csvNumber(field);
+            current.sunrise = (long)csvNumber(field);
+            current.sunset = (long)csvNumber(field);
+        }
+    }
+    current.location[0] = '\0'; // Open-Meteo does not name the place
+    return gotCurrent;
+}
+
+/*
+*   openMeteoParseForecast() - Groups the hourly rows in 3 hour forecast slots
+*
+*  Each slot starts with the values of its first hour. The minimum and maximum
+*  temperature, the highest chance of rain, the total rain and the worst weather
+*  code are taken over the hours of the slot.
+*/
+int openMeteoParseForecast(char* body, size_t len, Forecast* slots, int maxSlots) {
+    bool hourly = false;
+    int hour = 0;
+    int codes[FORECAST_HOURS];
+    char* cursor = body;
+    char* line;
+    if (maxSlots > FORECAST_HOURS) {
+        maxSlots = FORECAST_HOURS;
+    }
+    while ((line = csvNextLine(cursor, body + len)) != NULL) {
+        if (line[0] == '\0') {
+            hourly = false;
+            continue;
+        }
+        if (!csvIsData(line)) {
+            hourly = strncmp(line, "time", 4) == 0;
+            continue;
+        }
+        if (!hourly) {
+            continue;
+        }
+        int i = hour / 3;
+        if (i >= maxSlots) {
+            break;
+        }
+        char* field = line;
+        long dt = (long)csvNumber(field);
+        float temp = csvNumber(field);
+        float feels = csvNumber(field);
+        int humidity = (int)csvNumber(field);
+        int pressure = (int)(csvNumber(field) + 0.5);
+        float pop = csvNumber(field) / 100;
+        float rain = csvNumber(field);
+        int code = (int)csvNumber(field);
+
+        Forecast& slot = slots[i];
+        if (hour % 3 == 0) {
+            slot.dt = dt;
+            slot.temp = temp;
+            slot.feels_like = feels;
+            slot.temp_min = temp;
+            slot.temp_max = temp;
+            slot.humidity = humidity;
+            slot.pressure = pressure;
+            slot.pop = pop;
+            slot.rain_3h = rain;
+            codes[i] = code;
+        } else {
+            if (temp < slot.temp_min) {
+                slot.temp_min = temp;
+            }
+            if (temp > slot.temp_max) {
+                slot.temp_max = temp;
+            }
+            if (pop > slot.pop) {
+                slot.pop = pop;
+            }
+            if (code > codes[i]) {
+                codes[i] = code;
+            }
+            slot.rain_3h += rain;
+        }
+        hour++;
+    }
+
+    int count = (hour + 2) / 3;
+    for (int i = 0; i < count; i++) {
+        const char* desc = openMeteoDescription(codes[i]);
+        strncpy(slots[i].description, desc, sizeof(slots[i].description));
+        slots[i].description[sizeof(slots[i].description) - 1] = '\0';
+    }
+    return count > 0 ? count : -1;
+}
+
+const WeatherProvider openMeteo = {
+    "Open-Meteo", "api.open-meteo.com", 80,
+    openMeteoBuildRequest, openMeteoParseCurrent, openMeteoParseForecast,
+    NULL, NULL, NULL
+};
+
+#endif
@@ -0,0 +1,203 @@
+// provider_owm.h
+//
+// OpenWeatherMap 2.5 provider (/weather and /forecast, JSON).
+// Parsed with the pull parser of owm_pull.h, as the body arrives when fetched
+// through the stream functions. The ArduinoJson parsers are kept
+// as the reference for the console benchmark, they expect the parseAllocator
+// defined in main.cpp.
+
+#ifndef PROVIDER_OWM_H
+#define PROVIDER_OWM_H
+
+#include <ArduinoJson.h>
+#include <owm_pull.h>
+#include <weather_model.h>
+
+/*
+*   buildWeatherRequest() - Builds the HTTP request for current weather
+*   buildForecastRequest() - Builds the HTTP request for weather forecast
+*
+*  These functions create the HTTP GET request string for the OpenWeatherMap API.
+*/
+void buildWeatherRequest(char* request, size_t size, const char* lat, const char* lon, const char* apiKey) {
+    snprintf(request, size,
+             "GET /data/2.5/weather?lat=%s&lon=%s&appid=%s&units=metric&lang=pt_br HTTP/1.1\r\n"
+             "Host: api.openweathermap.org\r\n"
+             "Connection: close\r\n\r\n",
+             lat, lon, apiKey);
+}
+
+void buildForecastRequest(char* request, size_t size, int slots, const char* lat, const char* lon, const char* apiKey) {
+    snprintf(request, size,
+             "GET /data/2.5/forecast?lat=%s&lon=%s&cnt=%d&appid=%s&units=metric&lang=pt_br HTTP/1.1\r\n"
+             "Host: api.openweathermap.org\r\n"
+             "Connection: close\r\n\r\n",
+             lat, lon, slots, apiKey);
+}
+
+void owmBuildRequest(char* request, size_t size, bool forecast, int slots, const char* lat, const char* lon, const char* apiKey) {
+    if (forecast) {
+        buildForecastRequest(request, size, slots, lat, lon, apiKey);
+    } else {
+        buildWeatherRequest(request, size, lat, lon, apiKey);
+    }
+}
+
+/*
+*   owmDeserialize() - Deserializes an OWM body into doc
+*
+*  The JSON starts at the first '{' of the body.
+*/
+bool owmDeserialize(JsonDocument& doc, char* body, size_t len) {
+    char* json = (char*)memchr(body, '{', len);
+    if (!json) {
+        LOGE("Erro: JSON não encontrado na resposta.");
+        return false;
+    }
+    DeserializationError error = deserializeJson(doc, json, len - (json - body));
+    if (error) {
+        LOGE("deserializeJson() failed: %s", error.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+*   owmPullEnd() - Logs why a pull parse did not finish, returns true if it did
+*/
+bool owmPullEnd(const OwmPull& p, int status) {
+    if (status == OWM_PULL_DONE) {
+        return true;
+    }
+    if (p.state == OWM_S_START) {
+        LOGE("Erro: JSON não encontrado na resposta.");
+    } else {
+        LOGE("Erro: JSON %s no byte %u", status == OWM_PULL_ERROR ? "inválido" : "incompleto", (unsigned)p.offset);
+    }
+    return false;
+}
+
+/*
+*   owmParseCurrent() - Reads the /weather response into the weather model
+*/
+bool owmParseCurrent(char* body, size_t len, CurrentWeather& current) {
+    OwmPull p;
+    owmPullBegin(p, &current, NULL, 0);
+    return owmPullEnd(p, owmPullFeed(p, body, len));
+}
+
+/*
+*   owmParseForecast() - Reads the /forecast response into forecast slots
+*/
+int owmParseForecast(char* body, size_t len, Forecast* slots, int maxSlots) {
+    OwmPull p;
+    owmPullBegin(p, NULL, slots, maxSlots);
+    if (!owmPullEnd(p, owmPullFeed(p, body, len))) {
+        return -1;
+    }
+    return p.count; // The API may return fewer entries than requested
+}
+
+/*
+*   owmStreamBegin() - Starts a pull parse that takes the body as it arrives
+*   owmStreamFeed() - Parses the next bytes of the body
+*   owmStreamEnd() - Ends the parse, returns the forecast slots filled or -1
+*
+*  Only one response is read at a time, so the parser state is a single
+*  static OwmPull.
+*/
+OwmPull owmStream;
+
+void owmStreamBegin(CurrentWeather* current, Forecast* slots, int maxSlots) {
+    owmPullBegin(owmStream, current, slots, maxSlots);
+}
+
+int owmStreamFeed(const char* data, size_t len) {
+    int status = owmPullFeed(owmStream, data, len);
+    return status == OWM_PULL_DONE ? WEATHER_STREAM_DONE : status == OWM_PULL_ERROR ? WEATHER_STREAM_ERROR
+                                                                                      : WEATHER_STREAM_MORE;
+}
+
+int owmStreamEnd() {
+    int status = owmStream.state == OWM_S_DONE ? OWM_PULL_DONE :
+                 owmStream.state == OWM_S_ERROR ? OWM_PULL_ERROR : OWM_PULL_MORE;
+    return owmPullEnd(owmStream, status) ? owmStream.count : -1;
+}
+
+/*
+*   owmJsonParseCurrent() - Same as owmParseCurrent() with ArduinoJson
+*/
+bool owmJsonParseCurrent(char* body, size_t len, CurrentWeather& current) {
+    JsonDocument doc(&parseAllocator);
+    if (!owmDeserialize(doc, body, len)) {
+        return false;
+    }
+
+    JsonObject weather_0 = doc["weather"][0];
+    const char* desc = weather_0["description"] | "";
+    strncpy(current.description, desc, sizeof(current.description)); // Copy string to avoid null pointer
+    current.description[sizeof(current.description) - 1] = '\0'; // add null terminator
+    const char* name = doc["name"] | "";
+    strncpy(current.location, name, sizeof(current.location)); // Copy string to avoid null pointer
+    current.location[sizeof(current.location) - 1] = '\0'; // add null terminator
+
+    JsonObject main = doc["main"];
+    current.temp = main["temp"];
+    current.feels_like = main["feels_like"];
+    current.temp_min = main["temp_min"];
+    current.temp_max = main["temp_max"];
+    current.pressure = main["pressure"];
+    current.humidity = main["humidity"];
+    current.dt = doc["dt"];
+
+    JsonObject sys = doc["sys"];
+    current.sunset = sys["sunset"];
+    current.sunrise = sys["sunrise"];
+    return true;
+}
+
+/*
+*   owmJsonParseForecast() - Same as owmParseForecast() with ArduinoJson
+*/
+int owmJsonParseForecast(char* body, size_t len, Forecast* slots, int maxSlots) {
+    JsonDocument doc(&parseAllocator);
+    if (!owmDeserialize(doc, body, len)) {
+        return -1;
+    }
+
+    JsonArray list = doc["list"];
+    int count = list.size(); // The API may return fewer entries than requested
+    if (count > maxSlots) {
+        count = maxSlots;
+    }
+
+    for (int i = 0; i < count; i++) {
+        JsonObject entry = list[i];
+        JsonObject main = entry["main"];
+        JsonObject weather0 = entry["weather"][0];
+        JsonObject rain = entry["rain"];
+
+        slots[i].dt = entry["dt"];
+        slots[i].temp = main["temp"];
+        slots[i].feels_like = main["feels_like"];
+        slots[i].temp_min = main["temp_min"];
+        slots[i].temp_max = main["temp_max"];
+        slots[i].pressure = main["pressure"];
+        slots[i].humidity = main["humidity"];
+        slots[i].pop = entry["pop"];
+        slots[i].rain_3h = rain["3h"] | 0.0;
+
+        const char* desc = weather0["description"] | "";
+        strncpy(slots[i].description, desc, sizeof(slots[i].description));
+        slots[i].description[sizeof(slots[i].description) - 1] = '\0';
+    }
+    return count;
+}
+
+const WeatherProvider openWeatherMap = {
+    "OpenWeatherMap", "api.openweathermap.org", 443,
+    owmBuildRequest, owmParseCurrent, owmParseForecast,
+    owmStreamBegin, owmStreamFeed, owmStreamEnd
+};
+
+#endif
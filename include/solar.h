@@ -0,0 +1,144 @@
+// solar.h
+//
+// Sunrise, sunset and civil twilight computed on the clock itself.
+//
+// The NOAA solar calculator: the sun's declination and the equation of time
+// from the low precision series of Meeus, then the hour angle at which the
+// sun reaches the zenith distance of each event. Sunrise and sunset are taken
+// at 90.833 degrees (refraction and the solar disc), civil twilight at 96.
+// Each event is computed twice, the second time with the sun where it is at
+// the first estimate, which keeps the error well under a minute.
+//
+// Times stay in whole epoch seconds and only the sun's position runs in single
+// precision floats. The day count from J2000 is formed in integers before it
+// becomes a float, so its rounding (about a minute and a half) only moves the
+// sun by a thousandth of a degree. It runs once a day, the soft float cost of
+// the ESP8266 does not matter.
+//
+// Everything here works on epoch seconds passed in by the caller and has no
+// dependency on the Arduino core.
+
+#ifndef SOLAR_H
+#define SOLAR_H
+
+#include <math.h>
+
+#define SOLAR_ZENITH_SUN 90.833f // Sunrise and sunset
+#define SOLAR_ZENITH_CIVIL 96.0f // Civil dawn and dusk
+#define SOLAR_J2000 946728000L   // 2000-01-01 12:00 UTC
+#define SOLAR_SECONDS_PER_DAY 86400L
+
+/*
+*   SolarDay - Sun events of one local day, in local epoch seconds
+*
+*  An event is 0 when the sun does not cross its altitude on its side of
+*  noon. Near the polar circles that can happen to one event of a pair only,
+*  a sunset with no sunrise before it; the always field of a pair is set only
+*  when both events are missing: 1 above the altitude all day, -1 below it.
+*/
+struct SolarDay {
+    long day;         // Local day (local epoch / 86400) computed, 0 = none yet
+    long noon;        // Solar noon
+    long sunrise, sunset;
+    long dawn, dusk;  // Civil twilight, the sun 6 degrees below the horizon
+    int sunAlways;    // Sun above (1) or below (-1) the horizon all day, 0 it rises or sets
+    int civilAlways;  // Same for civil twilight
+};
+
+/*
+*   solarPosition() - Declination (radians) and equation of time (minutes) at a UTC epoch
+*/
+inline void solarPosition(long utc, float& decl, float& eqTime) {
+    const float rad = (float)M_PI / 180;
+    long s = utc - SOLAR_J2000;
+    float d = (float)(s / SOLAR_SECONDS_PER_DAY) + (float)(s % SOLAR_SECONDS_PER_DAY) / SOLAR_SECONDS_PER_DAY;
+    float t = d / 36525; // Julian centuries
+
+    float l0 = fmodf(280.46646f + 0.9856473598f * d + 0.0003032f * t * t, 360) * rad; // Mean longitude
+    float m = fmodf(357.52911f + 0.9856002586f * d - 0.0001537f * t * t, 360) * rad;  // Mean anomaly
+    float e = 0.016708634f - t * (0.000042037f + 0.0000001267f * t);                 // Orbit eccentricity
+    float c = sinf(m) * (1.914602f - t * (0.004817f + 0.000014f * t)) + sinf(2 * m) * (0.019993f - 0.000101f * t) +
+              sinf(3 * m) * 0.000289f; // Equation of the centre, degrees
+    float omega = (125.04f - 0.05295376f * d) * rad;
+    float lambda = l0 + (c - 0.00569f - 0.00478f * sinf(omega)) * rad; // Apparent longitude
+    float eps = (23.439291f - 0.0130042f * t + 0.00256f * cosf(omega)) * rad; // Obliquity, corrected
+
+    decl = asinf(sinf(eps) * sinf(lambda));
+    float y = tanf(eps / 2) * tanf(eps / 2);
+    eqTime = 4 / rad * (y * sinf(2 * l0) - 2 * e * sinf(m) + 4 * e * y * sinf(m) * cosf(2 * l0) -
+                        0.5f * y * y * sinf(4 * l0) - 1.25f * e * e * sinf(2 * m));
+}
+
+/*
+*   solarNoon() - UTC epoch of the solar noon nearest to a UTC epoch, at a longitude
+*/
+inline long solarNoon(long utc, float lon) {
+    float decl, eqTime;
+    solarPosition(utc, decl, eqTime);
+    long noon = utc / SOLAR_SECONDS_PER_DAY * SOLAR_SECONDS_PER_DAY + lroundf((720 - 4 * lon - eqTime) * 60);
+    if (noon - utc > SOLAR_SECONDS_PER_DAY / 2) {
+        noon -= SOLAR_SECONDS_PER_DAY;
+    } else if (utc - noon > SOLAR_SECONDS_PER_DAY / 2) {
+        noon += SOLAR_SECONDS_PER_DAY;
+    }
+    return noon;
+}
+
+/*
+*   solarEvent() - UTC epoch at which the sun reaches a zenith distance, before (-1) or after (1) noon
+*
+*  Returns 0 and sets always when it never does on that side of noon.
+*/
+inline long solarEvent(long noon, float lat, float lon, float zenith, int side, int& always) {
+    const float rad = (float)M_PI / 180;
+    long event = noon + side * 6 * 3600L;
+    for (int pass = 0; pass < 2; pass++) {
+        float decl, eqTime;
+        solarPosition(event, decl, eqTime);
+        float cosH = cosf(zenith * rad) / (cosf(lat * rad) * cosf(decl)) - tanf(lat * rad) * tanf(decl);
+        if (cosH > 1 || cosH < -1) {
+            always = cosH < -1 ? 1 : -1;
+            return 0;
+        }
+        long hourAngle = lroundf(acosf(cosH) / rad * 240); // 240 seconds per degree
+        event = solarNoon(event, lon) + side * hourAngle;
+    }
+    always = 0;
+    return event;
+}
+
+/*
+*   solarCompute() - Computes the events of a local day
+*
+*  lat and lon in degrees, north and east positive, utcOffset in seconds.
+*/
+inline void solarCompute(SolarDay& s, long day, float lat, float lon, long utcOffset) {
+    long noon = solarNoon(day * SOLAR_SECONDS_PER_DAY + SOLAR_SECONDS_PER_DAY / 2 - utcOffset, lon);
+    s.day = day;
+    s.noon = noon + utcOffset;
+    int before, after;
+    long rise = solarEvent(noon, lat, lon, SOLAR_ZENITH_SUN, -1, before);
+    long set = solarEvent(noon, lat, lon, SOLAR_ZENITH_SUN, 1, after);
+    s.sunrise = rise ? rise + utcOffset : 0;
+    s.sunset = set ? set + utcOffset : 0;
+    s.sunAlways = rise || set ? 0 : before;
+    long dawn = solarEvent(noon, lat, lon, SOLAR_ZENITH_CIVIL, -1, before);
+    long dusk = solarEvent(noon, lat, lon, SOLAR_ZENITH_CIVIL, 1, after);
+    s.dawn = dawn ? dawn + utcOffset : 0;
+    s.dusk = dusk ? dusk + utcOffset : 0;
+    s.civilAlways = dawn || dusk ? 0 : before;
+}
+
+/*
+*   solarDark() - True between civil dusk and civil dawn, at a local epoch of the computed day
+*
+*  With one of the two missing, the day is light on that side.
+*/
+inline bool solarDark(const SolarDay& s, long now) {
+    if (s.dawn == 0 && s.dusk == 0) {
+        return s.civilAlways < 0;
+    }
+    return (s.dawn && now < s.dawn) || (s.dusk && now >= s.dusk);
+}
+
+#endif
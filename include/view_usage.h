@@ -0,0 +1,83 @@
+// view_usage.h
+//
+// When the weather screens get looked at.
+//
+// Every time the Weather or the Forecast screen is opened, the hour of the day
+// gets USAGE_VIEW_POINTS points. The scores fade by an eighth each day, so
+// they follow the habits of the last couple of weeks. A clock looked at every
+// day at the same hour scores 8 * USAGE_VIEW_POINTS for it, which is why the
+// scores saturate at 255 instead of growing any further.
+//
+// Lazy fetching asks usageLikely() whether a view is likely in the current or
+// the next hour, and only then keeps the weather fresh in the background.
+// Until USAGE_LEARN_DAYS days have been seen every hour counts as likely, so
+// a new clock starts out fetching as usual.
+//
+// Everything here works on local epoch seconds passed in by the caller and has
+// no dependency on the Arduino core. The struct is small enough for the RTC
+// user memory.
+
+#ifndef VIEW_USAGE_H
+#define VIEW_USAGE_H
+
+#include <stdint.h>
+
+#define USAGE_VIEW_POINTS 16 // Points per view
+#define USAGE_LIKELY 32      // Score from which an hour is likely, about a view every third day keeps it there
+#define USAGE_LEARN_DAYS 3   // Days seen before the scores are trusted
+#define USAGE_SECONDS_PER_HOUR 3600L
+#define USAGE_SECONDS_PER_DAY 86400L
+
+/*
+*   ViewUsage - Views per hour of the day
+*/
+struct ViewUsage {
+    uint32_t day;      // Day (local epoch / 86400) the scores were last faded, 0 = never used
+    uint8_t days;      // Days seen, saturates at 255
+    uint8_t hours[24]; // Score of each hour of the day
+};
+
+/*
+*   usageRollover() - Fades the scores once for every day gone by
+*/
+inline void usageRollover(ViewUsage& u, long now) {
+    uint32_t day = now / USAGE_SECONDS_PER_DAY;
+    if (u.day == 0 || day < u.day) {
+        u.day = day; // First use, or a clock that went back
+        return;
+    }
+    for (int n = 0; u.day < day; u.day++, n++) {
+        if (n < 32) { // Longer gaps leave nothing to fade
+            for (int h = 0; h < 24; h++) {
+                u.hours[h] -= u.hours[h] / 8 + (u.hours[h] % 8 != 0);
+            }
+        }
+        if (u.days < 255) {
+            u.days++;
+        }
+    }
+}
+
+/*
+*   usageView() - Counts a view of a weather screen at the given time
+*/
+inline void usageView(ViewUsage& u, long now) {
+    usageRollover(u, now);
+    int h = now % USAGE_SECONDS_PER_DAY / USAGE_SECONDS_PER_HOUR;
+    int score = u.hours[h] + USAGE_VIEW_POINTS;
+    u.hours[h] = score > 255 ? 255 : score;
+}
+
+/*
+*   usageLikely() - True when a view is likely in the current or the next hour
+*/
+inline bool usageLikely(ViewUsage& u, long now) {
+    usageRollover(u, now);
+    if (u.days < USAGE_LEARN_DAYS) {
+        return true;
+    }
+    int h = now % USAGE_SECONDS_PER_DAY / USAGE_SECONDS_PER_HOUR;
+    return u.hours[h] >= USAGE_LIKELY || u.hours[(h + 1) % 24] >= USAGE_LIKELY;
+}
+
+#endif
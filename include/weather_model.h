@@ -0,0 +1,92 @@
+// weather_model.h
+//
+// Internal weather model. Every weather provider fills these structures and
+// the Weather and Forecast screens render only from them, so the screens do
+// not know which service the data came from.
+//
+// Times are UTC epoch seconds as delivered by the providers. Descriptions are
+// raw UTF-8, the caller adapts them to the LCD.
+
+#ifndef WEATHER_MODEL_H
+#define WEATHER_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FORECAST_HOURS 8 // Forecast slots kept
+#define FORECAST_SLOT_SECONDS 10800 // Each forecast slot covers 3 hours
+
+struct CurrentWeather {
+  long dt;           // Observation time
+  float temp;
+  float feels_like;
+  float temp_min;
+  float temp_max;
+  int pressure;
+  int humidity;
+  char description[21]; // 20 chars + '\0'
+  char location[21];    // 20 chars + '\0'
+  long sunrise;
+  long sunset;
+};
+
+struct Forecast {
+  long dt;           // Start of the slot
+  float temp;
+  float feels_like;
+  float temp_min;
+  float temp_max;
+  int pressure;
+  int humidity;
+  float pop;
+  float rain_3h;
+  char description[32];
+};
+
+/*
+*   WeatherModel - All the weather the screens show, published as a whole
+*
+*  The forecast is a ring ordered by dt, starting at forecastHead. version
+*  goes up each time a new model is published.
+*/
+struct WeatherModel {
+  uint32_t version;
+  CurrentWeather current; // Times in local time, descriptions ready for the LCD
+  long forecast_dt;       // Time of the last forecast fetch
+  Forecast forecast[FORECAST_HOURS];
+  int forecastHead;       // Ring index of the first slot
+  int forecastCount;      // Slots still in the future
+};
+
+/*
+*   WeatherProvider - A weather service the clock can fetch from
+*
+*   host/port:      server, port 443 is fetched over TLS
+*   buildRequest:   writes the full HTTP request for the current weather or the forecast,
+*                   slots is how many forecast slots to ask for, a provider may send more
+*   parseCurrent:   fills current from a response body, returns false if it is not usable
+*   parseForecast:  fills up to maxSlots slots from a response body, returns how many or -1
+*   streamBegin:    optional, starts a parse into current, or into up to maxSlots slots
+*   streamFeed:     takes the next bytes of the body, returns a WEATHER_STREAM_* status
+*   streamEnd:      ends the parse, returns the slots filled (0 for current) or -1
+*
+*   The parsers may modify the body in place, and may leave their output half
+*   written when they fail. A provider with the stream functions is parsed as
+*   the body arrives, so its body doesn't have to fit in a buffer. The others
+*   set them to NULL.
+*/
+enum { WEATHER_STREAM_MORE, WEATHER_STREAM_DONE, WEATHER_STREAM_ERROR };
+
+struct WeatherProvider {
+  const char* name;
+  const char* host;
+  uint16_t port;
+  void (*buildRequest)(char* request, size_t size, bool forecast, int slots, const char* lat, const char* lon, const char* apiKey);
+  bool (*parseCurrent)(char* body, size_t len, CurrentWeather& current);
+  int (*parseForecast)(char* body, size_t len, Forecast* slots, int maxSlots);
+  void (*streamBegin)(CurrentWeather* current, Forecast* slots, int maxSlots);
+  int (*streamFeed)(const char* data, size_t len);
+  int (*streamEnd)();
+};
+
+#endif
@@ -0,0 +1,251 @@
+// weather_snapshot.h
+//
+// Compact binary snapshot of the weather model, exchanged between clocks on
+// the same LAN and served by the weather gateway.
+//
+// Every field is written little endian at a fixed position, so the layout does
+// not depend on the compiler or the CPU. Temperatures are hundredths of a
+// degree, times are UTC epoch seconds, texts carry a one byte length. A
+// packet is the encoded body followed by a SNAPSHOT_TAG_LEN byte tag
+// (truncated HMAC-SHA256 of the body). The tag is computed and checked by the
+// caller, which has the key and the crypto library.
+//
+// Body layout:
+//   magic u32 "N162", version u8, kind u8, sender u32, lat i32, lon i32 (1e-4 degrees), flags u8
+//   SNAPSHOT_WEATHER adds:
+//     current: dt i32, temp/feels/min/max i16 x4, pressure u16, humidity u8,
+//              description text, location text, sunrise i32, sunset i32
+//     forecastFetched i32, count u8, then count slots:
+//              dt i32, temp/feels/min/max i16 x4, pressure u16, humidity u8,
+//              pop u8 (percent), rain u16 (hundredths of mm), description text
+
+#ifndef WEATHER_SNAPSHOT_H
+#define WEATHER_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <weather_model.h>
+
+#define SNAPSHOT_MAGIC 0x3236314E // "N162"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_TAG_LEN 16 // HMAC-SHA256 cut to 128 bits
+#define SNAPSHOT_HEADER_LEN 19 // Bytes of the common header
+#define SNAPSHOT_MAX_SIZE 640 // Largest body, a full forecast fits with room to spare
+
+#define SNAPSHOT_HELLO 1   // Presence of a clock, used for the leader election
+#define SNAPSHOT_WEATHER 2 // Weather model
+
+#define SNAPSHOT_HAS_WEATHER 0x01 // Hello flag: the sender holds weather data
+#define SNAPSHOT_FORECAST_PARTIAL 0x02 // Weather flag: the forecast holds only the first slots
+
+struct SnapshotHeader {
+    uint8_t kind;
+    uint32_t sender; // Chip ID of the sender
+    int32_t lat;     // Location in 1e-4 degrees, only clocks at the same place share data
+    int32_t lon;
+    uint8_t flags;
+};
+
+struct SnapshotCursor {
+    uint8_t* p;
+    size_t left;
+    bool ok;
+};
+
+inline void snapPut(SnapshotCursor& c, uint32_t value, int bytes) {
+    if (c.left < (size_t)bytes) {
+        c.ok = false;
+        return;
+    }
+    for (int i = 0; i < bytes; i++) {
+        *c.p++ = value >> (8 * i);
+    }
+    c.left -= bytes;
+}
+
+inline uint32_t snapGet(SnapshotCursor& c, int bytes) {
+    if (c.left < (size_t)bytes) {
+        c.ok = false;
+        return 0;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint32_t)*c.p++ << (8 * i);
+    }
+    c.left -= bytes;
+    return value;
+}
+
+// Hundredths, clamped to an int16
+inline void snapPutCenti(SnapshotCursor& c, float value) {
+    long v = lroundf(value * 100);
+    snapPut(c, (uint16_t)(int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v), 2);
+}
+
+inline float snapGetCenti(SnapshotCursor& c) {
+    return (int16_t)snapGet(c, 2) / 100.0f;
+}
+
+inline void snapPutText(SnapshotCursor& c, const char* text, size_t size) {
+    size_t len = strnlen(text, size - 1);
+    snapPut(c, len, 1);
+    if (c.left < len) {
+        c.ok = false;
+        return;
+    }
+    memcpy(c.p, text, len);
+    c.p += len;
+    c.left -= len;
+}
+
+inline void snapGetText(SnapshotCursor& c, char* text, size_t size) {
+    size_t len = snapGet(c, 1);
+    if (c.left < len) {
+        c.ok = false;
+        len = 0;
+    }
+    size_t keep = len < size - 1 ? len : size - 1;
+    memcpy(text, c.p, keep);
+    text[keep] = '\0';
+    c.p += len;
+    c.left -= len;
+}
+
+inline void snapshotPutHeader(SnapshotCursor& c, const SnapshotHeader& h) {
+    snapPut(c, SNAPSHOT_MAGIC, 4);
+    snapPut(c, SNAPSHOT_VERSION, 1);
+    snapPut(c, h.kind, 1);
+    snapPut(c, h.sender, 4);
+    snapPut(c, (uint32_t)h.lat, 4);
+    snapPut(c, (uint32_t)h.lon, 4);
+    snapPut(c, h.flags, 1);
+}
+
+/*
+*   snapshotEncodeHello() - Writes a hello body, returns its length or 0
+*/
+inline size_t snapshotEncodeHello(uint8_t* out, size_t size, const SnapshotHeader& h) {
+    SnapshotCursor c = {out, size, true};
+    snapshotPutHeader(c, h);
+    return c.ok ? size - c.left : 0;
+}
+
+/*
+*   snapshotEncodeWeather() - Writes a weather body, returns its length or 0
+*
+*  The forecast is read from a ring of FORECAST_HOURS slots starting at head.
+*  utcOffset is taken out of the observation and slot times, the snapshot
+*  carries UTC.
+*/
+inline size_t snapshotEncodeWeather(uint8_t* out, size_t size, const SnapshotHeader& h,
+                                    const CurrentWeather& current, long forecastFetched,
+                                    const Forecast* ring, int head, int count, long utcOffset) {
+    SnapshotCursor c = {out, size, true};
+    snapshotPutHeader(c, h);
+
+    snapPut(c, (uint32_t)(current.dt - utcOffset), 4);
+    snapPutCenti(c, current.temp);
+    snapPutCenti(c, current.feels_like);
+    snapPutCenti(c, current.temp_min);
+    snapPutCenti(c, current.temp_max);
+    snapPut(c, current.pressure, 2);
+    snapPut(c, current.humidity, 1);
+    snapPutText(c, current.description, sizeof(current.description));
+    snapPutText(c, current.location, sizeof(current.location));
+    snapPut(c, (uint32_t)current.sunrise, 4);
+    snapPut(c, (uint32_t)current.sunset, 4);
+
+    snapPut(c, (uint32_t)(forecastFetched - utcOffset), 4);
+    snapPut(c, count, 1);
+    for (int i = 0; i < count; i++) {
+        const Forecast& f = ring[(head + i) % FORECAST_HOURS];
+        snapPut(c, (uint32_t)(f.dt - utcOffset), 4);
+        snapPutCenti(c, f.temp);
+        snapPutCenti(c, f.feels_like);
+        snapPutCenti(c, f.temp_min);
+        snapPutCenti(c, f.temp_max);
+        snapPut(c, f.pressure, 2);
+        snapPut(c, f.humidity, 1);
+        snapPut(c, (uint8_t)lroundf(f.pop * 100), 1);
+        long rain = lroundf(f.rain_3h * 100);
+        snapPut(c, rain > 65535 ? 65535 : rain, 2);
+        snapPutText(c, f.description, sizeof(f.description));
+    }
+    return c.ok ? size - c.left : 0;
+}
+
+/*
+*   snapshotDecodeHeader() - Reads the common header, false if the body is not a snapshot
+*/
+inline bool snapshotDecodeHeader(const uint8_t* in, size_t len, SnapshotHeader& h) {
+    SnapshotCursor c = {(uint8_t*)in, len, true};
+    if (snapGet(c, 4) != SNAPSHOT_MAGIC || snapGet(c, 1) != SNAPSHOT_VERSION) {
+        return false;
+    }
+    h.kind = snapGet(c, 1);
+    h.sender = snapGet(c, 4);
+    h.lat = (int32_t)snapGet(c, 4);
+    h.lon = (int32_t)snapGet(c, 4);
+    h.flags = snapGet(c, 1);
+    return c.ok;
+}
+
+/*
+*   snapshotDecodeWeather() - Reads a weather body
+*
+*  Up to maxSlots slots are kept, count tells how many. utcOffset is added to
+*  the observation and slot times. current and forecastFetched are left alone
+*  when the body is bad, slots may have been written.
+*/
+inline bool snapshotDecodeWeather(const uint8_t* in, size_t len, CurrentWeather& current,
+                                  long& forecastFetched, Forecast* slots, int maxSlots, int& count, long utcOffset) {
+    SnapshotHeader h;
+    if (!snapshotDecodeHeader(in, len, h) || h.kind != SNAPSHOT_WEATHER) {
+        return false;
+    }
+    SnapshotCursor c = {(uint8_t*)in + SNAPSHOT_HEADER_LEN, len - SNAPSHOT_HEADER_LEN, true};
+
+    CurrentWeather w;
+    w.dt = (int32_t)snapGet(c, 4) + utcOffset;
+    w.temp = snapGetCenti(c);
+    w.feels_like = snapGetCenti(c);
+    w.temp_min = snapGetCenti(c);
+    w.temp_max = snapGetCenti(c);
+    w.pressure = snapGet(c, 2);
+    w.humidity = snapGet(c, 1);
+    snapGetText(c, w.description, sizeof(w.description));
+    snapGetText(c, w.location, sizeof(w.location));
+    w.sunrise = (int32_t)snapGet(c, 4);
+    w.sunset = (int32_t)snapGet(c, 4);
+
+    long fetched = (int32_t)snapGet(c, 4) + utcOffset;
+    int sent = snapGet(c, 1);
+    int kept = 0;
+    for (int i = 0; i < sent && c.ok; i++) {
+        Forecast f;
+        f.dt = (int32_t)snapGet(c, 4) + utcOffset;
+        f.temp = snapGetCenti(c);
+        f.feels_like = snapGetCenti(c);
+        f.temp_min = snapGetCenti(c);
+        f.temp_max = snapGetCenti(c);
+        f.pressure = snapGet(c, 2);
+        f.humidity = snapGet(c, 1);
+        f.pop = snapGet(c, 1) / 100.0f;
+        f.rain_3h = snapGet(c, 2) / 100.0f;
+        snapGetText(c, f.description, sizeof(f.description));
+        if (c.ok && kept < maxSlots) {
+            slots[kept++] = f;
+        }
+    }
+    if (!c.ok) {
+        return false;
+    }
+    current = w;
+    forecastFetched = fetched;
+    count = kept;
+    return true;
+}
+
+#endif
@@ -3,8 +3,8 @@
  * 
  * This project uses an ESP8266 microcontroller (Wemos D1) to display the current time
  * obtained from an NTP (Network Time Protocol) server on an LCD. It also fetches the
- * current weather information for a specified location (Curitiba) from wttr.in and displays
- * it on the second line of the LCD. The program includes WiFi connectivity, NTP synchronization,
+ * current weather information for a specified location (Curitiba) from OpenWeatherMap or
+ * Open-Meteo and displays it on the LCD. The program includes WiFi connectivity, NTP synchronization,
  * and weather data retrieval via HTTPS.
  * 
  * Features:
@@ -12,7 +12,7 @@
  *  - Synchronizes the time with an NTP server.
  *  - Displays the current time (hour, minute, second) on the LCD.
  *  - Displays the current date and day of the week.
- *  - Fetches and displays the current weather and forecast from OpenWeatherMap API.
+ *  - Fetches and displays the current weather and forecast from OpenWeatherMap or Open-Meteo.
  *  - Supports basic button inputs for navigating between different displays (Network, NTP, Date, Weather).
  * 
  * Hardware:
@@ -47,11 +47,15 @@
 #include <WiFiClientSecure.h>         // Library for secure HTTP (HTTPS) requests
 #include <LiquidCrystal.h>            // Library for controlling the LCD
 #include <ArduinoJson.h>              // Library for parsing JSON data
+#include <bearssl/bearssl_hmac.h>     // HMAC for the peer snapshots
+#include <user_interface.h>           // CPU governor, RTC timer and reset reason
 
 #include <wifi_credentials.h>         // Custom header for storing WiFi credentials
 #include <apikeys.h>                  // Custom header for storing API keys
 
 #define SERIALPRINT // Uncomment to enable serial print debugging
+// #define LOG_SYSLOG_HOST IPAddress(192, 168, 0, 2) // Uncomment to also send warnings and errors to a syslog server
+// #define LCD_MIRROR // Uncomment to stream the display to tools/lcdview
 
 
 // The correct sequence of pins Wemos D1 similar to Arduino UNO
@@ -77,8 +81,40 @@
 #define BUTTON A0
 
 // Initialize the LCD screen with specified pin configuration
+#ifdef LCD_MIRROR
+#include <lcd_mirror.h> // Copy of the display streamed to tools/lcdview
+
+/*
+*   MirrorLCD - LiquidCrystal that keeps lcdMirror in step with the display
+*
+*  Every command and character goes through send(), so the screens and
+*  digits.h need no change.
+*/
+LcdMirror lcdMirror;
+class MirrorLCD : public LiquidCrystal {
+public:
+    using LiquidCrystal::LiquidCrystal;
+    void send(uint8_t value, uint8_t mode) override {
+        LiquidCrystal::send(value, mode);
+        if (mode == COMMAND || mode == LCD_DATA) {
+            lcdMirrorTrack(lcdMirror, value, mode == LCD_DATA);
+        }
+    }
+};
+MirrorLCD lcd(D8, D9, D4, D5, D6, D7);
+#else
 LiquidCrystal lcd(D8, D9, D4, D5, D6, D7);
+#endif
+#include <log.h> // Ring buffered log, drained to the serial port from loop()
 #include <digits.h> // Custom header for displaying big digits on the LCD
+#include <fetch_schedule.h> // Adaptive weather fetch scheduling
+#include <weather_model.h> // Weather model shared by the providers and the screens
+#include <inflate.h> // Streaming gzip decoder for the weather responses
+#include <weather_snapshot.h> // Binary weather snapshot shared between clocks
+#include <view_usage.h> // Hours of the day the weather screens are looked at
+#include <solar.h> // Sunrise, sunset and civil twilight computed on the clock
+#include <http_body.h> // Chunked and gzip decoding of the response bodies
+#include <lcd_text.h> // Accents and scrolling for the LCD
 
 // NTP Server List. Change to your preferred servers
 const char* ntpServers[] = {
@@ -92,18 +128,50 @@ const char* ntpServers[] = {
 int numRedes = sizeof(ssids) / sizeof(ssids[0]);  // Number of Wi-Fi networks in wifi_credentials.h
 int numNTPServers = sizeof(ntpServers) / sizeof(ntpServers[0]); // Number of NTP Servers
 int ntpSrvIndex = 0; // Currently used NTP server
+int ntpFailover = -1; // Next server the failover tries, -1 when not failing over
+int wifiIndex = 0; // Wi-Fi network in use
 
 // Keys and LCD Variables
 int buttonState = 0;
 const char* gizmo[] = {"|", ">", "=", "<"}; //Wi-Fi loading animation
 const char* daysOfTheWeek[7] = {"Dom", "Seg", "Ter", "Qua", "Qui", "Sex", "Sab"};
-int counter = 0, lastCounter = 0, counterUD = 0, lastCounterUD = 0;
-int maxUI = 3; // Number of screens
-int minUI = -2; // Number of screens
-unsigned long lastMillis = 0, lastUIMillis = 0; // Last time the screen was updated
+#define HOME_SCREEN 2 // Big clock in screens[], shown at boot and after 60 seconds without input
+int counter = HOME_SCREEN, lastCounter = -1, counterUD = 0, lastCounterUD = 0; // Current screen and Up/Down position
+unsigned long lastRenderMillis = 0, lastUIMillis = 0; // Last time the screen was updated / a button was used
 unsigned int scrollPos = 0; // Position of the scrolling text
 char scrollBuffer[17]; // Buffer for scrolling text
-unsigned int updateInterval = 1000; // Update interval for the LCD
+
+// Data bus. Producers publish a new version of a topic whenever its data
+// changes, and a screen is redrawn only when a topic it subscribes to moves
+#define TOPIC_TIME     0 // Displayed second
+#define TOPIC_NTP      1 // Clock synced or NTP server switched
+#define TOPIC_NETWORK  2 // Wi-Fi network or IP address
+#define TOPIC_WEATHER  3 // Current weather
+#define TOPIC_FORECAST 4 // Forecast slots
+#define TOPIC_SUN      5 // Sun events of the day
+#define NUM_TOPICS     6
+#define SUB(topic) (1 << (topic))
+uint32_t topicVersion[NUM_TOPICS]; // Current version of each topic
+unsigned long lastPublishedEpoch = 0;
+uint32_t lastPublishedIP = 0;
+unsigned long lastNetworkCheckMillis = 0;
+
+// Render statistics, logged every hour
+#define RENDER_BASELINE 500 // Fixed redraw period of the old timer-driven screens
+#define RENDER_STATS_INTERVAL 3600000
+unsigned long rendersDone = 0, rendersSkipped = 0; // Renders in the current hour, and baseline ticks with nothing to draw
+unsigned long rendersTotal = 0, rendersSkippedTotal = 0; // Same since boot
+unsigned long lastSkipCheckMillis = 0, lastRenderStatsMillis = 0, lastRendersDone = 0;
+
+/*
+*  publish() - Announces a new version of a topic to the screens
+*/
+void publish(int topic) {
+    topicVersion[topic]++;
+}
+
+// Weather provider: openWeatherMap, openMeteo or weatherGateway (see include/provider_*.h)
+#define WEATHER_PROVIDER openWeatherMap
 
 // OpenWeatherMap API
 const char* apiKey = OWM_APIKEY; // Change for your API key
@@ -112,682 +180,2273 @@ const char* lat = "-25.504";
 const int alt = 935; // Altitude in meters
 #define MAX_REQUEST_SIZE 512
 #define MAX_RESPONSE_SIZE 4096
-#define FETCH_INTERVAL 900 // Fetch weather data every 15 minutes
-char weatherJson[MAX_RESPONSE_SIZE];
+#define FETCH_INTERVAL 900 // First guess of how often the weather data is updated (15 minutes)
+#define OWM_DAILY_QUOTA 1000 // API calls per day allowed by the OWM plan, shared by every clock using the key
+#define FLEET_SIZE 1 // Number of clocks sharing the API key
+#define FETCH_JITTER FETCH_MARGIN // Random delay added to each fetch, spreads the fleet
+char weatherPayload[MAX_RESPONSE_SIZE]; // Body of the last weather response
+size_t weatherPayloadLen = 0;
+
+// Parse cost limits. A parse above any of them is reported as a regression
+#define PARSE_US_PER_KB_LIMIT 6000 // Microseconds spent per KB of payload
+#define PARSE_PEAK_BYTES_LIMIT 12288 // Peak bytes allocated by the parser
 
 // Weather variables
 float tmp, hum, pres, calc_alt, qnh;
 float lastTemp = -1000, lastHum = -1000;
-float current_temp = 0.0;
-float current_feels_like = 0.0;
-float current_temp_min = 0.0;
-float current_temp_max = 0.0;
-int current_pressure = 0.0;
-int current_humidity = 0.0;
-char current_weatherDescription[21]; // 20 chars + '\0'
-char location_name[21]; // 20 chars + '\0'
-long current_sunset = 0;
-long current_sunrise = 0;
-long current_dt = 0;
-#define FORECAST_HOURS 8
-long forecast_dt = 0;
-struct Forecast {
-  long dt;
-  float temp;
-  float feels_like;
-  float temp_min;
-  float temp_max;
-  int pressure;
-  int humidity;
-  float pop;
-  float rain_3h;
-  char description[32];
-};
+#define FORECAST_MIN_HORIZON 64800 // Refetch when less than 18 hours of forecast are left
+#define FORECAST_REFETCH_MIN 3600 // Seconds after a successful forecast fetch before the next one, at least
+#define FORECAST_FIRST_SLOTS 2 // Slots asked first when there is no forecast at all (the first may have started), 0 asks for all
+unsigned long forecastWaitMillis = 0; // Since when there is no forecast to show, 0 while there is one
+bool forecastFirstShown = false;
+bool forecastPartial = false; // The first slots came in, the next fetch asks for all of them
+unsigned long forecastFirstMs = 0, forecastFullMs = 0; // Last wait for the first slot and for the full horizon
+RequestBudget requestBudget = {0, 0, OWM_DAILY_QUOTA / FLEET_SIZE};
+FetchSchedule weatherSchedule = {0, FETCH_INTERVAL, 0};
+FetchSchedule forecastSchedule = {0, FORECAST_REFETCH_MIN, 0};
+
+/*
+*   Weather model, double buffered
+*
+*  The screens, the metrics and the peers only read the front copy through
+*  weather, which is never written. A change starts with weatherBegin(), which
+*  copies the front into the back copy, goes into the back copy (the parsers
+*  write there directly) and is published by weatherSwap(), a single pointer
+*  store, once it has been checked. A parse that fails just never gets swapped
+*  in, so the screens show either the old model or the new one, never a mix.
+*
+*  Slots of the forecast ring that have started are dropped from the head, so
+*  the first slot is always the next one to come.
+*/
+WeatherModel weatherModels[2];
+const WeatherModel* weather = &weatherModels[0];
 
-Forecast forecast[FORECAST_HOURS];
+WeatherModel& weatherBegin() {
+    WeatherModel& next = weatherModels[weather == &weatherModels[0]];
+    next = *weather;
+    return next;
+}
+
+void weatherSwap() {
+    WeatherModel& next = weatherModels[weather == &weatherModels[0]];
+    next.version = weather->version + 1;
+    weather = &next;
+    LOGD("Modelo do tempo v%lu publicado", (unsigned long)next.version);
+}
 
 // Time Zone (UTC-3)
 const long utcOffsetInSeconds = -10800;
 
+// Failure handling
+#define NTP_SYNC_INTERVAL 60000 // Sync with the NTP server every minute
+#define NTP_FAILOVER_AFTER 3 // Consecutive failed syncs before trying the other servers
+#define NTP_RESTART_AFTER 21600000UL // Restart if the clock goes 6 hours without a sync
+#define BOOT_CONNECT_TIMEOUT 10000 // Time given to each Wi-Fi network at boot
+#define BOOT_RETRY 10000 // Wait before scanning again, or trying the NTP servers again, at boot
+#define BOOT_WEATHER_WAIT 120000 // The boot timeline is kept without the weather mark if it takes longer
+#define CLOCK_CACHE_MAX 21600 // Seconds the clock kept across a restart is trusted
+#define RETRY_BACKOFF_MIN 30000 // First retry of a failed weather fetch after 30 seconds
+#define RETRY_BACKOFF_MAX 900000 // Retries are never more than 15 minutes apart
+#define RATE_LIMIT_BACKOFF 1800000 // Wait 30 minutes after an HTTP 429
+
+// Heap monitoring
+// #define SOAKTEST // Uncomment to run accelerated fetch/parse/render/reconnect cycles
+#define HEAP_REPORT_INTERVAL 60000 // Sample the heap every minute
+#define HEAP_DECLINE_SAMPLES 10 // Samples in a row going down before a decline is flagged
+#define SOAK_CYCLE_INTERVAL 20000 // Length of one soak test cycle
+#define SOAK_RECONNECT_EVERY 5 // Drop and rejoin the Wi-Fi every few soak cycles
+
+// Peer sharing. Clocks at the same place elect the one with the lowest chip ID
+// as leader, only the leader fetches and it multicasts the weather to the rest
+#define PEER_SHARING // Comment out to have every clock fetch on its own
+#define PEER_GROUP IPAddress(239, 16, 2, 162) // Multicast group of the clocks
+#define PEER_PORT 16162
+#define PEER_HELLO_INTERVAL 30000 // Each clock announces itself every 30 seconds
+#define PEER_TIMEOUT 95000 // A peer not heard for three hellos is gone
+#define PEER_JOIN_WAIT 3000 // Time spent at boot listening for a leader
+#define PEER_MAX 16 // Peers tracked for the election
+#define PEER_MAX_AGE 10800 // Weather older than 3 hours is not taken from a peer
+#if defined(PEER_SHARING) && !defined(PEER_KEY)
+#error "PEER_SHARING needs its own PEER_KEY in apikeys.h, shared by the clocks of the site, see apikeys.example"
+#endif
+#ifndef PEER_KEY
+#define PEER_KEY "" // Without a key no snapshot is trusted, the gateway needs one too
+#endif
+
+// Metrics endpoint, Prometheus text format on http://<clock>/metrics
+#define METRICS // Comment out to disable the endpoint
+#define METRICS_PORT 80
+#define METRICS_TIMEOUT 2000 // A scrape not finished in 2 seconds is dropped
+#define METRICS_CHUNK 512 // Most bytes sent per loop, so the display keeps its tick
+#define METRICS_REQUEST_MAX 255 // Request bytes kept, only the request line matters
+#define METRICS_PART_MAX 640 // Buffer for the request or one part of the response, no part goes past 520 bytes
+
+// Serial console, type help in the serial monitor
+#define CONSOLE // Comment out to disable the console
+#define CONSOLE_LINE_MAX 64 // Longest command line
+#define CONSOLE_READ_MAX 32 // Most bytes read per loop
+#define CONSOLE_BENCH_SLICE 5000 // Microseconds of benchmark run per loop
+#define CONSOLE_BENCH_RUNS 100 // Default number of benchmark runs
+
+// Display mirror, see LCD_MIRROR at the top
+#define LCD_MIRROR_GROUP IPAddress(239, 16, 2, 162) // Same group as the peers, on another port
+#define LCD_MIRROR_PORT 16163
+#define LCD_MIRROR_INTERVAL 1000 // Changes are batched and sent at most once a second
+#define LCD_MIRROR_KEYFRAME 30000 // Everything is sent every 30 seconds, for viewers joining late
+
+// Radio windows. The radio sleeps between the NTP syncs and weather fetches,
+// which are batched into short wake windows; the display keeps running
+// #define RADIO_WINDOWS // Uncomment to sleep the radio between windows
+#define RADIO_WINDOW_INTERVAL 600000 // Longest time without an NTP sync, 10 minutes
+#define RADIO_NIGHT_INTERVAL 1800000 // ...and 30 minutes between civil dusk and dawn
+#define RADIO_WINDOW_MIN 2000 // A window stays open at least 2 seconds
+#define RADIO_WINDOW_MAX 30000 // ...and at most 30 seconds
+#define RADIO_WAKE_TIMEOUT 10000 // Give up joining the Wi-Fi after 10 seconds
+#define RADIO_WAKE_RETRY 60000 // Wait a minute after a failed wake
+#define RADIO_REPORT_INTERVAL 3600000 // Report the radio time every hour
+#define RADIO_SLEEP_MA 16 // Rough ESP8266 current with the radio off and the CPU running
+// CPU governor, 160 MHz only while fetching and parsing the weather
+#define CPU_BOOST // Comment out to stay at 80 MHz, the console cpu command also switches it
+#define CPU_BOOST_EXTRA_MA 10 // Rough extra current at 160 MHz, for the energy estimate
+// Lazy fetching. The weather is kept fresh in the background only at the hours
+// the weather screens are usually looked at, otherwise when one is opened
+// #define LAZY_FETCH // Uncomment to fetch on demand outside the usual hours
+
+#if defined(RADIO_WINDOWS) && defined(PEER_SHARING)
+#error "RADIO_WINDOWS keeps the radio off most of the time and the peers would lose each other, comment out PEER_SHARING"
+#endif
+
+/*
+*   LinkStats - Failure and recovery bookkeeping for one network service
+*
+*  An outage starts at the first failure after a success and ends with the next
+*  success. The time it took and the retries it needed are kept for diagnostics.
+*/
+struct LinkStats {
+    const char* name;
+    unsigned long attempts;
+    unsigned long failures;
+    unsigned int consecutiveFailures; // Retries made in the current outage
+    bool inOutage;
+    unsigned long lastSuccessMillis;
+    unsigned long outageStartMillis;
+    unsigned long lastRecoveryMs;   // Duration of the last outage
+    unsigned long maxRecoveryMs;    // Longest outage seen since boot
+    unsigned int lastOutageRetries; // Failed attempts in the last outage
+};
+
+LinkStats ntpLink = {"NTP"};
+LinkStats weatherLink = {"Clima"};
+int lastHttpStatus = 0; // Status code of the last weather response
+unsigned long weatherRetryMillis = 0, weatherRetryDelay = 0; // Backoff after a failed fetch
+unsigned long lastNTPSyncMillis = 0;
+long ntpOffset = 0; // Seconds the clock was stepped by the last sync
+unsigned long ntpDelayMs = 0; // Round trip of the last sync
+
+// Radio state, it only leaves RADIO_UP with RADIO_WINDOWS, see radioPoll()
+enum { RADIO_UP, RADIO_WAKING, RADIO_ASLEEP };
+int radioState = RADIO_UP;
+
+bool radioUp() {
+    return radioState == RADIO_UP;
+}
+
+/*
+*   Histogram - Counts of a duration in power of two buckets
+*
+*  Bucket 0 counts values below 64, bucket i values from 32 << i up to
+*  64 << i, and the last bucket everything above.
+*/
+#define HISTOGRAM_BUCKETS 16
+struct Histogram {
+    unsigned long counts[HISTOGRAM_BUCKETS];
+};
+
+Histogram loopHistogram;  // Loop duration in microseconds
+Histogram fetchHistogram; // Weather fetch duration in milliseconds
+
+void histogramAdd(Histogram& h, unsigned long value) {
+    int bucket = value < 64 ? 0 : 32 - __builtin_clz(value) - 6;
+    h.counts[min(bucket, HISTOGRAM_BUCKETS - 1)]++;
+}
+
 
 // Network initialization
 WiFiUDP ntpUDP;
-WiFiClientSecure client;
+WiFiClientSecure secureClient;
+WiFiClient plainClient;
 NTPClient timeClient(ntpUDP, ntpServers[0], utcOffsetInSeconds); // UTC-3 (Brasil)
 
 /*
- * tryNTPServer() - Tries to connect to a list of NTP servers
- * 
- * This function attempts to establish a connection with a list of NTP (Network Time Protocol)
- * servers to synchronize the time. It loops through the predefined list of NTP server addresses
- * and tries to update the time using each server. If a successful connection is made, it returns
- * the index of the server that was successfully connected to. If all servers fail, it returns -1.
- */
-int tryNTPServer() {
-    for (int i = 0; i < numNTPServers; i++) {
-        timeClient.setPoolServerName(ntpServers[i]);
-        timeClient.begin();
-        if (timeClient.update()) {
-            #ifdef SERIALPRINT
-            Serial.println("Conexão com NTP bem-sucedida: " + String(ntpServers[i]));
-            #endif
-            return i;
-        } else {
-            #ifdef SERIALPRINT
-            Serial.println("Erro ao conectar no NTP: " + String(ntpServers[i]));
-            #endif
-        }
+*   Boot record
+*
+*  Kept in the RTC user memory, which survives a restart or a crash but not a
+*  power cycle. It holds the local time of the last NTP sync together with the
+*  RTC timer at that moment, so after a restart the clock is on the display
+*  before Wi-Fi and NTP are back, and the boot timeline histograms of all the
+*  boots since power on, and the hours the weather screens get looked at
+*  (view_usage.h). The RTC timer runs on the slow clock, converted with
+*  the calibration of system_rtc_clock_cali_proc(), and wraps in about 8 hours.
+*/
+#define BOOT_RECORD_MAGIC 0x4E543632 // "NT62"
+#define BOOT_RECORD_OFFSET 32 // In 4 byte blocks, the first 128 bytes are left to OTA updates
+
+enum { BOOT_MARK_FRAME, BOOT_MARK_WIFI, BOOT_MARK_NTP, BOOT_MARK_PEERS, BOOT_MARK_WEATHER, BOOT_MARKS };
+const char* bootMarkNames[BOOT_MARKS] = {"quadro", "wifi", "ntp", "pares", "clima"};
+
+struct BootRecord {
+    uint32_t magic;
+    uint32_t boots;
+    uint32_t epoch;   // Local time at the last NTP sync, 0 if none yet
+    uint32_t rtcTime; // system_get_rtc_time() at that sync
+    uint32_t rtcCali; // Microseconds per RTC tick, 12 fractional bits
+    Histogram timeline[BOOT_MARKS]; // Milliseconds from reset to each mark
+    ViewUsage usage;
+    uint32_t check;
+};
+static_assert(sizeof(BootRecord) <= 512 - BOOT_RECORD_OFFSET * 4, "BootRecord does not fit the RTC user memory");
+
+BootRecord bootRecord;
+unsigned long bootMarks[BOOT_MARKS]; // millis() at each mark of this boot, 0 until reached
+bool bootTimelineKept = false; // This boot is in the timeline histograms
+unsigned long cachedEpoch = 0, cachedEpochMillis = 0; // Clock from the boot record, until NTP answers
+
+uint32_t bootRecordCheck(const BootRecord& r) {
+    const uint32_t* words = (const uint32_t*)&r;
+    uint32_t h = 2166136261UL; // FNV-1a over the words before check
+    for (size_t i = 0; i < offsetof(BootRecord, check) / 4; i++) {
+        h = (h ^ words[i]) * 16777619UL;
     }
-    return -1;
+    return h;
 }
 
-/*
-*  removeAccents() - Removes accents from a string
-*
-*  This function takes an UTF-8 string as input and removes any accents from the characters.
-*  It is necessary for the correct display of characters on the LCD.
-*/
-void removeAccents(char* str) {
-    char* src = str;
-    char* dst = str;
-  
-    while (*src) {
-      // Se encontrar caractere UTF-8 multibyte (início com 0xC3)
-      if ((uint8_t)*src == 0xC3) {
-        src++;  // Avança para o próximo byte
-        switch ((uint8_t)*src) {
-          case 0xA0: case 0xA1: case 0xA2: case 0xA3: case 0xA4:  *dst = 'a'; break; // àáâãä
-          case 0x80: case 0x81: case 0x82: case 0x83: case 0x84:  *dst = 'A'; break; // ÀÁÂÃÄ
-          case 0xA7: *dst = 'c'; break; // ç
-          case 0x87: *dst = 'C'; break; // Ç
-          case 0xA8: case 0xA9: case 0xAA: case 0xAB: *dst = 'e'; break; // èéêë
-          case 0x88: case 0x89: case 0x8A: case 0x8B: *dst = 'E'; break; // ÈÉÊË
-          case 0xAC: case 0xAD: case 0xAE: case 0xAF: *dst = 'i'; break; // ìíîï
-          case 0x8C: case 0x8D: case 0x8E: case 0x8F: *dst = 'I'; break; // ÌÍÎÏ
-          case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: *dst = 'o'; break; // òóôõö
-          case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: *dst = 'O'; break; // ÒÓÔÕÖ
-          case 0xB9: case 0xBA: case 0xBB: case 0xBC: *dst = 'u'; break; // ùúûü
-          case 0x99: case 0x9A: case 0x9B: case 0x9C: *dst = 'U'; break; // ÙÚÛÜ
-          case 0xB1: *dst = 'n'; break; // ñ
-          case 0x91: *dst = 'N'; break; // Ñ
-          default: *dst = '?'; break; // desconhecido
-        }
-        dst++;
-        src++; // Pula o segundo byte do caractere especial
-      } else {
-        *dst++ = *src++; // Copia byte normal
-      }
-    }
-    *dst = '\0'; // Termina a nova string
-  }
-  
-/*
-*  getScrollWindow() - Creates a scrolling window of characters
-*
-*  This function takes a source string and creates a scrolling window of characters
-*  with a specified width. The function wraps around the string if the position exceeds
-*  the length of the string. It fills the remaining space with spaces if the string is shorter
-*  than the specified width. The resulting string is stored in the destination buffer.
-*/
-void getScrollWindow(const char* src, char* dest, int pos, int width = 17) {
-    int len = strlen(src);
-    if (len == 0){
-        dest[0] = '\0';  // Returns an empty string for empty source
-        return;
-    }
-    
-    pos = pos % len; // Wraps around the scroll position
-
-    for (int i = 0; i < width; i++) {
-      int idx = (pos + i) % (len);  // Wraps around the string
-      if (idx < len) {
-        dest[i] = src[idx];
-      } else {
-        dest[i] = ' ';  // Adds spaces for the remaining width
-      }
-    }
-    dest[width] = '\0';
-  }
+void bootRecordWrite() {
+    bootRecord.check = bootRecordCheck(bootRecord);
+    ESP.rtcUserMemoryWrite(BOOT_RECORD_OFFSET, (uint32_t*)&bootRecord, sizeof(bootRecord));
+}
 
 /*
-*  upperFirstLetter() - Converts the first letter of a string to uppercase
+*   bootRecordRead() - Loads the boot record and the clock it kept, or starts a new one
+*
+*  The RTC timer keeps counting across a restart, a crash or a deep sleep,
+*  but starts over with the reset pin or a power cycle.
 */
-void upperFirstLetter(char* str) {
-    if (str && str[0] != '\0') {  // Checks for empty string        
-      str[0] = toupper(str[0]);  // Convert the first character to uppercase
+void bootRecordRead() {
+    bool kept = ESP.rtcUserMemoryRead(BOOT_RECORD_OFFSET, (uint32_t*)&bootRecord, sizeof(bootRecord)) &&
+                bootRecord.magic == BOOT_RECORD_MAGIC && bootRecord.check == bootRecordCheck(bootRecord);
+    if (!kept) {
+        memset(&bootRecord, 0, sizeof(bootRecord));
+        bootRecord.magic = BOOT_RECORD_MAGIC;
+    }
+    bootRecord.boots++;
+
+    uint32_t reason = system_get_rst_info()->reason;
+    if (kept && bootRecord.epoch && reason >= REASON_WDT_RST && reason <= REASON_DEEP_SLEEP_AWAKE) {
+        uint64_t us = ((uint64_t)(system_get_rtc_time() - bootRecord.rtcTime) * bootRecord.rtcCali) >> 12;
+        if (us / 1000000 < CLOCK_CACHE_MAX) {
+            cachedEpoch = bootRecord.epoch + us / 1000000;
+            cachedEpochMillis = millis();
+        }
     }
-  }
+    bootRecordWrite();
+}
 
 /*
-*   buildWeatherRequest() - Builds the HTTP request for current weather
-*   buildForecastRequest() - Builds the HTTP request for weather forecast
-*
-*  These functions create the HTTP GET request string for the OpenWeatherMap API.
+*   clockSave() - Keeps the time of a successful sync in the boot record
+*   clockKnown() - True once there is a time to show, from NTP or from the boot record
+*   clockEpoch() - Local time for the display, NTP when it has answered
 */
-void buildWeatherRequest(char* request, const char* lat, const char* lon, const char* apiKey) {
-    snprintf(request, MAX_REQUEST_SIZE, 
-             "GET /data/2.5/weather?lat=%s&lon=%s&appid=%s&units=metric&lang=pt_br HTTP/1.1\r\n"
-             "Host: api.openweathermap.org\r\n"
-             "Connection: close\r\n\r\n", 
-             lat, lon, apiKey);
+void clockSave() {
+    bootRecord.epoch = timeClient.getEpochTime();
+    bootRecord.rtcTime = system_get_rtc_time();
+    bootRecord.rtcCali = system_rtc_clock_cali_proc();
+    bootRecordWrite();
 }
 
-void buildForecastRequest(char* request, const char* lat, const char* lon, const char* apiKey) {
-    snprintf(request, MAX_REQUEST_SIZE, 
-             "GET /data/2.5/forecast?lat=%s&lon=%s&cnt=8&appid=%s&units=metric&lang=pt_br HTTP/1.1\r\n"
-             "Host: api.openweathermap.org\r\n"
-             "Connection: close\r\n\r\n", 
-             lat, lon, apiKey);
+bool clockKnown() {
+    return timeClient.isTimeSet() || cachedEpoch != 0;
 }
 
+unsigned long clockEpoch() {
+    if (timeClient.isTimeSet() || cachedEpoch == 0) {
+        return timeClient.getEpochTime();
+    }
+    return cachedEpoch + (millis() - cachedEpochMillis) / 1000;
+}
 
 /*
-*   getWeatherJSON() - Fetches weather data from OpenWeatherMap API
-*
-*  This function connects to the OpenWeatherMap API and retrieves the weather data
+*   bootTimelineKeep() - Adds the marks this boot reached to the timeline, once per boot
+*   bootMark() - Records when this boot reached a mark, and the timeline once all are in
 */
-void getWeatherJSON(bool forecast = false) {
-    if (!client.connect("api.openweathermap.org", 443)) { 
-        #ifdef SERIALPRINT
-        Serial.println("Falha ao conectar ao servidor.");
-        #endif
+void bootTimelineKeep() {
+    if (bootTimelineKept) {
         return;
     }
-    char req[MAX_REQUEST_SIZE];
-    if (forecast) {
-        buildForecastRequest(req, lat, lon, apiKey);
-    } else {
-        buildWeatherRequest(req, lat, lon, apiKey);
-    }    
-    
-    #ifdef SERIALPRINT
-    Serial.println("Requisição:");
-    Serial.println(req);
-    #endif
-    client.print(req); 
-
-    unsigned long timeout = millis();
-    while (client.available() == 0) { 
-        if (millis() - timeout > 5000) { // 5 seconds timeout
-            #ifdef SERIALPRINT
-            Serial.println("Erro: Timeout.");
-            #endif
-            client.stop();
-            return;
-        }
-    }
-    // Payload buffer
-    // User this while loop to avoid the Strings object
-    // to avoid memory fragmentation
-    unsigned int index = 0;
-    unsigned long lastRead = millis();
-    while (millis() - lastRead < 2000) { // 2 second timeout
-        while (client.available()) {            
-            if (index < MAX_RESPONSE_SIZE - 1) {  // Buffer limit check
-                weatherJson[index++] = (char)client.read();  // Add the next character to the buffer
-                lastRead = millis();  // Update last read time
-            } else {
-                break;  // Buffer is full, stop reading
-            }
+    bootTimelineKept = true;
+    for (int i = 0; i < BOOT_MARKS; i++) {
+        if (bootMarks[i]) {
+            histogramAdd(bootRecord.timeline[i], bootMarks[i]);
         }
-        yield(); // try to play nice with the esp8266
     }
-    weatherJson[index] = '\0';  // Add null terminator to the string
-    #ifdef SERIALPRINT
-    Serial.println("Resposta do servidor:");
-    Serial.print(weatherJson);
-    Serial.print("\n\n");
-    #endif
+    bootRecordWrite();
+}
 
-    // Find the JSON start position
-    char* jsonStart = strchr(weatherJson, '{');  // First { character
-    if (jsonStart) {
-        // Copy the JSON part to the payload
-        strcpy(weatherJson, jsonStart);
-    } else {
-        #ifdef SERIALPRINT
-        Serial.println("Erro: JSON não encontrado na resposta.");
-        #endif
+void bootMark(int mark) {
+    if (bootMarks[mark]) {
         return;
     }
-
+    bootMarks[mark] = max(millis(), 1UL);
+    LOGI("Boot: %s em %lu ms", bootMarkNames[mark], bootMarks[mark]);
+    for (int i = 0; i < BOOT_MARKS; i++) {
+        if (!bootMarks[i]) {
+            return;
+        }
+    }
+    bootTimelineKeep();
 }
 
 /*
-*  getForecast() - Feches and deserialize weather forecast data from OpenWeatherMap API
-*
-*  This function checks if the forecast data is older than the fetch interval.
-*  If it is, it fetches the forecast data from the OpenWeatherMap API and
-*  deserializes the JSON response and updates the global forecast variables.
+*   linkSuccess() - Records a successful attempt and closes the current outage
+*   linkFailure() - Records a failed attempt and opens an outage if none is open
 */
-void getForecast() {
-    if ((timeClient.getEpochTime() - forecast_dt > FETCH_INTERVAL*4)) {
-        forecast_dt = timeClient.getEpochTime();
-        getWeatherJSON(true);
-        
-        JsonDocument doc;
-
-        DeserializationError error = deserializeJson(doc, weatherJson, MAX_RESPONSE_SIZE);
-        
-        if (error) {
-            #ifdef SERIALPRINT
-            Serial.print(F("deserializeJson() failed: "));
-            Serial.println(error.f_str());
-            #endif
-            return;
-        }
-        
-        JsonArray list = doc["list"];
-        
-        for (int i = 0; i < FORECAST_HOURS; i++) {
-            JsonObject entry = list[i];
-            JsonObject main = entry["main"];
-            JsonObject weather0 = entry["weather"][0];
-            JsonObject rain = entry["rain"];
-            
-            forecast[i].dt = entry["dt"];
-            forecast[i].dt += utcOffsetInSeconds;
-            forecast[i].temp = main["temp"];
-            forecast[i].feels_like = main["feels_like"];
-            forecast[i].temp_min = main["temp_min"];
-            forecast[i].temp_max = main["temp_max"];
-            forecast[i].pressure = main["pressure"];
-            forecast[i].humidity = main["humidity"];
-            forecast[i].pop = entry["pop"];
-            forecast[i].rain_3h = rain["3h"] | 0.0;
-            
-            const char* desc = weather0["description"] | "";
-            strncpy(forecast[i].description, desc, sizeof(forecast[i].description));
-            forecast[i].description[sizeof(forecast[i].description) - 1] = '\0';
-            upperFirstLetter(forecast[i].description); // Capitalize first letter
-            removeAccents(forecast[i].description); // Remove accents
+void linkSuccess(LinkStats& link) {
+    link.attempts++;
+    link.lastSuccessMillis = millis();
+    if (link.inOutage) {
+        link.inOutage = false;
+        link.lastRecoveryMs = link.lastSuccessMillis - link.outageStartMillis;
+        if (link.lastRecoveryMs > link.maxRecoveryMs) {
+            link.maxRecoveryMs = link.lastRecoveryMs;
         }
-        
-
+        link.lastOutageRetries = link.consecutiveFailures;
+        LOGI("%s recuperado após %lu ms e %u falhas", link.name, link.lastRecoveryMs, link.lastOutageRetries);
     }
+    link.consecutiveFailures = 0;
+}
 
+void linkFailure(LinkStats& link) {
+    link.attempts++;
+    link.failures++;
+    link.consecutiveFailures++;
+    if (!link.inOutage) {
+        link.inOutage = true;
+        link.outageStartMillis = millis();
+    }
+    LOGW("%s falhou (%u seguidas, %lu ms sem dados)", link.name, link.consecutiveFailures,
+        millis() - link.lastSuccessMillis);
 }
 
 /*
-*   getWeather() - Fetches current weather data from OpenWeatherMap API
+*   ntpUpdate() - Syncs with the current NTP server and records the delay and the step
 *
-*  This function checks if the current weather data is older than the fetch interval.
-*  If it is, it fetches the current weather data from the OpenWeatherMap API and
-*  deserializes the JSON response. It updates the global weather variables with the
-*  current weather information.
+*  NTPClient keeps whole seconds, so the step is the offset the clock had.
 */
-void getWeather() {
-    if (timeClient.getEpochTime() - current_dt > FETCH_INTERVAL) {
-
-
-        getWeatherJSON(false);
-    
-        // JSON parsing   
-        JsonDocument doc;
-
-        DeserializationError error = deserializeJson(doc, weatherJson, MAX_RESPONSE_SIZE);
-
-        if (error) {
-            #ifdef SERIALPRINT
-            Serial.print(F("deserializeJson() failed: "));
-            Serial.println(error.f_str());
-            #endif
-            return;
-        }
-        
-        #ifdef SERIALPRINT
-        Serial.println("JSON parsed");
-        #endif
-        JsonObject weather_0 = doc["weather"][0];
-        const char* desc = weather_0["description"] | ""; 
-        strncpy(current_weatherDescription, desc, sizeof(current_weatherDescription)); // Copy string to avoid null pointer
-        current_weatherDescription[sizeof(current_weatherDescription) - 1] = '\0'; // add null terminator
-        upperFirstLetter(current_weatherDescription); // Capitalize first letter
-        removeAccents(current_weatherDescription); // Remove accents
-        const char* name = doc["name"] | "";
-        strncpy(location_name, name, sizeof(location_name)); // Copy string to avoid null pointer
-        location_name[sizeof(location_name) - 1] = '\0'; // add null terminator
-        upperFirstLetter(location_name); // Capitalize first letter
-        removeAccents(location_name); // Remove accents
-
-        JsonObject main = doc["main"];
-        current_temp= main["temp"]; 
-        current_feels_like = main["feels_like"]; 
-        current_temp_min = main["temp_min"]; 
-        current_temp_max = main["temp_max"]; 
-        current_pressure = main["pressure"]; 
-        current_humidity = main["humidity"]; 
-        current_dt = doc["dt"];
-        current_dt += utcOffsetInSeconds;
-
-        JsonObject sys = doc["sys"];
-        current_sunset = sys["sunset"];
-        current_sunrise = sys["sunrise"];
-
-        
-        #ifdef SERIALPRINT
-        Serial.printf("Clima: %s\n", current_weatherDescription);
-        Serial.printf("Temp: %.1f C\n", current_temp);
-        Serial.printf("Min: %.1f C\n", current_temp_min);
-        Serial.printf("Max: %.1f C\n", current_temp_max);
-        Serial.printf("Sensação: %.1f C\n", current_feels_like);
-        Serial.printf("Umidade: %d%%\n", current_humidity);
-        Serial.printf("Pressão: %d hPa\n", current_pressure);
-        Serial.printf("Localização: %s\n", location_name);
-        Serial.printf("Data: %ld\n", current_dt);
-        Serial.printf("Nascer do sol: %ld\n", current_sunrise);
-        Serial.printf("Pôr do sol: %ld\n", current_sunset);
-        Serial.printf("Latitude: %s\n", lat);
-        Serial.printf("Longitude: %s\n", lon);
-        #endif
-        
-
+bool ntpUpdate() {
+    bool wasSet = timeClient.isTimeSet();
+    unsigned long before = timeClient.getEpochTime();
+    unsigned long start = millis();
+    if (!timeClient.forceUpdate()) {
+        return false;
     }
- 
-  }
-
+    ntpDelayMs = millis() - start;
+    ntpOffset = wasSet ? (long)(timeClient.getEpochTime() - before) : 0;
+    clockSave();
+    return true;
+}
 
 /*
- * setup() - Initializes the system and connects to Wi-Fi and NTP server
+ * tryNTPServer() - Tries the next server of the NTP failover
  * 
- * It initializes the serial interface, the LCD display, and the Wi-Fi connection.
- * Then, it attempts to sync with an NTP server. If any step fails, 
- * the microcontroller is restarted.
+ * This function tries to synchronize the time with the server at ntpFailover, one server
+ * per call, so a DNS lookup that stalls on every server blocks loop() for one lookup at a
+ * time instead of one per server. If the server answers, it returns its index and the
+ * failover ends. Otherwise it returns -1, and ntpFailover moves to the next server, or to
+ * -1 after the last one. The pass is part of the sync attempt that started the failover,
+ * which already counted its failure in ntpLink.
  */
-void setup() {
-    Serial.begin(115200);  // Initialize serial communication at 115200 baud rate
-    lcd.begin(16, 2);  // Initialize the LCD with 16 columns and 2 rows
-    lcd.clear();
-    lcd.print("Conectando em:");
-    
-    bool conectado = false;  // Flag to track if Wi-Fi connection is successful
+int tryNTPServer() {
+    int i = ntpFailover;
+    ntpFailover = i + 1 < numNTPServers ? i + 1 : -1;
+    timeClient.setPoolServerName(ntpServers[i]);
+    timeClient.begin();
+    if (ntpUpdate()) {
+        LOGI("Conexão com NTP bem-sucedida: %s", ntpServers[i]);
+        linkSuccess(ntpLink);
+        lastNTPSyncMillis = millis();
+        ntpFailover = -1;
+        return i;
+    }
+    LOGW("Erro ao conectar no NTP: %s", ntpServers[i]);
+    return -1;
+}
 
-    WiFi.mode(WIFI_STA);
-    WiFi.disconnect(); // Limpa conexões anteriores
-    delay(100);
-    #ifdef SERIALPRINT
-    Serial.println("Escaneando redes...");
-    #endif
-    int n = WiFi.scanNetworks();
-    if (n == 0) {
-      #ifdef SERIALPRINT
-      Serial.println("Nenhuma rede encontrada.");
-      #endif
-      return;
-    }
-
-    // Loop to attempt connection to each SSID in the list
-    for (int i = 0; i < numRedes; i++) {
-        #ifdef SERIALPRINT
-        Serial.print("Tentando conectar em ");
-        Serial.print(ssids[i]);
-        #endif
-        lcd.setCursor(0, 1);
-        lcd.print("               ");
-        lcd.setCursor(0, 1);
-        lcd.print(ssids[i]);
-        bool found = false;
-        for (int j = 0; j < n; j++) {
-            if (WiFi.SSID(j) == ssids[i]) {
-                found = true;
-                break;
-            }
+/*
+*   syncNTP() - Keeps the clock in sync and recovers from NTP outages
+*
+*  Syncs with the current server every NTP_SYNC_INTERVAL. While the server
+*  does not answer the clock keeps running from millis(), so the display is not
+*  affected. After NTP_FAILOVER_AFTER failures in a row the other servers are
+*  tried, one per loop() pass, and only after NTP_RESTART_AFTER without any
+*  sync the ESP restarts.
+*/
+void syncNTP() {
+    if (!radioUp()) {
+        return;
+    }
+    if (ntpFailover >= 0) {
+        int n = tryNTPServer();
+        if (n >= 0) {
+            ntpSrvIndex = n;
+            publish(TOPIC_NTP);
+        } else if (ntpFailover < 0) {
+            timeClient.setPoolServerName(ntpServers[ntpSrvIndex]); // Keep retrying the last good server
         }
-        if (!found) {
-            #ifdef SERIALPRINT
-            Serial.println(" - Rede não encontrada.");
-            #endif
-            continue;  // Skip to the next SSID if not found
+    } else {
+        if (millis() - lastNTPSyncMillis < NTP_SYNC_INTERVAL) {
+            return;
         }
-        WiFi.begin(ssids[i], passwords[i]);
+        lastNTPSyncMillis = millis();
 
-        int tentativa = 0;
-        int j = 0;  // Index for the gizmo array
-        // Retry connection up to 10 seconds (100 attempts)
-        while (WiFi.status() != WL_CONNECTED && tentativa < 100) {
-            delay(100);
-            #ifdef SERIALPRINT
-            Serial.print(".");
-            #endif
-            lcd.setCursor(15, 1);
-            lcd.print(gizmo[j]);  // Display some progress information
-            j = (j + 1) % 4;  // Cycle through the gizmo array
-            tentativa++;
+        if (ntpUpdate()) {
+            linkSuccess(ntpLink);
+            publish(TOPIC_NTP);
+            return;
         }
-        
-        // If connected successfully to Wi-Fi
-        if (WiFi.status() == WL_CONNECTED) {
-            #ifdef SERIALPRINT
-            Serial.println("\nConectado!");
-            #endif
-            lcd.clear();
-            lcd.print("Conectado ao ");
-            lcd.setCursor(0, 1);
-            lcd.print("Wi-Fi: ");
-            lcd.print(ssids[i]);
-            conectado = true;
-            break;  // Exit loop if connection is successful
-        } else {
-            #ifdef SERIALPRINT
-            Serial.println("\nFalha ao conectar.");
-            #endif
+        linkFailure(ntpLink);
+        if (ntpLink.consecutiveFailures >= NTP_FAILOVER_AFTER) {
+            ntpFailover = 0; // From the next pass
         }
     }
 
-    // If no Wi-Fi connection was made, restart the system
-    if (!conectado) {
+    if (ntpLink.inOutage && millis() - ntpLink.lastSuccessMillis > NTP_RESTART_AFTER) {
         lcd.clear();
-        lcd.print("Erro ao conectar");
-        delay(10000);
-        ESP.restart();  // Restart the ESP to retry
-    }
-    
-    // Try connecting to an NTP server if Wi-Fi connection is successful
-    lcd.clear();
-    ntpSrvIndex = tryNTPServer();  // Call to tryNTPServer() function
-    
-    // If connected to NTP server, display success
-    if (ntpSrvIndex >= 0) {
-        lcd.print("Conectado ao NTP");
-        lcd.setCursor(0, 1);
-        lcd.print(ntpServers[ntpSrvIndex]);
-        delay(2000);
-    } else {
         lcd.print("Erro ao conectar NTP");
+        logFlush();
         delay(10000);
-        ESP.restart();  // Restart the ESP if NTP connection fails
+        ESP.restart();
     }
-    
-    // Create custom LCD characters
-    lcd.createChar(0, LT);
-    lcd.createChar(1, UB);
-    lcd.createChar(2, RT);
-    lcd.createChar(3, LL);
-    lcd.createChar(4, LB);
-    lcd.createChar(5, LR);
-    lcd.createChar(6, MB);
-    lcd.createChar(7, block);
-    
-    lcd.backlight();  // Turn on the LCD backlight
-    
-    // Display digits on the LCD
-    lcd.clear();
-    printDigits(0, 0);
-    printDigits(0, 4);
-    printDigits(0, 8);
-    printDigits(0, 12);
-    delay(1000);
-    
-    // Set SSL client to insecure mode (bypass certificate verification)
-    client.setInsecure();
-
-    getForecast();  // Fetch weather forecast data
-    getWeather();  // Fetch current weather data
 }
 
-
 /*
- * printNumber() - Displays a two-digit number on the LCD
- * 
- * It splits the number into tens and ones, then calls printDigits() to display 
- * each digit at the correct position on the LCD.
- */
-void printNumber(int val){
-     int col=9;    
-     printDigits(val/10,col);
-     printDigits(val%10,col+4);
+*   weatherFetchAllowed() - Checks the retry backoff of the weather service
+*   weatherFetchDone() - Updates the backoff with the outcome of a fetch
+*
+*  Failed fetches are retried after RETRY_BACKOFF_MIN, doubling up to
+*  RETRY_BACKOFF_MAX. An HTTP 429 waits RATE_LIMIT_BACKOFF.
+*/
+bool weatherFetchAllowed() {
+    return weatherRetryDelay == 0 || millis() - weatherRetryMillis >= weatherRetryDelay;
 }
 
+void weatherFetchDone(bool ok) {
+    if (ok) {
+        linkSuccess(weatherLink);
+        weatherRetryDelay = 0;
+        return;
+    }
+    linkFailure(weatherLink);
+    weatherRetryMillis = millis();
+    if (lastHttpStatus == 429) {
+        weatherRetryDelay = RATE_LIMIT_BACKOFF;
+    } else if (weatherRetryDelay == 0) {
+        weatherRetryDelay = RETRY_BACKOFF_MIN;
+    } else {
+        weatherRetryDelay = min(weatherRetryDelay * 2, (unsigned long)RETRY_BACKOFF_MAX);
+    }
+}
 
 /*
- * printTime() - Displays the current time on the LCD
- * 
- * Prints hours and minutes using printDigits(), 
- * placing colons at fixed positions to format the time.
- */
+*   usageCount() - Counts the opening of a screen showing the given topics
+*   fetchWanted() - Tells if the data of a topic is worth fetching now
+*
+*  Views of the Weather and Forecast screens are counted per hour of the day
+*  in the boot record, lazy or not, so the console and the metrics show the
+*  habits of a clock before LAZY_FETCH is turned on. With LAZY_FETCH a due
+*  fetch waits unless a view is likely around this hour, the screen of the
+*  topic is on display, or nothing was fetched since the boot. Opening the
+*  screen shows the cached data and the fetch runs in the same loop, right
+*  after the render. With PEER_SHARING only the usage of the leader counts.
+*/
+uint8_t screenSubscriptions = 0; // SUB() mask of the screen on display
+unsigned long screenViews = 0; // Weather and Forecast screens opened since boot
 
-void printTime(int h, int m, int s) {
-    counterUD = 0;
-    updateInterval = 1000;
-    scrollBuffer [0] = '\0'; // Clear the scroll buffer
-    scrollPos = 0; // Reset the scroll position
-    char separator = (s % 2 == 0) ? char(165) : ' ';
-    printDigits(h / 10, 0);
-    printDigits(h % 10, 4);
-    lcd.setCursor(7, 0);
-    lcd.print(separator);
-    lcd.setCursor(7, 1);
-    lcd.print(separator);
-    printDigits(m / 10, 8);
-    printDigits(m % 10, 12);
+void usageCount(uint8_t subscriptions) {
+    if (!(subscriptions & (SUB(TOPIC_WEATHER) | SUB(TOPIC_FORECAST))) || !clockKnown()) {
+        return;
+    }
+    screenViews++;
+    usageView(bootRecord.usage, clockEpoch());
+    bootRecordWrite();
 }
 
-
 /*
- * printDate() - Retrieves and displays the current date and time on the LCD
- * 
- * It fetches the epoch time from the NTP client and calculates the date manually. 
- * The function then formats and prints the time, weekday, and date on the LCD.
- */
-unsigned long lastDateMillis = 0;
-void printDate() {
-    if (millis() - lastDateMillis > 500) {
-        lastDateMillis = millis();
-    
-        timeClient.update();
-        
-        unsigned long epoch = timeClient.getEpochTime();
-        
-        // Calculates the time
-        int seconds = epoch % 60;
-        int minutes = (epoch / 60) % 60;
-        int hours = (epoch / 3600) % 24;
-        int days = epoch / 86400;
-        
-        // Set the date to the UNIX epoch: 1970-01-01
-        int year = 1970;
-        int month = 1;
-        int day = 1;
-
-        // Calculate the number of years elapsed
-        while (days >= (365 + (year % 4 == 0 ? 1 : 0))) {
-            days -= (365 + (year % 4 == 0 ? 1 : 0));
-            year++;
-        }
-
-        // Calculate the month
-        int daysInMonth[] = {31, (year % 4 == 0 ? 29 : 28), 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-        while (days >= daysInMonth[month - 1]) {
-            days -= daysInMonth[month - 1];
-            month++;
-        }
-
-        // Finally, the days
-        day += days;
+*   sunPoll() - Computes the sun events once a day, for lat and lon
+*   sunDark() - True between civil dusk and civil dawn
+*   sunClock() - Writes an event as HH:MM, or --:-- when it does not happen
+*
+*  The events come from solar.h, so the clock knows day from night with no
+*  network once it has the time, the one kept in the boot record included.
+*/
+SolarDay sun;
 
-        // Show the results        
-        lcd.setCursor(4, 0);
-        lcd.printf("%02d:%02d:%02d ", hours, minutes, seconds);
-        lcd.setCursor(1, 1);
-        lcd.print(daysOfTheWeek[timeClient.getDay()]);
-        lcd.print(" ");
-        lcd.printf("%02d/%02d/%04d", day, month, year);        
+const char* sunClock(char* text, long event) {
+    if (event == 0) {
+        return strcpy(text, "--:--");
     }
+    snprintf(text, 6, "%02ld:%02ld", event % 86400 / 3600, event % 3600 / 60);
+    return text;
 }
 
-
-/*
- * printNetwork() - Displays the device's IP address and Wi-Fi SSID on the LCD
- * 
- * It clears the LCD, prints the local IP address on the first row, 
- * and the connected Wi-Fi SSID on the second row. The information 
- * is displayed for 5 seconds.
- */
-unsigned long lastNetworkMillis = 0;
-void printNetwork() {
-    if (millis() - lastNetworkMillis > 1000) {
-        lastNetworkMillis = millis();
-        lcd.setCursor(0, 0);
-        lcd.print(WiFi.localIP());
-        lcd.setCursor(0, 1);
-        lcd.print(WiFi.SSID()); 
+void sunPoll() {
+    if (!clockKnown()) {
+        return;
     }
+    long day = clockEpoch() / 86400;
+    if (sun.day == day) {
+        return;
+    }
+    solarCompute(sun, day, atof(lat), atof(lon), utcOffsetInSeconds);
+    #ifdef SERIALPRINT
+    char dawn[6], sunrise[6], sunset[6], dusk[6];
+    LOGI("Sol: aurora %s, nascer %s, pôr %s, crepúsculo %s", sunClock(dawn, sun.dawn), sunClock(sunrise, sun.sunrise),
+         sunClock(sunset, sun.sunset), sunClock(dusk, sun.dusk));
+    #endif
+    publish(TOPIC_SUN);
 }
 
+bool sunDark() {
+    return sun.day != 0 && solarDark(sun, clockEpoch());
+}
 
-/*
- * printNTP() - Displays the current NTP server and time on the LCD
- * 
- * It clears the LCD and prints the active NTP server on the first row. 
- * The second row continuously updates with the formatted time for 10 seconds.
- */
-unsigned long lastNTPMillis = 0;
-void printNTP() {
-    if (millis() - lastNTPMillis > 1000) {
-        lastNTPMillis = millis();
-        lcd.setCursor(0, 0);
-        lcd.print(ntpServers[ntpSrvIndex]);
-        lcd.setCursor(0, 1);
-        lcd.print(timeClient.getFormattedTime());
+bool fetchWanted(int topic) {
+    #ifdef LAZY_FETCH
+    if ((screenSubscriptions & SUB(topic)) || usageLikely(bootRecord.usage, clockEpoch())) {
+        return true;
     }
+    return topic == TOPIC_WEATHER ? weather->current.dt == 0 : weather->forecast_dt == 0;
+    #else
+    return true;
+    #endif
 }
 
+Inflate inflater;
+bool gzipAllowed = true; // Cleared when the server sends a stream inflate cannot take
 
+// Last fetch cost, for the compression report
+unsigned long lastFetchWireBytes = 0, lastFetchBodyBytes = 0, lastFetchMs = 0;
+unsigned long fetchMsTotal = 0, fetchCount = 0; // Completed fetches since boot
+bool lastFetchGzip = false;
+#define RADIO_ACTIVE_MA 70 // Rough ESP8266 current while the radio receives, for the energy estimate
+unsigned long lastConnectMs = 0; // TCP connect and TLS handshake of the last fetch
+unsigned long connectMsTotal[2] = {0, 0}, connectCount[2] = {0, 0}; // At 80 and at 160 MHz
 
 /*
- *   printWeather() - Prints the weather information on the LCD
+*   CpuBoost - Runs the CPU at 160 MHz while an instance is alive
+*
+*  Put one at the top of a block that does the TLS handshake, decrypts or
+*  parses, the clock goes back to 80 MHz when the outermost one ends.
+*  millis() and micros() count the system timer and delayMicroseconds(), which
+*  times the LCD pulses, follows the frequency, so no timing changes with it.
+*/
+#ifdef CPU_BOOST
+bool cpuBoostEnabled = true;
+#else
+bool cpuBoostEnabled = false;
+#endif
+int cpuBoostDepth = 0;
+unsigned long cpuBoostStartMillis = 0, cpuBoostMs = 0; // Time spent at 160 MHz
+
+struct CpuBoost {
+    CpuBoost() {
+        if (cpuBoostDepth++ == 0 && cpuBoostEnabled) {
+            cpuBoostStartMillis = millis();
+            system_update_cpu_freq(SYS_CPU_160MHZ);
+        }
+    }
+    ~CpuBoost() {
+        if (--cpuBoostDepth == 0 && system_get_cpu_freq() != SYS_CPU_80MHZ) {
+            system_update_cpu_freq(SYS_CPU_80MHZ);
+            cpuBoostMs += millis() - cpuBoostStartMillis;
+        }
+    }
+};
+
+/*
+*   ParseAllocator - ArduinoJson allocator that keeps track of the heap it uses
+*
+*  Every block carries a small header with its size, so the allocator knows how
+*  many bytes the JsonDocument holds at any moment and the peak of that value.
+*/
+struct ParseAllocator : ArduinoJson::Allocator {
+    static const size_t HEADER = 8; // Keeps the returned blocks 8-byte aligned
+    size_t current = 0;
+    size_t peak = 0;
+    unsigned long allocations = 0;
+
+    void reset() {
+        current = 0;
+        peak = 0;
+        allocations = 0;
+    }
+
+    void* allocate(size_t size) override {
+        uint8_t* block = (uint8_t*)malloc(size + HEADER);
+        if (!block) {
+            return NULL;
+        }
+        *(size_t*)block = size;
+        track(size, 0);
+        return block + HEADER;
+    }
+
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        uint8_t* block = (uint8_t*)ptr - HEADER;
+        current -= *(size_t*)block;
+        free(block);
+    }
+
+    void* reallocate(void* ptr, size_t newSize) override {
+        if (!ptr) {
+            return allocate(newSize);
+        }
+        uint8_t* block = (uint8_t*)ptr - HEADER;
+        size_t oldSize = *(size_t*)block;
+        block = (uint8_t*)realloc(block, newSize + HEADER);
+        if (!block) {
+            return NULL;
+        }
+        *(size_t*)block = newSize;
+        track(newSize, oldSize);
+        return block + HEADER;
+    }
+
+    void track(size_t newSize, size_t oldSize) {
+        current += newSize - oldSize;
+        allocations++;
+        if (current > peak) {
+            peak = current;
+        }
+    }
+};
+
+/*
+*   ParseStats - Cost of the last parse of one endpoint
+*/
+struct ParseStats {
+    const char* name;
+    size_t bytes;           // Payload size
+    unsigned long micros;   // Time spent in the provider parser
+    unsigned long usPerKB;
+    size_t peakBytes;       // Peak heap held by the parser
+    unsigned long regressions; // Parses that went over one of the limits
+};
+
+ParseAllocator parseAllocator;
+ParseStats weatherParseStats = {"weather", 0, 0, 0, 0, 0};
+ParseStats forecastParseStats = {"forecast", 0, 0, 0, 0, 0};
+
+/*
+*   snapshotTag() - Computes the tag of a snapshot body (HMAC-SHA256 with PEER_KEY, cut short)
+*   snapshotTagValid() - Checks the tag of a received snapshot
+*/
+void snapshotTag(const uint8_t* data, size_t len, uint8_t* tag) {
+    br_hmac_key_context kc;
+    br_hmac_context ctx;
+    uint8_t full[32];
+    br_hmac_key_init(&kc, &br_sha256_vtable, PEER_KEY, strlen(PEER_KEY));
+    br_hmac_init(&ctx, &kc, 0);
+    br_hmac_update(&ctx, data, len);
+    br_hmac_out(&ctx, full);
+    memcpy(tag, full, SNAPSHOT_TAG_LEN);
+}
+
+bool snapshotTagValid(const uint8_t* data, size_t len, const uint8_t* tag) {
+    if (PEER_KEY[0] == '\0') {
+        return false;
+    }
+    uint8_t expected[SNAPSHOT_TAG_LEN];
+    snapshotTag(data, len, expected);
+    uint8_t diff = 0;
+    for (int i = 0; i < SNAPSHOT_TAG_LEN; i++) {
+        diff |= expected[i] ^ tag[i]; // Same time whatever the tag
+    }
+    return diff == 0;
+}
+
+#include <provider_owm.h> // OpenWeatherMap, JSON
+#include <provider_openmeteo.h> // Open-Meteo, CSV
+#include <provider_gateway.h> // Local weather gateway, binary snapshot
+const WeatherProvider& provider = WEATHER_PROVIDER;
+
+/*
+*   parseBegin() - Starts measuring a parse
+*   parseEnd() - Records the cost of the parse of weatherPayload
+*
+*  The time per KB and the peak memory are compared against
+*  PARSE_US_PER_KB_LIMIT and PARSE_PEAK_BYTES_LIMIT. A streamed parse is
+*  started with the fetch and its time is what streamSink() added up.
+*/
+unsigned long parseStartMicros = 0;
+unsigned long parseMicros = 0; // Time spent in the parser, over the whole body when it is streamed
+void parseBegin() {
+    parseAllocator.reset();
+    parseStartMicros = micros();
+    parseMicros = 0;
+}
+
+void parseEnd(ParseStats& stats) {
+    stats.micros = provider.streamFeed ? parseMicros : micros() - parseStartMicros;
+    stats.bytes = lastFetchBodyBytes;
+    stats.usPerKB = stats.bytes ? (unsigned long)((uint64_t)stats.micros * 1024 / stats.bytes) : 0;
+    stats.peakBytes = parseAllocator.peak;
+
+    bool regression = stats.usPerKB > PARSE_US_PER_KB_LIMIT || stats.peakBytes > PARSE_PEAK_BYTES_LIMIT;
+    if (regression) {
+        stats.regressions++;
+    }
+    #ifdef SERIALPRINT
+    logPrintf(regression ? LOG_WARN : LOG_INFO,
+        "Parse %s (%s): %u bytes, %lu us (%lu us/KB), pico %u bytes, %lu alocações%s",
+        stats.name, provider.name, (unsigned)stats.bytes, stats.micros, stats.usPerKB,
+        (unsigned)stats.peakBytes, parseAllocator.allocations,
+        regression ? " - REGRESSÃO" : "");
+    #endif
+}
+
+/*
+*   Weather fetch, run across loop() passes
+*
+*  fetchStart() connects to the provider, over TLS when the provider uses port
+*  443, and sends the request. fetchPoll() then takes at most
+*  FETCH_READ_PER_PASS bytes off the socket on each loop() pass, the header
+*  lines first and then the body, so the screens, the buttons and NTP keep
+*  going while a slow server trickles its reply. Only the connect and the TLS
+*  handshake still block. Any status other than 200 is a failure, the code is
+*  kept in lastHttpStatus.
+*
+*  A provider with stream functions parses the body as it arrives, into
+*  fetchCurrent or fetchSlots, so its parse state is carried from one pass to
+*  the next and the body can be of any size. weatherPayload is then only the
+*  inflate window, it holds the body (weatherPayloadLen) only when the body was
+*  smaller than it. The other providers get the body in weatherPayload, and a
+*  body that does not fit is rejected instead of being cut short.
+*
+*  The request asks for gzip. A gzip body is inflated as it arrives, which cuts
+*  the bytes that go through TLS and the radio. If the stream needs a window
+*  larger than the buffer, gzip is no longer asked for and the fetch is retried
+*  later in the clear.
+*/
+#define FETCH_READ_PER_PASS 256 // Bytes taken off the socket on each loop() pass
+#define FETCH_FIRST_BYTE_TIMEOUT 5000 // From the request to the first byte of the reply
+#define FETCH_READ_TIMEOUT 2000 // Between two reads
+
+enum { FETCH_IDLE, FETCH_WAIT, FETCH_HEADERS, FETCH_BODY };
+enum { FETCH_RUNNING, FETCH_OK, FETCH_FAILED };
+
+struct WeatherFetch {
+    uint8_t phase;
+    bool forecast;
+    int slots;              // Forecast slots asked for
+    WiFiClient* client;
+    HttpBody body;
+    char line[128];         // Header line being read
+    size_t lineLen;
+    bool statusRead;
+    bool boosted;           // Connected at 160 MHz
+    unsigned long start, lastRead;
+};
+
+WeatherFetch weatherFetch; // FETCH_IDLE
+CurrentWeather fetchCurrent; // Streamed parse, copied into the model when the fetch is done
+Forecast fetchSlots[FORECAST_HOURS];
+int streamStatus = WEATHER_STREAM_MORE;
+
+/*
+*   streamSink() - Hands decoded body bytes to the stream parser of the provider
+*/
+void streamSink(void* ctx, const uint8_t* data, size_t len) {
+    if (streamStatus != WEATHER_STREAM_MORE) {
+        return; // Whatever follows the end of the document, or an error
+    }
+    unsigned long start = micros();
+    streamStatus = provider.streamFeed((const char*)data, len);
+    parseMicros += micros() - start;
+}
+
+/*
+*   fetchStart() - Connects and sends the request, false if the server can't be reached
+*   fetchFail() - Drops the fetch
+*/
+bool fetchStart(bool forecast, int slots) {
+    WeatherFetch& f = weatherFetch;
+    weatherPayload[0] = '\0';
+    weatherPayloadLen = 0;
+    lastHttpStatus = 0;
+    f.start = millis();
+    f.client = provider.port == 443 ? &secureClient : &plainClient;
+    if (!f.client->connect(provider.host, provider.port)) {
+        LOGW("Falha ao conectar ao servidor %s.", provider.host);
+        return false;
+    }
+    lastConnectMs = millis() - f.start;
+    f.boosted = system_get_cpu_freq() == SYS_CPU_160MHZ;
+    connectMsTotal[f.boosted] += lastConnectMs;
+    connectCount[f.boosted]++;
+    char req[MAX_REQUEST_SIZE];
+    provider.buildRequest(req, sizeof(req), forecast, slots, lat, lon, apiKey);
+    size_t reqLen = strlen(req);
+    if (gzipAllowed && reqLen >= 2) {
+        // Insert the header before the blank line that ends the request
+        snprintf(req + reqLen - 2, sizeof(req) - reqLen + 2, "Accept-Encoding: gzip\r\n\r\n");
+    }
+
+    // Only the request line, the headers may carry the API key
+    LOGD("Requisição: %.*s", (int)strcspn(req, "\r"), req);
+    f.client->print(req);
+
+    f.forecast = forecast;
+    f.slots = slots;
+    f.lineLen = 0;
+    f.statusRead = false;
+    bodyBegin(f.body, weatherPayload, MAX_RESPONSE_SIZE, &inflater);
+    streamStatus = WEATHER_STREAM_MORE;
+    if (provider.streamBegin) {
+        parseBegin();
+        provider.streamBegin(forecast ? NULL : &fetchCurrent, forecast ? fetchSlots : NULL, FORECAST_HOURS);
+    }
+    f.lastRead = millis();
+    f.phase = FETCH_WAIT;
+    return true;
+}
+
+int fetchFail() {
+    weatherFetch.client->stop();
+    weatherFetch.phase = FETCH_IDLE;
+    return FETCH_FAILED;
+}
+
+/*
+*   fetchEnd() - Closes the connection once the body is done, checks it and logs the cost
+*/
+int fetchEnd() {
+    WeatherFetch& f = weatherFetch;
+    HttpBody& body = f.body;
+    f.client->stop();
+    f.phase = FETCH_IDLE;
+    bodyFinish(body); // Also adds the null terminator
+    weatherPayloadLen = bodyKept(body) ? body.outLen : 0;
+
+    lastFetchWireBytes = body.wireBytes;
+    lastFetchBodyBytes = body.outLen;
+    lastFetchMs = millis() - f.start;
+    fetchMsTotal += lastFetchMs;
+    fetchCount++;
+    histogramAdd(fetchHistogram, lastFetchMs);
+    lastFetchGzip = body.gzip;
+    LOG_PAYLOAD(LOG_DEBUG, "Resposta", weatherPayload, weatherPayloadLen);
+    LOGI("Corpo: %lu bytes recebidos, %lu bytes de dados%s, %lu ms (conexão %lu ms a %u MHz), ~%lu mAs",
+         lastFetchWireBytes, lastFetchBodyBytes, lastFetchGzip ? " (gzip)" : "",
+         lastFetchMs, lastConnectMs, f.boosted ? 160 : 80,
+         lastFetchMs * (RADIO_ACTIVE_MA + (f.boosted ? CPU_BOOST_EXTRA_MA : 0)) / 1000);
+
+    if (body.overflow || body.inflateStatus == INFLATE_ERR_SIZE) {
+        LOGE("Erro: resposta maior que o buffer.");
+        return FETCH_FAILED;
+    }
+    if (body.gzip && body.inflateStatus != INFLATE_DONE) {
+        LOGW("Erro: gzip invalido (%d), pedindo sem compressao.", body.inflateStatus);
+        gzipAllowed = false;
+        return FETCH_FAILED;
+    }
+    if (bodyTruncated(body)) {
+        LOGW("Erro: resposta incompleta.");
+        return FETCH_FAILED;
+    }
+    return FETCH_OK;
+}
+
+/*
+*   fetchReading() - True while the body still wants bytes
+*/
+bool fetchReading(const HttpBody& body) {
+    return !body.overflow && body.inflateStatus == INFLATE_OK && streamStatus != WEATHER_STREAM_ERROR &&
+           !bodyComplete(body);
+}
+
+/*
+*   fetchPoll() - Reads what one loop() pass allows of the reply, returns a FETCH_* result
+*/
+int fetchPoll() {
+    WeatherFetch& f = weatherFetch;
+    WiFiClient& client = *f.client;
+    if (f.phase == FETCH_WAIT) {
+        if (!client.available()) {
+            if (millis() - f.lastRead > FETCH_FIRST_BYTE_TIMEOUT) {
+                LOGW("Erro: Timeout.");
+                return fetchFail();
+            }
+            return FETCH_RUNNING;
+        }
+        f.phase = FETCH_HEADERS;
+    }
+
+    // Status line and headers, longer lines are cut to the buffer size
+    size_t taken = 0;
+    while (f.phase == FETCH_HEADERS && taken < FETCH_READ_PER_PASS && client.available()) {
+        char c = client.read();
+        taken++;
+        f.lastRead = millis();
+        if (c != '\n') {
+            if (f.lineLen < sizeof(f.line) - 1) {
+                f.line[f.lineLen++] = c;
+            }
+            continue;
+        }
+        if (f.lineLen > 0 && f.line[f.lineLen - 1] == '\r') {
+            f.lineLen--;
+        }
+        f.line[f.lineLen] = '\0';
+        f.lineLen = 0;
+        if (!f.statusRead) {
+            sscanf(f.line, "HTTP/%*s %d", &lastHttpStatus);
+            f.statusRead = true;
+        } else if (f.line[0] != '\0') {
+            bodyHeader(f.body, f.line);
+        } else if (lastHttpStatus != 200) {
+            LOGW("Erro: HTTP %d", lastHttpStatus); // Only a 200 carries weather data, error replies may look like data
+            return fetchFail();
+        } else {
+            if (provider.streamFeed) {
+                bodySink(f.body, streamSink, NULL);
+            }
+            bodyStart(f.body);
+            f.phase = FETCH_BODY;
+        }
+    }
+    if (f.phase == FETCH_HEADERS) {
+        if (!client.available() && (!client.connected() || millis() - f.lastRead >= FETCH_READ_TIMEOUT)) {
+            LOGW("Erro: HTTP %d", lastHttpStatus);
+            return fetchFail();
+        }
+        return FETCH_RUNNING;
+    }
+
+    // Body. Use a small buffer instead of String objects to avoid memory fragmentation
+    uint8_t buf[128];
+    HttpBody& body = f.body;
+    while (taken < FETCH_READ_PER_PASS && fetchReading(body)) {
+        int n = client.available();
+        if (n <= 0) {
+            break;
+        }
+        n = client.read(buf, min((size_t)n, min(sizeof(buf), FETCH_READ_PER_PASS - taken)));
+        bodyReceive(body, buf, n);
+        taken += n;
+        f.lastRead = millis();
+    }
+    if (fetchReading(body) && (client.available() || (client.connected() && millis() - f.lastRead < FETCH_READ_TIMEOUT))) {
+        return FETCH_RUNNING;
+    }
+    return fetchEnd();
+}
+
+/*
+*   forecastSlot() - Returns the i-th slot of the forecast ring, counting from the next slot
+*/
+const Forecast& forecastSlot(const WeatherModel& m, int i) {
+    return m.forecast[(m.forecastHead + i) % FORECAST_HOURS];
+}
+
+/*
+*   dropPastSlots() - Removes the slots that have already started from the forecast ring
+*
+*  The slots are sorted by dt, so a binary search finds the first one still in
+*  the future and the head of the ring moves to it. Returns the number of
+*  slots dropped.
+*/
+int dropPastSlots(WeatherModel& m, long now) {
+    int lo = 0, hi = m.forecastCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (forecastSlot(m, mid).dt < now) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    m.forecastHead = (m.forecastHead + lo) % FORECAST_HOURS;
+    m.forecastCount -= lo;
+    return lo;
+}
+
+/*
+*   forecastHorizon() - Seconds of forecast left from now until the end of the last slot
+*/
+long forecastHorizon(long now) {
+    if (weather->forecastCount == 0) {
+        return 0;
+    }
+    return forecastSlot(*weather, weather->forecastCount - 1).dt + FORECAST_SLOT_SECONDS - now;
+}
+
+/*
+*   forecastDue() - Tells if the forecast should be fetched now
+*
+*  A short horizon alone is not enough: the provider may send few slots, or
+*  slots that have already started, and the refill would then run on every
+*  loop until the budget is gone. The forecast has its own forecastSchedule:
+*  after a successful fetch the next one waits FORECAST_REFETCH_MIN, or the
+*  spacing that makes the rest of the daily budget last the day if that is
+*  longer. The only exception is the full fetch that follows the first
+*  FORECAST_FIRST_SLOTS.
+*/
+bool forecastDue(long now) {
+    if (forecastHorizon(now) >= FORECAST_MIN_HORIZON) {
+        return false;
+    }
+    if (forecastPartial) {
+        return budgetLeft(requestBudget, now) > 0;
+    }
+    return scheduleDue(forecastSchedule, requestBudget, now);
+}
+
+/*
+*   forecastLoaded() - Times how long the screen waited for its first slot and for the full horizon
+*/
+void forecastLoaded(bool full) {
+    if (forecastWaitMillis == 0 || weather->forecastCount == 0) {
+        return;
+    }
+    unsigned long waited = millis() - forecastWaitMillis;
+    if (!forecastFirstShown) {
+        forecastFirstShown = true;
+        forecastFirstMs = waited;
+        LOGI("Previsão: primeiro slot após %lu ms", waited);
+    }
+    if (full) {
+        forecastFullMs = waited;
+        forecastWaitMillis = 0;
+        forecastFirstShown = false;
+        LOGI("Previsão: horizonte completo após %lu ms", waited);
+    }
+}
+
+#ifdef PEER_SHARING
+/*
+*   Peer sharing
+*
+*  Every clock multicasts a hello each PEER_HELLO_INTERVAL. The clock with the
+*  lowest chip ID heard in the last PEER_TIMEOUT is the leader. The leader
+*  fetches as usual and multicasts a snapshot of the weather after each fetch.
+*  The others only take snapshots for the same lat/lon that carry a valid tag
+*  and newer data than their own. A follower falls back to fetching when the
+*  leader goes quiet (failover) or when no snapshot came for two provider
+*  periods. A leader answers the hello of a clock with no data with a snapshot,
+*  so a clock that just booted does not have to fetch.
+*/
+struct Peer {
+    uint32_t id;
+    unsigned long lastSeen;
+};
+
+WiFiUDP peerUDP;
+Peer peers[PEER_MAX];
+IPAddress peerIP; // Address the multicast group was joined with
+unsigned long peerHelloMillis = 0;
+unsigned long peerSnapshotMillis = 0; // Last snapshot taken from a peer
+bool peerLeader = false;
+uint8_t peerPacket[SNAPSHOT_MAX_SIZE + SNAPSHOT_TAG_LEN];
+
+SnapshotHeader peerHeader(uint8_t kind) {
+    SnapshotHeader h;
+    h.kind = kind;
+    h.sender = ESP.getChipId();
+    h.lat = lroundf(atof(lat) * 10000);
+    h.lon = lroundf(atof(lon) * 10000);
+    h.flags = weather->current.dt != 0 ? SNAPSHOT_HAS_WEATHER : 0;
+    return h;
+}
+
+void peerSend(size_t len) {
+    if (len == 0) {
+        return;
+    }
+    snapshotTag(peerPacket, len, peerPacket + len);
+    peerUDP.beginPacketMulticast(PEER_GROUP, PEER_PORT, WiFi.localIP());
+    peerUDP.write(peerPacket, len + SNAPSHOT_TAG_LEN);
+    peerUDP.endPacket();
+}
+
+void peerSendHello() {
+    peerSend(snapshotEncodeHello(peerPacket, SNAPSHOT_MAX_SIZE, peerHeader(SNAPSHOT_HELLO)));
+}
+
+/*
+*   peerPublish() - Multicasts the weather model, called by the leader after a fetch
+*/
+void peerPublish() {
+    if (!peerLeader || weather->current.dt == 0) {
+        return;
+    }
+    SnapshotHeader h = peerHeader(SNAPSHOT_WEATHER);
+    if (forecastPartial) {
+        h.flags |= SNAPSHOT_FORECAST_PARTIAL;
+    }
+    size_t len = snapshotEncodeWeather(peerPacket, SNAPSHOT_MAX_SIZE, h,
+                                       weather->current, weather->forecast_dt, weather->forecast,
+                                       weather->forecastHead, weather->forecastCount, utcOffsetInSeconds);
+    peerSend(len);
+    LOGD("Peer: snapshot enviado, %u bytes", (unsigned)(len + SNAPSHOT_TAG_LEN));
+}
+
+/*
+*   peerSeen() - Records a peer and runs the election
+*/
+void peerSeen(uint32_t id) {
+    int slot = -1;
+    for (int i = 0; i < PEER_MAX; i++) {
+        if (peers[i].id == id) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && (peers[i].id == 0 || millis() - peers[i].lastSeen > PEER_TIMEOUT)) {
+            slot = i; // Free or expired, keep looking for the peer itself
+        }
+    }
+    if (slot >= 0) {
+        peers[slot].id = id;
+        peers[slot].lastSeen = millis();
+    }
+}
+
+void peerElect() {
+    uint32_t self = ESP.getChipId();
+    bool leader = true;
+    for (int i = 0; i < PEER_MAX; i++) {
+        if (peers[i].id != 0 && millis() - peers[i].lastSeen <= PEER_TIMEOUT && peers[i].id < self) {
+            leader = false;
+            break;
+        }
+    }
+    if (leader != peerLeader) {
+        peerLeader = leader;
+        LOGI("%s", leader ? "Peer: este relogio e o lider" : "Peer: seguindo outro relogio");
+    }
+}
+
+/*
+*   peerTake() - Adopts the data of a snapshot that is newer than ours
+*
+*  A forecast the leader only has the first slots of stays partial here.
+*/
+void peerTake(const uint8_t* body, size_t len, bool partial) {
+    static Forecast slots[FORECAST_HOURS];
+    CurrentWeather snap;
+    long snapForecastDt;
+    int count;
+    if (!snapshotDecodeWeather(body, len, snap, snapForecastDt, slots, FORECAST_HOURS, count, utcOffsetInSeconds)) {
+        return;
+    }
+    long now = timeClient.getEpochTime();
+    peerSnapshotMillis = millis();
+    bool takeWeather = snap.dt > weather->current.dt && snap.dt >= now - PEER_MAX_AGE;
+    bool takeForecast = snapForecastDt > weather->forecast_dt && count > 0;
+    if (!takeWeather && !takeForecast) {
+        return;
+    }
+    WeatherModel& next = weatherBegin();
+    if (takeWeather) {
+        next.current = snap;
+    }
+    if (takeForecast) {
+        memcpy(next.forecast, slots, sizeof(next.forecast[0]) * count);
+        next.forecastHead = 0;
+        next.forecastCount = count;
+        next.forecast_dt = snapForecastDt;
+        dropPastSlots(next, now);
+    }
+    weatherSwap();
+    if (takeWeather) {
+        publish(TOPIC_WEATHER);
+    }
+    if (takeForecast) {
+        counterUD = 0;
+        lastCounterUD = 0;
+        forecastPartial = partial;
+        forecastLoaded(!partial);
+        publish(TOPIC_FORECAST);
+    }
+}
+
+/*
+*   peerPoll() - Joins the group, reads the packets of the peers and sends the hellos
+*/
+void peerPoll() {
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    if (WiFi.localIP() != peerIP) {
+        peerIP = WiFi.localIP();
+        peerUDP.stop();
+        peerUDP.beginMulticast(peerIP, PEER_GROUP, PEER_PORT);
+    }
+
+    int size;
+    while ((size = peerUDP.parsePacket()) > 0) {
+        if (size <= SNAPSHOT_TAG_LEN || size > (int)sizeof(peerPacket)) {
+            continue; // The next parsePacket() drops it
+        }
+        size_t len = peerUDP.read(peerPacket, size) - SNAPSHOT_TAG_LEN;
+        SnapshotHeader h;
+        SnapshotHeader self = peerHeader(SNAPSHOT_HELLO);
+        if (!snapshotDecodeHeader(peerPacket, len, h) || h.sender == self.sender ||
+            h.lat != self.lat || h.lon != self.lon || !snapshotTagValid(peerPacket, len, peerPacket + len)) {
+            continue; // Ours, another place or not signed with our key
+        }
+        peerSeen(h.sender);
+        peerElect();
+        if (h.kind == SNAPSHOT_WEATHER) {
+            peerTake(peerPacket, len, h.flags & SNAPSHOT_FORECAST_PARTIAL);
+        } else if (h.kind == SNAPSHOT_HELLO && !(h.flags & SNAPSHOT_HAS_WEATHER)) {
+            peerPublish(); // A clock just came up
+        }
+    }
+
+    if (peerHelloMillis == 0 || millis() - peerHelloMillis > PEER_HELLO_INTERVAL) {
+        peerHelloMillis = millis();
+        peerElect(); // Peers may have timed out
+        peerSendHello();
+    }
+}
+
+/*
+*   peerJoin() - Ends the boot wait for a leader, bootPoll() calls it PEER_JOIN_WAIT after NTP
+*/
+void peerJoin() {
+    peerElect();
+    peerSnapshotMillis = millis();
+}
+
+/*
+*   peerShouldFetch() - True if this clock has to fetch the weather itself
+*/
+bool peerShouldFetch() {
+    if (peerLeader) {
+        return true;
+    }
+    return millis() - peerSnapshotMillis > 2000UL * weatherSchedule.period + PEER_HELLO_INTERVAL;
+}
+#else
+void peerPoll() {}
+void peerJoin() {}
+void peerPublish() {}
+bool peerShouldFetch() { return true; }
+#endif
+
+#ifdef RADIO_WINDOWS
+/*
+*   Radio windows
+*
+*  The radio is woken only for network work: an NTP sync older than
+*  RADIO_WINDOW_INTERVAL (RADIO_NIGHT_INTERVAL while sunDark(), nobody reads
+*  the seconds at night), or a weather or forecast fetch that is due. Whatever
+*  else is due runs in the same window, and NTP is synced in every window, so
+*  the traffic (DNS lookups included) comes in bursts. The radio goes back to
+*  sleep when nothing is left, or after RADIO_WINDOW_MAX. Waking joins with the
+*  channel and BSSID of the last association, which skips the scan. The clock
+*  runs on millis() meanwhile, so the display is not affected.
+*/
+uint8_t radioBSSID[6];
+int32_t radioChannel = 0;
+unsigned long radioStateMillis = 0; // Start of the current state
+unsigned long radioRetryMillis = 0, radioRetryDelay = 0; // Wait after a failed wake
+unsigned long radioPollMillis = 0, radioReportMillis = 0;
+unsigned long radioOnMs = 0, radioOnMsHour = 0; // Radio on since boot and in the current report period
+unsigned long radioWindows = 0, radioWindowsHour = 0, radioWakeFailures = 0;
+unsigned long radioLastHourOnS = 0, radioLastHourSavedMAh = 0;
+
+/*
+*   radioRemember() - Keeps the channel and BSSID of the access point for a fast wake
+*/
+void radioRemember() {
+    memcpy(radioBSSID, WiFi.BSSID(), sizeof(radioBSSID));
+    radioChannel = WiFi.channel();
+    radioState = RADIO_UP;
+    radioStateMillis = millis();
+}
+
+/*
+*   radioWorkDue() - Tells if a weather or forecast fetch is waiting for the radio
+*/
+bool radioWorkDue() {
+    long now = timeClient.getEpochTime();
+    if (weatherFetch.phase != FETCH_IDLE) {
+        return true; // Keep the radio until the reply is in
+    }
+    if (!weatherFetchAllowed() || !peerShouldFetch()) {
+        return false;
+    }
+    return (scheduleDue(weatherSchedule, requestBudget, now) && fetchWanted(TOPIC_WEATHER)) ||
+           (forecastDue(now) && fetchWanted(TOPIC_FORECAST));
+}
+
+void radioSleep() {
+    WiFi.disconnect();
+    WiFi.forceSleepBegin();
+    delay(1); // The modem only goes off after a yield
+    radioState = RADIO_ASLEEP;
+    radioStateMillis = millis();
+}
+
+void radioWake() {
+    WiFi.forceSleepWake();
+    delay(1);
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssids[wifiIndex], passwords[wifiIndex], radioChannel, radioBSSID);
+    radioState = RADIO_WAKING;
+    radioStateMillis = millis();
+    radioWindows++;
+    radioWindowsHour++;
+}
+
+/*
+*   radioReport() - Logs the radio time of the last hour and the energy it saved
+*
+*  The saving compares with the radio on all the time, at RADIO_ACTIVE_MA
+*  against RADIO_SLEEP_MA.
+*/
+void radioReport() {
+    radioLastHourOnS = radioOnMsHour / 1000;
+    unsigned long offS = RADIO_REPORT_INTERVAL / 1000 > radioLastHourOnS ? RADIO_REPORT_INTERVAL / 1000 - radioLastHourOnS : 0;
+    radioLastHourSavedMAh = offS * (RADIO_ACTIVE_MA - RADIO_SLEEP_MA) / 3600;
+    LOGI("Rádio: %lu s ligado na última hora (%lu%%), %lu janelas, economia estimada %lu mAh",
+         radioLastHourOnS, radioLastHourOnS * 100000 / RADIO_REPORT_INTERVAL, radioWindowsHour, radioLastHourSavedMAh);
+    radioOnMsHour = 0;
+    radioWindowsHour = 0;
+}
+
+/*
+*   radioPoll() - Opens and closes the windows
+*/
+void radioPoll() {
+    unsigned long elapsed = millis() - radioPollMillis;
+    radioPollMillis = millis();
+    if (radioState != RADIO_ASLEEP) {
+        radioOnMs += elapsed;
+        radioOnMsHour += elapsed;
+    }
+    if (millis() - radioReportMillis >= RADIO_REPORT_INTERVAL) {
+        radioReportMillis = millis();
+        radioReport();
+    }
+
+    switch (radioState) {
+        case RADIO_ASLEEP:
+            if (millis() - radioRetryMillis >= radioRetryDelay &&
+                (millis() - lastNTPSyncMillis >= (sunDark() ? RADIO_NIGHT_INTERVAL : RADIO_WINDOW_INTERVAL) ||
+                 radioWorkDue())) {
+                radioWake();
+            }
+            break;
+
+        case RADIO_WAKING:
+            if (WiFi.status() == WL_CONNECTED) {
+                radioRemember();
+                radioRetryDelay = 0;
+                lastNTPSyncMillis = millis() - NTP_SYNC_INTERVAL; // Sync in every window
+            } else if (millis() - radioStateMillis > RADIO_WAKE_TIMEOUT) {
+                radioWakeFailures++;
+                LOGW("Rádio: falha ao reconectar (%lu)", radioWakeFailures);
+                radioRetryMillis = millis();
+                radioRetryDelay = RADIO_WAKE_RETRY;
+                radioChannel = 0; // Scan next time, the access point may have moved
+                radioSleep();
+            }
+            break;
+
+        case RADIO_UP: {
+            unsigned long open = millis() - radioStateMillis;
+            bool ntpDone = millis() - lastNTPSyncMillis < NTP_SYNC_INTERVAL && ntpFailover < 0;
+            if ((ntpDone && !radioWorkDue() && open >= RADIO_WINDOW_MIN) || open >= RADIO_WINDOW_MAX) {
+                radioSleep();
+            }
+            break;
+        }
+    }
+}
+#else
+void radioPoll() {}
+#endif
+
+/*
+*   Boot sequence
+*
+*  setup() only starts the display, which shows the clock kept in the boot
+*  record, or the progress of the boot until NTP answers. bootPoll() then runs
+*  one step per loop: scan without waiting, join the first network of
+*  wifi_credentials.h in range, try the NTP servers one per loop and give the
+*  peers PEER_JOIN_WAIT to hand over their data. A failure retries after
+*  BOOT_RETRY instead of restarting. Once the boot is done the loop fetches the
+*  weather on its usual schedule.
+*/
+enum { BOOT_SCAN, BOOT_SCANNING, BOOT_CONNECT, BOOT_NTP, BOOT_PEERS, BOOT_DONE };
+int bootState = BOOT_SCAN;
+int bootSsid = 0, bootNtp = 0; // Network and NTP server being tried
+unsigned long bootStateMillis = 0, bootRetryMillis = 0, bootRetryDelay = 0;
+char bootStatus[24] = "Iniciando"; // Shown on the home screen until the clock is known
+
+bool bootDone() {
+    return bootState == BOOT_DONE;
+}
+
+void bootEnter(int state) {
+    bootState = state;
+    bootStateMillis = millis();
+}
+
+void bootRetry(const char* status, int state) {
+    snprintf(bootStatus, sizeof(bootStatus), "%s", status);
+    bootRetryMillis = millis();
+    bootRetryDelay = BOOT_RETRY;
+    bootEnter(state);
+}
+
+/*
+*   bootConnectNext() - Joins the next network of the list, from bootSsid on, that the scan found
+*/
+void bootConnectNext() {
+    int n = WiFi.scanComplete();
+    for (; bootSsid < numRedes; bootSsid++) {
+        size_t ssidLen = strlen(ssids[bootSsid]);
+        for (int j = 0; j < n; j++) {
+            // Compare against the raw scan record, WiFi.SSID(j) would build a String
+            bss_info* info = WiFi.getScanInfoByIndex(j);
+            if (info && info->ssid_len == ssidLen && memcmp(info->ssid, ssids[bootSsid], ssidLen) == 0) {
+                LOGI("Tentando conectar em %s", ssids[bootSsid]);
+                snprintf(bootStatus, sizeof(bootStatus), "Wi-Fi %s", ssids[bootSsid]);
+                WiFi.begin(ssids[bootSsid], passwords[bootSsid]);
+                bootEnter(BOOT_CONNECT);
+                return;
+            }
+        }
+        LOGI("%s - Rede não encontrada.", ssids[bootSsid]);
+    }
+    LOGE("Nenhuma rede conhecida encontrada.");
+    WiFi.scanDelete();
+    bootRetry("Sem Wi-Fi", BOOT_SCAN);
+}
+
+void bootPoll() {
+    if (weather->current.dt) {
+        bootMark(BOOT_MARK_WEATHER); // From a fetch or from a peer
+    } else if (!bootTimelineKept && bootMarks[BOOT_MARK_PEERS] &&
+               millis() - bootMarks[BOOT_MARK_PEERS] > BOOT_WEATHER_WAIT) {
+        LOGI("Boot: sem clima após %lu ms, linha do tempo salva sem ele", millis());
+        bootTimelineKeep(); // With LAZY_FETCH the first fetch may wait for hours
+    }
+    if (bootState == BOOT_DONE || millis() - bootRetryMillis < bootRetryDelay) {
+        return;
+    }
+    bootRetryDelay = 0;
+
+    switch (bootState) {
+        case BOOT_SCAN:
+            LOGI("Escaneando redes...");
+            snprintf(bootStatus, sizeof(bootStatus), "Buscando redes");
+            WiFi.scanNetworks(true);
+            bootEnter(BOOT_SCANNING);
+            break;
+
+        case BOOT_SCANNING: {
+            int n = WiFi.scanComplete();
+            if (n == WIFI_SCAN_RUNNING) {
+                break;
+            }
+            if (n <= 0) {
+                LOGE("Nenhuma rede encontrada.");
+                bootRetry("Sem redes", BOOT_SCAN);
+                break;
+            }
+            bootSsid = 0;
+            bootConnectNext();
+            break;
+        }
+
+        case BOOT_CONNECT:
+            if (WiFi.status() == WL_CONNECTED) {
+                LOGI("Conectado em %s", ssids[bootSsid]);
+                WiFi.scanDelete();
+                wifiIndex = bootSsid;
+                bootMark(BOOT_MARK_WIFI);
+                bootNtp = 0;
+                bootEnter(BOOT_NTP);
+            } else if (millis() - bootStateMillis > BOOT_CONNECT_TIMEOUT) {
+                LOGW("Falha ao conectar em %s.", ssids[bootSsid]);
+                bootSsid++;
+                bootConnectNext();
+            }
+            break;
+
+        case BOOT_NTP:
+            snprintf(bootStatus, sizeof(bootStatus), "NTP %s", ntpServers[bootNtp]);
+            timeClient.setPoolServerName(ntpServers[bootNtp]);
+            timeClient.begin();
+            if (ntpUpdate()) {
+                LOGI("Conexão com NTP bem-sucedida: %s", ntpServers[bootNtp]);
+                linkSuccess(ntpLink);
+                lastNTPSyncMillis = millis();
+                ntpSrvIndex = bootNtp;
+                publish(TOPIC_NTP);
+                bootMark(BOOT_MARK_NTP);
+                bootEnter(BOOT_PEERS);
+            } else {
+                LOGW("Erro ao conectar no NTP: %s", ntpServers[bootNtp]);
+                bootNtp = (bootNtp + 1) % numNTPServers;
+                if (bootNtp == 0) {
+                    linkFailure(ntpLink); // One failure per pass over the servers
+                    bootRetry("Sem NTP", BOOT_NTP);
+                }
+            }
+            break;
+
+        case BOOT_PEERS:
+            #ifdef PEER_SHARING
+            if (millis() - bootStateMillis < PEER_JOIN_WAIT) {
+                break; // peerPoll() listens meanwhile, a leader may already have the weather
+            }
+            #endif
+            peerJoin();
+            bootMark(BOOT_MARK_PEERS);
+            bootEnter(BOOT_DONE);
+            #ifdef RADIO_WINDOWS
+            radioRemember(); // The first fetches run in this window
+            radioPollMillis = radioReportMillis = millis();
+            #endif
+            break;
+    }
+}
+
+/*
+*  getForecast() - Feches and parses the weather forecast from the weather provider
+*  forecastFetched() - Refills the forecast ring once the fetch is done
+*
+*  Past slots are dropped from the forecast ring as time goes by. Only when the
+*  forecast left covers less than FORECAST_MIN_HORIZON, it starts a fetch of the
+*  forecast from the provider, which weatherFetchPoll() runs over the next
+*  loop() passes. The response is then parsed and refills the ring.
+*
+*  With no forecast at all (at boot, or after an outage longer than the
+*  horizon) it first asks for FORECAST_FIRST_SLOTS slots only, a small reply
+*  the screen can show at once. That leaves the horizon short, so the full
+*  forecast is fetched on the next loop and replaces it. Only one such short
+*  fetch is made in a row, so it costs one request more per boot or outage.
+*  With LAZY_FETCH the refill also waits for fetchWanted().
+*/
+void getForecast() {
+    long now = timeClient.getEpochTime();
+    if (weather->forecastCount > 0 && forecastSlot(*weather, 0).dt < now) {
+        int dropped = dropPastSlots(weatherBegin(), now);
+        weatherSwap();
+        // Keep showing the same slot, or the first one if it was dropped
+        counterUD = constrain(counterUD - dropped, 0, max(weather->forecastCount - 1, 0));
+        lastCounterUD = counterUD;
+        publish(TOPIC_FORECAST);
+    }
+    if (weather->forecastCount == 0 && forecastWaitMillis == 0) {
+        forecastWaitMillis = max(millis(), 1UL);
+    }
+    if (weatherFetch.phase == FETCH_IDLE && forecastDue(now) && weatherFetchAllowed() &&
+        fetchWanted(TOPIC_FORECAST) && peerShouldFetch() && radioUp()) {
+        CpuBoost boost; // Handshake
+        budgetSpend(requestBudget, now);
+        int slots = weather->forecastCount == 0 && !forecastPartial && FORECAST_FIRST_SLOTS > 0 ? FORECAST_FIRST_SLOTS
+                                                                                             : FORECAST_HOURS;
+        if (!fetchStart(true, slots)) {
+            weatherFetchDone(false);
+        }
+    }
+}
+
+void forecastFetched(bool ok) {
+    if (!ok) {
+        weatherFetchDone(false);
+        return;
+    }
+    long now = timeClient.getEpochTime();
+    WeatherModel& next = weatherBegin();
+    int count;
+    if (provider.streamEnd) {
+        count = provider.streamEnd();
+        memcpy(next.forecast, fetchSlots, sizeof(next.forecast));
+    } else {
+        parseBegin();
+        count = provider.parseForecast(weatherPayload, weatherPayloadLen, next.forecast, FORECAST_HOURS);
+    }
+    parseEnd(forecastParseStats);
+
+    if (count < 0) {
+        weatherFetchDone(false);
+        return; // The back copy is dropped, the screens keep the old forecast
+    }
+    next.forecast_dt = now;
+    scheduleSpaced(forecastSchedule, requestBudget, now);
+    weatherFetchDone(true);
+
+    next.forecastHead = 0;
+    for (int i = 0; i < FORECAST_HOURS; i++) {
+        Forecast& slot = next.forecast[i];
+        if (i >= count) {
+            memset(&slot, 0, sizeof(slot)); // Don't keep stale slots around
+            continue;
+        }
+        slot.dt += utcOffsetInSeconds;
+        upperFirstLetter(slot.description); // Capitalize first letter
+        removeAccents(slot.description); // Remove accents
+
+        if (i > 0 && slot.dt <= next.forecast[i - 1].dt) {
+            count = i; // The ring must stay sorted, ignore out of order slots
+            memset(&slot, 0, sizeof(slot));
+        }
+    }
+    next.forecastCount = count;
+    dropPastSlots(next, now);
+    weatherSwap();
+    counterUD = 0;
+    lastCounterUD = 0;
+    int slots = weatherFetch.slots;
+    forecastPartial = slots < FORECAST_HOURS && count <= slots; // The gateway always sends everything
+    forecastLoaded(!forecastPartial);
+    publish(TOPIC_FORECAST);
+    peerPublish();
+}
+
+/*
+*   getWeather() - Fetches current weather data from the weather provider
+*   weatherFetched() - Takes the current weather once the fetch is done
+*
+*  This function checks if weatherSchedule says new data should be available.
+*  If it is, it starts a fetch of the current weather from the provider, which
+*  weatherFetchPoll() runs over the next loop() passes. The response is then
+*  parsed into the current weather model, and the next fetch is planned from
+*  the dt it received. All fetches count against the daily requestBudget.
+*  With LAZY_FETCH a due fetch also waits for fetchWanted().
+*/
+void getWeather() {
+    long now = timeClient.getEpochTime();
+    if (weatherFetch.phase == FETCH_IDLE && scheduleDue(weatherSchedule, requestBudget, now) &&
+        weatherFetchAllowed() && fetchWanted(TOPIC_WEATHER) && peerShouldFetch() && radioUp()) {
+        CpuBoost boost; // Handshake
+        budgetSpend(requestBudget, now);
+        if (!fetchStart(false, FORECAST_HOURS)) {
+            weatherFetchDone(false);
+        }
+    }
+}
+
+void weatherFetched(bool ok) {
+    if (!ok) {
+        weatherFetchDone(false);
+        return;
+    }
+    long now = timeClient.getEpochTime();
+    WeatherModel& next = weatherBegin();
+    CurrentWeather& current = next.current;
+    if (provider.streamEnd) {
+        ok = provider.streamEnd() >= 0;
+        current = fetchCurrent;
+    } else {
+        parseBegin();
+        ok = provider.parseCurrent(weatherPayload, weatherPayloadLen, current);
+    }
+    parseEnd(weatherParseStats);
+
+    if (!ok) {
+        weatherFetchDone(false);
+        return; // The back copy is dropped, the screens keep the old weather
+    }
+    weatherFetchDone(true);
+
+    upperFirstLetter(current.description); // Capitalize first letter
+    removeAccents(current.description); // Remove accents
+    upperFirstLetter(current.location); // Capitalize first letter
+    removeAccents(current.location); // Remove accents
+    current.dt += utcOffsetInSeconds;
+    if (current.sunrise && (current.sunrise + utcOffsetInSeconds) / 86400 == sun.day) {
+        LOGD("Sol: nascer calculado %+ld s do provedor", sun.sunrise - (current.sunrise + utcOffsetInSeconds));
+    }
+    weatherSwap();
+    publish(TOPIC_WEATHER);
+    peerPublish();
+
+    scheduleUpdate(weatherSchedule, requestBudget, now, current.dt, ESP.random() % (FETCH_JITTER + 1));
+
+    LOGD("Clima: %s, %.1f C (min %.1f, max %.1f, sensação %.1f), umidade %d%%, %d hPa",
+        current.description, current.temp, current.temp_min, current.temp_max, current.feels_like,
+        current.humidity, current.pressure);
+    LOGD("Local: %s (%s, %s), data %ld, sol %ld-%ld", current.location, lat, lon,
+        current.dt, current.sunrise, current.sunset);
+    LOGI("Período do provedor: %ld s, próxima busca em %ld s, %d requisições hoje",
+        weatherSchedule.period, weatherSchedule.nextFetch - now, requestBudget.used);
+}
+
+/*
+*   weatherFetchPoll() - Runs the weather or forecast fetch under way for one loop() pass
+*/
+void weatherFetchPoll() {
+    if (weatherFetch.phase == FETCH_IDLE) {
+        return;
+    }
+    CpuBoost boost; // Decrypt and parse
+    int result = fetchPoll();
+    if (result == FETCH_RUNNING) {
+        return;
+    }
+    if (weatherFetch.forecast) {
+        forecastFetched(result == FETCH_OK);
+    } else {
+        weatherFetched(result == FETCH_OK);
+    }
+}
+
+
+/*
+*   HeapStats - Heap health over time
+*
+*  The free heap and the largest free block are sampled periodically. A run of
+*  HEAP_DECLINE_SAMPLES samples where either one keeps going down points to a
+*  leak or to fragmentation. The render path is also watched: a screen update
+*  that leaves the free heap different from before counts as an allocation.
+*/
+struct HeapStats {
+    unsigned long samples;
+    uint32_t freeHeap;
+    uint32_t maxBlock;
+    uint32_t minFreeHeap;
+    uint32_t minMaxBlock;
+    uint8_t fragmentation;
+    unsigned int declineRun;    // Samples in a row going down
+    bool declining;
+    unsigned long renders;
+    unsigned long renderAllocs; // Renders that changed the free heap
+};
+
+HeapStats heapStats = {0, 0, 0, UINT32_MAX, UINT32_MAX, 0, 0, false, 0, 0};
+unsigned long lastHeapMillis = 0;
+
+/*
+*   heapSample() - Takes one heap sample and checks for a steady decline
+*/
+void heapSample() {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+
+    if (heapStats.samples > 0 && (freeHeap < heapStats.freeHeap || maxBlock < heapStats.maxBlock)
+        && freeHeap <= heapStats.freeHeap && maxBlock <= heapStats.maxBlock) {
+        heapStats.declineRun++;
+    } else {
+        heapStats.declineRun = 0;
+    }
+    heapStats.declining = heapStats.declineRun >= HEAP_DECLINE_SAMPLES;
+
+    heapStats.samples++;
+    heapStats.freeHeap = freeHeap;
+    heapStats.maxBlock = maxBlock;
+    heapStats.fragmentation = ESP.getHeapFragmentation();
+    if (freeHeap < heapStats.minFreeHeap) {
+        heapStats.minFreeHeap = freeHeap;
+    }
+    if (maxBlock < heapStats.minMaxBlock) {
+        heapStats.minMaxBlock = maxBlock;
+    }
+
+    #ifdef SERIALPRINT
+    logPrintf(heapStats.declining ? LOG_WARN : LOG_INFO,
+        "Heap #%lu: livre %u (min %u), maior bloco %u (min %u), frag %u%%, alocações JSON %lu, renders %lu/%lu alocaram%s",
+        heapStats.samples, freeHeap, heapStats.minFreeHeap, maxBlock, heapStats.minMaxBlock,
+        heapStats.fragmentation, parseAllocator.allocations, heapStats.renderAllocs, heapStats.renders,
+        heapStats.declining ? " - DECLÍNIO" : "");
+    #endif
+}
+
+unsigned long loopMicrosLast = 0, loopMicrosMax = 0; // Loop duration, the max is reset at each scrape
+
+#ifdef LCD_MIRROR
+/*
+*   Display mirror
+*
+*  The changes lcdMirror collected are multicast at most every
+*  LCD_MIRROR_INTERVAL, and only when there are any, so a static screen costs
+*  nothing but the keyframe every LCD_MIRROR_KEYFRAME.
+*/
+WiFiUDP mirrorUDP;
+uint8_t mirrorPacket[LCD_MIRROR_PACKET_MAX];
+unsigned long mirrorSentMillis = 0, mirrorKeyframeMillis = 0;
+bool mirrorStarted = false;
+uint16_t mirrorSeq = 0;
+unsigned long mirrorBytes = 0; // Payload bytes sent since boot
+
+void mirrorPoll() {
+    if (millis() - mirrorSentMillis < LCD_MIRROR_INTERVAL || WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    bool keyframe = !mirrorStarted || millis() - mirrorKeyframeMillis >= LCD_MIRROR_KEYFRAME;
+    if (!keyframe && lcdMirror.dirtyCells == 0 && lcdMirror.dirtyGlyphs == 0) {
+        return;
+    }
+    mirrorSentMillis = millis();
+    if (keyframe) {
+        mirrorKeyframeMillis = millis();
+        mirrorStarted = true;
+    }
+    size_t len = lcdMirrorEncode(mirrorPacket, sizeof(mirrorPacket), lcdMirror, keyframe, mirrorSeq++, ESP.getChipId());
+    mirrorUDP.beginPacketMulticast(LCD_MIRROR_GROUP, LCD_MIRROR_PORT, WiFi.localIP());
+    mirrorUDP.write(mirrorPacket, len);
+    mirrorUDP.endPacket();
+    mirrorBytes += len;
+}
+#else
+void mirrorPoll() {}
+#endif
+
+#ifdef METRICS
+/*
+*   Metrics endpoint
+*
+*  A minimal HTTP responder for GET /metrics in the Prometheus text format.
+*  It serves one client at a time from a static buffer and never waits on the
+*  socket: each loop reads what has arrived and writes at most METRICS_CHUNK
+*  bytes that fit in the TCP buffer, so a scrape never holds up the display.
+*  The response, near 3 KB with every option on, is rendered a part at a
+*  time once the previous part is sent. A client that takes longer than
+*  METRICS_TIMEOUT is dropped.
+*/
+WiFiServer metricsServer(METRICS_PORT);
+WiFiClient metricsClient;
+char metricsBuffer[METRICS_PART_MAX]; // Request first, then the response one part at a time
+size_t metricsLen = 0, metricsSent = 0;
+int metricsPart = 0; // Part of the response in metricsBuffer
+bool metricsFound = false; // The request was for /metrics
+bool metricsResponding = false;
+unsigned long metricsStartMillis = 0;
+unsigned long metricsScrapes = 0;
+bool metricsToSerial = false; // metricsBuffer is going to the serial console
+
+void metricsAppend(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(metricsBuffer + metricsLen, sizeof(metricsBuffer) - metricsLen, format, args);
+    va_end(args);
+    if (n > 0) {
+        metricsLen = min(metricsLen + n, sizeof(metricsBuffer) - 1);
+    }
+}
+
+void metricsGauge(const char* name, const char* type, unsigned long value) {
+    metricsAppend("# TYPE %s %s\n%s %lu\n", name, type, name, value);
+}
+
+/*
+*   metricsRender() - Writes one part of the response into metricsBuffer, false past the last one
+*
+*  Part 0 is the HTTP header, then each part holds a few metrics and fits
+*  in the buffer whole, so the response never has to be held at once.
+*/
+bool metricsRender(int part, bool found) {
+    metricsLen = 0;
+    if (part > 0 && !found) {
+        return false;
+    }
+    switch (part) {
+        case 0:
+            if (!found) {
+                metricsAppend("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            } else {
+                metricsAppend("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+            }
+            return true;
+
+        case 1:
+            metricsGauge("ntp162_uptime_seconds", "gauge", millis() / 1000);
+            metricsGauge("ntp162_heap_free_bytes", "gauge", ESP.getFreeHeap());
+            metricsGauge("ntp162_heap_max_block_bytes", "gauge", ESP.getMaxFreeBlockSize());
+            metricsGauge("ntp162_heap_fragmentation_percent", "gauge", ESP.getHeapFragmentation());
+            metricsAppend("# TYPE ntp162_wifi_rssi_dbm gauge\nntp162_wifi_rssi_dbm %d\n", WiFi.RSSI());
+            break;
+
+        case 2:
+            metricsGauge("ntp162_weather_fetch_attempts_total", "counter", weatherLink.attempts);
+            metricsGauge("ntp162_weather_fetch_failures_total", "counter", weatherLink.failures);
+            metricsAppend("# TYPE ntp162_weather_fetch_seconds summary\n"
+                          "ntp162_weather_fetch_seconds_sum %.3f\nntp162_weather_fetch_seconds_count %lu\n",
+                          fetchMsTotal / 1000.0, fetchCount);
+            metricsAppend("# TYPE ntp162_weather_fetch_last_seconds gauge\nntp162_weather_fetch_last_seconds %.3f\n",
+                          lastFetchMs / 1000.0);
+            metricsGauge("ntp162_weather_fetch_wire_bytes", "gauge", lastFetchWireBytes);
+            break;
+
+        case 3:
+            metricsAppend("# TYPE ntp162_weather_connect_seconds summary\n");
+            for (int i = 0; i < 2; i++) {
+                metricsAppend("ntp162_weather_connect_seconds_sum{cpu_mhz=\"%d\"} %.3f\n"
+                              "ntp162_weather_connect_seconds_count{cpu_mhz=\"%d\"} %lu\n",
+                              i ? 160 : 80, connectMsTotal[i] / 1000.0, i ? 160 : 80, connectCount[i]);
+            }
+            metricsAppend("# TYPE ntp162_cpu_boost_seconds_total counter\nntp162_cpu_boost_seconds_total %.3f\n",
+                          cpuBoostMs / 1000.0);
+            break;
+
+        case 4:
+            metricsGauge("ntp162_weather_requests_today", "gauge", requestBudget.used);
+            metricsGauge("ntp162_weather_model_version", "counter", weather->version);
+            metricsAppend("# TYPE ntp162_forecast_first_seconds gauge\nntp162_forecast_first_seconds %.3f\n"
+                          "# TYPE ntp162_forecast_full_seconds gauge\nntp162_forecast_full_seconds %.3f\n",
+                          forecastFirstMs / 1000.0, forecastFullMs / 1000.0);
+            metricsAppend("# TYPE ntp162_weather_age_seconds gauge\nntp162_weather_age_seconds %ld\n",
+                          weather->current.dt ? (long)timeClient.getEpochTime() - weather->current.dt : -1);
+            break;
+
+        case 5:
+            metricsGauge("ntp162_ntp_sync_attempts_total", "counter", ntpLink.attempts);
+            metricsGauge("ntp162_ntp_sync_failures_total", "counter", ntpLink.failures);
+            metricsAppend("# TYPE ntp162_ntp_offset_seconds gauge\nntp162_ntp_offset_seconds %ld\n", ntpOffset);
+            metricsAppend("# TYPE ntp162_ntp_delay_seconds gauge\nntp162_ntp_delay_seconds %.3f\n", ntpDelayMs / 1000.0);
+            break;
+
+        case 6:
+            metricsAppend("# TYPE ntp162_loop_seconds gauge\nntp162_loop_seconds %.6f\n", loopMicrosLast / 1e6);
+            metricsAppend("# TYPE ntp162_loop_max_seconds gauge\nntp162_loop_max_seconds %.6f\n", loopMicrosMax / 1e6);
+            loopMicrosMax = 0;
+            metricsGauge("ntp162_renders_total", "counter", rendersTotal);
+            metricsGauge("ntp162_renders_skipped_total", "counter", rendersSkippedTotal);
+            metricsGauge("ntp162_log_dropped_total", "counter", logDroppedTotal);
+            metricsGauge("ntp162_boots_total", "counter", bootRecord.boots);
+            break;
+
+        case 7:
+            metricsAppend("# TYPE ntp162_boot_mark_seconds gauge\n");
+            for (int i = 0; i < BOOT_MARKS; i++) {
+                if (bootMarks[i]) {
+                    metricsAppend("ntp162_boot_mark_seconds{mark=\"%s\"} %.3f\n", bootMarkNames[i], bootMarks[i] / 1000.0);
+                }
+            }
+            metricsGauge("ntp162_screen_views_total", "counter", screenViews);
+            metricsGauge("ntp162_sun_dark", "gauge", sunDark());
+            break;
+
+        case 8:
+            #ifdef LAZY_FETCH
+            metricsGauge("ntp162_fetch_wanted", "gauge", fetchWanted(TOPIC_WEATHER));
+            #endif
+            metricsGauge("ntp162_scrapes_total", "counter", metricsScrapes);
+            #ifdef PEER_SHARING
+            metricsGauge("ntp162_peer_leader", "gauge", peerLeader);
+            #endif
+            #ifdef LCD_MIRROR
+            metricsGauge("ntp162_lcd_mirror_bytes_total", "counter", mirrorBytes);
+            #endif
+            break;
+
+        case 9:
+            #ifdef RADIO_WINDOWS
+            metricsGauge("ntp162_radio_on_seconds_total", "counter", radioOnMs / 1000);
+            metricsGauge("ntp162_radio_windows_total", "counter", radioWindows);
+            metricsGauge("ntp162_radio_wake_failures_total", "counter", radioWakeFailures);
+            metricsGauge("ntp162_radio_last_hour_on_seconds", "gauge", radioLastHourOnS);
+            metricsGauge("ntp162_radio_last_hour_saved_mah", "gauge", radioLastHourSavedMAh);
+            #endif
+            break;
+
+        default:
+            return false;
+    }
+    return true;
+}
+
+/*
+*   metricsDump() - Sends the metrics to the serial console through the log ring
+*/
+bool metricsDump() {
+    if (metricsClient || metricsToSerial) {
+        return false;
+    }
+    metricsPart = 1; // No HTTP header
+    metricsRender(metricsPart, true);
+    metricsSent = 0;
+    metricsToSerial = true;
+    return true;
+}
+
+/*
+*   metricsPoll() - Advances the current scrape or serial dump, or takes the next client
+*/
+void metricsPoll() {
+    if (metricsToSerial) {
+        if (metricsSent >= metricsLen) {
+            metricsSent = 0;
+            metricsToSerial = metricsRender(++metricsPart, true);
+            return;
+        }
+        // Whole lines only, so log lines do not land in the middle of one
+        size_t n = min(LOG_RING_SIZE - logCount, metricsLen - metricsSent);
+        while (n > 0 && metricsBuffer[metricsSent + n - 1] != '\n') {
+            n--;
+        }
+        logPush(metricsBuffer + metricsSent, n);
+        metricsSent += n;
+        return; // A scrape waits in the backlog meanwhile
+    }
+    if (!metricsClient) {
+        metricsClient = metricsServer.accept();
+        if (!metricsClient) {
+            return;
+        }
+        metricsLen = 0;
+        metricsSent = 0;
+        metricsResponding = false;
+        metricsStartMillis = millis();
+    }
+    if (millis() - metricsStartMillis > METRICS_TIMEOUT) {
+        metricsClient.stop();
+        return;
+    }
+
+    if (!metricsResponding) {
+        while (metricsClient.available() && metricsLen < METRICS_REQUEST_MAX) {
+            metricsBuffer[metricsLen++] = metricsClient.read();
+        }
+        metricsBuffer[metricsLen] = '\0';
+        if (!strstr(metricsBuffer, "\r\n\r\n") && metricsLen < METRICS_REQUEST_MAX) {
+            return; // Rest of the request still on the way
+        }
+        metricsFound = strncmp(metricsBuffer, "GET /metrics ", 13) == 0;
+        metricsPart = 0;
+        metricsRender(metricsPart, metricsFound);
+        metricsSent = 0;
+        metricsScrapes += metricsFound;
+        metricsResponding = true;
+    }
+
+    if (metricsSent >= metricsLen) {
+        metricsSent = 0;
+        if (!metricsRender(++metricsPart, metricsFound)) {
+            metricsClient.stop();
+            return;
+        }
+    }
+    size_t n = min((size_t)metricsClient.availableForWrite(), min(metricsLen - metricsSent, (size_t)METRICS_CHUNK));
+    if (n > 0) {
+        metricsSent += metricsClient.write((const uint8_t*)metricsBuffer + metricsSent, n);
+    }
+}
+#else
+bool metricsDump() { return false; }
+void metricsPoll() {}
+#endif
+
+
+/*
+ * setup() - Initializes the system and starts the boot sequence
+ * 
+ * It initializes the serial interface and the LCD display with its custom
+ * characters, so the first frame is drawn by the first loop. Wi-Fi and NTP
+ * are left to bootPoll(), which runs from the loop without blocking it.
+ */
+void setup() {
+    Serial.begin(115200);  // Initialize serial communication at 115200 baud rate
+    bootRecordRead();
+    forecastWaitMillis = max(millis(), 1UL); // Time to the first forecast counts from the boot
+    #ifdef LCD_MIRROR
+    lcdMirrorInit(lcdMirror);
+    #endif
+    lcd.begin(16, 2);  // Initialize the LCD with 16 columns and 2 rows
+
+    // Create custom LCD characters, before the first frame
+    lcd.createChar(0, LT);
+    lcd.createChar(1, UB);
+    lcd.createChar(2, RT);
+    lcd.createChar(3, LL);
+    lcd.createChar(4, LB);
+    lcd.createChar(5, LR);
+    lcd.createChar(6, MB);
+    lcd.createChar(7, block);
+    lcd.clear();
+    lcd.backlight();  // Turn on the LCD backlight
+    LOGI("Boot %lu%s", (unsigned long)bootRecord.boots, cachedEpoch ? ", relógio mantido do último boot" : "");
+
+    WiFi.mode(WIFI_STA);
+    #ifdef RADIO_WINDOWS
+    WiFi.persistent(false); // Every wake calls WiFi.begin(), don't write the credentials to flash each time
+    #endif
+    WiFi.disconnect(); // Limpa conexões anteriores
+
+    // Set SSL client to insecure mode (bypass certificate verification)
+    secureClient.setInsecure();
+
+    #ifdef METRICS
+    metricsServer.begin();
+    #endif
+    // Wi-Fi, NTP and the peers come up in bootPoll(), the weather once the boot is done
+}
+
+
+/*
+ * printNumber() - Displays a two-digit number on the LCD
+ * 
+ * It splits the number into tens and ones, then calls printDigits() to display 
+ * each digit at the correct position on the LCD.
+ */
+void printNumber(int val){
+     int col=9;    
+     printDigits(val/10,col);
+     printDigits(val%10,col+4);
+}
+
+
+/*
+ * printTime() - Displays the current time on the LCD
+ * 
+ * Prints hours and minutes using printDigits(), 
+ * placing colons at fixed positions to format the time.
+ */
+
+void printTime() {
+    static bool placeholder = false;
+    bootMark(BOOT_MARK_FRAME);
+    if (!clockKnown()) {
+        // No time yet, show how the boot is going
+        lcd.setCursor(0, 0);
+        lcd.printf("Iniciando      %s", gizmo[(millis() / 1000) % 4]);
+        lcd.setCursor(0, 1);
+        lcd.printf("%-16.16s", bootStatus);
+        placeholder = true;
+        return;
+    }
+    if (placeholder) {
+        lcd.clear();
+        placeholder = false;
+    }
+    unsigned long epoch = clockEpoch();
+    int h = (epoch / 3600) % 24;
+    int m = (epoch / 60) % 60;
+    int s = epoch % 60;
+    char separator = (s % 2 == 0) ? char(165) : ' ';
+    printDigits(h / 10, 0);
+    printDigits(h % 10, 4);
+    lcd.setCursor(7, 0);
+    lcd.print(separator);
+    lcd.setCursor(7, 1);
+    lcd.print(separator);
+    printDigits(m / 10, 8);
+    printDigits(m % 10, 12);
+}
+
+
+/*
+ * printDate() - Retrieves and displays the current date and time on the LCD
+ * 
+ * It fetches the epoch time from the NTP client and calculates the date manually. 
+ * The function then formats and prints the time, weekday, and date on the LCD.
+ */
+void printDate() {
+    unsigned long epoch = clockEpoch();
+    
+    // Calculates the time
+    int seconds = epoch % 60;
+    int minutes = (epoch / 60) % 60;
+    int hours = (epoch / 3600) % 24;
+    int days = epoch / 86400;
+    
+    // Set the date to the UNIX epoch: 1970-01-01
+    int year = 1970;
+    int month = 1;
+    int day = 1;
+
+    // Calculate the number of years elapsed
+    while (days >= (365 + (year % 4 == 0 ? 1 : 0))) {
+        days -= (365 + (year % 4 == 0 ? 1 : 0));
+        year++;
+    }
+
+    // Calculate the month
+    int daysInMonth[] = {31, (year % 4 == 0 ? 29 : 28), 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    while (days >= daysInMonth[month - 1]) {
+        days -= daysInMonth[month - 1];
+        month++;
+    }
+
+    // Finally, the days
+    day += days;
+
+    // Show the results        
+    lcd.setCursor(4, 0);
+    lcd.printf("%02d:%02d:%02d ", hours, minutes, seconds);
+    lcd.setCursor(1, 1);
+    lcd.print(daysOfTheWeek[(epoch / 86400 + 4) % 7]); // 1970-01-01 was a Thursday
+    lcd.print(" ");
+    lcd.printf("%02d/%02d/%04d", day, month, year);        
+}
+
+
+/*
+ * printNetwork() - Displays the device's IP address and Wi-Fi SSID on the LCD
+ * 
+ * It clears the LCD, prints the local IP address on the first row, 
+ * and the connected Wi-Fi SSID on the second row. The information 
+ * is displayed for 5 seconds.
+ */
+void printNetwork() {
+    lcd.setCursor(0, 0);
+    lcd.print(WiFi.localIP());
+    lcd.setCursor(0, 1);
+    lcd.print(ssids[wifiIndex]); 
+}
+
+
+/*
+ * printNTP() - Displays the current NTP server and time on the LCD
+ * 
+ * It clears the LCD and prints the active NTP server on the first row. 
+ * The second row continuously updates with the formatted time for 10 seconds.
+ */
+void printNTP() {
+    lcd.setCursor(0, 0);
+    lcd.print(ntpServers[ntpSrvIndex]);
+    lcd.setCursor(0, 1);
+    lcd.printf("%02d:%02d:%02d", timeClient.getHours(), timeClient.getMinutes(), timeClient.getSeconds());
+}
+
+
+
+/*
+ *   printWeather() - Prints the weather information on the LCD
  * 
  *   The weather information is scrolled on the second row of the LCD.
  *   The first row shows the time the weather information was last updated.
  */
-unsigned long lastWeatherMillis = 0;
 void printWeather() {
-    updateInterval = 500;
-    if (millis() - lastWeatherMillis > updateInterval) {
-        lastWeatherMillis = millis();
-        char weather[100];
-        snprintf(weather, 
-            sizeof(weather), 
-            "%s - Temp: %.1fC - Humid: %d%% - Press: %dhPa   ", 
-            current_weatherDescription, 
-            current_temp, 
-            current_humidity, 
-            current_pressure);
-        #ifdef SERIALPRINT
-        Serial.println(weather);
-        #endif
-        removeAccents(weather);
-        getScrollWindow(weather, scrollBuffer, scrollPos);
-        time_t epoch = (time_t)current_dt;
-        struct tm timeinfo;
-        gmtime_r(&epoch, &timeinfo);
-        lcd.setCursor(0, 0);
-        lcd.printf("Hoje as %02d:%02d", timeinfo.tm_hour, timeinfo.tm_min);
-        lcd.setCursor(0, 1);
-        lcd.print(scrollBuffer);
-        scrollPos++;
-    }
-
+    const CurrentWeather& current = weather->current;
+    char text[100];
+    snprintf(text, 
+        sizeof(text), 
+        "%s - Temp: %.1fC - Humid: %d%% - Press: %dhPa   ", 
+        current.description, 
+        current.temp, 
+        current.humidity, 
+        current.pressure);
+    LOGD("%s", text);
+    removeAccents(text);
+    getScrollWindow(text, scrollBuffer, scrollPos);
+    time_t epoch = (time_t)current.dt;
+    struct tm timeinfo;
+    gmtime_r(&epoch, &timeinfo);
+    lcd.setCursor(0, 0);
+    lcd.printf("Hoje as %02d:%02d", timeinfo.tm_hour, timeinfo.tm_min);
+    lcd.setCursor(0, 1);
+    lcd.print(scrollBuffer);
+    scrollPos++;
 }
 
 /*
@@ -795,72 +2454,666 @@ void printWeather() {
 *
 *   The forecast information is scrolled on the second row of the LCD.
 *   The first row shows the date and time of the forecast.
+*   counterUD is the slot shown, counted from the next slot to come.
 */
 void printForecast() {
-    updateInterval = 500;
-    if (millis() - lastWeatherMillis > updateInterval) {
-        lastWeatherMillis = millis();
-        char weather[100];
-        snprintf(weather, sizeof(weather),
-         "%s - Min: %.1fC Max: %.1fC - %.0f%% Chuva: %.1fmm  Humid: %d%% - Press: %dhPa   ",
-         forecast[counterUD].description,
-         forecast[counterUD].temp_min,
-         forecast[counterUD].temp_max,
-         forecast[counterUD].pop*100,
-         forecast[counterUD].rain_3h,
-         forecast[counterUD].humidity,
-         forecast[counterUD].pressure);
-        #ifdef SERIALPRINT
-        Serial.println(weather);
-        #endif
-        removeAccents(weather);
-        getScrollWindow(weather, scrollBuffer, scrollPos);
-        time_t epoch = (time_t)forecast[counterUD].dt;
-        struct tm timeinfo;
-        gmtime_r(&epoch, &timeinfo);
+    const WeatherModel& model = *weather; // One model for the whole frame
+    if (model.forecastCount == 0) {
+        lcd.setCursor(0, 0);
+        lcd.print("Sem previsao    ");
+        lcd.setCursor(0, 1);
+        lcd.print("                ");
+        return;
+    }
+    const Forecast& slot = forecastSlot(model, constrain(counterUD, 0, model.forecastCount - 1));
+    char text[100];
+    snprintf(text, sizeof(text),
+     "%s - Min: %.1fC Max: %.1fC - %.0f%% Chuva: %.1fmm  Humid: %d%% - Press: %dhPa   ",
+     slot.description,
+     slot.temp_min,
+     slot.temp_max,
+     slot.pop*100,
+     slot.rain_3h,
+     slot.humidity,
+     slot.pressure);
+    LOGD("%s", text);
+    removeAccents(text);
+    getScrollWindow(text, scrollBuffer, scrollPos);
+    time_t epoch = (time_t)slot.dt;
+    struct tm timeinfo;
+    gmtime_r(&epoch, &timeinfo);
+    lcd.setCursor(0, 0);
+    lcd.printf("%02d/%02d - %02d:%02d", timeinfo.tm_mday, timeinfo.tm_mon+1,timeinfo.tm_hour, timeinfo.tm_min);
+    lcd.setCursor(0, 1);
+    lcd.print(scrollBuffer);
+    scrollPos++;
+}
+
+
+/*
+*   forecastUpDown() - Up/Down handling of the Forecast screen, moves between the forecast slots
+*
+*   The position is clamped to the slots left in the forecast ring.
+*/
+void forecastUpDown(int step) {
+    counterUD = constrain(counterUD + step, 0, max(weather->forecastCount - 1, 0));
+}
+
+
+/*
+*   printSun() - Prints today's sunrise and sunset, and the civil twilight
+*   printSunRow() - Prints one pair of events, or where the sun stays all day
+*
+*   Days with neither event of a pair say which side the sun is stuck on,
+*   an event missing on its own (near the polar circles) shows as --:--.
+*/
+void printSunRow(int row, const char* label, long rise, long set, int always) {
+    lcd.setCursor(0, row);
+    if (rise == 0 && set == 0 && always) {
+        lcd.printf("%-5s%-11s", label, always > 0 ? "dia todo" : "noite toda");
+    } else {
+        char riseText[6], setText[6];
+        lcd.printf("%-5s%s %s", label, sunClock(riseText, rise), sunClock(setText, set));
+    }
+}
+
+void printSun() {
+    if (sun.day == 0) {
         lcd.setCursor(0, 0);
-        lcd.printf("%02d/%02d - %02d:%02d", timeinfo.tm_mday, timeinfo.tm_mon+1,timeinfo.tm_hour, timeinfo.tm_min);
+        lcd.print("Sem horario     ");
         lcd.setCursor(0, 1);
-        lcd.print(scrollBuffer);
-        scrollPos++;
+        lcd.print("                ");
+        return;
+    }
+    printSunRow(0, "Sol", sun.sunrise, sun.sunset, sun.sunAlways);
+    printSunRow(1, "Crep", sun.dawn, sun.dusk, sun.civilAlways);
+}
+
+
+/*
+*   Screen - Descriptor of one screen of the clock
+*
+*   render:        draws the screen
+*   tick:          animation period in ms (text scrolling), 0 if the screen is static
+*   subscriptions: SUB() mask of the data bus topics the screen shows
+*   upDown:        Up/Down button handler, NULL if the screen ignores them
+*
+*   Left/Right cycle through the screens in table order. Adding a screen
+*   is one entry in this table.
+*/
+struct Screen {
+    const char* name;
+    void (*render)();
+    unsigned int tick;
+    uint8_t subscriptions;
+    void (*upDown)(int step);
+};
+
+constexpr Screen screens[] = {
+    {"NTP",      printNTP,      0,   SUB(TOPIC_TIME) | SUB(TOPIC_NTP), NULL},
+    {"Rede",     printNetwork,  0,   SUB(TOPIC_NETWORK),               NULL},
+    {"Hora",     printTime,     0,   SUB(TOPIC_TIME),                  NULL},
+    {"Data",     printDate,     0,   SUB(TOPIC_TIME),                  NULL},
+    {"Clima",    printWeather,  500, SUB(TOPIC_WEATHER),               NULL},
+    {"Previsao", printForecast, 500, SUB(TOPIC_FORECAST),              forecastUpDown},
+    {"Sol",      printSun,      0,   SUB(TOPIC_SUN),                   NULL},
+};
+constexpr int NUM_SCREENS = sizeof(screens) / sizeof(screens[0]);
+
+
+/*
+*   publishTime() - Time service, publishes TOPIC_TIME when the displayed second changes
+*   publishNetwork() - Network state, publishes TOPIC_NETWORK when the IP address changes
+*/
+void publishTime() {
+    unsigned long epoch = clockEpoch();
+    if (epoch != lastPublishedEpoch) {
+        lastPublishedEpoch = epoch;
+        publish(TOPIC_TIME);
+    }
+}
+
+void publishNetwork() {
+    if (millis() - lastNetworkCheckMillis < 1000) {
+        return;
+    }
+    lastNetworkCheckMillis = millis();
+    uint32_t ip = WiFi.localIP();
+    if (ip != lastPublishedIP) {
+        lastPublishedIP = ip;
+        publish(TOPIC_NETWORK);
+    }
+}
+
+
+/*
+*   renderScreen() - Draws the current screen if it is due
+*
+*   A screen is drawn when it has just been entered, when a topic it
+*   subscribes to has a new version or when its animation tick is due.
+*   Otherwise nothing runs. Every RENDER_BASELINE ms without a draw is
+*   counted as a render skipped compared to the old timer-driven screens.
+*/
+uint32_t seenVersion[NUM_TOPICS]; // Topic versions the current screen was drawn with
+void renderScreen() {
+    const Screen& screen = screens[counter];
+    bool entered = lastCounter != counter;
+    if (entered) {
+        lastCounter = counter;
+        screenSubscriptions = screen.subscriptions;
+        usageCount(screen.subscriptions);
+        lcd.clear();
+        scrollBuffer[0] = '\0'; // Clear the scroll buffer
+        scrollPos = 0; // Reset the scroll position
+        counterUD = 0;
+        lastCounterUD = 0;
+    }
+    bool moved = lastCounterUD != counterUD;
+    lastCounterUD = counterUD;
+
+    bool changed = false;
+    for (int t = 0; t < NUM_TOPICS; t++) {
+        if ((screen.subscriptions & SUB(t)) && seenVersion[t] != topicVersion[t]) {
+            changed = true;
+        }
+    }
+
+    if (millis() - lastSkipCheckMillis >= RENDER_BASELINE) {
+        lastSkipCheckMillis = millis();
+        if (lastRendersDone == rendersDone) {
+            rendersSkipped++;
+            rendersSkippedTotal++;
+        }
+        lastRendersDone = rendersDone;
+    }
+    if (millis() - lastRenderStatsMillis >= RENDER_STATS_INTERVAL) {
+        lastRenderStatsMillis = millis();
+        LOGI("Renders na última hora: %lu feitos, %lu pulados", rendersDone, rendersSkipped);
+        rendersDone = 0;
+        rendersSkipped = 0;
+        lastRendersDone = 0;
+    }
+
+    if (!entered && !moved && !changed
+        && (screen.tick == 0 || millis() - lastRenderMillis < screen.tick)) {
+        return;
+    }
+    lastRenderMillis = millis();
+    memcpy(seenVersion, topicVersion, sizeof(seenVersion));
+    rendersDone++;
+    rendersTotal++;
+
+    uint32_t heapBeforeRender = ESP.getFreeHeap();
+    screen.render();
+    heapStats.renders++;
+    if (ESP.getFreeHeap() != heapBeforeRender) {
+        heapStats.renderAllocs++;
     }
 }
 
 
+#ifdef SOAKTEST
+/*
+*   soakCycle() - Runs one accelerated soak test cycle
+*
+*  Every SOAK_CYCLE_INTERVAL both weather fetches are forced, the next screen is
+*  shown and the heap is sampled. Every SOAK_RECONNECT_EVERY cycles the Wi-Fi is
+*  dropped and joined again.
+*/
+unsigned long lastSoakMillis = 0, soakCycles = 0;
+void soakCycle() {
+    if (millis() - lastSoakMillis < SOAK_CYCLE_INTERVAL) {
+        return;
+    }
+    lastSoakMillis = millis();
+    soakCycles++;
+
+    if (soakCycles % SOAK_RECONNECT_EVERY == 0) {
+        WiFi.disconnect();
+        WiFi.begin(ssids[wifiIndex], passwords[wifiIndex]);
+        unsigned long start = millis();
+        while (WiFi.status() != WL_CONNECTED && millis() - start < 10000) {
+            delay(100);
+        }
+        publish(TOPIC_NETWORK);
+    }
+
+    weatherSchedule.nextFetch = 0;  // Force both fetches on this pass
+    weatherBegin().forecastCount = 0;
+    weatherSwap();
+    requestBudget.used = 0; // The accelerated cycles would use up the daily budget
+    weatherRetryDelay = 0;
+    counter = (counter + 1) % NUM_SCREENS;
+    heapSample();
+}
+#endif
+
 /*
  * button() - Determines which button is pressed based on analog input
  * 
  * It reads an analog value and returns a corresponding button code:
  * 0 = No button, 1 = Select (unreliable), 2 = Left, 3 = Down, 4 = Up, 5 = Right.
+ * A value above buttonThresholds[i] is button i, the buttons command of the
+ * serial console shows the current value and adjusts the thresholds.
  */
+int buttonThresholds[5] = {1010, 900, 600, 300, 100};
 
- int button(int analogValue) {
-    if (analogValue > 1010) {
-        return 0;
-    } else if (analogValue > 900) {
-        return 1; // Select - Not very reliable on this shield, avoid using
-    } else if (analogValue > 600) {
-        return 2; // Left
-    } else if (analogValue > 300) {
-        return 3; // Down
-    } else if (analogValue > 100) {
-        return 4; // Up
-    } else if (analogValue >= 0) {
-        return 5; // Right
+int button(int analogValue) {
+    for (int i = 0; i < 5; i++) {
+        if (analogValue > buttonThresholds[i]) {
+            return i;
+        }
+    }
+    return analogValue >= 0 ? 5 : 0;
+}
+
+#ifdef CONSOLE
+/*
+*   Serial console
+*
+*  Line oriented commands typed in the serial monitor, to look inside a running
+*  clock and tune it without reflashing. Each loop reads at most
+*  CONSOLE_READ_MAX bytes that have already arrived into a fixed line buffer
+*  and runs the command when its line ends, so while nothing is typed the cost
+*  is one Serial.available(). Replies go through the log ring and never wait on
+*  the UART. Benchmarks run in slices of CONSOLE_BENCH_SLICE per loop.
+*/
+struct ConsoleCommand {
+    const char* name;
+    void (*run)(char* args);
+    const char* help;
+};
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+char consoleLine[CONSOLE_LINE_MAX + 1];
+size_t consoleLen = 0;
+bool consoleOverflow = false;
+const Benchmark* bench = NULL; // Benchmark in progress
+unsigned long benchLeft = 0, benchRuns = 0, benchMicros = 0, benchMax = 0;
+
+bool consoleNumber(const char* text, long& value) {
+    if (text == NULL || *text == '\0') {
+        return false;
+    }
+    char* end;
+    value = strtol(text, &end, 10);
+    return *end == '\0';
+}
+
+/*
+*   benchRender() - Draws the current screen
+*   benchSnapshot() - Encodes, signs, checks and decodes the weather as a peer snapshot
+*/
+void benchRender() {
+    screens[counter].render();
+}
+
+void benchSnapshot() {
+    static uint8_t packet[SNAPSHOT_MAX_SIZE + SNAPSHOT_TAG_LEN];
+    static CurrentWeather decoded;
+    static Forecast slot;
+    SnapshotHeader header = {SNAPSHOT_WEATHER, ESP.getChipId(), 0, 0, SNAPSHOT_HAS_WEATHER};
+    size_t len = snapshotEncodeWeather(packet, SNAPSHOT_MAX_SIZE, header, weather->current, weather->forecast_dt,
+                                       weather->forecast, weather->forecastHead, weather->forecastCount,
+                                       utcOffsetInSeconds);
+    snapshotTag(packet, len, packet + len);
+    long fetched;
+    int count;
+    if (snapshotTagValid(packet, len, packet + len)) {
+        snapshotDecodeWeather(packet, len, decoded, fetched, &slot, 1, count, utcOffsetInSeconds);
+    }
+}
+
+/*
+*   benchOwm() - Parses the last response with the OWM pull parser
+*   benchOwmJson() - Same with ArduinoJson, for comparison
+*
+*  Only meaningful after a fetch from OpenWeatherMap whose body was small
+*  enough to stay in weatherPayload. The results go to scratch copies, the
+*  weather on the screens is not touched.
+*/
+CurrentWeather benchCurrent;
+Forecast benchSlots[FORECAST_HOURS];
+
+void benchOwm() {
+    if (strstr(weatherPayload, "\"list\"")) {
+        owmParseForecast(weatherPayload, weatherPayloadLen, benchSlots, FORECAST_HOURS);
+    } else {
+        owmParseCurrent(weatherPayload, weatherPayloadLen, benchCurrent);
+    }
+}
+
+void benchOwmJson() {
+    if (strstr(weatherPayload, "\"list\"")) {
+        owmJsonParseForecast(weatherPayload, weatherPayloadLen, benchSlots, FORECAST_HOURS);
+    } else {
+        owmJsonParseCurrent(weatherPayload, weatherPayloadLen, benchCurrent);
+    }
+}
+
+const Benchmark benchmarks[] = {
+    {"render",   benchRender},
+    {"snapshot", benchSnapshot},
+    {"owm",      benchOwm},
+    {"owmjson",  benchOwmJson},
+};
+
+void benchStep() {
+    unsigned long sliceStart = micros();
+    while (benchLeft > 0 && micros() - sliceStart < CONSOLE_BENCH_SLICE) {
+        unsigned long start = micros();
+        bench->run();
+        unsigned long us = micros() - start;
+        benchMicros += us;
+        benchMax = max(benchMax, us);
+        benchRuns++;
+        benchLeft--;
+    }
+    if (benchLeft == 0) {
+        logReply("bench %s: %lu execuções, média %lu us, máx %lu us", bench->name, benchRuns,
+                 benchMicros / benchRuns, benchMax);
+        bench = NULL;
+    }
+}
+
+/*
+*   Console commands, args holds the rest of the line
+*/
+void consoleHelp(char* args);
+
+void consoleMetrics(char* args) {
+    if (!metricsDump()) {
+        logReply("Métricas indisponíveis (METRICS desligado ou em uso)");
+    }
+}
+
+void histogramReply(const char* name, const Histogram& h) {
+    logReply("%s:", name);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (h.counts[i] == 0) {
+            continue;
+        }
+        if (i < HISTOGRAM_BUCKETS - 1) {
+            logReply("  < %lu: %lu", 64UL << i, h.counts[i]);
+        } else {
+            logReply("  >= %lu: %lu", 32UL << i, h.counts[i]);
+        }
+    }
+}
+
+void consoleHist(char* args) {
+    if (strcmp(args, "reset") == 0) {
+        memset(&loopHistogram, 0, sizeof(loopHistogram));
+        memset(&fetchHistogram, 0, sizeof(fetchHistogram));
+        logReply("Histogramas zerados");
+        return;
+    }
+    histogramReply("Loop (us)", loopHistogram);
+    histogramReply("Busca do tempo (ms)", fetchHistogram);
+}
+
+void consoleBoot(char* args) {
+    logReply("Boot %lu, %s", (unsigned long)bootRecord.boots, bootDone() ? "concluído" : bootStatus);
+    for (int i = 0; i < BOOT_MARKS; i++) {
+        if (bootMarks[i]) {
+            logReply("  %-6s %lu ms", bootMarkNames[i], bootMarks[i]);
+        } else {
+            logReply("  %-6s pendente", bootMarkNames[i]);
+        }
+    }
+    for (int i = 0; i < BOOT_MARKS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Boots até %s (ms)", bootMarkNames[i]);
+        histogramReply(name, bootRecord.timeline[i]);
+    }
+}
+
+void consoleUsage(char* args) {
+    ViewUsage& u = bootRecord.usage;
+    if (clockKnown()) {
+        usageRollover(u, clockEpoch());
+    }
+    logReply("Telas de clima: %lu vistas neste boot, %u dias de uso%s", screenViews, u.days,
+             u.days < USAGE_LEARN_DAYS ? ", aprendendo" : "");
+    for (int h = 0; h < 24; h += 8) {
+        char line[64];
+        int len = 0;
+        for (int i = h; i < h + 8; i++) {
+            len += snprintf(line + len, sizeof(line) - len, " %02d:%3u%c", i, u.hours[i],
+                            u.hours[i] >= USAGE_LIKELY ? '*' : ' ');
+        }
+        logReply("%s", line);
+    }
+    #ifdef LAZY_FETCH
+    logReply("Busca em segundo plano agora: %s", fetchWanted(TOPIC_WEATHER) ? "sim" : "não");
+    #endif
+}
+
+void consoleSun(char* args) {
+    if (sun.day == 0) {
+        logReply("Sol: sem horário ainda");
+        return;
+    }
+    long events[] = {sun.dawn, sun.sunrise, sun.noon, sun.sunset, sun.dusk};
+    const char* names[] = {"aurora", "nascer", "meio-dia", "pôr", "crepúsculo"};
+    for (int i = 0; i < 5; i++) {
+        if (events[i]) {
+            logReply("  %-11s %02ld:%02ld:%02ld", names[i], events[i] % 86400 / 3600, events[i] % 3600 / 60,
+                     events[i] % 60);
+        } else {
+            logReply("  %-11s não ocorre hoje", names[i]);
+        }
+    }
+    logReply("Agora: %s", sunDark() ? "noite" : "dia");
+}
+
+void consoleFetch(char* args) {
+    if (strcmp(args, "forecast") == 0) {
+        weatherBegin().forecastCount = 0; // Leaves no horizon, so the forecast is fetched again
+        weatherSwap();
+    } else {
+        weatherSchedule.nextFetch = 0;
+    }
+    weatherRetryDelay = 0;
+    logReply("Busca no próximo loop (%d requisições hoje de %d)", requestBudget.used, requestBudget.limit);
+}
+
+void consoleNTP(char* args) {
+    long index;
+    if (consoleNumber(args, index)) {
+        if (index < 0 || index >= numNTPServers) {
+            logReply("Servidor NTP de 0 a %d", numNTPServers - 1);
+            return;
+        }
+        ntpSrvIndex = index;
+        publish(TOPIC_NTP);
+    }
+    timeClient.setPoolServerName(ntpServers[ntpSrvIndex]);
+    ntpFailover = -1; // A failover under way gives way to this sync
+    lastNTPSyncMillis = millis() - NTP_SYNC_INTERVAL; // syncNTP() runs it in this loop
+    logReply("Sincronizando com %s (offset %ld s, atraso %lu ms)", ntpServers[ntpSrvIndex], ntpOffset, ntpDelayMs);
+}
+
+void consoleScreen(char* args) {
+    long n;
+    if (!consoleNumber(args, n)) {
+        for (int i = 0; i < NUM_SCREENS; i++) {
+            logReply("%c%d %s", i == counter ? '*' : ' ', i, screens[i].name);
+        }
+        return;
+    }
+    if (n < 0 || n >= NUM_SCREENS) {
+        logReply("Tela de 0 a %d", NUM_SCREENS - 1);
+        return;
+    }
+    counter = n;
+    lastUIMillis = millis();
+}
+
+void consoleLog(char* args) {
+    long level;
+    if (consoleNumber(args, level) && level >= LOG_ERROR && level <= LOG_DEBUG) {
+        logLevel = level;
+    }
+    logReply("Nível do log %d (0 erro, 1 aviso, 2 info, 3 debug), %lu linhas perdidas", logLevel, logDroppedTotal);
+}
+
+void consoleInterval(char* args) {
+    long period;
+    if (consoleNumber(args, period)) {
+        weatherSchedule.period = constrain(period, PROVIDER_PERIOD_MIN, PROVIDER_PERIOD_MAX);
+    }
+    logReply("Período do provedor %ld s, próxima busca em %ld s", weatherSchedule.period,
+             weatherSchedule.nextFetch - (long)timeClient.getEpochTime());
+}
+
+void consoleButtons(char* args) {
+    long values[5];
+    int n = 0;
+    char* rest;
+    for (char* token = strtok_r(args, " ", &rest); token && n < 5; token = strtok_r(NULL, " ", &rest)) {
+        if (!consoleNumber(token, values[n])) {
+            break;
+        }
+        n++;
+    }
+    if (n == 5) {
+        for (int i = 0; i < 5; i++) {
+            buttonThresholds[i] = values[i];
+        }
+    }
+    logReply("ADC %d, limites %d %d %d %d %d", analogRead(BUTTON), buttonThresholds[0], buttonThresholds[1],
+             buttonThresholds[2], buttonThresholds[3], buttonThresholds[4]);
+}
+
+void consoleCpu(char* args) {
+    if (strcmp(args, "auto") == 0 || strcmp(args, "80") == 0) {
+        cpuBoostEnabled = args[0] == 'a';
+    }
+    unsigned long uptime = max(millis() / 1000, 1UL);
+    logReply("CPU %s, %lu s a 160 MHz (+%lu uA em média)", cpuBoostEnabled ? "auto" : "80 MHz",
+             cpuBoostMs / 1000, cpuBoostMs * CPU_BOOST_EXTRA_MA / uptime);
+    for (int i = 0; i < 2; i++) {
+        logReply("  conexão a %d MHz: %lu, média %lu ms", i ? 160 : 80, connectCount[i],
+                 connectCount[i] ? connectMsTotal[i] / connectCount[i] : 0);
+    }
+}
+
+void consoleBench(char* args) {
+    if (bench) {
+        logReply("bench %s em andamento", bench->name);
+        return;
+    }
+    char* rest;
+    char* name = strtok_r(args, " ", &rest);
+    long runs;
+    if (!consoleNumber(strtok_r(NULL, " ", &rest), runs) || runs < 1) {
+        runs = CONSOLE_BENCH_RUNS;
+    }
+    for (const Benchmark& b : benchmarks) {
+        if (name && strcmp(name, b.name) == 0) {
+            if (strncmp(b.name, "owm", 3) == 0 && weatherPayloadLen == 0) {
+                logReply("bench %s: a última resposta não ficou no buffer", b.name);
+                return;
+            }
+            bench = &b;
+            benchLeft = runs;
+            benchRuns = benchMicros = benchMax = 0;
+            return;
+        }
     }
-    return 0;
+    logReply("bench render|snapshot|owm|owmjson [n]");
 }
 
+const ConsoleCommand consoleCommands[] = {
+    {"help",     consoleHelp,     "lista os comandos"},
+    {"metrics",  consoleMetrics,  "mostra as métricas"},
+    {"hist",     consoleHist,     "[reset] histogramas do loop e das buscas"},
+    {"boot",     consoleBoot,     "linha do tempo deste boot e dos anteriores"},
+    {"sun",      consoleSun,      "nascer, pôr e crepúsculo de hoje"},
+    {"usage",    consoleUsage,    "horas em que as telas de clima são vistas"},
+    {"fetch",    consoleFetch,    "[forecast] busca o tempo ou a previsão agora"},
+    {"ntp",      consoleNTP,      "[n] sincroniza, com o servidor n se dado"},
+    {"screen",   consoleScreen,   "[n] lista as telas ou mostra a tela n"},
+    {"log",      consoleLog,      "[0-3] nível do log"},
+    {"interval", consoleInterval, "[s] período do provedor"},
+    {"buttons",  consoleButtons,  "[5 limites] valor do ADC e limites dos botões"},
+    {"cpu",      consoleCpu,      "[auto|80] governador da CPU e tempos de conexão"},
+    {"bench",    consoleBench,    "render|snapshot|owm|owmjson [n] mede n execuções"},
+};
+
+void consoleHelp(char* args) {
+    for (const ConsoleCommand& c : consoleCommands) {
+        logReply("%-8s %s", c.name, c.help);
+    }
+}
+
+void consoleRun(char* line) {
+    char* name = line + strspn(line, " ");
+    if (*name == '\0') {
+        return;
+    }
+    char* args = name + strcspn(name, " ");
+    if (*args != '\0') {
+        *args++ = '\0';
+    }
+    while (*args == ' ') {
+        args++;
+    }
+    for (const ConsoleCommand& c : consoleCommands) {
+        if (strcmp(name, c.name) == 0) {
+            c.run(args);
+            return;
+        }
+    }
+    logReply("Comando desconhecido: %s, help lista os comandos", name);
+}
+
+/*
+*   consolePoll() - Advances a running benchmark and reads what was typed
+*/
+void consolePoll() {
+    if (bench) {
+        benchStep();
+    }
+    int n = Serial.available();
+    if (n <= 0) {
+        return;
+    }
+    for (n = min(n, CONSOLE_READ_MAX); n > 0; n--) {
+        char c = Serial.read();
+        if (c == '\r' || c == '\n') {
+            consoleLine[consoleLen] = '\0';
+            if (consoleOverflow) {
+                logReply("Linha longa demais");
+            } else {
+                consoleRun(consoleLine);
+            }
+            consoleLen = 0;
+            consoleOverflow = false;
+        } else if (c == '\b' || c == 127) {
+            consoleLen -= consoleLen > 0;
+        } else if (consoleLen < CONSOLE_LINE_MAX) {
+            consoleLine[consoleLen++] = c;
+        } else {
+            consoleOverflow = true;
+        }
+    }
+}
+#else
+void consolePoll() {}
+#endif
+
 // *************
 // The main loop
 // *************
 void loop()
 {
-
-    // Uncomment the following lines to get the value of the analog pin
-    // into the serial monitor, to adjust the function button
-    // int x = analogRead(BUTTON);
-    // Serial.print(x);
+    unsigned long loopStart = micros();
 
     // Reads the buttons and take action if some is pressed
     if (millis() - lastUIMillis > 666) {
@@ -868,43 +3121,28 @@ void loop()
         
         switch (buttonState) {
             case 1:
-                #ifdef SERIALPRINT
-                Serial.printf("Select %d\n", counter);
-                #endif
+                LOGD("Select %s", screens[counter].name);
                 break;
 
             case 2:
-                counter--;
-                if (counter < minUI) {
-                    counter = maxUI;
-                }
-                #ifdef SERIALPRINT
-                Serial.printf("Left %d\n", counter);
-                #endif
+                counter = (counter + NUM_SCREENS - 1) % NUM_SCREENS;
+                lastUIMillis = millis();
+                LOGD("Left %s", screens[counter].name);
                 break;
 
             case 3:
-                counterUD--;
-                #ifdef SERIALPRINT
-                Serial.println("Down");
-                #endif
-                break;
-
             case 4:
-                counterUD++;
-                #ifdef SERIALPRINT
-                Serial.println("Up");
-                #endif
+                if (screens[counter].upDown) {
+                    screens[counter].upDown(buttonState == 4 ? 1 : -1);
+                    lastUIMillis = millis();
+                }
+                LOGD("%s", buttonState == 4 ? "Up" : "Down");
                 break;
 
             case 5:
-                counter++;
-                if (counter > maxUI) {
-                    counter = minUI;
-                }
-                #ifdef SERIALPRINT
-                Serial.printf("Right %d\n", counter);
-                #endif
+                counter = (counter + 1) % NUM_SCREENS;
+                lastUIMillis = millis();
+                LOGD("Right %s", screens[counter].name);
                 break;
 
             default:
@@ -912,78 +3150,45 @@ void loop()
                 break;
         }
     }
-    
-    if ((millis() - lastMillis > updateInterval) || (lastCounter != counter) || (lastCounterUD != counterUD) ) {
-        lastMillis = millis();
-
-        timeClient.update();
-        if (!timeClient.isTimeSet()) {
-            #ifdef SERIALPRINT
-            Serial.println("Erro ao atualizar o tempo.");
-            #endif
-            int n = tryNTPServer();
-            if (n < 0) {
-                lcd.clear();
-                lcd.print("Erro ao conectar NTP");
-                delay(10000);
-                ESP.restart();
-            }
-        }
-
-
-        int hours = timeClient.getHours();
-        int minutes = timeClient.getMinutes();
-        int seconds = timeClient.getSeconds();
-
-        if (lastCounter != counter) {
-            lastCounter = counter;
-            lastUIMillis = millis();
-            lcd.clear();
-        }
-        if (lastCounterUD != counterUD) {
-            lastCounterUD = counterUD;
-            lastUIMillis = millis();
-        }
-
-        if (millis() - lastUIMillis > 60000) {
-            counter = 0;
-        }
 
-        switch (counter)
-        {
-        case 0:            
-            printTime(hours, minutes, seconds);
-            break;
-
-        case -2:
-            printNTP();
-            break;
+    bootPoll();
+    if (bootDone()) {
+        syncNTP();
+    }
 
-        case -1:
-            printNetwork();
-            break;
+    if (counter != HOME_SCREEN && millis() - lastUIMillis > 60000) {
+        counter = HOME_SCREEN;
+    }
 
-        case 1: 
-            printDate();
-            break;
-        
-        case 2: 
-            printWeather();
-            break;
-        
-        case 3:
-            printForecast();
-            break;
-        
-        
-        default:
-            printTime(hours, minutes, seconds);
-            break;
-        }
- 
+    publishTime();
+    publishNetwork();
+    sunPoll();
+    renderScreen();
+    peerPoll();
+    metricsPoll();
+    consolePoll();
+    mirrorPoll();
+    logDrain();
+
+    #ifdef SOAKTEST
+    if (bootDone()) {
+        soakCycle();
+    }
+    #else
+    if (millis() - lastHeapMillis > HEAP_REPORT_INTERVAL) {
+        lastHeapMillis = millis();
+        heapSample();
     }
+    #endif
 
-    getForecast();  // Fetch weather forecast data
-    getWeather();  // Fetch current weather data
+    if (bootDone()) {
+        getForecast();  // Fetch weather forecast data
+        getWeather();  // Fetch current weather data
+        weatherFetchPoll(); // A few hundred bytes of the reply
+        radioPoll();
+    }
 
+    loopMicrosLast = micros() - loopStart;
+    loopMicrosMax = max(loopMicrosMax, loopMicrosLast);
+    histogramAdd(loopHistogram, loopMicrosLast);
 }
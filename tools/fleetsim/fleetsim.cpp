@@ -0,0 +1,592 @@
+// fleetsim.cpp
+//
+// Fleet simulator for NTP162 clocks.
+//
+// Runs N virtual clocks for a stretch of virtual time and reports the load
+// they put on the NTP servers and on the weather provider, and how stale the
+// weather they show gets. Each clock has its own boot time, Wi-Fi join time,
+// network losses and random jitter, and runs second by second through the
+// same steps as the firmware: the NTP step of bootPoll(), syncNTP() with
+// failover and restart, getForecast() on the forecast horizon and its own
+// schedule, and getWeather() on the adaptive schedule, with the retry backoff
+// of weatherFetchDone().
+// With -v the clocks fetch lazily (LAZY_FETCH): someone opens the weather
+// screens that many times a day, mostly at two habit hours of each clock, and
+// the report adds the age of the weather found on the screen when it opens.
+//
+// The weather schedule, request budget and view usage are the firmware's own
+// code (include/fetch_schedule.h, include/view_usage.h). The NTP and retry steps call the Arduino core
+// in the firmware, so they are mirrored here with the values of src/main.cpp;
+// keep them in step. The servers are stand-ins: an NTP server answers unless
+// the request is lost or the server is in an outage window, the weather
+// provider publishes a new observation every provider period.
+//
+// Clocks are independent, so they are simulated in chunks on a work-stealing
+// thread pool, each worker counting into its own per-second timeline, merged
+// at the end. Results do not depend on the number of threads.
+//
+// Build with make, run ./fleetsim -h for the options.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fetch_schedule.h>
+#include <view_usage.h>
+
+// Same values as src/main.cpp
+#define NTP_SERVERS 6 // scarlett, a/b/c.ntp.br, time.nist.gov, pool.ntp.org
+#define NTP_SYNC_INTERVAL 60 // Seconds
+#define NTP_FAILOVER_AFTER 3
+#define NTP_RESTART_AFTER 21600
+#define RETRY_BACKOFF_MIN 30
+#define RETRY_BACKOFF_MAX 900
+#define FETCH_INTERVAL 900
+#define FETCH_JITTER FETCH_MARGIN
+#define OWM_DAILY_QUOTA 1000
+#define FORECAST_HOURS 8
+#define FORECAST_SLOT_SECONDS 10800
+#define FORECAST_MIN_HORIZON 64800
+#define FORECAST_FIRST_SLOTS 2
+#define FORECAST_REFETCH_MIN 3600
+#define BOOT_RETRY 10 // bootPoll() waits 10 s after every NTP server failed
+#define RESTART_DELAY 10 // syncNTP() waits 10 s before ESP.restart()
+#define VIEW_SECONDS 20 // A weather screen stays open this long
+#define VIEW_HABIT_SHARE 0.8 // Share of the views at the two habit hours, the rest at any hour
+
+#define CHUNK 32 // Clocks per task
+
+struct Options {
+    int devices = 200;
+    int fleetSize = 0;       // FLEET_SIZE in the firmware, 0 = devices
+    long hours = 24;
+    int threads = 0;         // 0 = hardware threads
+    long bootSpread = 0;     // Boot times spread over this many seconds, 0 = all at once (power cut)
+    double ntpLoss = 0.01;   // Chance an NTP request gets no answer
+    double wifiLoss = 0.02;  // Chance a weather request fails on the network
+    long outageStart = -1;   // Outage of the first NTP server, seconds from the start
+    long outageEnd = -1;
+    long providerPeriod = 600; // Provider publishes an observation this often
+    long providerPhase = 137;  // ...this many seconds past the period boundary
+    double views = 0;          // Weather screen views per clock per day, 0 = eager fetching
+    unsigned seed = 1;
+    const char* csv = nullptr; // Per-minute timeline
+};
+
+static Options options;
+
+/*
+*   Timeline - Requests per second of virtual time
+*/
+struct Timeline {
+    std::vector<uint32_t> ntp[NTP_SERVERS];
+    std::vector<uint32_t> weather;
+    std::vector<uint32_t> forecast;
+
+    explicit Timeline(long seconds) {
+        for (auto& t : ntp) {
+            t.assign(seconds, 0);
+        }
+        weather.assign(seconds, 0);
+        forecast.assign(seconds, 0);
+    }
+
+    void merge(const Timeline& other) {
+        for (int s = 0; s < NTP_SERVERS; s++) {
+            for (size_t i = 0; i < ntp[s].size(); i++) {
+                ntp[s][i] += other.ntp[s][i];
+            }
+        }
+        for (size_t i = 0; i < weather.size(); i++) {
+            weather[i] += other.weather[i];
+            forecast[i] += other.forecast[i];
+        }
+    }
+};
+
+struct DeviceResult {
+    double meanStaleness; // Mean age of the shown observation, seconds
+    long maxStaleness;
+    long blindSeconds;    // Time after boot with no weather at all
+    int restarts;
+    long weatherRequests;
+    long views;
+    double viewAgeSum;    // Age of the observation on the screen when it was opened
+};
+
+/*
+*   Device - One virtual clock
+*/
+struct Device {
+    int id;
+    std::mt19937 rng;
+    long bootAt;
+
+    // syncNTP() state
+    int server;
+    int failover; // Next server of tryNTPServer(), -1 when not failing over
+    long lastSync;
+    long lastSuccess;
+    int consecutiveFailures;
+    bool inOutage;
+
+    // getWeather()/getForecast() state
+    FetchSchedule schedule;
+    FetchSchedule forecastSchedule;
+    RequestBudget budget;
+    long retryAt;
+    long retryDelay;
+    long forecastEnd;     // End of the last forecast slot, 0 = none
+    bool forecastPartial; // Only the first slots were fetched
+    long shownDt;     // Observation shown on the screen, 0 = none
+
+    // Lazy fetching, kept across restarts like the boot record
+    ViewUsage usage;
+    int habit[2];     // Hours of the day the clock is usually looked at
+    long viewUntil;   // A weather screen is open until then
+
+    bool chance(double p) {
+        return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+    }
+
+    long uniform(long lo, long hi) {
+        return std::uniform_int_distribution<long>(lo, hi)(rng);
+    }
+};
+
+static bool ntpAnswers(Device& d, int server, long t, long start) {
+    if (server == 0 && t - start >= options.outageStart && t - start < options.outageEnd) {
+        return false;
+    }
+    return !d.chance(options.ntpLoss);
+}
+
+static long providerDt(long t) {
+    return (t - options.providerPhase) / options.providerPeriod * options.providerPeriod + options.providerPhase;
+}
+
+/*
+*   boot() - bootPoll(): Wi-Fi join, then the NTP servers one per loop until one answers
+*
+*  Returns the time the boot is over, or -1 if the simulation ends first.
+*  The first fetches follow in the loop.
+*/
+static long boot(Device& d, long& t, long start, long end, Timeline& tl) {
+    d.server = 0;
+    d.failover = -1;
+    d.consecutiveFailures = 0;
+    d.inOutage = false;
+    scheduleInit(d.schedule, FETCH_INTERVAL);
+    scheduleInit(d.forecastSchedule, FORECAST_REFETCH_MIN);
+    d.budget = {0, 0, OWM_DAILY_QUOTA / (options.fleetSize ? options.fleetSize : options.devices)};
+    d.retryAt = 0;
+    d.retryDelay = 0;
+    d.forecastEnd = 0;
+    d.forecastPartial = false;
+    d.shownDt = 0;
+
+    t += d.uniform(2, 8); // Wi-Fi scan and join
+    for (int i = 0; t < end; i = (i + 1) % NTP_SERVERS) {
+        tl.ntp[i][t - start]++;
+        if (ntpAnswers(d, i, t, start)) {
+            d.server = i;
+            d.lastSync = t;
+            d.lastSuccess = t;
+            return t;
+        }
+        t++; // forceUpdate() times out after a second
+        if (i == NTP_SERVERS - 1) {
+            t += BOOT_RETRY;
+        }
+    }
+    return -1;
+}
+
+static void ntpStep(Device& d, long t, long start, Timeline& tl, bool& restart) {
+    if (d.failover >= 0) { // tryNTPServer(), one server per loop
+        int i = d.failover;
+        d.failover = i + 1 < NTP_SERVERS ? i + 1 : -1;
+        tl.ntp[i][t - start]++;
+        if (ntpAnswers(d, i, t, start)) {
+            d.server = i;
+            d.failover = -1;
+            d.consecutiveFailures = 0;
+            d.inOutage = false;
+            d.lastSuccess = t;
+            d.lastSync = t;
+        }
+    } else {
+        if (t - d.lastSync < NTP_SYNC_INTERVAL) {
+            return;
+        }
+        d.lastSync = t;
+        tl.ntp[d.server][t - start]++;
+        if (ntpAnswers(d, d.server, t, start)) {
+            d.consecutiveFailures = 0;
+            d.inOutage = false;
+            d.lastSuccess = t;
+            return;
+        }
+        d.consecutiveFailures++;
+        d.inOutage = true;
+        if (d.consecutiveFailures >= NTP_FAILOVER_AFTER) {
+            d.failover = 0;
+        }
+    }
+    if (d.inOutage && t - d.lastSuccess > NTP_RESTART_AFTER) {
+        restart = true;
+    }
+}
+
+static void fetchDone(Device& d, long t, bool ok) {
+    if (ok) {
+        d.retryDelay = 0;
+        return;
+    }
+    d.retryAt = t;
+    d.retryDelay = d.retryDelay == 0 ? RETRY_BACKOFF_MIN : std::min(d.retryDelay * 2, (long)RETRY_BACKOFF_MAX);
+}
+
+static bool fetchAllowed(const Device& d, long t) {
+    return d.retryDelay == 0 || t - d.retryAt >= d.retryDelay;
+}
+
+/*
+*   viewStep() - Opens the weather screens now and then, and counts the view like usageCount()
+*/
+static void viewStep(Device& d, long t, DeviceResult& r) {
+    if (options.views <= 0 || t < d.viewUntil) {
+        return;
+    }
+    int hour = t % SECONDS_PER_DAY / 3600;
+    double rate = options.views * (1 - VIEW_HABIT_SHARE) / SECONDS_PER_DAY;
+    if (hour == d.habit[0] || hour == d.habit[1]) {
+        rate += options.views * VIEW_HABIT_SHARE / 2 / 3600;
+    }
+    if (!d.chance(rate)) {
+        return;
+    }
+    d.viewUntil = t + VIEW_SECONDS;
+    usageView(d.usage, t);
+    if (d.shownDt) {
+        r.views++;
+        r.viewAgeSum += t - d.shownDt;
+    }
+}
+
+/*
+*   fetchWanted() - Lazy fetching lets a due fetch wait unless a view is likely or a screen is open
+*/
+static bool fetchWanted(Device& d, long t, bool fetched) {
+    return options.views <= 0 || t < d.viewUntil || usageLikely(d.usage, t) || !fetched;
+}
+
+static void weatherStep(Device& d, long t, long start, Timeline& tl, DeviceResult& r) {
+    long horizon = d.forecastEnd ? d.forecastEnd - t : 0;
+    bool due = d.forecastPartial ? budgetLeft(d.budget, t) > 0 : scheduleDue(d.forecastSchedule, d.budget, t);
+    if (horizon < FORECAST_MIN_HORIZON && due && fetchAllowed(d, t) && fetchWanted(d, t, d.forecastEnd != 0)) {
+        budgetSpend(d.budget, t);
+        tl.forecast[t - start]++;
+        r.weatherRequests++;
+        bool ok = !d.chance(options.wifiLoss);
+        // With no forecast left only the first slots are asked for, the rest on the next loop
+        int slots = horizon <= 0 && !d.forecastPartial ? FORECAST_FIRST_SLOTS : FORECAST_HOURS;
+        if (ok) {
+            long first = (t + FORECAST_SLOT_SECONDS - 1) / FORECAST_SLOT_SECONDS * FORECAST_SLOT_SECONDS;
+            d.forecastEnd = first + slots * FORECAST_SLOT_SECONDS;
+            d.forecastPartial = slots < FORECAST_HOURS;
+            scheduleSpaced(d.forecastSchedule, d.budget, t);
+        }
+        fetchDone(d, t, ok);
+    }
+    if (scheduleDue(d.schedule, d.budget, t) && fetchAllowed(d, t) && fetchWanted(d, t, d.shownDt != 0)) {
+        budgetSpend(d.budget, t);
+        tl.weather[t - start]++;
+        r.weatherRequests++;
+        bool ok = !d.chance(options.wifiLoss);
+        fetchDone(d, t, ok);
+        if (ok) {
+            long dt = providerDt(t);
+            d.shownDt = std::max(d.shownDt, dt);
+            scheduleUpdate(d.schedule, d.budget, t, dt, d.uniform(0, FETCH_JITTER));
+        }
+    }
+}
+
+/*
+*   simulate() - Runs one clock from its boot to the end of the simulation
+*/
+static void simulate(int id, long start, long end, Timeline& tl, DeviceResult& r) {
+    Device d = {};
+    d.id = id;
+    d.rng.seed(options.seed * 1000003u + id);
+    d.bootAt = start + (options.bootSpread ? d.uniform(0, options.bootSpread) : 0);
+    d.habit[0] = d.uniform(6, 9);   // Breakfast
+    d.habit[1] = d.uniform(17, 22); // Evening
+    r = {};
+
+    double stalenessSum = 0;
+    long shownSeconds = 0;
+    long t = d.bootAt;
+    while (t < end) {
+        if (boot(d, t, start, end, tl) < 0) {
+            break;
+        }
+        bool restart = false;
+        for (; t < end && !restart; t++) {
+            ntpStep(d, t, start, tl, restart);
+            viewStep(d, t, r);
+            weatherStep(d, t, start, tl, r);
+            if (d.shownDt) {
+                long age = t - d.shownDt;
+                stalenessSum += age;
+                shownSeconds++;
+                r.maxStaleness = std::max(r.maxStaleness, age);
+            } else {
+                r.blindSeconds++;
+            }
+        }
+        if (restart) {
+            r.restarts++;
+            t += RESTART_DELAY;
+        }
+    }
+    r.meanStaleness = shownSeconds ? stalenessSum / shownSeconds : 0;
+}
+
+/*
+*   WorkStealingPool - Workers take tasks from their own deque and steal from the others when it runs dry
+*/
+class WorkStealingPool {
+public:
+    typedef std::function<void(int worker)> Task;
+
+    explicit WorkStealingPool(int workers) : queues(workers) {}
+
+    void push(int worker, Task task) {
+        std::lock_guard<std::mutex> lock(queues[worker].mutex);
+        queues[worker].tasks.push_back(std::move(task));
+    }
+
+    void run() {
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < queues.size(); w++) {
+            threads.emplace_back([this, w] { work(w); });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    unsigned long steals() const { return stolen.load(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    std::vector<Queue> queues;
+    std::atomic<unsigned long> stolen{0};
+
+    bool take(size_t w, Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(queues[w].mutex);
+            if (!queues[w].tasks.empty()) {
+                task = std::move(queues[w].tasks.back());
+                queues[w].tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = queues[(w + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front()); // Oldest task, the largest piece left
+                victim.tasks.pop_front();
+                stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t w) {
+        Task task;
+        while (take(w, task)) { // No task creates tasks, so empty everywhere means done
+            task(w);
+        }
+    }
+};
+
+static long percentile(std::vector<long> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1))];
+}
+
+static void peak(const std::vector<uint32_t>& perSecond, const char* name) {
+    auto it = std::max_element(perSecond.begin(), perSecond.end());
+    long busiestMinute = 0, minuteAt = 0;
+    for (size_t m = 0; m * 60 < perSecond.size(); m++) {
+        long sum = 0;
+        for (size_t s = m * 60; s < std::min(perSecond.size(), m * 60 + 60); s++) {
+            sum += perSecond[s];
+        }
+        if (sum > busiestMinute) {
+            busiestMinute = sum;
+            minuteAt = m;
+        }
+    }
+    unsigned long total = 0;
+    for (uint32_t v : perSecond) {
+        total += v;
+    }
+    printf("%-10s %9lu requests, %7.2f/s average, peak %u/s at %lds, busiest minute %ld at %ldmin\n",
+           name, total, (double)total / perSecond.size(), *it, (long)(it - perSecond.begin()), busiestMinute, minuteAt);
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: fleetsim [options]\n"
+            "  -n devices        clocks to simulate (200)\n"
+            "  -f fleet_size     FLEET_SIZE set in the firmware, the daily budget is the quota over it (devices)\n"
+            "  -H hours          virtual time to run (24)\n"
+            "  -t threads        worker threads (all cores)\n"
+            "  -b seconds        spread the boots over this long, 0 boots all at once (0)\n"
+            "  -l loss           NTP request loss (0.01)\n"
+            "  -w loss           weather request failure (0.02)\n"
+            "  -o start:end      outage of the first NTP server, seconds from the start\n"
+            "  -p seconds        provider update period (600)\n"
+            "  -v views          weather screen views per clock per day, fetching lazily (0, eager)\n"
+            "  -s seed           random seed (1)\n"
+            "  -c file           write the per-minute request timeline as CSV\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:H:t:b:l:w:o:p:v:s:c:h")) != -1) {
+        switch (opt) {
+            case 'n': options.devices = atoi(optarg); break;
+            case 'f': options.fleetSize = atoi(optarg); break;
+            case 'H': options.hours = atol(optarg); break;
+            case 't': options.threads = atoi(optarg); break;
+            case 'b': options.bootSpread = atol(optarg); break;
+            case 'l': options.ntpLoss = atof(optarg); break;
+            case 'w': options.wifiLoss = atof(optarg); break;
+            case 'o':
+                if (sscanf(optarg, "%ld:%ld", &options.outageStart, &options.outageEnd) != 2) {
+                    usage();
+                }
+                break;
+            case 'p': options.providerPeriod = atol(optarg); break;
+            case 'v': options.views = atof(optarg); break;
+            case 's': options.seed = atoi(optarg); break;
+            case 'c': options.csv = optarg; break;
+            default: usage();
+        }
+    }
+    if (options.devices < 1 || options.hours < 1 || options.providerPeriod < 1) {
+        usage();
+    }
+    int workers = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+    const long start = 1760000000 / SECONDS_PER_DAY * SECONDS_PER_DAY; // Midnight, so the budget day lines up
+    const long seconds = options.hours * 3600;
+    const long end = start + seconds;
+
+    std::vector<Timeline> timelines(workers, Timeline(seconds));
+    std::vector<DeviceResult> results(options.devices);
+    WorkStealingPool pool(workers);
+    int task = 0;
+    for (int first = 0; first < options.devices; first += CHUNK, task++) {
+        int last = std::min(first + CHUNK, options.devices);
+        pool.push(task % workers, [&, first, last](int w) {
+            for (int id = first; id < last; id++) {
+                simulate(id, start, end, timelines[w], results[id]);
+            }
+        });
+    }
+    pool.run();
+    for (int w = 1; w < workers; w++) {
+        timelines[0].merge(timelines[w]);
+    }
+    const Timeline& tl = timelines[0];
+
+    printf("%d clocks, %ld h, %d workers (%lu tasks stolen)\n", options.devices, options.hours, workers, pool.steals());
+    peak(tl.ntp[0], "scarlett");
+    std::vector<uint32_t> publicNtp(seconds, 0);
+    for (int s = 1; s < NTP_SERVERS; s++) {
+        for (long i = 0; i < seconds; i++) {
+            publicNtp[i] += tl.ntp[s][i];
+        }
+    }
+    peak(publicNtp, "other NTP");
+    std::vector<uint32_t> provider(seconds, 0);
+    for (long i = 0; i < seconds; i++) {
+        provider[i] = tl.weather[i] + tl.forecast[i];
+    }
+    peak(provider, "provider");
+
+    long requests = 0, views = 0;
+    double viewAgeSum = 0;
+    int restarts = 0;
+    std::vector<long> meanAge, maxAge, blind;
+    for (const DeviceResult& r : results) {
+        requests += r.weatherRequests;
+        restarts += r.restarts;
+        views += r.views;
+        viewAgeSum += r.viewAgeSum;
+        meanAge.push_back(lround(r.meanStaleness));
+        maxAge.push_back(r.maxStaleness);
+        blind.push_back(r.blindSeconds);
+    }
+    double perDay = (double)requests * SECONDS_PER_DAY / seconds;
+    printf("provider quota: %.0f requests/day for the fleet, %d allowed (%.0f%%)\n",
+           perDay, OWM_DAILY_QUOTA, 100 * perDay / OWM_DAILY_QUOTA);
+    printf("staleness per clock (s): mean p50 %ld p95 %ld, max p50 %ld p95 %ld worst %ld\n",
+           percentile(meanAge, 0.5), percentile(meanAge, 0.95),
+           percentile(maxAge, 0.5), percentile(maxAge, 0.95), percentile(maxAge, 1.0));
+    printf("time without weather per clock (s): p50 %ld p95 %ld worst %ld, %d restarts\n",
+           percentile(blind, 0.5), percentile(blind, 0.95), percentile(blind, 1.0), restarts);
+    if (options.views > 0) {
+        printf("weather screen views: %ld, weather age when opened mean %.0f s\n",
+               views, views ? viewAgeSum / views : 0.0);
+    }
+
+    if (options.csv) {
+        FILE* f = fopen(options.csv, "w");
+        if (!f) {
+            perror(options.csv);
+            return 1;
+        }
+        fprintf(f, "minute,scarlett,other_ntp,weather,forecast\n");
+        for (long m = 0; m * 60 < seconds; m++) {
+            unsigned long a = 0, b = 0, c = 0, d = 0;
+            for (long s = m * 60; s < std::min(seconds, m * 60 + 60); s++) {
+                a += tl.ntp[0][s];
+                b += publicNtp[s];
+                c += tl.weather[s];
+                d += tl.forecast[s];
+            }
+            fprintf(f, "%ld,%lu,%lu,%lu,%lu\n", m, a, b, c, d);
+        }
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+// driver.cpp
+//
+// Stand-in for libFuzzer where clang is not available, linked with the same
+// targets and built with g++ -fsanitize=address,undefined.
+//
+// It runs every input of the corpus, then mutated copies of them: bit flips,
+// random bytes, inserted and removed runs, duplicated runs, splices of two
+// inputs and truncations. It is not coverage guided, so it finds less than
+// libFuzzer in the same time, but it takes the same options the Makefile
+// passes to libFuzzer:
+//
+//   ./fuzz_owm [-runs=N] [-seed=N] [-max_len=N] [-max_total_time=S] corpus dirs or files...
+//
+// On a crash or a failed check the input is written to crash-<hash> in the
+// current directory, and the target run on it alone reproduces the failure.
+
+#include <dirent.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+extern "C" void __sanitizer_set_death_callback(void (*callback)(void));
+
+static std::vector<std::vector<uint8_t>> corpus;
+static const std::vector<uint8_t>* current = NULL; // Input being run, saved on a crash
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+/*
+*   saveCrash() - Writes the input being run to crash-<hash>
+*/
+static void saveCrash() {
+    if (!current) {
+        return;
+    }
+    uint32_t h = 2166136261UL;
+    for (uint8_t c : *current) {
+        h = (h ^ c) * 16777619UL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "crash-%08x", h);
+    FILE* f = fopen(name, "wb");
+    if (f) {
+        fwrite(current->data(), 1, current->size(), f);
+        fclose(f);
+        fprintf(stderr, "Input written to %s (%zu bytes)\n", name, current->size());
+    }
+    current = NULL;
+}
+
+static void onSignal(int sig) {
+    saveCrash();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static uint32_t rand32() {
+    rng ^= rng << 13; // xorshift64
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)(rng >> 16);
+}
+
+static void addFile(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        exit(1);
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    corpus.push_back(data);
+}
+
+static void addPath(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        exit(1);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        addFile(path);
+        return;
+    }
+    DIR* dir = opendir(path.c_str());
+    while (struct dirent* e = readdir(dir)) {
+        if (e->d_name[0] != '.') {
+            addPath(path + "/" + e->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+/*
+*   mutate() - Applies one random change to an input
+*/
+static void mutate(std::vector<uint8_t>& d, size_t maxLen) {
+    size_t n = d.size();
+    switch (rand32() % 8) {
+        case 0: // Flip a bit
+            if (n) {
+                d[rand32() % n] ^= 1 << (rand32() % 8);
+            }
+            break;
+        case 1: { // Random byte, often an interesting one
+            static const uint8_t special[] = {0, 0xFF, 0x7F, 0x80, 0xC3, '\r', '\n', '"', '\\', '{', '}', '[', ']', ',', '-', '0', '9'};
+            if (n) {
+                d[rand32() % n] = rand32() % 2 ? special[rand32() % sizeof(special)] : rand32();
+            }
+            break;
+        }
+        case 2: { // Insert random bytes
+            size_t at = n ? rand32() % (n + 1) : 0, count = 1 + rand32() % 8;
+            for (size_t i = 0; i < count; i++) {
+                d.insert(d.begin() + at, (uint8_t)rand32());
+            }
+            break;
+        }
+        case 3: // Remove a run
+            if (n) {
+                size_t at = rand32() % n, count = 1 + rand32() % (n - at < 32 ? n - at : 32);
+                d.erase(d.begin() + at, d.begin() + at + count);
+            }
+            break;
+        case 4: // Duplicate a run
+            if (n) {
+                size_t at = rand32() % n, count = 1 + rand32() % (n - at < 64 ? n - at : 64);
+                std::vector<uint8_t> run(d.begin() + at, d.begin() + at + count);
+                d.insert(d.begin() + rand32() % (n + 1), run.begin(), run.end());
+            }
+            break;
+        case 5: { // Splice with another input
+            const std::vector<uint8_t>& other = corpus[rand32() % corpus.size()];
+            if (n && !other.empty()) {
+                size_t cut = rand32() % n, from = rand32() % other.size();
+                d.resize(cut);
+                d.insert(d.end(), other.begin() + from, other.end());
+            }
+            break;
+        }
+        case 6: // Truncate
+            if (n) {
+                d.resize(rand32() % n);
+            }
+            break;
+        case 7: // Overwrite a run with a run from elsewhere
+            if (n > 1) {
+                size_t from = rand32() % n, to = rand32() % n, count = 1 + rand32() % 16;
+                for (size_t i = 0; i < count && from + i < n && to + i < n; i++) {
+                    d[to + i] = d[from + i];
+                }
+            }
+            break;
+    }
+    if (d.size() > maxLen) {
+        d.resize(maxLen);
+    }
+}
+
+static void run(const std::vector<uint8_t>& data) {
+    current = &data;
+    // A copy of the exact size, so that ASan sees a read past the end
+    uint8_t* copy = new uint8_t[data.size() ? data.size() : 1];
+    memcpy(copy, data.data(), data.size());
+    LLVMFuzzerTestOneInput(copy, data.size());
+    delete[] copy;
+    current = NULL;
+}
+
+int main(int argc, char** argv) {
+    long runs = -1, maxTime = 0;
+    size_t maxLen = 8192;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = atol(argv[i] + 6);
+        } else if (strncmp(argv[i], "-seed=", 6) == 0) {
+            rng ^= strtoull(argv[i] + 6, NULL, 10) * 0x2545F4914F6CDD1DULL;
+        } else if (strncmp(argv[i], "-max_len=", 9) == 0) {
+            maxLen = atol(argv[i] + 9);
+        } else if (strncmp(argv[i], "-max_total_time=", 16) == 0) {
+            maxTime = atol(argv[i] + 16);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Ignoring %s\n", argv[i]);
+        } else {
+            addPath(argv[i]);
+        }
+    }
+
+    __sanitizer_set_death_callback(saveCrash);
+    signal(SIGABRT, onSignal);
+    signal(SIGSEGV, onSignal);
+
+    for (const std::vector<uint8_t>& input : corpus) {
+        run(input);
+    }
+    if (corpus.empty()) {
+        corpus.push_back(std::vector<uint8_t>());
+    }
+    if (runs < 0) {
+        runs = maxTime ? -1 : 0; // No -runs and no -max_total_time: just the corpus
+    }
+
+    time_t start = time(NULL);
+    long done = 0;
+    for (; runs < 0 || done < runs; done++) {
+        if (maxTime && time(NULL) - start >= maxTime) {
+            break;
+        }
+        std::vector<uint8_t> input = corpus[rand32() % corpus.size()];
+        int changes = 1 + rand32() % 4;
+        for (int i = 0; i < changes; i++) {
+            mutate(input, maxLen);
+        }
+        run(input);
+    }
+    printf("%s: %zu corpus inputs, %ld mutated runs, %ld s, no failure\n", argv[0], corpus.size(), done,
+           (long)(time(NULL) - start));
+    return 0;
+}
@@ -0,0 +1,61 @@
+// fuzz.h
+//
+// Shared by the fuzz targets.
+//
+// The firmware gets its input in the pieces the socket happens to return, so
+// every streaming target decodes each input twice, in one piece and in pieces
+// of varying size, and checks that both give the same result.
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Aborts with a message, the fuzzer keeps the input that got here
+#define FUZZ_CHECK(cond)                                                         \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort();                                                             \
+        }                                                                        \
+    } while (0)
+
+/*
+*   FuzzPieces - Cuts an input in pieces of 1 to 128 bytes
+*
+*  The sizes follow from a hash of the input, a run is reproducible from the
+*  saved input alone. With whole set the input comes in one piece.
+*/
+struct FuzzPieces {
+    const uint8_t* data;
+    size_t left;
+    uint32_t state;
+    bool whole;
+
+    FuzzPieces(const uint8_t* input, size_t size, bool whole) : data(input), left(size), state(2166136261UL), whole(whole) {
+        for (size_t i = 0; i < size; i++) {
+            state = (state ^ input[i]) * 16777619UL; // FNV-1a
+        }
+    }
+
+    // Next piece, false at the end of the input
+    bool next(const uint8_t*& piece, size_t& len) {
+        if (left == 0) {
+            return false;
+        }
+        state = state * 1103515245 + 12345;
+        len = whole ? left : 1 + (state >> 16) % 128;
+        if (len > left) {
+            len = left;
+        }
+        piece = data;
+        data += len;
+        left -= len;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,128 @@
+// fuzz_http.cpp
+//
+// Fuzz target for include/http_body.h: a whole HTTP response, status line,
+// headers and body, read the way fetchPoll() reads it off the socket,
+// through the chunked decoder and inflate when the headers ask for them.
+// The body is also decoded into a sink, the way a streamed provider gets it,
+// which must see the same bytes as the buffer whenever the buffer takes them.
+
+#include <string.h>
+
+#include <string>
+
+#include <http_body.h>
+
+#include "fuzz.h"
+
+#define MAX_RESPONSE_SIZE 4096 // Same as the firmware
+
+static Inflate inflater;
+
+struct Decoded {
+    bool headersDone, overflow, truncated, kept;
+    int inflateStatus;
+    size_t len;
+};
+
+static void sinkAppend(void* ctx, const uint8_t* data, size_t len) {
+    ((std::string*)ctx)->append((const char*)data, len);
+}
+
+/*
+*   decode() - Reads a response from data into out, in one piece or in pieces
+*
+*  With sunk the body goes to it and out is the inflate window.
+*/
+static Decoded decode(const uint8_t* data, size_t size, bool whole, char* out, std::string* sunk = NULL) {
+    Decoded d = {};
+    HttpBody body;
+    bodyBegin(body, out, MAX_RESPONSE_SIZE, &inflater);
+    if (sunk) {
+        bodySink(body, sinkAppend, sunk);
+    }
+
+    // Header lines as fetchPoll() cuts them, the first one is the status line
+    char line[128];
+    size_t n = 0, i = 0;
+    bool status = true;
+    while (i < size && !d.headersDone) {
+        char c = data[i++];
+        if (c != '\n') {
+            if (n < sizeof(line) - 1) {
+                line[n++] = c;
+            }
+            continue;
+        }
+        if (n > 0 && line[n - 1] == '\r') {
+            n--;
+        }
+        line[n] = '\0';
+        if (status) {
+            status = false;
+        } else if (n == 0) {
+            d.headersDone = true;
+        } else {
+            bodyHeader(body, line);
+        }
+        n = 0;
+    }
+    if (!d.headersDone) {
+        return d;
+    }
+
+    bodyStart(body);
+    FuzzPieces pieces(data + i, size - i, whole);
+    const uint8_t* piece;
+    size_t len;
+    while (!body.overflow && body.inflateStatus == INFLATE_OK && !bodyComplete(body) && pieces.next(piece, len)) {
+        bodyReceive(body, piece, len);
+    }
+    bodyFinish(body);
+
+    d.kept = bodyKept(body);
+    if (sunk) {
+        FUZZ_CHECK(!body.overflow && body.inflateStatus != INFLATE_ERR_SIZE);
+        FUZZ_CHECK(sunk->size() == body.outLen);
+        FUZZ_CHECK(!d.kept || (out[body.outLen] == '\0' && memcmp(out, sunk->data(), body.outLen) == 0));
+    } else {
+        FUZZ_CHECK(body.outLen < MAX_RESPONSE_SIZE);
+        FUZZ_CHECK(out[body.outLen] == '\0');
+    }
+    d.overflow = body.overflow || body.inflateStatus == INFLATE_ERR_SIZE;
+    d.truncated = bodyTruncated(body);
+    d.inflateStatus = body.inflateStatus;
+    d.len = body.outLen;
+    return d;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // Heap buffers, so that ASan sees a write one past the end
+    char* whole = new char[MAX_RESPONSE_SIZE];
+    char* pieces = new char[MAX_RESPONSE_SIZE];
+    Decoded a = decode(data, size, true, whole);
+    Decoded b = decode(data, size, false, pieces);
+
+    // How the socket cut the body must not change what is accepted
+    FUZZ_CHECK(a.headersDone == b.headersDone);
+    FUZZ_CHECK(a.overflow == b.overflow);
+    if (!a.overflow) {
+        FUZZ_CHECK(a.inflateStatus == b.inflateStatus);
+    }
+    if (!a.overflow && a.inflateStatus >= 0) { // After an inflate error the rest of the body is not read
+        FUZZ_CHECK(a.truncated == b.truncated);
+        FUZZ_CHECK(a.len == b.len && memcmp(whole, pieces, a.len) == 0);
+    }
+
+    // A sink never runs out of room, and a ring as large as the buffer takes
+    // every back reference the buffer could
+    std::string sunk;
+    Decoded c = decode(data, size, false, pieces, &sunk);
+    FUZZ_CHECK(a.headersDone == c.headersDone);
+    if (a.headersDone && !a.overflow && a.inflateStatus >= 0) {
+        FUZZ_CHECK(a.inflateStatus == c.inflateStatus && a.truncated == c.truncated);
+        FUZZ_CHECK(c.kept && a.len == c.len && memcmp(whole, sunk.data(), a.len) == 0);
+    }
+    delete[] whole;
+    delete[] pieces;
+    return 0;
+}
@@ -0,0 +1,92 @@
+// fuzz_inflate.cpp
+//
+// Fuzz target for include/inflate.h: the input is a gzip stream, inflated
+// the two ways the firmware can use the decoder:
+//
+//   - into an output buffer the size of the response buffer, no sink
+//   - through a sink, with a small ring window
+//
+// Each one in one piece and in pieces, which must end the same way. When
+// both ways get to the end of the stream they must agree on the output.
+
+#include <string.h>
+
+#include <inflate.h>
+
+#include "fuzz.h"
+
+#define OUTPUT_SIZE 4095   // MAX_RESPONSE_SIZE - 1, as fetchPoll() uses it without a sink
+#define RING_SIZE 1024     // Window used with the sink, a power of 2
+#define SINK_KEEP 65536    // Sink output kept for the comparison
+
+struct SinkOutput {
+    uint8_t* data;
+    size_t len;   // Bytes kept
+    size_t total; // Bytes seen
+};
+
+static void sinkWrite(void* ctx, const uint8_t* data, size_t len) {
+    SinkOutput& out = *(SinkOutput*)ctx;
+    FUZZ_CHECK(len <= RING_SIZE);
+    size_t n = len < SINK_KEEP - out.len ? len : SINK_KEEP - out.len;
+    memcpy(out.data + out.len, data, n);
+    out.len += n;
+    out.total += len;
+}
+
+static int feed(Inflate& z, const uint8_t* data, size_t size, bool whole) {
+    FuzzPieces pieces(data, size, whole);
+    const uint8_t* piece;
+    size_t len;
+    int status = INFLATE_OK;
+    while (status == INFLATE_OK && pieces.next(piece, len)) {
+        status = inflateFeed(z, piece, len, false);
+    }
+    if (status == INFLATE_OK) {
+        status = inflateFeed(z, NULL, 0, true);
+    }
+    FUZZ_CHECK(status != INFLATE_OK);
+    return status;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static Inflate z;
+
+    // Into a buffer, heap allocated so that ASan sees a write past its end
+    uint8_t* whole = new uint8_t[OUTPUT_SIZE];
+    uint8_t* pieces = new uint8_t[OUTPUT_SIZE];
+    inflateBegin(z, whole, OUTPUT_SIZE, NULL, NULL);
+    int statusA = feed(z, data, size, true);
+    uint32_t lenA = z.outTotal;
+    inflateBegin(z, pieces, OUTPUT_SIZE, NULL, NULL);
+    int statusB = feed(z, data, size, false);
+    FUZZ_CHECK(statusA == statusB);
+    FUZZ_CHECK(lenA <= OUTPUT_SIZE);
+    if (statusA == INFLATE_DONE) {
+        FUZZ_CHECK(z.outTotal == lenA && memcmp(whole, pieces, lenA) == 0);
+    }
+
+    // Through a sink
+    uint8_t* ring = new uint8_t[RING_SIZE];
+    SinkOutput outA = {new uint8_t[SINK_KEEP], 0, 0};
+    SinkOutput outB = {new uint8_t[SINK_KEEP], 0, 0};
+    inflateBegin(z, ring, RING_SIZE, sinkWrite, &outA);
+    int sinkA = feed(z, data, size, true);
+    inflateBegin(z, ring, RING_SIZE, sinkWrite, &outB);
+    int sinkB = feed(z, data, size, false);
+    FUZZ_CHECK(sinkA == sinkB);
+    if (sinkA == INFLATE_DONE) {
+        FUZZ_CHECK(outA.total == outB.total && outA.len == outB.len && memcmp(outA.data, outB.data, outA.len) == 0);
+        FUZZ_CHECK(outA.total == z.outTotal);
+    }
+    if (sinkA == INFLATE_DONE && statusA == INFLATE_DONE) {
+        FUZZ_CHECK(outA.total == lenA && memcmp(outA.data, whole, lenA) == 0);
+    }
+
+    delete[] whole;
+    delete[] pieces;
+    delete[] ring;
+    delete[] outA.data;
+    delete[] outB.data;
+    return 0;
+}
@@ -0,0 +1,40 @@
+// fuzz_openmeteo.cpp
+//
+// Fuzz target for include/provider_openmeteo.h: the input is an Open-Meteo
+// CSV body, parsed as the current weather and as the forecast. The parsers
+// cut the body in place and, like fetchPoll() does, the buffer holds
+// a terminator after the body.
+
+#include <string.h>
+
+#include <provider_openmeteo.h>
+
+#include "fuzz.h"
+
+static char* copyBody(const uint8_t* data, size_t size) {
+    char* body = new char[size + 1]; // Heap, so that ASan sees a read past the terminator
+    memcpy(body, data, size);
+    body[size] = '\0';
+    return body;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    char* body = copyBody(data, size);
+    CurrentWeather current;
+    memset(&current, 0, sizeof(current));
+    openMeteoParseCurrent(body, size, current);
+    FUZZ_CHECK(memchr(current.description, '\0', sizeof(current.description)) != NULL);
+    FUZZ_CHECK(current.location[0] == '\0');
+    delete[] body;
+
+    body = copyBody(data, size);
+    Forecast slots[FORECAST_HOURS];
+    memset(slots, 0, sizeof(slots));
+    int count = openMeteoParseForecast(body, size, slots, FORECAST_HOURS);
+    FUZZ_CHECK(count >= -1 && count <= FORECAST_HOURS);
+    for (int i = 0; i < FORECAST_HOURS; i++) {
+        FUZZ_CHECK(memchr(slots[i].description, '\0', sizeof(slots[i].description)) != NULL);
+    }
+    delete[] body;
+    return 0;
+}
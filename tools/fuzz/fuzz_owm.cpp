@@ -0,0 +1,56 @@
+// fuzz_owm.cpp
+//
+// Fuzz target for include/owm_pull.h: the input is an OpenWeatherMap body,
+// parsed as a /weather and as a /forecast response, each in one piece and in
+// pieces, which must give the same weather.
+
+#include <string.h>
+
+#include <owm_pull.h>
+
+#include "fuzz.h"
+
+/*
+*   terminated() - True if a string field ends inside its array
+*/
+static bool terminated(const char* s, size_t size) {
+    return memchr(s, '\0', size) != NULL;
+}
+
+static int parse(const uint8_t* data, size_t size, bool whole, CurrentWeather* current, Forecast* slots, OwmPull& p) {
+    owmPullBegin(p, current, slots, slots ? FORECAST_HOURS : 0);
+    FuzzPieces pieces(data, size, whole);
+    const uint8_t* piece;
+    size_t len;
+    int status = OWM_PULL_MORE;
+    while (status == OWM_PULL_MORE && pieces.next(piece, len)) {
+        status = owmPullFeed(p, (const char*)piece, len);
+    }
+    FUZZ_CHECK(p.depth <= OWM_PULL_DEPTH);
+    return status;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static OwmPull a, b;
+
+    CurrentWeather currentA, currentB;
+    int statusA = parse(data, size, true, &currentA, NULL, a);
+    int statusB = parse(data, size, false, &currentB, NULL, b);
+    FUZZ_CHECK(statusA == statusB && a.offset == b.offset);
+    FUZZ_CHECK(terminated(currentA.description, sizeof(currentA.description)));
+    FUZZ_CHECK(terminated(currentA.location, sizeof(currentA.location)));
+    FUZZ_CHECK(memcmp(&currentA, &currentB, sizeof(currentA)) == 0);
+
+    Forecast slotsA[FORECAST_HOURS], slotsB[FORECAST_HOURS];
+    memset(slotsA, 0, sizeof(slotsA));
+    memset(slotsB, 0, sizeof(slotsB));
+    statusA = parse(data, size, true, NULL, slotsA, a);
+    statusB = parse(data, size, false, NULL, slotsB, b);
+    FUZZ_CHECK(statusA == statusB && a.offset == b.offset);
+    FUZZ_CHECK(a.count >= 0 && a.count <= FORECAST_HOURS && a.count == b.count);
+    for (int i = 0; i < FORECAST_HOURS; i++) {
+        FUZZ_CHECK(terminated(slotsA[i].description, sizeof(slotsA[i].description)));
+    }
+    FUZZ_CHECK(memcmp(slotsA, slotsB, sizeof(slotsA)) == 0);
+    return 0;
+}
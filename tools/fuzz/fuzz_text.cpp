@@ -0,0 +1,34 @@
+// fuzz_text.cpp
+//
+// Fuzz target for include/lcd_text.h: the input is a description or a city
+// name as it comes from a provider, made ready for the LCD the way
+// getWeather() and the weather screens do it.
+
+#include <string.h>
+
+#include <lcd_text.h>
+
+#include "fuzz.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    char* text = new char[size + 1]; // Heap, so that ASan sees a write past the end
+    memcpy(text, data, size);
+    text[size] = '\0';
+    size_t before = strlen(text);
+
+    upperFirstLetter(text);
+    removeAccents(text);
+    size_t after = strlen(text);
+    FUZZ_CHECK(after <= before);
+    FUZZ_CHECK(memchr(text, 0xC3, after) == NULL); // Every two byte sequence was replaced
+
+    char* window = new char[17]; // scrollBuffer of src/main.cpp, on the heap so that ASan sees a write past it
+    for (int pos = 0; pos < (int)after + 2; pos += 7) {
+        getScrollWindow(text, window, pos);
+        FUZZ_CHECK(strlen(window) <= 16);
+        FUZZ_CHECK(after == 0 || window[0] == text[pos % after]);
+    }
+    delete[] window;
+    delete[] text;
+    return 0;
+}
@@ -0,0 +1,493 @@
+// bench.cpp
+//
+// Load benchmark for the weather gateway and the metrics endpoint of the clocks.
+//
+//   ./bench [-h host] [-p port] [-c connections] [-d seconds] [-l locations]
+//       Runs one client thread per connection, each one opening a connection,
+//       asking for a snapshot and reading the reply as fast as it can, over
+//       `locations` different places. Prints requests per second and latency.
+//
+//   ./bench -h clock -p 80 -u /metrics -c 2
+//       Same load on a fixed path, e.g. the metrics endpoint of a clock.
+//
+//   ./bench -s port [-r dir]
+//       Runs a stand-in upstream answering OpenWeatherMap and Open-Meteo
+//       requests with the recorded responses of tools/responses (or dir), so
+//       the gateway and the providers can be measured without the internet.
+//
+//   ./bench -m [-z] [-p port] [-g gateway port] [-n fetches]
+//       Cost of each weather provider per fetch, with the requests the clock
+//       builds: OpenWeatherMap and Open-Meteo from the stand-in on port, the
+//       gateway snapshot from the gateway on gateway port. Each fetch is read
+//       and parsed as the clock does it, with include/http_body.h and the
+//       provider's parser, and the bytes on the wire, the body, the fetch
+//       time and the parse time are reported, the times as the median of
+//       `fetches`. The bytes are what the clock receives, the times are the
+//       host's and only compare the providers with each other; the TLS of
+//       OpenWeatherMap is not included.
+//       With -z every fetch is made twice, without and with the
+//       Accept-Encoding: gzip the clock sends, and the decode column is the
+//       inflate time of the gzip replies. The stand-in sends the .gz of a
+//       recorded response when asked, the gateway never compresses.
+//
+// `make run-bench` starts the stand-in and the gateway and runs the benchmark,
+// `make run-providers` the provider cost.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <http_body.h>
+#include <owm_pull.h>
+#include <provider_openmeteo.h>
+#include <weather_snapshot.h>
+
+#define LOGW(...) // provider_gateway.h logs a bad tag on the clock
+static std::string snapshotKey = "bench"; // PEER_KEY the gateway was started with, as in make run-bench
+
+/*
+*   snapshotTagValid() - The check of main.cpp, with OpenSSL instead of BearSSL
+*/
+bool snapshotTagValid(const uint8_t* data, size_t len, const uint8_t* tag) {
+    unsigned char full[EVP_MAX_MD_SIZE];
+    unsigned int fullLen = 0;
+    HMAC(EVP_sha256(), snapshotKey.data(), snapshotKey.size(), data, len, full, &fullLen);
+    return CRYPTO_memcmp(full, tag, SNAPSHOT_TAG_LEN) == 0;
+}
+
+#include <provider_gateway.h>
+
+#define MAX_RESPONSE_SIZE 4096 // Same as src/main.cpp
+
+typedef std::chrono::steady_clock Clock;
+
+/*
+*   OpenWeatherMap as in include/provider_owm.h, which needs ArduinoJson for its reference parsers
+*/
+static void owmBuildRequest(char* request, size_t size, bool forecast, int slots, const char* lat, const char* lon,
+                            const char* apiKey) {
+    if (forecast) {
+        snprintf(request, size,
+                 "GET /data/2.5/forecast?lat=%s&lon=%s&cnt=%d&appid=%s&units=metric&lang=pt_br HTTP/1.1\r\n"
+                 "Host: api.openweathermap.org\r\n"
+                 "Connection: close\r\n\r\n",
+                 lat, lon, slots, apiKey);
+    } else {
+        snprintf(request, size,
+                 "GET /data/2.5/weather?lat=%s&lon=%s&appid=%s&units=metric&lang=pt_br HTTP/1.1\r\n"
+                 "Host: api.openweathermap.org\r\n"
+                 "Connection: close\r\n\r\n",
+                 lat, lon, apiKey);
+    }
+}
+
+static bool owmParseCurrent(char* body, size_t len, CurrentWeather& current) {
+    OwmPull p;
+    owmPullBegin(p, &current, NULL, 0);
+    return owmPullFeed(p, body, len) == OWM_PULL_DONE;
+}
+
+static int owmParseForecast(char* body, size_t len, Forecast* slots, int maxSlots) {
+    OwmPull p;
+    owmPullBegin(p, NULL, slots, maxSlots);
+    return owmPullFeed(p, body, len) == OWM_PULL_DONE ? p.count : -1;
+}
+
+static const WeatherProvider openWeatherMap = {
+    "OpenWeatherMap", "api.openweathermap.org", 443,
+    owmBuildRequest, owmParseCurrent, owmParseForecast,
+    NULL, NULL, NULL
+};
+
+/*
+*   Recorded responses the stand-in answers with
+*/
+struct Recorded {
+    const char* file;
+    const char* contentType;
+    std::string body;
+    std::string gzip; // The .gz next to it, empty if there is none
+};
+
+static Recorded recorded[] = {
+    {"owm_current.json", "application/json; charset=utf-8", "", ""},
+    {"owm_forecast.json", "application/json; charset=utf-8", "", ""},
+    {"openmeteo_current.csv", "text/csv", "", ""},
+    {"openmeteo_forecast.csv", "text/csv", "", ""},
+};
+
+static bool readFile(const std::string& path, std::string& out) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    out.clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        out.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+/*
+*   standin() - Upstream stand-in, answers each connection with the recorded response it asks for
+*/
+static int standin(int port, const char* dir) {
+    for (Recorded& r : recorded) {
+        if (!readFile(std::string(dir) + "/" + r.file, r.body)) {
+            fprintf(stderr, "standin: cannot read %s/%s\n", dir, r.file);
+            return 1;
+        }
+        readFile(std::string(dir) + "/" + r.file + ".gz", r.gzip);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        perror("standin");
+        return 1;
+    }
+    for (;;) {
+        int c = accept(fd, nullptr, nullptr);
+        if (c < 0) {
+            continue;
+        }
+        char req[2048];
+        ssize_t n = recv(c, req, sizeof(req) - 1, 0);
+        req[n > 0 ? n : 0] = '\0';
+        const Recorded& r = strstr(req, "/data/2.5/forecast") ? recorded[1]
+                            : strstr(req, "/data/2.5/weather") ? recorded[0]
+                            : strstr(req, "hourly=")           ? recorded[3]
+                                                               : recorded[2];
+        bool gzip = strstr(req, "Accept-Encoding: gzip") && !r.gzip.empty();
+        const std::string& body = gzip ? r.gzip : r.body;
+        std::string out = std::string("HTTP/1.0 200 OK\r\nContent-Type: ") + r.contentType +
+                          (gzip ? "\r\nContent-Encoding: gzip" : "") +
+                          "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        send(c, out.data(), out.size(), MSG_NOSIGNAL);
+        close(c);
+    }
+}
+
+struct Result {
+    unsigned long ok = 0;
+    unsigned long errors = 0;
+    std::vector<uint32_t> latencyUs;
+};
+
+static const char* path = nullptr; // Fixed path instead of the snapshot of a location
+
+static void client(sockaddr_in addr, int locations, int id, Clock::time_point end, Result* result) {
+    int n = 0;
+    while (Clock::now() < end) {
+        int place = (id + n++) % locations;
+        char req[160];
+        int len = path ? snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n", path)
+                       : snprintf(req, sizeof(req),
+                                  "GET /snapshot?lat=-25.%04d&lon=-49.2908 HTTP/1.1\r\nHost: gateway\r\n"
+                                  "Connection: close\r\n\r\n", place);
+        Clock::time_point start = Clock::now();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        bool ok = fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+                  send(fd, req, len, MSG_NOSIGNAL) == len;
+        char buf[1024];
+        size_t total = 0;
+        ssize_t r;
+        bool status200 = false;
+        while (ok && (r = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            if (total == 0) {
+                status200 = r > 12 && memcmp(buf + 9, "200", 3) == 0;
+            }
+            total += r;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (ok && status200) {
+            result->ok++;
+            result->latencyUs.push_back(
+                std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+        } else {
+            result->errors++;
+        }
+    }
+}
+
+/*
+*   Cost of the providers
+*/
+struct Cost {
+    size_t wireBytes = 0, bodyBytes = 0;
+    bool gzip = false; // The reply came gzipped
+    std::vector<uint32_t> fetchUs, decodeNs, parseNs;
+    unsigned long errors = 0;
+};
+
+static uint32_t median(std::vector<uint32_t> v) {
+    if (v.empty()) {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+static uint32_t microsSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+static uint32_t nanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+/*
+*   fetchOnce() - Sends a request and reads the reply until the server closes
+*/
+static bool fetchOnce(sockaddr_in addr, const char* req, std::string& reply) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    size_t len = strlen(req);
+    bool ok = fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+              send(fd, req, len, MSG_NOSIGNAL) == (ssize_t)len;
+    char buf[1024];
+    ssize_t r;
+    reply.clear();
+    while (ok && (r = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        reply.append(buf, r);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ok && !reply.empty();
+}
+
+/*
+*   decodeReply() - Reads a reply into payload as fetchPoll() does, returns the body length or -1
+*/
+static long decodeReply(const std::string& reply, char* payload, bool& gzip) {
+    static Inflate inflater;
+    HttpBody body;
+    bodyBegin(body, payload, MAX_RESPONSE_SIZE, &inflater);
+    size_t headerEnd = reply.find("\r\n\r\n");
+    int status = 0;
+    if (headerEnd == std::string::npos || sscanf(reply.c_str(), "HTTP/%*s %d", &status) != 1 || status != 200) {
+        return -1;
+    }
+    for (size_t at = reply.find("\r\n") + 2; at < headerEnd;) {
+        size_t end = reply.find("\r\n", at);
+        bodyHeader(body, reply.substr(at, end - at).c_str());
+        at = end + 2;
+    }
+    bodyStart(body);
+    bodyReceive(body, (const uint8_t*)reply.data() + headerEnd + 4, reply.size() - headerEnd - 4);
+    bodyFinish(body);
+    gzip = body.gzip;
+    if (body.overflow || body.inflateStatus < 0 || bodyTruncated(body)) {
+        return -1;
+    }
+    return body.outLen;
+}
+
+/*
+*   measureProvider() - Fetches and parses the current weather or the forecast of a provider `fetches` times
+*/
+static Cost measureProvider(const WeatherProvider& provider, bool forecast, bool gzip, sockaddr_in addr, int fetches) {
+    Cost cost;
+    char req[1024];
+    provider.buildRequest(req, sizeof(req), forecast, FORECAST_HOURS, "-25.504", "-49.2908", "bench");
+    size_t reqLen = strlen(req);
+    if (gzip && reqLen >= 2) {
+        // As fetchStart(), the header goes before the blank line
+        snprintf(req + reqLen - 2, sizeof(req) - reqLen + 2, "Accept-Encoding: gzip\r\n\r\n");
+    }
+    static char payload[MAX_RESPONSE_SIZE];
+    std::string reply;
+    for (int i = 0; i < fetches; i++) {
+        Clock::time_point start = Clock::now();
+        if (!fetchOnce(addr, req, reply)) {
+            cost.errors++;
+            continue;
+        }
+        uint32_t fetchUs = microsSince(start);
+
+        start = Clock::now();
+        long len = decodeReply(reply, payload, cost.gzip);
+        uint32_t decodeNs = nanosSince(start);
+
+        start = Clock::now();
+        CurrentWeather current;
+        Forecast slots[FORECAST_HOURS];
+        bool ok = len >= 0 && (forecast ? provider.parseForecast(payload, len, slots, FORECAST_HOURS) > 0
+                                        : provider.parseCurrent(payload, len, current));
+        uint32_t parseNs = nanosSince(start);
+        if (!ok) {
+            cost.errors++;
+            continue;
+        }
+        cost.wireBytes = reply.size();
+        cost.bodyBytes = len;
+        cost.fetchUs.push_back(fetchUs);
+        cost.decodeNs.push_back(decodeNs);
+        cost.parseNs.push_back(parseNs);
+    }
+    return cost;
+}
+
+/*
+*   providerCosts() - Table of the cost of each provider, per fetch and per refresh (current + forecast)
+*
+*   With compare, each provider is measured without and with gzip, and the
+*   bytes saved are weighed against the inflate time.
+*/
+static int providerCosts(sockaddr_in standinAddr, int gatewayPort, int fetches, bool compare) {
+    sockaddr_in gatewayAddr = standinAddr;
+    gatewayAddr.sin_port = htons(gatewayPort);
+    struct Row {
+        const WeatherProvider* provider;
+        sockaddr_in addr;
+    };
+    std::vector<Row> rows = {{&openWeatherMap, standinAddr}, {&openMeteo, standinAddr}};
+    if (gatewayPort) {
+        rows.push_back({&weatherGateway, gatewayAddr});
+    }
+
+    int failures = 0;
+    printf("%-15s %-9s %-8s %6s %6s %9s %9s %9s\n", "provider", "fetch", "encoding", "wire", "body", "fetch us",
+           "decode ns", "parse ns");
+    for (const Row& row : rows) {
+        size_t wire[2] = {0, 0};
+        uint32_t decodeNs[2] = {0, 0};
+        bool gzipped = false; // The server sent gzip when asked
+        for (int gzip = 0; gzip <= (compare ? 1 : 0); gzip++) {
+            uint32_t fetchUs = 0, parseNs = 0;
+            for (bool forecast : {false, true}) {
+                Cost cost = measureProvider(*row.provider, forecast, gzip, row.addr, fetches);
+                if (cost.fetchUs.empty()) {
+                    printf("%-15s %-9s failed\n", row.provider->name, forecast ? "forecast" : "current");
+                    failures++;
+                    continue;
+                }
+                printf("%-15s %-9s %-8s %6zu %6zu %9u %9u %9u", row.provider->name,
+                       forecast ? "forecast" : "current", cost.gzip ? "gzip" : "identity", cost.wireBytes,
+                       cost.bodyBytes, median(cost.fetchUs), median(cost.decodeNs), median(cost.parseNs));
+                printf(cost.errors ? "  %lu errors\n" : "\n", cost.errors);
+                gzipped |= cost.gzip;
+                wire[gzip] += cost.wireBytes;
+                fetchUs += median(cost.fetchUs);
+                decodeNs[gzip] += median(cost.decodeNs);
+                parseNs += median(cost.parseNs);
+            }
+            printf("%-15s %-9s %-8s %6zu %6s %9u %9u %9u\n", row.provider->name, "refresh", gzip && gzipped ? "gzip" : "identity",
+                   wire[gzip], "", fetchUs, decodeNs[gzip], parseNs);
+        }
+        if (compare && !gzipped) {
+            printf("%-15s gzip: not sent by the server\n", row.provider->name);
+        } else if (compare && wire[0]) {
+            printf("%-15s gzip: %ld bytes less per refresh (%.0f%%), for %d ns more decoding\n", row.provider->name,
+                   (long)wire[0] - (long)wire[1], 100.0 * ((long)wire[0] - (long)wire[1]) / wire[0],
+                   (int)decodeNs[1] - (int)decodeNs[0]);
+        }
+    }
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    const char* host = "127.0.0.1";
+    const char* responses = "../responses";
+    int port = 8162, connections = 16, seconds = 10, locations = 50, gatewayPort = 0, fetches = 200;
+    int standinPort = 0;
+    bool providers = false, compare = false;
+    int opt;
+    signal(SIGPIPE, SIG_IGN);
+    while ((opt = getopt(argc, argv, "h:p:c:d:l:u:s:r:mzg:n:")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': connections = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'l': locations = atoi(optarg); break;
+            case 'u': path = optarg; break;
+            case 's': standinPort = atoi(optarg); break;
+            case 'r': responses = optarg; break;
+            case 'm': providers = true; break;
+            case 'z': compare = true; break;
+            case 'g': gatewayPort = atoi(optarg); break;
+            case 'n': fetches = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: bench [-h host] [-p port] [-c connections] [-d seconds] [-l locations | -u path]\n"
+                                "       bench -m [-z] [-h host] [-p port] [-g gateway port] [-n fetches]\n"
+                                "       bench -s port [-r responses dir]\n");
+                return 2;
+        }
+    }
+    if (standinPort) {
+        return standin(standinPort, responses);
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 || connections < 1 || locations < 1) {
+        fprintf(stderr, "bench: bad arguments\n");
+        return 2;
+    }
+    if (providers) {
+        return providerCosts(addr, gatewayPort, fetches < 1 ? 1 : fetches, compare);
+    }
+
+    // Warm the cache so the run measures serving, not the upstream
+    Result warm;
+    client(addr, locations, 0, Clock::now() + std::chrono::milliseconds(500), &warm);
+
+    std::vector<Result> results(connections);
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::seconds(seconds);
+    for (int i = 0; i < connections; i++) {
+        threads.emplace_back(client, addr, locations, i, end, &results[i]);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Result all;
+    for (auto& r : results) {
+        all.ok += r.ok;
+        all.errors += r.errors;
+        all.latencyUs.insert(all.latencyUs.end(), r.latencyUs.begin(), r.latencyUs.end());
+    }
+    std::sort(all.latencyUs.begin(), all.latencyUs.end());
+    auto pct = [&](double p) {
+        return all.latencyUs.empty() ? 0u : all.latencyUs[(size_t)(p * (all.latencyUs.size() - 1))];
+    };
+    if (path) {
+        printf("%d connections, %s, %.1f s\n", connections, path, elapsed);
+    } else {
+        printf("%d connections, %d locations, %.1f s\n", connections, locations, elapsed);
+    }
+    printf("%lu ok, %lu errors, %.0f requests/s\n", all.ok, all.errors, all.ok / elapsed);
+    printf("latency p50 %u us, p99 %u us, max %u us\n", pct(0.5), pct(0.99), pct(1.0));
+    return all.errors ? 1 : 0;
+}
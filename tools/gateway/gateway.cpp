@@ -0,0 +1,415 @@
+// gateway.cpp
+//
+// Caching weather gateway for NTP162 clocks.
+//
+// The gateway fetches the weather once per location from the upstream
+// provider, keeps the result as a ready to send signed snapshot (see
+// include/weather_snapshot.h) and serves it to the clocks over plain HTTP:
+//
+//   GET /snapshot?lat=-25.504&lon=-49.2908  ->  snapshot body + tag
+//
+// The first request for a location fetches it, concurrent requests for the
+// same location wait for that one fetch. Known locations are refreshed in
+// the background every refresh period, and clocks get the cached copy in
+// the meantime. Locations nobody asked for in a day are dropped.
+//
+// The upstream is Open-Meteo, parsed with the same code the clocks use
+// (include/provider_openmeteo.h). -u points it at a local stand-in that
+// answers in the Open-Meteo CSV format, see bench.cpp.
+//
+// Build with make, run with: ./gateway -k KEY [-p 8162] [-u host:port] [-t threads] [-r seconds]
+// The key must be the PEER_KEY of the clocks.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <provider_openmeteo.h>
+#include <weather_snapshot.h>
+
+#define RETRY_FAILED 60      // Seconds before a failed location is fetched again
+#define IDLE_DROP 86400      // Locations not requested for a day are dropped
+#define FIRST_FETCH_WAIT 15  // Seconds a request waits for the first fetch of its location
+#define STATS_INTERVAL 60    // Seconds between stats lines
+
+struct Options {
+    int port = 8162;
+    std::string upstreamHost = "api.open-meteo.com";
+    int upstreamPort = 80;
+    std::string key;
+    int threads = 8;
+    int refresh = 900;
+};
+
+struct Location {
+    std::string lat, lon; // As the clocks send them, passed upstream as is
+    std::shared_ptr<const std::string> packet; // Snapshot body + tag, null until fetched
+    time_t fetched = 0;   // Last fetch attempt
+    time_t lastRequest = 0;
+    bool fetching = false;
+};
+
+typedef std::pair<int32_t, int32_t> LocationKey; // 1e-4 degrees, like the snapshot
+
+static Options options;
+static std::mutex cacheMutex;
+static std::condition_variable cacheFetched;
+static std::map<LocationKey, Location> cache;
+
+static std::atomic<unsigned long> statRequests(0), statHits(0), statErrors(0), statUpstream(0), statUpstreamErrors(0);
+
+/*
+*   httpGet() - Sends a request to the upstream and returns the body of a 200 reply
+*/
+static bool httpGet(const std::string& request, std::string& body) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    std::string port = std::to_string(options.upstreamPort);
+    if (getaddrinfo(options.upstreamHost.c_str(), port.c_str(), &hints, &res) != 0) {
+        return false;
+    }
+    int fd = -1;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        timeval tv = {10, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string reply;
+    bool ok = send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size();
+    char buf[4096];
+    ssize_t n;
+    while (ok && (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        reply.append(buf, n);
+    }
+    close(fd);
+
+    int status = 0;
+    size_t headerEnd = reply.find("\r\n\r\n");
+    if (!ok || headerEnd == std::string::npos || sscanf(reply.c_str(), "HTTP/%*s %d", &status) != 1 || status != 200) {
+        return false;
+    }
+    body = reply.substr(headerEnd + 4);
+    return true;
+}
+
+/*
+*   upstreamRequest() - The clock's request for Open-Meteo, sent as HTTP/1.0 so it is not chunked
+*/
+static std::string upstreamRequest(const Location& loc, bool forecast) {
+    char req[1024];
+    openMeteoBuildRequest(req, sizeof(req), forecast, FORECAST_HOURS, loc.lat.c_str(), loc.lon.c_str(), ""); // Always the full snapshot
+    std::string request(req);
+    size_t version = request.find(" HTTP/1.1\r\n");
+    if (version != std::string::npos) {
+        request.replace(version, 9, " HTTP/1.0");
+    }
+    return request;
+}
+
+static void tag(const uint8_t* data, size_t len, uint8_t* out) {
+    unsigned char full[EVP_MAX_MD_SIZE];
+    unsigned int fullLen = 0;
+    HMAC(EVP_sha256(), options.key.data(), options.key.size(), data, len, full, &fullLen);
+    memcpy(out, full, SNAPSHOT_TAG_LEN);
+}
+
+/*
+*   fetchLocation() - Fetches current weather and forecast and builds the signed snapshot
+*/
+static std::shared_ptr<const std::string> fetchLocation(const LocationKey& key, const Location& loc) {
+    statUpstream++;
+    std::string currentBody, forecastBody;
+    if (!httpGet(upstreamRequest(loc, false), currentBody) || !httpGet(upstreamRequest(loc, true), forecastBody)) {
+        statUpstreamErrors++;
+        return nullptr;
+    }
+
+    CurrentWeather current = {};
+    Forecast slots[FORECAST_HOURS] = {};
+    std::vector<char> text(currentBody.begin(), currentBody.end());
+    text.push_back('\0');
+    bool ok = openMeteoParseCurrent(text.data(), currentBody.size(), current);
+    text.assign(forecastBody.begin(), forecastBody.end());
+    text.push_back('\0');
+    int count = openMeteoParseForecast(text.data(), forecastBody.size(), slots, FORECAST_HOURS);
+    if (!ok || count < 0) {
+        statUpstreamErrors++;
+        return nullptr;
+    }
+
+    SnapshotHeader header = {SNAPSHOT_WEATHER, 0, key.first, key.second, 0};
+    uint8_t packet[SNAPSHOT_MAX_SIZE + SNAPSHOT_TAG_LEN];
+    size_t len = snapshotEncodeWeather(packet, SNAPSHOT_MAX_SIZE, header, current, time(nullptr),
+                                       slots, 0, count, 0);
+    if (len == 0) {
+        statUpstreamErrors++;
+        return nullptr;
+    }
+    tag(packet, len, packet + len);
+    return std::make_shared<const std::string>((const char*)packet, len + SNAPSHOT_TAG_LEN);
+}
+
+/*
+*   lookup() - Returns the snapshot of a location, fetching it if nobody did yet
+*/
+static std::shared_ptr<const std::string> lookup(const LocationKey& key, const std::string& lat, const std::string& lon) {
+    std::unique_lock<std::mutex> lock(cacheMutex);
+    Location& loc = cache[key];
+    time_t now = time(nullptr);
+    loc.lastRequest = now;
+    if (loc.packet) {
+        statHits++;
+        return loc.packet;
+    }
+    if (!loc.fetching && now - loc.fetched >= RETRY_FAILED) {
+        // This request fetches, the ones that come meanwhile wait for it
+        loc.lat = lat;
+        loc.lon = lon;
+        loc.fetching = true;
+        Location copy = loc;
+        lock.unlock();
+        std::shared_ptr<const std::string> packet = fetchLocation(key, copy);
+        lock.lock();
+        Location& done = cache[key];
+        done.fetching = false;
+        done.fetched = time(nullptr);
+        done.packet = packet;
+        cacheFetched.notify_all();
+        return packet;
+    }
+    cacheFetched.wait_for(lock, std::chrono::seconds(FIRST_FETCH_WAIT), [&] { return !cache[key].fetching; });
+    return cache[key].packet;
+}
+
+/*
+*   refresher() - Refreshes the known locations in the background
+*/
+static void refresher() {
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::seconds(5));
+        std::vector<std::pair<LocationKey, Location>> due;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            time_t now = time(nullptr);
+            for (auto it = cache.begin(); it != cache.end();) {
+                Location& loc = it->second;
+                if (!loc.fetching && now - loc.lastRequest > IDLE_DROP) {
+                    it = cache.erase(it);
+                    continue;
+                }
+                long wait = loc.packet ? options.refresh : RETRY_FAILED;
+                if (!loc.fetching && now - loc.fetched >= wait) {
+                    loc.fetching = true;
+                    due.push_back(*it);
+                }
+                ++it;
+            }
+        }
+        for (auto& entry : due) {
+            std::shared_ptr<const std::string> packet = fetchLocation(entry.first, entry.second);
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            auto it = cache.find(entry.first);
+            if (it == cache.end()) {
+                continue;
+            }
+            it->second.fetching = false;
+            it->second.fetched = time(nullptr);
+            if (packet) {
+                it->second.packet = packet; // Keep serving the old copy if the fetch failed
+            }
+            cacheFetched.notify_all();
+        }
+    }
+}
+
+/*
+*   queryValue() - Copies the value of a query parameter, only digits, '.' and '-' are taken
+*/
+static bool queryValue(const char* query, const char* name, std::string& value) {
+    size_t nameLen = strlen(name);
+    for (const char* p = query; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : nullptr) {
+        if (strncmp(p, name, nameLen) == 0 && p[nameLen] == '=') {
+            value.clear();
+            for (p += nameLen + 1; *p && *p != '&' && value.size() < 16; p++) {
+                if (!strchr("0123456789.-", *p)) {
+                    return false;
+                }
+                value += *p;
+            }
+            return !value.empty();
+        }
+    }
+    return false;
+}
+
+static void reply(int fd, const char* status, const std::string* body) {
+    char header[160];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 %s\r\nContent-Type: application/octet-stream\r\n"
+                       "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                       status, body ? body->size() : 0);
+    std::string out(header, len);
+    if (body) {
+        out += *body;
+    }
+    send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+}
+
+/*
+*   serveClient() - Answers one HTTP request
+*/
+static void serveClient(int fd) {
+    timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    statRequests++;
+
+    char req[1024];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(req) - 1 && (n = recv(fd, req + len, sizeof(req) - 1 - len, 0)) > 0) {
+        len += n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n")) {
+            break;
+        }
+    }
+    req[len] = '\0';
+
+    char path[512];
+    std::string lat, lon;
+    if (sscanf(req, "GET %511s HTTP/", path) != 1 || strncmp(path, "/snapshot?", 10) != 0 ||
+        !queryValue(path + 10, "lat", lat) || !queryValue(path + 10, "lon", lon)) {
+        statErrors++;
+        reply(fd, "400 Bad Request", nullptr);
+        return;
+    }
+    double latValue = atof(lat.c_str()), lonValue = atof(lon.c_str());
+    if (latValue < -90 || latValue > 90 || lonValue < -180 || lonValue > 180) {
+        statErrors++;
+        reply(fd, "400 Bad Request", nullptr);
+        return;
+    }
+    LocationKey key(lround(latValue * 10000), lround(lonValue * 10000));
+    std::shared_ptr<const std::string> packet = lookup(key, lat, lon);
+    if (!packet) {
+        statErrors++;
+        reply(fd, "503 Service Unavailable", nullptr);
+        return;
+    }
+    reply(fd, "200 OK", packet.get());
+}
+
+static void worker(int listenFd) {
+    for (;;) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        serveClient(fd);
+        close(fd);
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "usage: gateway -k key [-p port] [-u host:port] [-t threads] [-r refresh_seconds]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "k:p:u:t:r:")) != -1) {
+        switch (opt) {
+            case 'k': options.key = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 'u': {
+                std::string upstream = optarg;
+                size_t colon = upstream.rfind(':');
+                options.upstreamHost = upstream.substr(0, colon);
+                if (colon != std::string::npos) {
+                    options.upstreamPort = atoi(upstream.c_str() + colon + 1);
+                }
+                break;
+            }
+            case 't': options.threads = atoi(optarg); break;
+            case 'r': options.refresh = atoi(optarg); break;
+            default: usage();
+        }
+    }
+    if (options.key.empty() || options.threads < 1 || options.refresh < 60) {
+        usage();
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int listenFd = socket(AF_INET6, SOCK_STREAM, 0);
+    int one = 1, zero = 0;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(options.port);
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 1024) != 0) {
+        perror("gateway: listen");
+        return 1;
+    }
+    fprintf(stderr, "gateway: port %d, upstream %s:%d, %d threads, refresh %d s\n",
+            options.port, options.upstreamHost.c_str(), options.upstreamPort, options.threads, options.refresh);
+
+    std::thread(refresher).detach();
+    for (int i = 0; i < options.threads; i++) {
+        std::thread(worker, listenFd).detach();
+    }
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::seconds(STATS_INTERVAL));
+        size_t locations;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            locations = cache.size();
+        }
+        fprintf(stderr, "gateway: %lu requests, %lu hits, %lu errors, %lu upstream fetches (%lu failed), %zu locations\n",
+                statRequests.load(), statHits.load(), statErrors.load(), statUpstream.load(),
+                statUpstreamErrors.load(), locations);
+    }
+}
@@ -0,0 +1,198 @@
+// lcdview.cpp
+//
+// Terminal viewer for the display mirror of the clocks (LCD_MIRROR in main.cpp).
+//
+//   ./lcdview [-g group] [-p port] [-i chip id] [-t] [-n packets]
+//       Joins the multicast group, follows one clock (the first one heard,
+//       or the one given with -i, in hex) and redraws its display on every
+//       packet. Custom characters are drawn pixel by pixel from the CGRAM
+//       glyphs in the stream, so the big digits of digits.h show as they do
+//       on the LCD. -t draws one character per cell instead, with the custom
+//       characters shaded by how many pixels they light. -n exits after that
+//       many packets, for scripts.
+//
+// The status line shows the clock, the packets lost (from the sequence
+// numbers), the stream rate and the age of the last keyframe.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <lcd_mirror.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static bool textMode = false;
+
+/*
+*   pixel() - Pixel of a custom character, row 0-7 and column 0-4 from the left
+*/
+static bool pixel(const LcdMirror& m, uint8_t code, int row, int column) {
+    return m.glyphs[code & 7][row] & (0x10 >> column);
+}
+
+/*
+*   character() - Text for a character code that is not a custom character
+*/
+static std::string character(uint8_t code) {
+    if (code == 0xDF) {
+        return "°"; // Degree sign of the HD44780 ROM
+    }
+    if (code == 0xFF) {
+        return "█";
+    }
+    return std::string(1, code >= 32 && code < 127 ? (char)code : '?');
+}
+
+static void drawText(const LcdMirror& m, std::string& out) {
+    static const char* shades[] = {" ", "░", "▒", "▓", "█"};
+    out += "+----------------+\n";
+    for (int row = 0; row < LCD_MIRROR_ROWS; row++) {
+        out += "|";
+        for (int col = 0; col < LCD_MIRROR_COLS; col++) {
+            uint8_t code = m.cells[row * LCD_MIRROR_COLS + col];
+            if (code < 16) {
+                int lit = 0;
+                for (int y = 0; y < 8; y++) {
+                    lit += __builtin_popcount(m.glyphs[code & 7][y] & 0x1F);
+                }
+                out += shades[(lit * 4 + 20) / 40];
+            } else {
+                out += character(code);
+            }
+        }
+        out += "|\n";
+    }
+    out += "+----------------+\n";
+}
+
+/*
+*   drawPixels() - Each cell is 5 columns and 4 lines of half blocks, two pixel rows per line
+*/
+static void drawPixels(const LcdMirror& m, std::string& out) {
+    static const char* halves[] = {" ", "▄", "▀", "█"}; // none, bottom, top, both
+    for (int row = 0; row < LCD_MIRROR_ROWS; row++) {
+        for (int line = 0; line < 4; line++) {
+            for (int col = 0; col < LCD_MIRROR_COLS; col++) {
+                uint8_t code = m.cells[row * LCD_MIRROR_COLS + col];
+                if (code < 16) {
+                    for (int x = 0; x < 5; x++) {
+                        out += halves[pixel(m, code, 2 * line, x) * 2 + pixel(m, code, 2 * line + 1, x)];
+                    }
+                } else if (line == 1) {
+                    out += "  " + character(code) + "  ";
+                } else {
+                    out += "     ";
+                }
+                out += " ";
+            }
+            out += "\n";
+        }
+        out += "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* group = "239.16.2.162";
+    int port = 16163;
+    long packetsMax = 0;
+    uint32_t follow = 0;
+    bool following = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "g:p:i:tn:")) != -1) {
+        switch (opt) {
+            case 'g': group = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'i': follow = strtoul(optarg, nullptr, 16); following = true; break;
+            case 't': textMode = true; break;
+            case 'n': packetsMax = atol(optarg); break;
+            default:
+                fprintf(stderr, "usage: lcdview [-g group] [-p port] [-i chip id] [-t] [-n packets]\n");
+                return 2;
+        }
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("lcdview: bind");
+        return 1;
+    }
+    ip_mreq mreq = {};
+    if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1) {
+        fprintf(stderr, "lcdview: bad group %s\n", group);
+        return 2;
+    }
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+        perror("lcdview: multicast"); // Unicast to the port still works
+    }
+
+    LcdMirror m;
+    lcdMirrorInit(m);
+    bool synced = false; // A keyframe has arrived
+    uint16_t nextSeq = 0;
+    unsigned long packets = 0, lost = 0, bytes = 0;
+    Clock::time_point start = Clock::now(), keyframeAt = start;
+    printf("\x1b[2J");
+
+    while (packetsMax == 0 || (long)packets < packetsMax) {
+        uint8_t buf[LCD_MIRROR_PACKET_MAX * 2];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        LcdMirrorHeader h;
+        if (n <= 0) {
+            continue;
+        }
+        LcdMirror next = m;
+        if (!lcdMirrorDecode(buf, n, next, h) || (following && h.sender != follow)) {
+            continue;
+        }
+        if (!following) {
+            follow = h.sender;
+            following = true;
+        }
+        if (packets > 0 && h.seq != nextSeq) {
+            lost += (uint16_t)(h.seq - nextSeq);
+        }
+        nextSeq = h.seq + 1;
+        packets++;
+        bytes += n;
+        if (h.flags & LCD_MIRROR_KEYFRAME_FLAG) {
+            synced = true;
+            keyframeAt = Clock::now();
+        }
+        m = next;
+
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        std::string out = "\x1b[H";
+        if (textMode) {
+            drawText(m, out);
+        } else {
+            drawPixels(m, out);
+        }
+        char keyframe[40] = "waiting for a keyframe";
+        if (synced) {
+            snprintf(keyframe, sizeof(keyframe), "keyframe %.0f s ago",
+                     std::chrono::duration<double>(Clock::now() - keyframeAt).count());
+        }
+        char status[160];
+        snprintf(status, sizeof(status), "clock %08x  packets %lu  lost %lu  %.1f B/s  %s\x1b[K\n",
+                 follow, packets, lost, elapsed > 1 ? bytes / elapsed : 0.0, keyframe);
+        out += status;
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+    return 0;
+}
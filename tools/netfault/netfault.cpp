@@ -0,0 +1,780 @@
+// netfault.cpp
+//
+// Fault injection for the network paths of an NTP162 clock.
+//
+// One clock runs in virtual time against a network shim that injects the
+// faults of a scenario script: NTP replies lost, delayed or held back out of
+// order, DNS lookups that stall or fail, weather connections refused, reset
+// or closed halfway through the body, stalled or slow, and HTTP error codes.
+//
+// The clock side mirrors src/main.cpp with its values: syncNTP() with the
+// failover of tryNTPServer(), one server per loop() pass, and the restart after NTP_RESTART_AFTER, the
+// NTP step of bootPoll() after a restart, and fetchStart()/fetchPoll() with
+// their timeouts and the retry backoff of weatherFetchDone(). Every call that
+// blocks loop() on the clock advances the virtual time by as long as it
+// would block. A fetch only blocks for the DNS lookup, the connect and the
+// handshake, the reply is read a pass at a time while the display renders. NTPClient is mirrored too: it resolves the server name for
+// every request, drops what is waiting on its socket, sends and takes the
+// first reply that comes within a second, whatever request it answers.
+// The weather responses are the recorded ones in tools/responses, read
+// through the firmware's own include/http_body.h and include/owm_pull.h.
+// Weather is fetched FETCH_INTERVAL after each success: the adaptive schedule
+// of fetch_schedule.h follows the provider's updates, which are not modelled.
+//
+// The report says how long the display kept working (the longest loop()
+// stall and the time spent in a restart), the largest clock error, how many
+// retries each outage took and how long it lasted (as LinkStats counts them),
+// and how long after the faults ended the time and the weather were fresh
+// again. A script may end with expectations, and netfault exits non-zero
+// when one of them is not met.
+//
+// Build with make, make check runs every script in scenarios/.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <http_body.h>
+#include <owm_pull.h>
+
+// Values of src/main.cpp, in milliseconds
+#define NTP_SERVERS 6 // scarlett, a/b/c.ntp.br, time.nist.gov, pool.ntp.org
+#define NTP_SYNC_INTERVAL 60000
+#define NTP_FAILOVER_AFTER 3
+#define NTP_RESTART_AFTER 21600000L
+#define RESTART_DELAY 10000 // syncNTP() shows the error this long before ESP.restart()
+#define BOOT_RETRY 10000
+#define FETCH_INTERVAL 900000
+#define RETRY_BACKOFF_MIN 30000
+#define RETRY_BACKOFF_MAX 900000
+#define RATE_LIMIT_BACKOFF 1800000
+#define FIRST_BYTE_TIMEOUT 5000 // FETCH_FIRST_BYTE_TIMEOUT, waiting for the reply
+#define READ_TIMEOUT 2000       // FETCH_READ_TIMEOUT, between reads
+#define READ_SIZE 256           // FETCH_READ_PER_PASS, bytes taken off the socket per loop() pass
+#define MAX_RESPONSE_SIZE 4096
+
+// Values of the Arduino core and the libraries
+#define NTP_TIMEOUT 1000      // NTPClient::forceUpdate() waits this long for a reply
+#define DNS_TIMEOUT 10000     // ESP8266WiFiClass::hostByName() default
+#define TCP_RTO 1000          // lwIP first retransmission timeout, doubles on each retry
+#define TCP_RETRIES 6         // Retransmissions before lwIP drops the connection
+
+// The network when nothing is injected
+#define RTT 40               // Round trip to any server
+#define TLS_HANDSHAKE 1500   // TCP connect and TLS handshake at 160 MHz
+#define SEGMENT 536          // TCP segment, the payload arrives in pieces this large
+#define WIFI_JOIN 3000       // Wi-Fi join after a restart
+#define LOOP_TIME 50         // loop() without any network call, mostly the render
+
+enum Target { T_NTP, T_DNS, T_WEATHER };
+enum Kind { F_LOSS, F_DELAY, F_REORDER, F_STALL, F_FAIL, F_REFUSE, F_RESET, F_TRUNCATE, F_STATUS, F_SLOW };
+
+static const char* kindNames[] = {"loss", "delay", "reorder", "stall", "fail", "refuse", "reset", "truncate", "status", "slow"};
+
+/*
+*   Fault - One fault of a scenario, active from `from` to `to`
+*/
+struct Fault {
+    long from, to;
+    Target target;
+    int server; // NTP server, -1 for all
+    Kind kind;
+    double value;
+};
+
+struct Expect {
+    std::string metric;
+    bool atMost; // <= or >=
+    double value;
+    int line;
+};
+
+struct Scenario {
+    std::string name;
+    long duration = 4 * 3600000L;
+    std::vector<Fault> faults;
+    std::vector<Expect> expects;
+};
+
+/*
+*   LinkStats - As in src/main.cpp, an outage lasts from the first failure to the next success
+*/
+struct LinkStats {
+    unsigned long attempts, failures, consecutiveFailures;
+    bool inOutage;
+    long outageStart;
+    long lastSuccess;
+    long maxRecovery;
+    unsigned long maxRetries; // Failures in one outage
+    unsigned long outages;
+};
+
+struct Datagram {
+    long arrive;
+    long serverTime; // Time the server put in the reply
+};
+
+/*
+*   Clock - State of the simulated clock and of the network shim
+*/
+struct Clock {
+    const Scenario* s;
+    std::mt19937 rng;
+    long t; // Virtual milliseconds since the start
+
+    // Clock side
+    int server;
+    int failover; // Next server of tryNTPServer(), -1 when not failing over
+    long lastSync;
+    bool timeSet;
+    long clockBase, clockSetAt; // Time the clock was set to, and when
+    LinkStats ntp, weather;
+    long weatherDue, retryAt, retryDelay;
+    int lastHttpStatus;
+    long shownAt; // Time the shown weather was fetched, -1 none
+    std::vector<Datagram> inbox;
+
+    // Report
+    long lastRender;
+    long maxStall, displayDown, maxClockError, maxWeatherAge;
+    long ntpFresh, weatherFresh; // First success after the last fault, -1 none
+    int restarts;
+};
+
+static std::string responsePath = "../responses/http_owm_current.txt";
+static std::string response;
+
+/*
+*   fault() - Value of the fault of a kind active on a target now, or NAN
+*/
+static double fault(const Clock& c, Target target, int server, Kind kind) {
+    for (const Fault& f : c.s->faults) {
+        if (f.target == target && f.kind == kind && c.t >= f.from && c.t < f.to &&
+            (f.server < 0 || f.server == server)) {
+            return f.value;
+        }
+    }
+    return NAN;
+}
+
+static bool chance(Clock& c, double p) {
+    return std::uniform_real_distribution<double>(0, 1)(c.rng) < p;
+}
+
+static long lastFaultEnd(const Scenario& s) {
+    long end = 0;
+    for (const Fault& f : s.faults) {
+        end = std::max(end, f.to);
+    }
+    return end;
+}
+
+static void linkSuccess(Clock& c, LinkStats& link) {
+    link.attempts++;
+    if (link.inOutage) {
+        link.inOutage = false;
+        link.maxRecovery = std::max(link.maxRecovery, c.t - link.outageStart);
+        link.maxRetries = std::max(link.maxRetries, link.consecutiveFailures);
+    }
+    link.lastSuccess = c.t;
+    link.consecutiveFailures = 0;
+}
+
+static void linkFailure(Clock& c, LinkStats& link) {
+    link.attempts++;
+    link.failures++;
+    link.consecutiveFailures++;
+    if (!link.inOutage) {
+        link.inOutage = true;
+        link.outageStart = c.t;
+        link.outages++;
+    }
+}
+
+/*
+*   dnsLookup() - hostByName(), false if the name does not resolve in time
+*/
+static bool dnsLookup(Clock& c) {
+    if (!isnan(fault(c, T_DNS, -1, F_FAIL))) {
+        c.t += RTT;
+        return false;
+    }
+    double stall = fault(c, T_DNS, -1, F_STALL);
+    if (!isnan(stall) && stall >= DNS_TIMEOUT) {
+        c.t += DNS_TIMEOUT;
+        return false;
+    }
+    c.t += RTT + (isnan(stall) ? 0 : (long)stall);
+    return true;
+}
+
+/*
+*   ntpUpdate() - NTPClient::forceUpdate() on a server
+*/
+static bool ntpUpdate(Clock& c, int server) {
+    // Whatever came in since the last request is dropped
+    c.inbox.erase(std::remove_if(c.inbox.begin(), c.inbox.end(), [&](const Datagram& d) { return d.arrive <= c.t; }),
+                  c.inbox.end());
+    if (dnsLookup(c)) {
+        double loss = fault(c, T_NTP, server, F_LOSS);
+        if (isnan(loss) || !chance(c, loss)) {
+            double delay = fault(c, T_NTP, server, F_DELAY);
+            double reorder = fault(c, T_NTP, server, F_REORDER);
+            long back = RTT / 2 + (isnan(delay) ? 0 : (long)delay);
+            if (!isnan(reorder)) {
+                back += std::uniform_int_distribution<long>(0, (long)reorder)(c.rng);
+            }
+            c.inbox.push_back({c.t + RTT / 2 + back, c.t + RTT / 2});
+        }
+    }
+    // The first reply within the timeout is taken, even one meant for an earlier request
+    long deadline = c.t + NTP_TIMEOUT;
+    auto first = c.inbox.end();
+    for (auto it = c.inbox.begin(); it != c.inbox.end(); ++it) {
+        if (it->arrive <= deadline && (first == c.inbox.end() || it->arrive < first->arrive)) {
+            first = it;
+        }
+    }
+    if (first == c.inbox.end()) {
+        c.t = deadline;
+        return false;
+    }
+    c.t = std::max(c.t, first->arrive);
+    c.clockBase = first->serverTime;
+    c.clockSetAt = c.t;
+    c.timeSet = true;
+    c.inbox.erase(first);
+    return true;
+}
+
+static void render(Clock& c);
+
+/*
+*   idle() - loop() passes until the time until, a fetch waiting on the socket doesn't block them
+*/
+static void idle(Clock& c, long until) {
+    while (c.t + LOOP_TIME <= until) {
+        c.t += LOOP_TIME;
+        render(c);
+    }
+    c.t = std::max(c.t, until);
+}
+
+/*
+*   fetchWeather() - fetchStart(), fetchPoll() and the parse of weatherFetched()
+*/
+static bool fetchWeather(Clock& c) {
+    c.lastHttpStatus = 0;
+    if (!dnsLookup(c)) {
+        return false;
+    }
+    if (!isnan(fault(c, T_WEATHER, -1, F_REFUSE))) {
+        c.t += RTT;
+        return false;
+    }
+    c.t += TLS_HANDSHAKE;
+
+    // What the server sends, cut where the shim ends the connection
+    std::string wire = response;
+    double status = fault(c, T_WEATHER, -1, F_STATUS);
+    if (!isnan(status)) {
+        char line[48];
+        snprintf(line, sizeof(line), "HTTP/1.1 %d Error", (int)status);
+        wire = line + wire.substr(wire.find('\r'));
+    }
+    double reset = fault(c, T_WEATHER, -1, F_RESET);
+    double truncate = fault(c, T_WEATHER, -1, F_TRUNCATE);
+    if (!isnan(reset) && reset < wire.size()) {
+        wire.resize((size_t)reset);
+    } else if (!isnan(truncate) && truncate < wire.size()) {
+        wire.resize((size_t)truncate);
+    }
+
+    // When each segment gets to the clock, loss costs a retransmission
+    double loss = fault(c, T_WEATHER, -1, F_LOSS);
+    double delay = fault(c, T_WEATHER, -1, F_DELAY);
+    double slow = fault(c, T_WEATHER, -1, F_SLOW);
+    double stall = fault(c, T_WEATHER, -1, F_STALL);
+    long at = c.t + RTT + (isnan(stall) ? 0 : (long)stall) + (isnan(delay) ? 0 : (long)delay);
+    std::vector<std::pair<long, std::string>> segments;
+    for (size_t i = 0; i < wire.size(); i += SEGMENT) {
+        int tries = 0;
+        long rto = TCP_RTO;
+        while (!isnan(loss) && chance(c, loss) && tries < TCP_RETRIES) {
+            at += rto;
+            rto *= 2;
+            tries++;
+        }
+        if (tries == TCP_RETRIES) {
+            break; // lwIP gives up, the connection is gone
+        }
+        segments.push_back({at, wire.substr(i, SEGMENT)});
+        at += isnan(slow) ? 1 : (long)slow;
+    }
+
+    // The clock side: first byte, then the socket read READ_SIZE bytes at a time
+    if (segments.empty() || segments[0].first - c.t > FIRST_BYTE_TIMEOUT) {
+        idle(c, c.t + (segments.empty() ? RTT : FIRST_BYTE_TIMEOUT));
+        return false;
+    }
+    static char payload[MAX_RESPONSE_SIZE];
+    static Inflate inflater;
+    HttpBody body;
+    bodyBegin(body, payload, sizeof(payload), &inflater);
+    std::string line;
+    int part = 0; // 0 status line, 1 headers, 2 body
+    bool headersDone = false;
+    for (auto& seg : segments) {
+        if (seg.first - c.t > READ_TIMEOUT) {
+            idle(c, c.t + READ_TIMEOUT);
+            break;
+        }
+        idle(c, seg.first);
+        const std::string& data = seg.second;
+        for (size_t i = 0; i < data.size(); i++) {
+            if (part == 2) {
+                for (size_t j = i; j < data.size() && !body.overflow && body.inflateStatus == INFLATE_OK &&
+                                   !bodyComplete(body);
+                     j += READ_SIZE) {
+                    if (j > i) {
+                        idle(c, c.t + LOOP_TIME); // The next pass takes the next piece
+                    }
+                    bodyReceive(body, (const uint8_t*)data.data() + j, std::min((size_t)READ_SIZE, data.size() - j));
+                }
+                break;
+            }
+            if (data[i] != '\n') {
+                line += data[i];
+                continue;
+            }
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (part == 0) {
+                sscanf(line.c_str(), "HTTP/%*s %d", &c.lastHttpStatus);
+                part = 1;
+            } else if (line.empty()) {
+                headersDone = true;
+                if (c.lastHttpStatus != 200) {
+                    return false; // Only a 200 carries weather data
+                }
+                bodyStart(body);
+                part = 2;
+            } else {
+                bodyHeader(body, line.c_str());
+            }
+            line.clear();
+        }
+        if (part == 2 && bodyComplete(body)) {
+            break;
+        }
+    }
+    if (!headersDone) {
+        return false;
+    }
+    bodyFinish(body);
+    if (body.overflow || body.inflateStatus < 0 || bodyTruncated(body)) {
+        return false;
+    }
+    static CurrentWeather current;
+    static OwmPull p;
+    owmPullBegin(p, &current, NULL, 0);
+    return owmPullFeed(p, payload, body.outLen) == OWM_PULL_DONE;
+}
+
+/*
+*   weatherFetchDone() - The retry backoff, as in src/main.cpp
+*/
+static void weatherFetchDone(Clock& c, bool ok) {
+    if (ok) {
+        linkSuccess(c, c.weather);
+        c.retryDelay = 0;
+        c.weatherDue = c.t + FETCH_INTERVAL;
+        c.shownAt = c.t;
+        if (c.weatherFresh < 0 && c.t >= lastFaultEnd(*c.s)) {
+            c.weatherFresh = c.t;
+        }
+        return;
+    }
+    linkFailure(c, c.weather);
+    c.retryAt = c.t;
+    if (c.lastHttpStatus == 429) {
+        c.retryDelay = RATE_LIMIT_BACKOFF;
+    } else if (c.retryDelay == 0) {
+        c.retryDelay = RETRY_BACKOFF_MIN;
+    } else {
+        c.retryDelay = std::min(c.retryDelay * 2, (long)RETRY_BACKOFF_MAX);
+    }
+}
+
+static void ntpSynced(Clock& c) {
+    linkSuccess(c, c.ntp);
+    c.lastSync = c.t;
+    if (c.ntpFresh < 0 && c.t >= lastFaultEnd(*c.s)) {
+        c.ntpFresh = c.t;
+    }
+}
+
+/*
+*   boot() - Wi-Fi join and the NTP step of bootPoll(), the display shows the boot screen
+*/
+static void boot(Clock& c) {
+    long start = c.t;
+    c.t += WIFI_JOIN;
+    c.timeSet = false;
+    c.failover = -1;
+    c.inbox.clear();
+    for (int i = 0; c.t < c.s->duration; i = (i + 1) % NTP_SERVERS) {
+        if (ntpUpdate(c, i)) {
+            c.server = i;
+            ntpSynced(c);
+            break;
+        }
+        if (i == NTP_SERVERS - 1) {
+            linkFailure(c, c.ntp); // One failure per pass over the servers
+            c.t += BOOT_RETRY;
+        }
+        c.t += LOOP_TIME;
+    }
+    if (c.restarts) {
+        c.displayDown += std::min(c.t, c.s->duration) - start; // Not the first boot
+    }
+    c.weatherDue = c.t; // The first fetch comes right after the boot
+    c.retryDelay = 0;
+    c.lastRender = c.t;
+}
+
+/*
+*   syncNTP() - As in src/main.cpp, returns true when the clock restarts
+*/
+static bool syncNTP(Clock& c) {
+    if (c.failover >= 0) { // tryNTPServer(), one server per pass
+        int i = c.failover;
+        c.failover = i + 1 < NTP_SERVERS ? i + 1 : -1;
+        if (ntpUpdate(c, i)) {
+            c.server = i;
+            c.failover = -1;
+            ntpSynced(c);
+        }
+    } else {
+        if (c.t - c.lastSync < NTP_SYNC_INTERVAL) {
+            return false;
+        }
+        c.lastSync = c.t;
+        if (ntpUpdate(c, c.server)) {
+            ntpSynced(c);
+            return false;
+        }
+        linkFailure(c, c.ntp);
+        if (c.ntp.consecutiveFailures >= NTP_FAILOVER_AFTER) {
+            c.failover = 0;
+        }
+    }
+    if (c.ntp.inOutage && c.t - c.ntp.lastSuccess > NTP_RESTART_AFTER) {
+        long start = c.t;
+        c.t += RESTART_DELAY;
+        c.displayDown += c.t - start;
+        c.restarts++;
+        return true;
+    }
+    return false;
+}
+
+/*
+*   render() - The display shows the clock, records how it looks
+*/
+static void render(Clock& c) {
+    c.maxStall = std::max(c.maxStall, c.t - c.lastRender);
+    c.lastRender = c.t;
+    if (c.timeSet) {
+        long shown = c.clockBase + (c.t - c.clockSetAt);
+        c.maxClockError = std::max(c.maxClockError, labs(shown - c.t));
+    }
+    if (c.shownAt >= 0) {
+        c.maxWeatherAge = std::max(c.maxWeatherAge, c.t - c.shownAt);
+    }
+}
+
+static Clock run(const Scenario& s, unsigned seed) {
+    Clock c = {};
+    c.s = &s;
+    c.rng.seed(seed);
+    c.shownAt = -1;
+    c.ntpFresh = -1;
+    c.weatherFresh = -1;
+    c.ntp.lastSuccess = 0;
+    boot(c);
+    while (c.t < s.duration) {
+        if (syncNTP(c)) {
+            boot(c);
+            continue;
+        }
+        if (c.t >= c.weatherDue && (c.retryDelay == 0 || c.t - c.retryAt >= c.retryDelay)) {
+            weatherFetchDone(c, fetchWeather(c));
+        }
+        render(c);
+        c.t += LOOP_TIME;
+    }
+    return c;
+}
+
+/*
+*   parseTime() - "500ms", "90s", "10m", "2h" or plain seconds, in milliseconds
+*/
+static bool parseTime(const char* text, long& ms) {
+    char* end;
+    double v = strtod(text, &end);
+    if (end == text) {
+        return false;
+    }
+    if (strcmp(end, "ms") == 0) {
+        ms = (long)v;
+    } else if (*end == '\0' || strcmp(end, "s") == 0) {
+        ms = (long)(v * 1000);
+    } else if (strcmp(end, "m") == 0) {
+        ms = (long)(v * 60000);
+    } else if (strcmp(end, "h") == 0) {
+        ms = (long)(v * 3600000);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static const char* metricNames[] = {"display_stall", "display_down", "clock_error", "restarts", "ntp_failures",
+                                    "ntp_retries", "ntp_recover", "ntp_fresh", "weather_failures",
+                                    "weather_retries", "weather_recover", "weather_fresh", "weather_age"};
+
+/*
+*   metric() - Value of a metric of a run, times in milliseconds, -1 when it never happened
+*/
+static double metric(const Clock& c, const std::string& name) {
+    long end = lastFaultEnd(*c.s);
+    if (name == "display_stall") return c.maxStall;
+    if (name == "display_down") return c.displayDown;
+    if (name == "clock_error") return c.maxClockError;
+    if (name == "restarts") return c.restarts;
+    if (name == "ntp_failures") return c.ntp.failures;
+    if (name == "ntp_retries") return std::max(c.ntp.maxRetries, c.ntp.consecutiveFailures);
+    if (name == "ntp_recover") return c.ntp.inOutage ? std::max(c.ntp.maxRecovery, c.t - c.ntp.outageStart) : c.ntp.maxRecovery;
+    if (name == "ntp_fresh") return c.ntpFresh < 0 ? -1 : c.ntpFresh - end;
+    if (name == "weather_failures") return c.weather.failures;
+    if (name == "weather_retries") return std::max(c.weather.maxRetries, c.weather.consecutiveFailures);
+    if (name == "weather_recover") return c.weather.inOutage ? std::max(c.weather.maxRecovery, c.t - c.weather.outageStart) : c.weather.maxRecovery;
+    if (name == "weather_fresh") return c.weatherFresh < 0 ? -1 : c.weatherFresh - end;
+    if (name == "weather_age") return c.maxWeatherAge;
+    return NAN;
+}
+
+static bool isTime(const std::string& name) {
+    return name != "restarts" && name.find("failures") == std::string::npos && name.find("retries") == std::string::npos;
+}
+
+static void printMetric(const Clock& c, const char* name) {
+    double v = metric(c, name);
+    if (!isTime(name)) {
+        printf("  %-17s %8.0f\n", name, v);
+    } else if (v < 0) {
+        printf("  %-17s    never\n", name);
+    } else {
+        printf("  %-17s %8.1f s\n", name, v / 1000);
+    }
+}
+
+/*
+*   load() - Reads a scenario script
+*
+*  duration <time>
+*  at <time> for <time> <ntp|ntpN|dns|weather> <fault> [value]
+*  expect <metric> <=|>= <value>
+*/
+static bool load(const char* path, Scenario& s) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return false;
+    }
+    const char* slash = strrchr(path, '/');
+    s.name = slash ? slash + 1 : path;
+    char text[256];
+    int n = 0;
+    bool ok = true;
+    while (fgets(text, sizeof(text), f)) {
+        n++;
+        char* hash = strchr(text, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char w[6][64] = {};
+        int words = sscanf(text, "%63s %63s %63s %63s %63s %63s", w[0], w[1], w[2], w[3], w[4], w[5]);
+        if (words <= 0) {
+            continue;
+        }
+        bool good = false;
+        if (strcmp(w[0], "duration") == 0 && words == 2) {
+            good = parseTime(w[1], s.duration);
+        } else if (strcmp(w[0], "at") == 0 && words >= 6 && strcmp(w[2], "for") == 0) {
+            Fault fault = {};
+            long length;
+            good = parseTime(w[1], fault.from) && parseTime(w[3], length);
+            fault.to = fault.from + length;
+            fault.server = -1;
+            const char* target = w[4];
+            const char* kind = w[5];
+            if (strncmp(target, "ntp", 3) == 0) {
+                fault.target = T_NTP;
+                if (target[3]) {
+                    fault.server = atoi(target + 3);
+                    good = good && fault.server >= 0 && fault.server < NTP_SERVERS;
+                }
+            } else if (strcmp(target, "dns") == 0) {
+                fault.target = T_DNS;
+            } else if (strcmp(target, "weather") == 0) {
+                fault.target = T_WEATHER;
+            } else {
+                good = false;
+            }
+            // "at 10m for 5m weather reset 700": the value comes after the kind
+            char value[64] = "";
+            if (sscanf(text, "%*s %*s %*s %*s %*s %*s %63s", value) != 1) {
+                value[0] = '\0';
+            }
+            int k = -1;
+            for (int i = 0; i < (int)(sizeof(kindNames) / sizeof(kindNames[0])); i++) {
+                if (strcmp(kind, kindNames[i]) == 0) {
+                    k = i;
+                }
+            }
+            good = good && k >= 0;
+            fault.kind = (Kind)k;
+            long ms;
+            if (k == F_DELAY || k == F_REORDER || k == F_STALL || k == F_SLOW) {
+                good = good && parseTime(value, ms);
+                fault.value = ms;
+            } else if (k == F_LOSS || k == F_RESET || k == F_TRUNCATE || k == F_STATUS) {
+                char* end;
+                fault.value = strtod(value, &end);
+                good = good && end != value;
+            }
+            s.faults.push_back(fault);
+        } else if (strcmp(w[0], "expect") == 0 && words == 4) {
+            Expect e;
+            e.metric = w[1];
+            e.atMost = strcmp(w[2], "<=") == 0;
+            e.line = n;
+            long ms;
+            if (isTime(e.metric)) {
+                good = parseTime(w[3], ms);
+                e.value = ms;
+            } else {
+                e.value = atof(w[3]);
+                good = true;
+            }
+            good = good && (e.atMost || strcmp(w[2], ">=") == 0) &&
+                   std::find_if(std::begin(metricNames), std::end(metricNames),
+                                [&](const char* m) { return e.metric == m; }) != std::end(metricNames);
+            s.expects.push_back(e);
+        }
+        if (!good) {
+            fprintf(stderr, "%s:%d: cannot read: %s", path, n, text);
+            ok = false;
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+static bool readResponse() {
+    FILE* f = fopen(responsePath.c_str(), "rb");
+    if (!f) {
+        fprintf(stderr, "%s: cannot read\n", responsePath.c_str());
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        response.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: netfault [options] scenario...\n"
+            "  -r file   recorded weather response (../responses/http_owm_current.txt)\n"
+            "  -s seed   random seed (1)\n"
+            "  -q        only the expectations\n"
+            "\n"
+            "scenario scripts:\n"
+            "  duration <time>                                   virtual time to run (4h)\n"
+            "  at <time> for <time> <target> <fault> [value]     inject a fault\n"
+            "  expect <metric> <=|>= <value>                     fail the run otherwise\n"
+            "times as 500ms, 90s, 10m or 2h\n"
+            "targets: ntp (all servers), ntp0-ntp5, dns, weather\n"
+            "faults:  loss p, delay time, reorder time (replies held back up to), stall time,\n"
+            "         fail (dns), refuse, reset bytes, truncate bytes, status code, slow time (per segment)\n"
+            "metrics: display_stall display_down clock_error restarts ntp_failures ntp_retries\n"
+            "         ntp_recover ntp_fresh weather_failures weather_retries weather_recover\n"
+            "         weather_fresh weather_age\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    unsigned seed = 1;
+    bool quiet = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:qh")) != -1) {
+        switch (opt) {
+            case 'r': responsePath = optarg; break;
+            case 's': seed = atoi(optarg); break;
+            case 'q': quiet = true; break;
+            default: usage();
+        }
+    }
+    if (optind >= argc || !readResponse()) {
+        usage();
+    }
+
+    int failed = 0;
+    for (int i = optind; i < argc; i++) {
+        Scenario s;
+        if (!load(argv[i], s)) {
+            return 2;
+        }
+        Clock c = run(s, seed);
+        if (!quiet) {
+            printf("%s: %.1f h, faults end at %.1f min\n", s.name.c_str(), s.duration / 3600000.0,
+                   lastFaultEnd(s) / 60000.0);
+            for (const char* name : metricNames) {
+                printMetric(c, name);
+            }
+        }
+        for (const Expect& e : s.expects) {
+            double v = metric(c, e.metric);
+            bool met = e.atMost ? v >= 0 && v <= e.value : v >= e.value; // -1 is never
+            if (!met) {
+                printf("%s:%d: expected %s %s %g%s, got %g%s\n", s.name.c_str(), e.line, e.metric.c_str(),
+                       e.atMost ? "<=" : ">=", isTime(e.metric) ? e.value / 1000 : e.value,
+                       isTime(e.metric) ? " s" : "", isTime(e.metric) ? v / 1000 : v, isTime(e.metric) ? " s" : "");
+                failed++;
+            }
+        }
+        if (!quiet) {
+            printf("\n");
+        }
+    }
+    if (failed) {
+        printf("%d expectations not met\n", failed);
+        return 1;
+    }
+    printf("all expectations met\n");
+    return 0;
+}
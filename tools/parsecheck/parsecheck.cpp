@@ -0,0 +1,476 @@
+// parsecheck.cpp
+//
+// Parse cost regression check for the weather parsers.
+//
+// The firmware measures every parse of a fetched body with parseBegin() and
+// parseEnd() in src/main.cpp, and logs a regression when it goes over
+// PARSE_US_PER_KB_LIMIT or PARSE_PEAK_BYTES_LIMIT. That only shows on a clock
+// that happens to fetch. This runs the same parsers on the recorded responses
+// of tools/responses, on the host, and exits non-zero when one of them got
+// worse:
+//
+//   - heap: malloc, calloc, realloc and free are wrapped, and every block the
+//     parser takes is counted, with the peak of the bytes it holds. The peak
+//     must stay under PARSE_PEAK_BYTES_LIMIT, and the number of blocks must
+//     not grow past the baseline (0 for the pull and CSV parsers)
+//   - time: the best time over many runs, as a multiple of the time a plain
+//     byte by byte pass over the same body takes, must stay within
+//     TIME_TOLERANCE of the baseline
+//   - memory: the heap peak, plus the body bytes the parser needs in RAM at
+//     once, plus its own state, must not grow past the baseline
+//
+// Each response also has to parse to what it holds: current weather with a
+// description, or the expected number of forecast slots, and the location
+// and first temperature listed with it. The OpenWeatherMap bodies are fed to
+// the pull parser FETCH_READ_PER_PASS bytes at a time, as fetchPoll() hands
+// them over across loop() passes, so they need not fit in MAX_RESPONSE_SIZE.
+//
+// When the ArduinoJson headers are found (the PlatformIO copy, or
+// ARDUINOJSON=dir), the OpenWeatherMap bodies are also parsed with the
+// ArduinoJson parsers of provider_owm.h, the baseline the pull parser
+// replaced, and shown below each of them for comparison. Their result is
+// checked the same way, and the pull parser must not need more memory than
+// they do.
+//
+// Host times do not carry over to the ESP8266, and differ between hosts, so
+// the baseline holds the multiple rather than the time: it moves much less
+// from one host to another. make baseline records it after a deliberate
+// change, make check compares with it.
+
+#include <malloc.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <owm_pull.h>
+#include <provider_openmeteo.h>
+
+#if __has_include(<ArduinoJson.h>)
+#define HAVE_ARDUINOJSON
+#include <ArduinoJson.h>
+#endif
+
+#define MAX_RESPONSE_SIZE 4096      // Same as src/main.cpp
+#define MAX_STREAMED_SIZE 32768     // Largest streamed body read from tools/responses
+#define FETCH_READ_PER_PASS 256     // Same as src/main.cpp
+#define PARSE_PEAK_BYTES_LIMIT 12288 // Same as src/main.cpp
+#define TIME_TOLERANCE 2.0           // Slowdown over the baseline taken as a regression
+#define ROUNDS 15                    // Batches timed, the best one counts
+#define BATCH_NS 20000000L           // Length of a batch, about 20 ms
+
+// Heap wrapped around glibc, counting only between heapCount(true) and heapCount(false)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static bool counting = false;
+static size_t heapCurrent = 0, heapPeak = 0;
+static unsigned long heapBlocks = 0;
+
+static void heapTake(void* ptr) {
+    if (counting && ptr) {
+        heapBlocks++;
+        heapCurrent += malloc_usable_size(ptr);
+        if (heapCurrent > heapPeak) {
+            heapPeak = heapCurrent;
+        }
+    }
+}
+
+static void heapGive(void* ptr) {
+    if (counting && ptr) {
+        size_t size = malloc_usable_size(ptr);
+        heapCurrent = heapCurrent > size ? heapCurrent - size : 0;
+    }
+}
+
+extern "C" void* malloc(size_t size) {
+    void* ptr = __libc_malloc(size);
+    heapTake(ptr);
+    return ptr;
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    void* ptr = __libc_calloc(count, size);
+    heapTake(ptr);
+    return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    heapGive(ptr);
+    ptr = __libc_realloc(ptr, size);
+    heapTake(ptr);
+    return ptr;
+}
+
+extern "C" void free(void* ptr) {
+    heapGive(ptr);
+    __libc_free(ptr);
+}
+
+static void heapCount(bool on) {
+    if (on) {
+        heapCurrent = 0;
+        heapPeak = 0;
+        heapBlocks = 0;
+    }
+    counting = on;
+}
+
+// As in the firmware, the parsers may cut it in place. The firmware never holds a streamed body whole
+static char weatherPayload[MAX_STREAMED_SIZE];
+static size_t weatherPayloadLen = 0;
+
+// What the last parse gave, checked by parsed()
+static CurrentWeather current;
+static Forecast slots[FORECAST_HOURS];
+
+/*
+*   Parsers run by the firmware, with the body in weatherPayload
+*/
+static int owmFeed(OwmPull& p) {
+    int status = OWM_PULL_MORE;
+    for (size_t i = 0; i < weatherPayloadLen && status == OWM_PULL_MORE; i += FETCH_READ_PER_PASS) {
+        size_t len = weatherPayloadLen - i < FETCH_READ_PER_PASS ? weatherPayloadLen - i : FETCH_READ_PER_PASS;
+        status = owmPullFeed(p, weatherPayload + i, len);
+    }
+    return status;
+}
+
+static bool parseOwmCurrent(int expected) {
+    static OwmPull p;
+    owmPullBegin(p, &current, NULL, 0);
+    return owmFeed(p) == OWM_PULL_DONE && current.description[0] && current.dt != 0;
+}
+
+static bool parseOwmForecast(int expected) {
+    static OwmPull p;
+    owmPullBegin(p, NULL, slots, FORECAST_HOURS);
+    return owmFeed(p) == OWM_PULL_DONE && p.count == expected;
+}
+
+static bool parseOpenMeteoCurrent(int expected) {
+    return openMeteoParseCurrent(weatherPayload, weatherPayloadLen, current) && current.sunrise != 0;
+}
+
+static bool parseOpenMeteoForecast(int expected) {
+    return openMeteoParseForecast(weatherPayload, weatherPayloadLen, slots, FORECAST_HOURS) == expected;
+}
+
+/*
+*   ArduinoJson parsers of provider_owm.h, with the heap taken from the wrapped malloc
+*/
+#ifdef HAVE_ARDUINOJSON
+#define LOGE(...)
+
+struct HostAllocator : ArduinoJson::Allocator {
+    void* allocate(size_t size) override {
+        return malloc(size);
+    }
+    void deallocate(void* ptr) override {
+        free(ptr);
+    }
+    void* reallocate(void* ptr, size_t size) override {
+        return realloc(ptr, size);
+    }
+};
+static HostAllocator parseAllocator;
+
+#include <provider_owm.h>
+
+static bool parseOwmJsonCurrent(int expected) {
+    return owmJsonParseCurrent(weatherPayload, weatherPayloadLen, current) && current.description[0] &&
+           current.dt != 0;
+}
+
+static bool parseOwmJsonForecast(int expected) {
+    return owmJsonParseForecast(weatherPayload, weatherPayloadLen, slots, FORECAST_HOURS) == expected;
+}
+#else
+#define parseOwmJsonCurrent NULL
+#define parseOwmJsonForecast NULL
+#endif
+
+struct Response {
+    const char* file;
+    bool (*parse)(int expected);
+    int expected;         // Forecast slots
+    bool streamed;        // Fed in pieces, the firmware never holds it whole
+    const char* location; // Location of the current weather, NULL to skip
+    float temp;           // Temperature of the current weather or the first slot, NAN to skip
+    bool (*reference)(int expected); // ArduinoJson, NULL if none
+};
+
+// The snow, fog, heat, cold, multilingual and winter responses are synthetic,
+// written in the shape of the recorded ones to cover the conditions they miss
+static const Response responses[] = {
+    {"owm_current.json", parseOwmCurrent, 0, true, NULL, NAN, parseOwmJsonCurrent},
+    {"owm_current_rain.json", parseOwmCurrent, 0, true, NULL, NAN, parseOwmJsonCurrent},
+    {"owm_current_snow.json", parseOwmCurrent, 0, true, "Urubici", -3.46f, parseOwmJsonCurrent},
+    {"owm_current_fog.json", parseOwmCurrent, 0, true, NULL, 9.8f, parseOwmJsonCurrent},
+    {"owm_current_heat.json", parseOwmCurrent, 0, true, "Teresina", 46.73f, parseOwmJsonCurrent},
+    {"owm_current_cold.json", parseOwmCurrent, 0, true, "Yakutsk", -41.38f, parseOwmJsonCurrent},
+    {"owm_current_multilingual.json", parseOwmCurrent, 0, true, "S\xC3\xA3o Jos\xC3\xA9 dos Pinha", 24.1f,
+     parseOwmJsonCurrent},
+    {"owm_forecast.json", parseOwmForecast, FORECAST_HOURS, true, NULL, NAN, parseOwmJsonForecast},
+    {"owm_forecast_winter.json", parseOwmForecast, FORECAST_HOURS, true, NULL, -2.1f, parseOwmJsonForecast},
+    {"owm_forecast_5d.json", parseOwmForecast, FORECAST_HOURS, true, NULL, NAN, parseOwmJsonForecast},
+    {"openmeteo_current.csv", parseOpenMeteoCurrent, 0, false, NULL, NAN, NULL},
+    {"openmeteo_forecast.csv", parseOpenMeteoForecast, FORECAST_HOURS, false, NULL, NAN, NULL},
+};
+
+struct Cost {
+    double nsPerKB;
+    double scans;   // Parse time over the time of scan()
+    unsigned long blocks;
+    size_t peakBytes;
+    size_t ramBytes; // peakBytes, with the body held at once and the parser's state
+};
+
+/*
+*   parsed() - Whether the last parse gave the location and temperature the response lists
+*/
+static bool parsed(const Response& r) {
+    if (r.location && strcmp(current.location, r.location) != 0) {
+        return false;
+    }
+    float temp = r.expected ? slots[0].temp : current.temp;
+    return isnan(r.temp) || fabsf(temp - r.temp) < 0.01f;
+}
+
+static long nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static bool load(const char* dir, const char* file, char* body, size_t size, size_t& len) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    len = fread(body, 1, size, f);
+    fclose(f);
+    body[len < size ? len : 0] = '\0';
+    return len < size; // Too large for the buffer it has to fit in
+}
+
+/*
+*   scan() - The least any parser does: reads every byte of the body once
+*/
+static volatile uint32_t scanSink;
+static bool scan(int expected) {
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < weatherPayloadLen; i++) {
+        h = (h ^ (uint8_t)weatherPayload[i]) * 16777619UL;
+    }
+    scanSink = h;
+    return true;
+}
+
+/*
+*   bestNs() - Best time of a parse of body, copying the body back each time as a fetch would
+*/
+static double bestNs(bool (*parse)(int expected), int expected, const char* body, size_t len) {
+    double best = 1e18;
+    for (int round = 0; round < ROUNDS; round++) {
+        long start = nowNs(), elapsed;
+        long runs = 0;
+        do {
+            memcpy(weatherPayload, body, len + 1);
+            parse(expected);
+            runs++;
+            elapsed = nowNs() - start;
+        } while (elapsed < BATCH_NS);
+        double ns = (double)elapsed / runs;
+        if (ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+/*
+*   measure() - Parses a body many times, returns false if a parse gives the wrong result
+*/
+static bool measure(const Response& r, bool (*parse)(int expected), const char* body, size_t len, Cost& cost) {
+    // One parse with the heap counted
+    memcpy(weatherPayload, body, len);
+    weatherPayload[len] = '\0';
+    weatherPayloadLen = len;
+    memset(&current, 0, sizeof(current));
+    memset(slots, 0, sizeof(slots));
+    heapCount(true);
+    bool ok = parse(r.expected);
+    heapCount(false);
+    cost.blocks = heapBlocks;
+    cost.peakBytes = heapPeak;
+    if (!ok || !parsed(r)) {
+        return false;
+    }
+
+    double parseNs = bestNs(parse, r.expected, body, len);
+    cost.nsPerKB = parseNs * 1024 / len;
+    cost.scans = parseNs / bestNs(scan, 0, body, len);
+    return true;
+}
+
+/*
+*   reference() - Shows the ArduinoJson parse of a body against the firmware's parser
+*/
+static bool reference(const Response& r, const char* body, size_t len, const Cost& parser) {
+    Cost cost;
+    if (!measure(r, r.reference, body, len, cost)) {
+        printf("  %-28s parse failed\n", "ArduinoJson");
+        return true;
+    }
+    cost.ramBytes = cost.peakBytes + len;
+    printf("  %-28s %6s %8.0f %6.1f %7lu %6zu %6zu  (%.1fx the time, %ld bytes more memory)\n", "ArduinoJson", "",
+           cost.nsPerKB, cost.scans, cost.blocks, cost.peakBytes, cost.ramBytes, cost.scans / parser.scans,
+           (long)cost.ramBytes - (long)parser.ramBytes);
+    return parser.ramBytes <= cost.ramBytes;
+}
+
+struct Baseline {
+    char file[64];
+    double scans;
+    unsigned long blocks;
+    size_t ramBytes;
+};
+
+static int readBaseline(const char* path, Baseline* out, int max) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    int n = 0;
+    char line[256];
+    while (n < max && fgets(line, sizeof(line), f)) {
+        if (line[0] != '#' && sscanf(line, "%63s %lf %lu %zu", out[n].file, &out[n].scans, &out[n].blocks, &out[n].ramBytes) == 4) {
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static void usage() {
+    printf("Usage: parsecheck [-u] [-b baseline] [responses dir]\n"
+           "  -b file  Baseline (default baseline.txt)\n"
+           "  -u       Records the baseline instead of checking it\n"
+           "  dir      Recorded responses (default ../responses)\n");
+}
+
+int main(int argc, char** argv) {
+    const char* baselinePath = "baseline.txt";
+    const char* dir = "../responses";
+    bool update = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-u") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 2;
+        } else {
+            dir = argv[i];
+        }
+    }
+
+    const int count = sizeof(responses) / sizeof(responses[0]);
+    Baseline baseline[count];
+    int baselineCount = update ? 0 : readBaseline(baselinePath, baseline, count);
+    if (baselineCount < 0) {
+        printf("No baseline in %s, record one with make baseline (parsecheck -u)\n", baselinePath);
+        return 2;
+    }
+
+    FILE* out = NULL;
+    if (update) {
+        out = fopen(baselinePath, "w");
+        if (!out) {
+            printf("Cannot write %s\n", baselinePath);
+            return 2;
+        }
+        fprintf(out, "# response, parse time in scans of the body, heap blocks, memory; written by parsecheck -u\n");
+    }
+
+    static char body[MAX_STREAMED_SIZE];
+    int failures = 0;
+    printf("%-30s %6s %8s %6s %7s %6s %6s\n", "response", "bytes", "ns/KB", "scans", "blocks", "peak", "memory");
+    for (const Response& r : responses) {
+        size_t len;
+        Cost cost;
+        size_t size = r.streamed ? MAX_STREAMED_SIZE : MAX_RESPONSE_SIZE;
+        if (!load(dir, r.file, body, size, len)) {
+            printf("%-30s cannot be read or does not fit in %zu bytes\n", r.file, size);
+            failures++;
+            continue;
+        }
+        if (!measure(r, r.parse, body, len, cost)) {
+            printf("%-30s parse failed\n", r.file);
+            failures++;
+            continue;
+        }
+        cost.ramBytes = cost.peakBytes + (r.streamed ? FETCH_READ_PER_PASS + sizeof(OwmPull) : len);
+        printf("%-30s %6zu %8.0f %6.1f %7lu %6zu %6zu", r.file, len, cost.nsPerKB, cost.scans, cost.blocks,
+               cost.peakBytes, cost.ramBytes);
+
+        const char* regression = NULL;
+        if (cost.peakBytes > PARSE_PEAK_BYTES_LIMIT) {
+            regression = "peak over PARSE_PEAK_BYTES_LIMIT";
+        }
+        if (update) {
+            fprintf(out, "%s %.1f %lu %zu\n", r.file, cost.scans, cost.blocks, cost.ramBytes);
+        } else {
+            const Baseline* b = NULL;
+            for (int i = 0; i < baselineCount; i++) {
+                if (strcmp(baseline[i].file, r.file) == 0) {
+                    b = &baseline[i];
+                }
+            }
+            if (!b) {
+                regression = "not in the baseline";
+            } else if (cost.blocks > b->blocks) {
+                regression = "more heap blocks than the baseline";
+            } else if (cost.ramBytes > b->ramBytes) {
+                regression = "more memory than the baseline";
+            } else if (cost.scans > b->scans * TIME_TOLERANCE) {
+                regression = "slower than the baseline";
+            }
+            if (b) {
+                printf("  (baseline %.1f scans, %lu blocks, %zu bytes)", b->scans, b->blocks, b->ramBytes);
+            }
+        }
+        if (regression) {
+            printf("  REGRESSION: %s", regression);
+            failures++;
+        }
+        printf("\n");
+        if (r.reference && !reference(r, body, len, cost)) {
+            printf("  REGRESSION: more memory than ArduinoJson\n");
+            failures++;
+        }
+    }
+    #ifndef HAVE_ARDUINOJSON
+    printf("ArduinoJson not found, no baseline rows (make ARDUINOJSON=path/to/ArduinoJson/src)\n");
+    #endif
+
+    if (out) {
+        fclose(out);
+        printf("Baseline written to %s\n", baselinePath);
+    }
+    if (failures) {
+        printf("%d regressions\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
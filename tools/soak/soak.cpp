@@ -0,0 +1,698 @@
+// soak.cpp
+//
+// Host soak of the fetch, parse and render path, with every heap block counted.
+//
+// SOAKTEST in src/main.cpp runs accelerated cycles on a clock and counts the
+// renders that changed the free heap, which only shows a render that keeps
+// what it takes. This runs the same cycles on the host with malloc, calloc,
+// realloc and free wrapped, so every block taken is counted, even one given
+// back before the render returns:
+//
+//   - fetch: a recorded response of tools/responses is read through the
+//     firmware's decoder (include/http_body.h), chunked and gzip included
+//   - parse: the firmware's parsers fill the back copy of the weather model,
+//     which is swapped in as in getWeather() and getForecast(). OpenWeatherMap
+//     is parsed as the body is decoded, like the firmware streams it, which
+//     also reads the 5 day forecast (16 KB, four times weatherPayload)
+//   - render: the next screen is shown for SOAK_CYCLE_INTERVAL of virtual
+//     time, drawn whenever renderScreen() would draw it, on an LCD that
+//     takes the heap where the ESP8266 core does (Print::printf() above 64
+//     characters)
+//
+// The cycles alternate between OpenWeatherMap and Open-Meteo. The first
+// cycles show each screen with each provider once and are the warm up, after
+// them no block may be taken: it exits non-zero on any steady state block,
+// and -v shows the fetch or the screen that took it.
+//
+//   ./soak [-c cycles] [-v] [responses dir]
+//
+// The screens are copies of the print*() functions of src/main.cpp, with the
+// Wi-Fi and NTP client replaced by fixed values. Keep them in step.
+
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <http_body.h>
+#include <lcd_text.h>
+#include <owm_pull.h>
+#include <provider_openmeteo.h>
+#include <solar.h>
+
+#define MAX_RESPONSE_SIZE 4096      // Same as src/main.cpp
+#define SOAK_CYCLE_INTERVAL 20000   // Same as src/main.cpp
+#define LOOP_INTERVAL 20            // Virtual ms between two passes of loop()
+#define READ_SIZE 256               // Bytes given to the decoder per socket read
+#define START_EPOCH 1760007600L     // An hour before the first slot of the recorded forecast
+
+// Heap wrapped around glibc, counting while counting is set
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static bool counting = false;
+static unsigned long heapBlocks = 0;
+static size_t heapBytes = 0;
+
+static void heapTake(void* ptr) {
+    if (counting && ptr) {
+        heapBlocks++;
+        heapBytes += malloc_usable_size(ptr);
+    }
+}
+
+extern "C" void* malloc(size_t size) {
+    void* ptr = __libc_malloc(size);
+    heapTake(ptr);
+    return ptr;
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    void* ptr = __libc_calloc(count, size);
+    heapTake(ptr);
+    return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    ptr = __libc_realloc(ptr, size);
+    heapTake(ptr);
+    return ptr;
+}
+
+extern "C" void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+/*
+*   HostLCD - 16x2 LCD in memory, with the calls of LiquidCrystal the screens use
+*
+*   printf() is the one of the ESP8266 core's Print: a 64 byte buffer on the
+*   stack, and new[] for a longer text.
+*/
+class HostLCD {
+public:
+    char cells[32]; // Row 0, then row 1
+    int col = 0, row = 0;
+
+    void clear() {
+        memset(cells, ' ', sizeof(cells));
+        col = row = 0;
+    }
+    void setCursor(int c, int r) {
+        col = c;
+        row = r;
+    }
+    size_t write(uint8_t c) {
+        if (row >= 0 && row < 2 && col >= 0 && col < 16) {
+            cells[row * 16 + col] = c;
+        }
+        col++;
+        return 1;
+    }
+    size_t write(const uint8_t* text, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            write(text[i]);
+        }
+        return len;
+    }
+    size_t print(const char* text) {
+        return write((const uint8_t*)text, strlen(text));
+    }
+    size_t print(char c) {
+        return write((uint8_t)c);
+    }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list arg;
+        va_start(arg, format);
+        char temp[64];
+        char* buffer = temp;
+        size_t len = vsnprintf(temp, sizeof(temp), format, arg);
+        va_end(arg);
+        if (len > sizeof(temp) - 1) {
+            buffer = new char[len + 1];
+            va_start(arg, format);
+            vsnprintf(buffer, len + 1, format, arg);
+            va_end(arg);
+        }
+        len = write((const uint8_t*)buffer, len);
+        if (buffer != temp) {
+            delete[] buffer;
+        }
+        return len;
+    }
+};
+
+HostLCD lcd;
+
+// digits.h draws the big digits of printTime() on lcd, with the Arduino types
+typedef uint8_t byte;
+#define B00000 0x00
+#define B00111 0x07
+#define B01111 0x0F
+#define B11100 0x1C
+#define B11110 0x1E
+#define B11111 0x1F
+#include <digits.h>
+
+/*
+*   State of the firmware the screens read, as in src/main.cpp
+*/
+const long utcOffsetInSeconds = -10800;
+const char* ntpServers[] = {"scarlett", "a.ntp.br", "b.ntp.br", "c.ntp.br", "time.nist.gov", "pool.ntp.org"};
+const char* ssids[] = {"soak"};
+int ntpSrvIndex = 0, wifiIndex = 0;
+const uint8_t localIP[4] = {192, 168, 0, 162};
+const char* daysOfTheWeek[7] = {"Dom", "Seg", "Ter", "Qua", "Qui", "Sex", "Sab"};
+int counter = 2, lastCounter = -1, counterUD = 0, lastCounterUD = 0;
+unsigned long lastRenderMillis = 0;
+unsigned int scrollPos = 0;
+char scrollBuffer[17];
+SolarDay sun;
+
+#define TOPIC_TIME     0
+#define TOPIC_NTP      1
+#define TOPIC_NETWORK  2
+#define TOPIC_WEATHER  3
+#define TOPIC_FORECAST 4
+#define TOPIC_SUN      5
+#define NUM_TOPICS     6
+#define SUB(topic) (1 << (topic))
+uint32_t topicVersion[NUM_TOPICS];
+unsigned long lastPublishedEpoch = 0;
+
+void publish(int topic) {
+    topicVersion[topic]++;
+}
+
+WeatherModel weatherModels[2];
+const WeatherModel* weather = &weatherModels[0];
+
+WeatherModel& weatherBegin() {
+    WeatherModel& next = weatherModels[weather == &weatherModels[0]];
+    next = *weather;
+    return next;
+}
+
+void weatherSwap() {
+    WeatherModel& next = weatherModels[weather == &weatherModels[0]];
+    next.version = weather->version + 1;
+    weather = &next;
+}
+
+const Forecast& forecastSlot(const WeatherModel& m, int i) {
+    return m.forecast[(m.forecastHead + i) % FORECAST_HOURS];
+}
+
+// Virtual time
+static unsigned long nowMillis = 0;
+
+unsigned long millis() {
+    return nowMillis;
+}
+
+unsigned long clockEpoch() {
+    return START_EPOCH + utcOffsetInSeconds + nowMillis / 1000;
+}
+
+int constrain(int v, int low, int high) {
+    return v < low ? low : v > high ? high : v;
+}
+
+const char* sunClock(char* text, long event) {
+    if (event == 0) {
+        return strcpy(text, "--:--");
+    }
+    snprintf(text, 6, "%02ld:%02ld", event % 86400 / 3600, event % 3600 / 60);
+    return text;
+}
+
+/*
+*   Screens, copied from src/main.cpp
+*/
+void printTime() {
+    unsigned long epoch = clockEpoch();
+    int h = (epoch / 3600) % 24;
+    int m = (epoch / 60) % 60;
+    int s = epoch % 60;
+    char separator = (s % 2 == 0) ? char(165) : ' ';
+    printDigits(h / 10, 0);
+    printDigits(h % 10, 4);
+    lcd.setCursor(7, 0);
+    lcd.print(separator);
+    lcd.setCursor(7, 1);
+    lcd.print(separator);
+    printDigits(m / 10, 8);
+    printDigits(m % 10, 12);
+}
+
+void printDate() {
+    unsigned long epoch = clockEpoch();
+    int seconds = epoch % 60;
+    int minutes = (epoch / 60) % 60;
+    int hours = (epoch / 3600) % 24;
+    int days = epoch / 86400;
+    int year = 1970;
+    int month = 1;
+    int day = 1;
+    while (days >= (365 + (year % 4 == 0 ? 1 : 0))) {
+        days -= (365 + (year % 4 == 0 ? 1 : 0));
+        year++;
+    }
+    int daysInMonth[] = {31, (year % 4 == 0 ? 29 : 28), 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    while (days >= daysInMonth[month - 1]) {
+        days -= daysInMonth[month - 1];
+        month++;
+    }
+    day += days;
+    lcd.setCursor(4, 0);
+    lcd.printf("%02d:%02d:%02d ", hours, minutes, seconds);
+    lcd.setCursor(1, 1);
+    lcd.print(daysOfTheWeek[(epoch / 86400 + 4) % 7]);
+    lcd.print(" ");
+    lcd.printf("%02d/%02d/%04d", day, month, year);
+}
+
+void printNetwork() {
+    lcd.setCursor(0, 0);
+    lcd.printf("%u.%u.%u.%u", localIP[0], localIP[1], localIP[2], localIP[3]); // Print of an IPAddress
+    lcd.setCursor(0, 1);
+    lcd.print(ssids[wifiIndex]);
+}
+
+void printNTP() {
+    unsigned long epoch = clockEpoch();
+    lcd.setCursor(0, 0);
+    lcd.print(ntpServers[ntpSrvIndex]);
+    lcd.setCursor(0, 1);
+    lcd.printf("%02d:%02d:%02d", (int)(epoch / 3600 % 24), (int)(epoch / 60 % 60), (int)(epoch % 60));
+}
+
+void printWeather() {
+    const CurrentWeather& current = weather->current;
+    char text[100];
+    snprintf(text,
+        sizeof(text),
+        "%s - Temp: %.1fC - Humid: %d%% - Press: %dhPa   ",
+        current.description,
+        current.temp,
+        current.humidity,
+        current.pressure);
+    removeAccents(text);
+    getScrollWindow(text, scrollBuffer, scrollPos);
+    time_t epoch = (time_t)current.dt;
+    struct tm timeinfo;
+    gmtime_r(&epoch, &timeinfo);
+    lcd.setCursor(0, 0);
+    lcd.printf("Hoje as %02d:%02d", timeinfo.tm_hour, timeinfo.tm_min);
+    lcd.setCursor(0, 1);
+    lcd.print(scrollBuffer);
+    scrollPos++;
+}
+
+void printForecast() {
+    const WeatherModel& model = *weather;
+    if (model.forecastCount == 0) {
+        lcd.setCursor(0, 0);
+        lcd.print("Sem previsao    ");
+        lcd.setCursor(0, 1);
+        lcd.print("                ");
+        return;
+    }
+    const Forecast& slot = forecastSlot(model, constrain(counterUD, 0, model.forecastCount - 1));
+    char text[100];
+    snprintf(text, sizeof(text),
+     "%s - Min: %.1fC Max: %.1fC - %.0f%% Chuva: %.1fmm  Humid: %d%% - Press: %dhPa   ",
+     slot.description,
+     slot.temp_min,
+     slot.temp_max,
+     slot.pop*100,
+     slot.rain_3h,
+     slot.humidity,
+     slot.pressure);
+    removeAccents(text);
+    getScrollWindow(text, scrollBuffer, scrollPos);
+    time_t epoch = (time_t)slot.dt;
+    struct tm timeinfo;
+    gmtime_r(&epoch, &timeinfo);
+    lcd.setCursor(0, 0);
+    lcd.printf("%02d/%02d - %02d:%02d", timeinfo.tm_mday, timeinfo.tm_mon+1,timeinfo.tm_hour, timeinfo.tm_min);
+    lcd.setCursor(0, 1);
+    lcd.print(scrollBuffer);
+    scrollPos++;
+}
+
+void printSunRow(int row, const char* label, long rise, long set, int always) {
+    lcd.setCursor(0, row);
+    if (rise == 0 && set == 0 && always) {
+        lcd.printf("%-5s%-11s", label, always > 0 ? "dia todo" : "noite toda");
+    } else {
+        char riseText[6], setText[6];
+        lcd.printf("%-5s%s %s", label, sunClock(riseText, rise), sunClock(setText, set));
+    }
+}
+
+void printSun() {
+    if (sun.day == 0) {
+        lcd.setCursor(0, 0);
+        lcd.print("Sem horario     ");
+        lcd.setCursor(0, 1);
+        lcd.print("                ");
+        return;
+    }
+    printSunRow(0, "Sol", sun.sunrise, sun.sunset, sun.sunAlways);
+    printSunRow(1, "Crep", sun.dawn, sun.dusk, sun.civilAlways);
+}
+
+struct Screen {
+    const char* name;
+    void (*render)();
+    unsigned int tick;
+    uint8_t subscriptions;
+};
+
+const Screen screens[] = {
+    {"NTP",      printNTP,      0,   SUB(TOPIC_TIME) | SUB(TOPIC_NTP)},
+    {"Rede",     printNetwork,  0,   SUB(TOPIC_NETWORK)},
+    {"Hora",     printTime,     0,   SUB(TOPIC_TIME)},
+    {"Data",     printDate,     0,   SUB(TOPIC_TIME)},
+    {"Clima",    printWeather,  500, SUB(TOPIC_WEATHER)},
+    {"Previsao", printForecast, 500, SUB(TOPIC_FORECAST)},
+    {"Sol",      printSun,      0,   SUB(TOPIC_SUN)},
+};
+const int NUM_SCREENS = sizeof(screens) / sizeof(screens[0]);
+
+/*
+*   renderScreen() - Draws the current screen when src/main.cpp would, returns true if it did
+*/
+uint32_t seenVersion[NUM_TOPICS];
+bool renderScreen() {
+    const Screen& screen = screens[counter];
+    bool entered = lastCounter != counter;
+    if (entered) {
+        lastCounter = counter;
+        lcd.clear();
+        scrollBuffer[0] = '\0';
+        scrollPos = 0;
+        counterUD = 0;
+        lastCounterUD = 0;
+    }
+    bool moved = lastCounterUD != counterUD;
+    lastCounterUD = counterUD;
+    bool changed = false;
+    for (int t = 0; t < NUM_TOPICS; t++) {
+        if ((screen.subscriptions & SUB(t)) && seenVersion[t] != topicVersion[t]) {
+            changed = true;
+        }
+    }
+    if (!entered && !moved && !changed
+        && (screen.tick == 0 || millis() - lastRenderMillis < screen.tick)) {
+        return false;
+    }
+    lastRenderMillis = millis();
+    memcpy(seenVersion, topicVersion, sizeof(seenVersion));
+    screen.render();
+    return true;
+}
+
+/*
+*   Recorded responses, read into memory before the soak
+*/
+struct Recorded {
+    const char* file;
+    bool forecast;
+    bool openMeteo;
+    char* data;
+    size_t len;
+};
+
+static Recorded recorded[] = {
+    {"http_owm_current.txt", false, false, NULL, 0},
+    {"http_owm_forecast_5d.txt", true, false, NULL, 0},
+    {"http_owm_forecast_5d_gzip.txt", true, false, NULL, 0},
+    {"http_owm_forecast_gzip.txt", true, false, NULL, 0},
+    {"http_openmeteo_current_chunked.txt", false, true, NULL, 0},
+    {"http_openmeteo_forecast_gzip_chunked.txt", true, true, NULL, 0},
+};
+
+static bool load(const char* dir, Recorded& r) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, r.file);
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    static char buffer[8 * MAX_RESPONSE_SIZE];
+    r.len = fread(buffer, 1, sizeof(buffer), f);
+    fclose(f);
+    r.data = (char*)malloc(r.len);
+    memcpy(r.data, buffer, r.len);
+    return true;
+}
+
+char weatherPayload[MAX_RESPONSE_SIZE];
+size_t weatherPayloadLen = 0;
+Inflate inflater;
+OwmPull owmStream;
+int owmStatus;
+
+/*
+*   owmSink() - Takes the decoded OpenWeatherMap body, as streamSink() does
+*/
+static void owmSink(void* ctx, const uint8_t* data, size_t len) {
+    if (owmStatus == OWM_PULL_MORE) {
+        owmStatus = owmPullFeed(owmStream, (const char*)data, len);
+    }
+}
+
+/*
+*   fetch() - Reads a recorded response as fetchPoll() reads the socket
+*/
+static bool fetch(const Recorded& r) {
+    HttpBody body;
+    bodyBegin(body, weatherPayload, MAX_RESPONSE_SIZE, &inflater);
+    if (!r.openMeteo) {
+        bodySink(body, owmSink, NULL);
+    }
+    char line[128];
+    size_t n = 0, i = 0;
+    bool status = true, headersDone = false;
+    while (i < r.len && !headersDone) {
+        char c = r.data[i++];
+        if (c != '\n') {
+            if (n < sizeof(line) - 1) {
+                line[n++] = c;
+            }
+            continue;
+        }
+        if (n > 0 && line[n - 1] == '\r') {
+            n--;
+        }
+        line[n] = '\0';
+        if (status) {
+            status = false;
+        } else if (n == 0) {
+            headersDone = true;
+        } else {
+            bodyHeader(body, line);
+        }
+        n = 0;
+    }
+    if (!headersDone) {
+        return false;
+    }
+    bodyStart(body);
+    while (i < r.len && !body.overflow && body.inflateStatus == INFLATE_OK && owmStatus != OWM_PULL_ERROR &&
+           !bodyComplete(body)) {
+        size_t len = r.len - i < READ_SIZE ? r.len - i : READ_SIZE;
+        bodyReceive(body, (const uint8_t*)r.data + i, len);
+        i += len;
+    }
+    bodyFinish(body);
+    weatherPayloadLen = bodyKept(body) ? body.outLen : 0;
+    return !body.overflow && body.inflateStatus >= 0 && !bodyTruncated(body);
+}
+
+/*
+*   parse() - Fetches r into the back copy and swaps it in, as getWeather() and getForecast()
+*/
+static bool parse(const Recorded& r) {
+    WeatherModel& next = weatherBegin();
+    owmStatus = OWM_PULL_MORE;
+    if (!r.openMeteo) {
+        owmPullBegin(owmStream, r.forecast ? NULL : &next.current, r.forecast ? next.forecast : NULL, FORECAST_HOURS);
+    }
+    if (!fetch(r)) {
+        return false;
+    }
+    if (!r.forecast) {
+        CurrentWeather& current = next.current;
+        bool ok;
+        if (r.openMeteo) {
+            ok = openMeteoParseCurrent(weatherPayload, weatherPayloadLen, current);
+        } else {
+            ok = owmStatus == OWM_PULL_DONE;
+        }
+        if (!ok) {
+            return false;
+        }
+        upperFirstLetter(current.description);
+        removeAccents(current.description);
+        upperFirstLetter(current.location);
+        removeAccents(current.location);
+        current.dt += utcOffsetInSeconds;
+        weatherSwap();
+        publish(TOPIC_WEATHER);
+        return true;
+    }
+
+    int count;
+    if (r.openMeteo) {
+        count = openMeteoParseForecast(weatherPayload, weatherPayloadLen, next.forecast, FORECAST_HOURS);
+    } else {
+        count = owmStatus == OWM_PULL_DONE ? owmStream.count : -1;
+    }
+    if (count <= 0) {
+        return false;
+    }
+    next.forecastHead = 0;
+    for (int i = 0; i < count; i++) {
+        Forecast& slot = next.forecast[i];
+        slot.dt += utcOffsetInSeconds;
+        upperFirstLetter(slot.description);
+        removeAccents(slot.description);
+    }
+    next.forecastCount = count;
+    weatherSwap();
+    counterUD = 0;
+    lastCounterUD = 0;
+    publish(TOPIC_FORECAST);
+    return true;
+}
+
+struct Counts {
+    unsigned long fetchBlocks, renderBlocks, renders;
+    size_t renderBytes;
+};
+
+/*
+*   soakCycle() - One cycle of SOAKTEST: both fetches, the next screen, SOAK_CYCLE_INTERVAL of loop()
+*/
+static bool soakCycle(unsigned long cycle, Counts& counts, bool verbose) {
+    bool openMeteo = (cycle / NUM_SCREENS) % 2; // Each screen with each provider
+    for (Recorded& r : recorded) {
+        if (r.openMeteo != openMeteo) {
+            continue;
+        }
+        heapBlocks = 0;
+        counting = true;
+        bool ok = parse(r);
+        counting = false;
+        counts.fetchBlocks += heapBlocks;
+        if (!ok) {
+            printf("Cycle %lu: %s could not be read\n", cycle, r.file);
+            return false;
+        }
+        if (heapBlocks && verbose) {
+            printf("Cycle %lu: %lu blocks in the fetch of %s\n", cycle, heapBlocks, r.file);
+        }
+    }
+    counter = (counter + 1) % NUM_SCREENS;
+
+    unsigned long end = nowMillis + SOAK_CYCLE_INTERVAL;
+    for (; nowMillis < end; nowMillis += LOOP_INTERVAL) {
+        unsigned long epoch = clockEpoch();
+        if (epoch != lastPublishedEpoch) {
+            lastPublishedEpoch = epoch;
+            publish(TOPIC_TIME);
+        }
+        long day = epoch / 86400;
+        if (sun.day != day) {
+            solarCompute(sun, day, -25.504f, -49.2908f, utcOffsetInSeconds);
+            publish(TOPIC_SUN);
+        }
+        if (screens[counter].render == printForecast && nowMillis % 5000 == 0) {
+            counterUD = (counterUD + 1) % FORECAST_HOURS; // Up and Down through the slots
+        }
+
+        heapBlocks = 0;
+        heapBytes = 0;
+        counting = true;
+        bool drawn = renderScreen();
+        counting = false;
+        counts.renders += drawn;
+        counts.renderBlocks += heapBlocks;
+        counts.renderBytes += heapBytes;
+        if (heapBlocks && verbose) {
+            printf("Cycle %lu: %lu blocks (%zu bytes) in a render of %s\n", cycle, heapBlocks, heapBytes,
+                   screens[counter].name);
+        }
+    }
+    if (verbose) {
+        char shown[33];
+        for (int i = 0; i < 32; i++) {
+            uint8_t c = lcd.cells[i];
+            shown[i] = c < 8 ? '#' : c < 32 || c > 126 ? ':' : c; // Big digit glyphs, the blinking colon
+        }
+        printf("Cycle %lu, %s with %s: |%.16s|%.16s|\n", cycle, screens[counter].name,
+               openMeteo ? "Open-Meteo" : "OpenWeatherMap", shown, shown + 16);
+    }
+    return true;
+}
+
+static void usage() {
+    printf("Usage: soak [-c cycles] [-v] [responses dir]\n"
+           "  -c N  Soak cycles after the warm up (default 200)\n"
+           "  -v    Prints each cycle and every block taken\n"
+           "  dir   Recorded responses (default ../responses)\n");
+}
+
+int main(int argc, char** argv) {
+    const char* dir = "../responses";
+    unsigned long cycles = 200;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            cycles = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 2;
+        } else {
+            dir = argv[i];
+        }
+    }
+    for (Recorded& r : recorded) {
+        if (!load(dir, r)) {
+            printf("Cannot read %s/%s\n", dir, r.file);
+            return 2;
+        }
+    }
+    lcd.clear();
+
+    // Warm up: every screen once with each provider
+    const unsigned long warmup = 2 * NUM_SCREENS;
+    Counts first = {}, steady = {};
+    for (unsigned long cycle = 0; cycle < warmup + cycles; cycle++) {
+        if (!soakCycle(cycle, cycle < warmup ? first : steady, verbose)) {
+            return 2;
+        }
+    }
+
+    printf("Warm up:      %lu cycles, %lu renders, %lu blocks in fetch and parse, %lu in render\n", warmup,
+           first.renders, first.fetchBlocks, first.renderBlocks);
+    printf("Steady state: %lu cycles, %lu renders, %lu blocks in fetch and parse, %lu in render (%.2f per render)\n",
+           cycles, steady.renders, steady.fetchBlocks, steady.renderBlocks,
+           steady.renders ? (double)steady.renderBlocks / steady.renders : 0.0);
+    if (steady.fetchBlocks || steady.renderBlocks) {
+        printf("FAIL: the steady state takes heap, run with -v to see where\n");
+        return 1;
+    }
+    printf("ok, no heap taken in the steady state\n");
+    return 0;
+}
@@ -0,0 +1,238 @@
+// solartest.cpp
+//
+// Host test of include/solar.h.
+//
+// Every day of 2026, at places from the equator to beyond the polar circle,
+// the events of solarCompute() are checked against two references:
+//
+//   - the NOAA solar calculator in double precision, each event iterated
+//     until it settles, which is what solar.h approximates in floats
+//   - the USNO "Almanac for Computers" sunrise algorithm, an independent
+//     and cruder method, as a check on the NOAA formulas themselves
+//
+// Then the polar cases: midnight sun, polar night with and without civil
+// twilight, and days near the polar circle where only one event of a pair
+// happens. Exits non-zero when anything is off.
+//
+// Build and run with make check.
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#include <solar.h>
+
+#define NOAA_TOLERANCE 60  // Seconds
+#define USNO_TOLERANCE 120 // Seconds, below 60 degrees of latitude
+#define DAY_2026 20454L    // 2026-01-01, in days since the epoch
+
+static int failures = 0;
+
+static void fail(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void fail(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    printf("FAIL: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    failures++;
+}
+
+/*
+*   noaaPosition() - Declination (radians) and equation of time (minutes), NOAA spreadsheet in doubles
+*/
+static void noaaPosition(double jd, double& decl, double& eqTime) {
+    const double r = M_PI / 180;
+    double t = (jd - 2451545.0) / 36525;
+    double l0 = fmod(280.46646 + t * (36000.76983 + t * 0.0003032), 360);
+    double m = 357.52911 + t * (35999.05029 - 0.0001537 * t);
+    double e = 0.016708634 - t * (0.000042037 + 0.0000001267 * t);
+    double c = sin(m * r) * (1.914602 - t * (0.004817 + 0.000014 * t)) + sin(2 * m * r) * (0.019993 - 0.000101 * t) +
+               sin(3 * m * r) * 0.000289;
+    double omega = 125.04 - 1934.136 * t;
+    double lambda = l0 + c - 0.00569 - 0.00478 * sin(omega * r);
+    double eps0 = 23 + (26 + (21.448 - t * (46.815 + t * (0.00059 - t * 0.001813))) / 60) / 60;
+    double eps = eps0 + 0.00256 * cos(omega * r);
+    decl = asin(sin(eps * r) * sin(lambda * r));
+    double y = tan(eps * r / 2) * tan(eps * r / 2);
+    eqTime = 4 / r * (y * sin(2 * l0 * r) - 2 * e * sin(m * r) + 4 * e * y * sin(m * r) * cos(2 * l0 * r) -
+                      0.5 * y * y * sin(4 * l0 * r) - 1.25 * e * e * sin(2 * m * r));
+}
+
+/*
+*   noaaEvent() - UTC epoch of an event on a UTC day, NAN if the sun does not reach the zenith distance
+*/
+static double noaaEvent(long day, double lat, double lon, double zenith, int side) {
+    const double r = M_PI / 180;
+    double t = day * 86400.0 + 43200 - lon * 240; // Mean noon
+    for (int i = 0; i < 10; i++) {
+        double decl, eqTime;
+        noaaPosition(t / 86400.0 + 2440587.5, decl, eqTime);
+        double noon = day * 86400.0 + (720 - 4 * lon - eqTime) * 60;
+        double cosH = cos(zenith * r) / (cos(lat * r) * cos(decl)) - tan(lat * r) * tan(decl);
+        if (cosH > 1 || cosH < -1) {
+            return NAN;
+        }
+        t = noon + side * acos(cosH) / r * 240;
+    }
+    return t;
+}
+
+/*
+*   usnoEvent() - UTC hour of an event on a day of the year, USNO Almanac for Computers, NAN if none
+*/
+static double usnoEvent(int dayOfYear, double lat, double lon, double zenith, bool rising) {
+    const double r = M_PI / 180;
+    double lonHour = lon / 15;
+    double t = dayOfYear + ((rising ? 6 : 18) - lonHour) / 24;
+    double m = 0.9856 * t - 3.289;
+    double l = fmod(m + 1.916 * sin(m * r) + 0.020 * sin(2 * m * r) + 282.634 + 720, 360);
+    double ra = fmod(atan(0.91764 * tan(l * r)) / r + 720, 360);
+    ra = (ra + floor(l / 90) * 90 - floor(ra / 90) * 90) / 15;
+    double sinDecl = 0.39782 * sin(l * r);
+    double cosDecl = cos(asin(sinDecl));
+    double cosH = (cos(zenith * r) - sinDecl * sin(lat * r)) / (cosDecl * cos(lat * r));
+    if (cosH > 1 || cosH < -1) {
+        return NAN;
+    }
+    double h = (rising ? 360 - acos(cosH) / r : acos(cosH) / r) / 15;
+    return fmod(h + ra - 0.06571 * t - 6.622 - lonHour + 48, 24);
+}
+
+struct Place {
+    const char* name;
+    double lat, lon;
+    long utcOffset;
+};
+
+const Place places[] = {
+    {"Curitiba", -25.504, -49.2908, -3 * 3600}, {"Quito", -0.18, -78.47, -5 * 3600},
+    {"Greenwich", 51.4769, 0, 0},               {"Tokyo", 35.68, 139.69, 9 * 3600},
+    {"Ushuaia", -54.8, -68.3, -3 * 3600},       {"Auckland", -36.85, 174.76, 12 * 3600},
+    {"Reykjavik", 64.15, -21.94, 0},            {"Tromso", 69.65, 18.96, 3600},
+};
+
+/*
+*   checkYear() - Compares every event of 2026 at a place with the references
+*/
+static void checkYear(const Place& p) {
+    const char* names[] = {"sunrise", "sunset", "dawn", "dusk"};
+    double worstNoaa = 0, worstUsno = 0;
+    int missing = 0, mismatches = 0;
+    for (long day = DAY_2026; day < DAY_2026 + 365; day++) {
+        SolarDay s;
+        solarCompute(s, day, (float)p.lat, (float)p.lon, p.utcOffset);
+        long events[] = {s.sunrise, s.sunset, s.dawn, s.dusk};
+        for (int k = 0; k < 4; k++) {
+            double zenith = k < 2 ? 90.833 : 96;
+            double reference = noaaEvent(day, p.lat, p.lon, zenith, k % 2 ? 1 : -1);
+            if (std::isnan(reference) != (events[k] == 0)) {
+                mismatches++; // One day either way at the edge of the polar day or night
+                continue;
+            }
+            if (events[k] == 0) {
+                missing++;
+                continue;
+            }
+            double utc = events[k] - p.utcOffset;
+            double diff = fabs(utc - reference);
+            if (diff > worstNoaa) {
+                worstNoaa = diff;
+            }
+            if (diff > NOAA_TOLERANCE) {
+                fail("%s day %ld %s %.0f s off NOAA", p.name, day - DAY_2026 + 1, names[k], diff);
+            }
+            double usno = usnoEvent(day - DAY_2026 + 1, p.lat, p.lon, zenith, k % 2 == 0);
+            if (!std::isnan(usno) && fabs(p.lat) < 60) {
+                double hour = fmod(fmod(utc, 86400) / 3600 + 24, 24);
+                double diffUsno = fabs(hour - usno) * 3600;
+                diffUsno = diffUsno > 43200 ? 86400 - diffUsno : diffUsno;
+                if (diffUsno > worstUsno) {
+                    worstUsno = diffUsno;
+                }
+                if (diffUsno > USNO_TOLERANCE) {
+                    fail("%s day %ld %s %.0f s off USNO", p.name, day - DAY_2026 + 1, names[k], diffUsno);
+                }
+            }
+        }
+    }
+    if (mismatches > (fabs(p.lat) < 60 ? 0 : 3)) {
+        fail("%s: %d events found by only one side", p.name, mismatches);
+    }
+    char usno[32] = "USNO not compared";
+    if (fabs(p.lat) < 60) {
+        snprintf(usno, sizeof(usno), "USNO within %3.0f s", worstUsno);
+    }
+    printf("%-10s NOAA within %2.0f s, %s, %3d events not happening, %d at the edge\n", p.name, worstNoaa, usno,
+           missing, mismatches);
+}
+
+/*
+*   expect() - Checks the events and flags of one day
+*/
+static void expect(const char* what, const SolarDay& s, bool rise, bool set, int sunAlways, bool dawn, bool dusk,
+                   int civilAlways) {
+    if ((s.sunrise != 0) != rise || (s.sunset != 0) != set || s.sunAlways != sunAlways || (s.dawn != 0) != dawn ||
+        (s.dusk != 0) != dusk || s.civilAlways != civilAlways) {
+        fail("%s: sunrise %ld sunset %ld (%d), dawn %ld dusk %ld (%d)", what, s.sunrise, s.sunset, s.sunAlways,
+             s.dawn, s.dusk, s.civilAlways);
+    }
+}
+
+static void expectDark(const char* what, const SolarDay& s, long secondOfDay, bool dark) {
+    if (solarDark(s, s.day * 86400 + secondOfDay) != dark) {
+        fail("%s: should be %s at %02ld:%02ld", what, dark ? "dark" : "light", secondOfDay / 3600,
+             secondOfDay % 3600 / 60);
+    }
+}
+
+static void checkPolar() {
+    SolarDay s;
+
+    solarCompute(s, DAY_2026 + 171, 69.65f, 18.96f, 3600); // Tromso, 2026-06-21
+    expect("Tromso, midnight sun", s, false, false, 1, false, false, 1);
+    expectDark("Tromso, midnight sun", s, 0, false);
+
+    solarCompute(s, DAY_2026 + 354, 69.65f, 18.96f, 3600); // Tromso, 2026-12-21
+    expect("Tromso, polar night", s, false, false, -1, true, true, 0);
+    expectDark("Tromso, polar night", s, 0, true);
+    expectDark("Tromso, polar night", s, 12 * 3600, false);
+
+    solarCompute(s, DAY_2026 + 354, 80.0f, 18.96f, 3600); // Svalbard, 2026-12-21
+    expect("80 N, night without twilight", s, false, false, -1, false, false, -1);
+    expectDark("80 N, night without twilight", s, 12 * 3600, true);
+
+    // 66 N, 2026-06-30: the sun dips under the horizon in the evening only,
+    // the morning is still lit from the night before
+    solarCompute(s, DAY_2026 + 180, 66.0f, 18.96f, 3600);
+    expect("66 N, sunset without sunrise", s, false, true, 0, false, false, 1);
+    double reference = noaaEvent(DAY_2026 + 180, 66.0, 18.96, 90.833, 1);
+    if (s.sunset && fabs(s.sunset - 3600 - reference) > NOAA_TOLERANCE) {
+        fail("66 N, sunset without sunrise: sunset %.0f s off NOAA", fabs(s.sunset - 3600 - reference));
+    }
+
+    // 64 N, 2026-05-19 and 20: the last dusk is at 23:22, the dawn after it
+    // comes a minute and a half before midnight, and no dusk follows on the 20th
+    solarCompute(s, DAY_2026 + 138, 64.0f, 18.96f, 3600);
+    expect("64 N, last dusk", s, true, true, 0, true, true, 0);
+    expectDark("64 N, last dusk", s, 23 * 3600 + 50 * 60, true);
+    solarCompute(s, DAY_2026 + 139, 64.0f, 18.96f, 3600);
+    expect("64 N, dawn without dusk", s, true, true, 0, true, false, 0);
+    expectDark("64 N, dawn without dusk", s, 0, false);
+    expectDark("64 N, dawn without dusk", s, 23 * 3600 + 59 * 60, false);
+}
+
+int main() {
+    for (const Place& p : places) {
+        checkYear(p);
+    }
+    checkPolar();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}